@@ -0,0 +1,965 @@
+/*
+ * Package cache functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Finished packages are stored in "CacheDir/packages/xx/key", where "key"
+ * is the SHA-256 digest of a build manifest that uses file contents instead
+ * of file information, so the same sources produce the same key in any
+ * build directory.  Entries are written to a temporary directory and renamed
+ * into place, so several builds can share one cache.  Using an entry updates
+ * its modification time, and the least recently used entries are removed
+ * when the cache grows past CacheSize megabytes.
+ *
+ * Package files are always copied into and out of the cache (using a
+ * copy-on-write clone when the filesystem supports it) since the packagers
+ * rewrite their output files in place, and each entry has a ".digests" file
+ * with the SHA-256 digest of every package file that is checked when the
+ * entry is used.
+ *
+ * Stripped executables in "CacheDir/strip/xx" are limited the same way,
+ * using CacheSize or CACHE_STRIP_SIZE megabytes when the package cache is
+ * disabled.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <fcntl.h>
+#include <utime.h>
+#ifdef HAVE_LINUX_FS_H
+#    include <sys/ioctl.h>
+#    include <linux/fs.h>
+#endif /* HAVE_LINUX_FS_H */
+
+/*
+ * Local constants...
+ */
+
+#define CACHE_DIGESTS ".digests" /* Digests of the package files in an entry */
+#define CACHE_STRIP_SIZE 1024    /* Default size of strip cache in MB */
+#define CACHE_TMP_AGE 3600       /* Age of abandoned temporary entries */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Package file ****/
+{
+    char name[256]; /* Filename */
+    off_t size;     /* Size of file */
+    time_t mtime;   /* Modification time */
+    ino_t ino;      /* Inode number */
+} cache_file_t;
+
+typedef struct /**** Cache entry ****/
+{
+    char path[1024]; /* Entry directory */
+    time_t mtime;    /* Last use */
+    off_t size;      /* Size of files */
+} cache_entry_t;
+
+typedef struct /**** Stripped executable ****/
+{
+    char name[128]; /* "xx/digest" */
+    time_t mtime;   /* Last use */
+    off_t size;     /* Size of files */
+} cache_strip_t;
+
+struct cache_s /**** Package cache lookup ****/
+{
+    const char *directory,  /* Output directory */
+        *prodname;          /* Product name */
+    dist_t *dist;           /* Distribution */
+    char key[SHA256_HEX_SIZE], /* Cache key */
+        entry[1024];        /* Cache entry directory */
+    int num_files;          /* Number of package files before building */
+    cache_file_t *files;    /* Package files before building */
+};
+
+/*
+ * Local functions...
+ */
+
+static int cache_compare(cache_entry_t *a, cache_entry_t *b);
+static int cache_compare_strip(cache_strip_t *a, cache_strip_t *b);
+static int cache_compare_strip_names(cache_strip_t *a, cache_strip_t *b);
+static int cache_copy(const char *dst, const char *src);
+static void cache_count(const char *name);
+static void cache_evict(void);
+static int cache_remove(const char *path);
+static int cache_scan(const char *directory, const char *prodname, dist_t *dist,
+                      cache_file_t **files);
+static void cache_strip_remove(const char *name);
+
+/*
+ * 'cache_delete()' - Free a package cache lookup.
+ */
+
+void                    /* O - Nothing */
+cache_delete(cache_t *cache) /* I - Package cache lookup */
+{
+    if (!cache)
+        return;
+
+    free(cache->files);
+    free(cache);
+}
+
+/*
+ * 'cache_fetch()' - Copy cached packages to the output directory.
+ */
+
+int                     /* O - 1 on a cache hit, 0 on a miss */
+cache_fetch(cache_t *cache) /* I - Package cache lookup */
+{
+    DIR *dir;             /* Entry directory */
+    DIRENT *dent;         /* Directory entry */
+    FILE *fp;             /* Digests file */
+    char src[1024],       /* Cached package file */
+        dst[1024],        /* Output package file */
+        line[1024],       /* Line from digests file */
+        name[256],        /* Filename from digests file */
+        expected[SHA256_HEX_SIZE], /* Digest from digests file */
+        hex[SHA256_HEX_SIZE]; /* Digest of copied file */
+    int num_files = 0;    /* Number of package files */
+
+    if ((dir = opendir(cache->entry)) == NULL) {
+        if (Verbosity)
+            printf("Package cache miss for %s.\n", cache->key);
+
+        cache_count("misses");
+        return (0);
+    }
+
+    snprintf(src, sizeof(src), "%s/" CACHE_DIGESTS, cache->entry);
+    fp = fopen(src, "r");
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (dent->d_name[0] == '.')
+            continue;
+
+        snprintf(src, sizeof(src), "%s/%s", cache->entry, dent->d_name);
+        snprintf(dst, sizeof(dst), "%s/%s", cache->directory, dent->d_name);
+
+        if (Verbosity > 1)
+            printf("%s -> %s...\n", src, dst);
+
+        if (cache_copy(dst, src)) {
+            /*
+             * The entry is being removed by another build; rebuild...
+             */
+
+            if (fp)
+                fclose(fp);
+
+            closedir(dir);
+            cache_count("misses");
+            return (0);
+        }
+
+        /*
+         * Make sure the copy has the contents that were stored...
+         */
+
+        expected[0] = '\0';
+
+        if (fp) {
+            rewind(fp);
+
+            while (fgets(line, sizeof(line), fp))
+                if (sscanf(line, "%64s %255[^\n]", hex, name) == 2 &&
+                    !strcmp(name, dent->d_name)) {
+                    strlcpy(expected, hex, sizeof(expected));
+                    break;
+                }
+        }
+
+        if (!expected[0] || sha256_file(dst, hex, sizeof(hex)) || strcmp(hex, expected)) {
+            fprintf(stderr, "epm: Package cache entry %s is damaged, removing it.\n",
+                    cache->key);
+
+            unlink(dst);
+
+            if (fp)
+                fclose(fp);
+
+            closedir(dir);
+            cache_remove(cache->entry);
+            cache_count("misses");
+            return (0);
+        }
+
+        num_files++;
+    }
+
+    if (fp)
+        fclose(fp);
+
+    closedir(dir);
+
+    if (!num_files) {
+        cache_count("misses");
+        return (0);
+    }
+
+    /*
+     * Mark the entry as recently used...
+     */
+
+    utime(cache->entry, NULL);
+
+    if (Verbosity)
+        printf("Package cache hit for %s, using %d cached package files.\n", cache->key,
+               num_files);
+
+    cache_count("hits");
+
+    return (1);
+}
+
+/*
+ * 'cache_new()' - Start a package cache lookup.
+ *
+ * The package files already in the output directory are remembered so that
+ * 'cache_store()' only stores the files written by the build.
+ */
+
+cache_t *                       /* O - Package cache lookup or NULL on error */
+cache_new(const char *directory, /* I - Output directory */
+          const char *prodname,  /* I - Product name */
+          dist_t *dist,          /* I - Distribution */
+          const char *key)       /* I - Cache key */
+{
+    cache_t *cache; /* Package cache lookup */
+
+    if ((cache = calloc(1, sizeof(cache_t))) == NULL)
+        return (NULL);
+
+    cache->directory = directory;
+    cache->prodname = prodname;
+    cache->dist = dist;
+    strlcpy(cache->key, key, sizeof(cache->key));
+    snprintf(cache->entry, sizeof(cache->entry), "%s/packages/%c%c/%s", CacheDir, key[0],
+             key[1], key);
+
+    if ((cache->num_files = cache_scan(directory, prodname, dist, &cache->files)) < 0)
+        cache->num_files = 0;
+
+    return (cache);
+}
+
+/*
+ * 'cache_stats()' - Show the package cache statistics.
+ */
+
+void             /* O - Nothing */
+cache_stats(void) /* I - Nothing */
+{
+    char filename[1024], /* Statistics file */
+        line[256];       /* Line from file */
+    FILE *fp;            /* Statistics file */
+    DIR *dir,            /* Cache directory */
+        *subdir;         /* Cache subdirectory */
+    DIRENT *dent,        /* Directory entry */
+        *subdent;        /* Subdirectory entry */
+    cache_file_t *files; /* Entry files */
+    int i,               /* Looping var */
+        num_files,       /* Number of entry files */
+        num_entries = 0; /* Number of entries */
+    double size = 0.0;   /* Size of entries */
+
+    snprintf(filename, sizeof(filename), "%s/packages", CacheDir);
+
+    if ((dir = opendir(filename)) != NULL) {
+        while ((dent = readdir(dir)) != NULL) {
+            if (dent->d_name[0] == '.' || strlen(dent->d_name) != 2)
+                continue;
+
+            snprintf(filename, sizeof(filename), "%s/packages/%s", CacheDir,
+                     dent->d_name);
+
+            if ((subdir = opendir(filename)) == NULL)
+                continue;
+
+            while ((subdent = readdir(subdir)) != NULL) {
+                if (subdent->d_name[0] == '.')
+                    continue;
+
+                snprintf(filename, sizeof(filename), "%s/packages/%s/%s", CacheDir,
+                         dent->d_name, subdent->d_name);
+
+                if ((num_files = cache_scan(filename, NULL, NULL, &files)) < 0)
+                    continue;
+
+                for (i = 0; i < num_files; i++)
+                    size += files[i].size;
+
+                free(files);
+                num_entries++;
+            }
+
+            closedir(subdir);
+        }
+
+        closedir(dir);
+    }
+
+    printf("Package cache: %s/packages\n", CacheDir);
+    printf("    %d entries, %.0fk\n", num_entries, size / 1024.0);
+    printf("    Limit %dM\n", CacheSize);
+
+    snprintf(filename, sizeof(filename), "%s/packages/stats", CacheDir);
+
+    if ((fp = fopen(filename, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp))
+            printf("    %s", line);
+
+        fclose(fp);
+    }
+}
+
+/*
+ * 'cache_store()' - Store the packages written by a build.
+ */
+
+int                     /* O - 0 on success, -1 on error */
+cache_store(cache_t *cache) /* I - Package cache lookup */
+{
+    int i, j;            /* Looping vars */
+    int num_files,       /* Number of package files after building */
+        num_stored;      /* Number of files stored */
+    cache_file_t *files; /* Package files after building */
+    FILE *fp;            /* Digests file */
+    char temp[1024],     /* Temporary entry directory */
+        src[1024],       /* Output package file */
+        dst[1024],       /* Cached package file */
+        hex[SHA256_HEX_SIZE], /* Digest of cached package file */
+        *slash;          /* Last slash in entry directory */
+
+    if ((num_files = cache_scan(cache->directory, cache->prodname, cache->dist, &files)) <= 0)
+        return (-1);
+
+    /*
+     * Create a temporary entry and fill it with the new and changed
+     * package files...
+     */
+
+    snprintf(temp, sizeof(temp), "%s/packages", CacheDir);
+    make_directory(temp, 0755, (uid_t)-1, (gid_t)-1);
+
+    strlcat(temp, "/tmp.XXXXXX", sizeof(temp));
+
+    if (!mkdtemp(temp)) {
+        fprintf(stderr, "epm: Unable to create package cache directory \"%s\": %s\n",
+                temp, strerror(errno));
+        free(files);
+        return (-1);
+    }
+
+    snprintf(dst, sizeof(dst), "%s/" CACHE_DIGESTS, temp);
+
+    if ((fp = fopen(dst, "w")) == NULL) {
+        cache_remove(temp);
+        free(files);
+        return (-1);
+    }
+
+    for (i = 0, num_stored = 0; i < num_files; i++) {
+        for (j = 0; j < cache->num_files; j++)
+            if (!strcmp(files[i].name, cache->files[j].name))
+                break;
+
+        if (j < cache->num_files && files[i].size == cache->files[j].size &&
+            files[i].mtime == cache->files[j].mtime && files[i].ino == cache->files[j].ino)
+            continue;
+
+        snprintf(src, sizeof(src), "%s/%s", cache->directory, files[i].name);
+        snprintf(dst, sizeof(dst), "%s/%s", temp, files[i].name);
+
+        if (cache_copy(dst, src) || sha256_file(dst, hex, sizeof(hex))) {
+            fclose(fp);
+            cache_remove(temp);
+            free(files);
+            return (-1);
+        }
+
+        fprintf(fp, "%s %s\n", hex, files[i].name);
+
+        num_stored++;
+    }
+
+    free(files);
+
+    if (fclose(fp)) {
+        cache_remove(temp);
+        return (-1);
+    }
+
+    if (!num_stored) {
+        cache_remove(temp);
+        return (0);
+    }
+
+    /*
+     * Move it into place; if another build stored the same packages first,
+     * use theirs...
+     */
+
+    strlcpy(dst, cache->entry, sizeof(dst));
+    if ((slash = strrchr(dst, '/')) != NULL)
+        *slash = '\0';
+
+    make_directory(dst, 0755, (uid_t)-1, (gid_t)-1);
+
+    if (rename(temp, cache->entry)) {
+        cache_remove(temp);
+
+        if (errno != EEXIST && errno != ENOTEMPTY) {
+            fprintf(stderr, "epm: Unable to create package cache entry \"%s\": %s\n",
+                    cache->entry, strerror(errno));
+            return (-1);
+        }
+    } else if (Verbosity)
+        printf("Stored %d package files in the package cache.\n", num_stored);
+
+    cache_evict();
+
+    return (0);
+}
+
+/*
+ * 'cache_strip_evict()' - Remove the least recently used stripped executables.
+ *
+ * The stripped copy of a file and its ".debug", ".nodebug", and temporary
+ * files all start with the digest of the file and are removed together.
+ * Files used since "used" are never removed.
+ */
+
+void                         /* O - Nothing */
+cache_strip_evict(time_t used) /* I - Time of this build */
+{
+    char filename[1024],     /* Strip cache directory */
+        *ptr;                /* Pointer to extension */
+    DIR *dir,                /* Strip cache directory */
+        *subdir;             /* Strip cache subdirectory */
+    DIRENT *dent,            /* Directory entry */
+        *subdent;            /* Subdirectory entry */
+    struct stat fileinfo;    /* File information */
+    cache_strip_t *files,    /* Files */
+        *file,               /* Current file */
+        *temp;               /* New files array */
+    int i,                   /* Looping var */
+        num_files = 0,       /* Number of files */
+        alloc_files = 0;     /* Allocated files */
+    double size = 0.0,       /* Size of files */
+        limit;               /* Maximum size of files */
+
+    snprintf(filename, sizeof(filename), "%s/strip", CacheDir);
+
+    if ((dir = opendir(filename)) == NULL)
+        return;
+
+    files = NULL;
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (dent->d_name[0] == '.' || strlen(dent->d_name) != 2)
+            continue;
+
+        snprintf(filename, sizeof(filename), "%s/strip/%s", CacheDir, dent->d_name);
+
+        if ((subdir = opendir(filename)) == NULL)
+            continue;
+
+        while ((subdent = readdir(subdir)) != NULL) {
+            if (subdent->d_name[0] == '.' ||
+                strlen(subdent->d_name) + 3 >= sizeof(files->name))
+                continue;
+
+            snprintf(filename, sizeof(filename), "%s/strip/%s/%s", CacheDir,
+                     dent->d_name, subdent->d_name);
+
+            if (stat(filename, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+                continue;
+
+            if (num_files >= alloc_files) {
+                if ((temp = realloc(files, (size_t)(alloc_files + 1024) *
+                                               sizeof(cache_strip_t))) == NULL)
+                    break;
+
+                files = temp;
+                alloc_files += 1024;
+            }
+
+            file = files + num_files++;
+
+            snprintf(file->name, sizeof(file->name), "%s/%s", dent->d_name,
+                     subdent->d_name);
+            if ((ptr = strchr(file->name + 3, '.')) != NULL)
+                *ptr = '\0';
+
+            file->mtime = fileinfo.st_mtime;
+            file->size = fileinfo.st_size;
+            size += fileinfo.st_size;
+        }
+
+        closedir(subdir);
+    }
+
+    closedir(dir);
+
+    if ((limit = (CacheSize > 0 ? CacheSize : CACHE_STRIP_SIZE) * 1048576.0) >= size ||
+        num_files == 0) {
+        free(files);
+        return;
+    }
+
+    /*
+     * Combine the files for each digest, using the newest time...
+     */
+
+    qsort(files, (size_t)num_files, sizeof(cache_strip_t),
+          (int (*)(const void *, const void *))cache_compare_strip_names);
+
+    for (i = 1, file = files; i < num_files; i++) {
+        if (!strcmp(files[i].name, file->name)) {
+            file->size += files[i].size;
+            if (files[i].mtime > file->mtime)
+                file->mtime = files[i].mtime;
+        } else
+            *(++file) = files[i];
+    }
+
+    num_files = (int)(file - files) + 1;
+
+    /*
+     * Then remove the oldest until the cache is small enough...
+     */
+
+    qsort(files, (size_t)num_files, sizeof(cache_strip_t),
+          (int (*)(const void *, const void *))cache_compare_strip);
+
+    for (i = 0, file = files; i < num_files && size > limit && file->mtime < used;
+         i++, file++) {
+        if (Verbosity > 1)
+            printf("Removing %s from the strip cache...\n", file->name);
+
+        cache_strip_remove(file->name);
+        size -= file->size;
+    }
+
+    free(files);
+}
+
+/*
+ * 'cache_compare()' - Compare the last use of two cache entries.
+ */
+
+static int                     /* O - Result of comparison */
+cache_compare(cache_entry_t *a, /* I - First entry */
+              cache_entry_t *b) /* I - Second entry */
+{
+    if (a->mtime < b->mtime)
+        return (-1);
+    else if (a->mtime > b->mtime)
+        return (1);
+    else
+        return (strcmp(a->path, b->path));
+}
+
+/*
+ * 'cache_compare_strip()' - Compare the last use of two stripped executables.
+ */
+
+static int                           /* O - Result of comparison */
+cache_compare_strip(cache_strip_t *a, /* I - First executable */
+                    cache_strip_t *b) /* I - Second executable */
+{
+    if (a->mtime < b->mtime)
+        return (-1);
+    else if (a->mtime > b->mtime)
+        return (1);
+    else
+        return (strcmp(a->name, b->name));
+}
+
+/*
+ * 'cache_compare_strip_names()' - Compare the names of two stripped
+ *                                 executables.
+ */
+
+static int                                 /* O - Result of comparison */
+cache_compare_strip_names(cache_strip_t *a, /* I - First executable */
+                          cache_strip_t *b) /* I - Second executable */
+{
+    return (strcmp(a->name, b->name));
+}
+
+/*
+ * 'cache_copy()' - Copy a file, using a copy-on-write clone if possible.
+ */
+
+static int               /* O - 0 on success, -1 on error */
+cache_copy(const char *dst, /* I - Destination file */
+           const char *src) /* I - Source file */
+{
+    struct stat srcinfo; /* Source file information */
+#if defined(HAVE_LINUX_FS_H) && defined(FICLONE)
+    int srcfd,           /* Source file descriptor */
+        dstfd;           /* Destination file descriptor */
+#endif /* HAVE_LINUX_FS_H && FICLONE */
+
+    unlink(dst);
+
+    if (stat(src, &srcinfo))
+        return (-1);
+
+#if defined(HAVE_LINUX_FS_H) && defined(FICLONE)
+    if ((srcfd = open(src, O_RDONLY)) >= 0) {
+        if ((dstfd = open(dst, O_WRONLY | O_CREAT | O_EXCL, srcinfo.st_mode & 07777)) >= 0) {
+            if (!ioctl(dstfd, FICLONE, srcfd)) {
+                fchmod(dstfd, srcinfo.st_mode & 07777);
+                close(dstfd);
+                close(srcfd);
+                return (0);
+            }
+
+            close(dstfd);
+            unlink(dst);
+        }
+
+        close(srcfd);
+    }
+#endif /* HAVE_LINUX_FS_H && FICLONE */
+
+    return (copy_file(dst, src, srcinfo.st_mode & 07777, (uid_t)-1, (gid_t)-1));
+}
+
+/*
+ * 'cache_count()' - Add one to a package cache statistic.
+ */
+
+static void                /* O - Nothing */
+cache_count(const char *name) /* I - Statistic name */
+{
+    int fd;              /* Statistics file */
+    FILE *fp;            /* Statistics file */
+    struct flock lock;   /* File lock */
+    char filename[1024], /* Statistics file */
+        line[256],       /* Line from file */
+        statname[256];   /* Statistic name */
+    long value;          /* Statistic value */
+    int i,               /* Looping var */
+        num_stats = 0;   /* Number of statistics */
+    struct {
+        char name[64];   /* Statistic name */
+        long value;      /* Statistic value */
+    } stats[8];          /* Statistics */
+
+    snprintf(filename, sizeof(filename), "%s/packages", CacheDir);
+    make_directory(filename, 0755, (uid_t)-1, (gid_t)-1);
+    strlcat(filename, "/stats", sizeof(filename));
+
+    if ((fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0)
+        return;
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+
+    if (fcntl(fd, F_SETLKW, &lock) || (fp = fdopen(fd, "r+")) == NULL) {
+        close(fd);
+        return;
+    }
+
+    /*
+     * Read the current values, add one, and write them back...
+     */
+
+    while (fgets(line, sizeof(line), fp) && num_stats < (int)(sizeof(stats) / sizeof(stats[0])))
+        if (sscanf(line, "%255s%ld", statname, &value) == 2) {
+            strlcpy(stats[num_stats].name, statname, sizeof(stats[0].name));
+            stats[num_stats].value = value;
+            num_stats++;
+        }
+
+    for (i = 0; i < num_stats; i++)
+        if (!strcmp(stats[i].name, name))
+            break;
+
+    if (i >= num_stats && num_stats < (int)(sizeof(stats) / sizeof(stats[0]))) {
+        strlcpy(stats[i].name, name, sizeof(stats[0].name));
+        stats[i].value = 0;
+        num_stats++;
+    }
+
+    if (i < num_stats)
+        stats[i].value++;
+
+    rewind(fp);
+
+    for (i = 0; i < num_stats; i++)
+        fprintf(fp, "%-10s %ld\n", stats[i].name, stats[i].value);
+
+    /*
+     * Remove the file if it can't be truncated, since the old values after
+     * the new ones would be read back next time...
+     */
+
+    if (fflush(fp) || ftruncate(fd, ftell(fp)))
+        unlink(filename);
+
+    fclose(fp);
+}
+
+/*
+ * 'cache_evict()' - Remove the least recently used packages from the cache.
+ */
+
+static void       /* O - Nothing */
+cache_evict(void) /* I - Nothing */
+{
+    char filename[1024];    /* Cache directory */
+    DIR *dir,               /* Cache directory */
+        *subdir;            /* Cache subdirectory */
+    DIRENT *dent,           /* Directory entry */
+        *subdent;           /* Subdirectory entry */
+    struct stat entryinfo;  /* Entry information */
+    cache_file_t *files;    /* Entry files */
+    cache_entry_t *entries, /* Entries */
+        *temp;              /* New entries array */
+    int i,                  /* Looping var */
+        num_files,          /* Number of entry files */
+        num_entries = 0,    /* Number of entries */
+        alloc_entries = 0;  /* Allocated entries */
+    double size = 0.0,      /* Size of entries */
+        limit;              /* Maximum size of entries */
+
+    snprintf(filename, sizeof(filename), "%s/packages", CacheDir);
+
+    if ((dir = opendir(filename)) == NULL)
+        return;
+
+    entries = NULL;
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (!strncmp(dent->d_name, "tmp.", 4)) {
+            /*
+             * Remove temporary entries left behind by builds that were
+             * interrupted...
+             */
+
+            snprintf(filename, sizeof(filename), "%s/packages/%s", CacheDir, dent->d_name);
+
+            if (!stat(filename, &entryinfo) &&
+                entryinfo.st_mtime < time(NULL) - CACHE_TMP_AGE)
+                cache_remove(filename);
+
+            continue;
+        }
+
+        if (dent->d_name[0] == '.' || strlen(dent->d_name) != 2)
+            continue;
+
+        snprintf(filename, sizeof(filename), "%s/packages/%s", CacheDir, dent->d_name);
+
+        if ((subdir = opendir(filename)) == NULL)
+            continue;
+
+        while ((subdent = readdir(subdir)) != NULL) {
+            if (subdent->d_name[0] == '.')
+                continue;
+
+            if (num_entries >= alloc_entries) {
+                if ((temp = realloc(entries, (size_t)(alloc_entries + 64) *
+                                                 sizeof(cache_entry_t))) == NULL)
+                    break;
+
+                entries = temp;
+                alloc_entries += 64;
+            }
+
+            snprintf(entries[num_entries].path, sizeof(entries[0].path),
+                     "%s/packages/%s/%s", CacheDir, dent->d_name, subdent->d_name);
+
+            if (stat(entries[num_entries].path, &entryinfo) ||
+                (num_files = cache_scan(entries[num_entries].path, NULL, NULL, &files)) < 0)
+                continue;
+
+            entries[num_entries].mtime = entryinfo.st_mtime;
+            entries[num_entries].size = 0;
+
+            for (i = 0; i < num_files; i++)
+                entries[num_entries].size += files[i].size;
+
+            free(files);
+
+            size += entries[num_entries].size;
+            num_entries++;
+        }
+
+        closedir(subdir);
+    }
+
+    closedir(dir);
+
+    /*
+     * Remove the oldest entries until the cache is small enough...
+     */
+
+    limit = CacheSize * 1048576.0;
+
+    if (size > limit && num_entries > 0) {
+        qsort(entries, (size_t)num_entries, sizeof(cache_entry_t),
+              (int (*)(const void *, const void *))cache_compare);
+
+        for (i = 0; i < num_entries && size > limit; i++) {
+            if (Verbosity > 1)
+                printf("Removing %s from the package cache...\n", entries[i].path);
+
+            if (!cache_remove(entries[i].path)) {
+                size -= entries[i].size;
+                cache_count("evictions");
+            }
+        }
+    }
+
+    free(entries);
+}
+
+/*
+ * 'cache_remove()' - Remove a cache entry directory.
+ */
+
+static int                /* O - 0 on success, -1 on error */
+cache_remove(const char *path) /* I - Entry directory */
+{
+    DIR *dir;            /* Entry directory */
+    DIRENT *dent;        /* Directory entry */
+    char filename[1024]; /* Entry file */
+
+    if ((dir = opendir(path)) == NULL)
+        return (-1);
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+            continue;
+
+        snprintf(filename, sizeof(filename), "%s/%s", path, dent->d_name);
+        unlink(filename);
+    }
+
+    closedir(dir);
+
+    return (rmdir(path));
+}
+
+/*
+ * 'cache_scan()' - Get the package files for a product in a directory.
+ *
+ * Package files are the regular files that are named for the product - see
+ * 'manifest_is_output()' - or all regular files when "dist" is NULL.
+ */
+
+static int                      /* O - Number of files or -1 on error */
+cache_scan(const char *directory, /* I - Directory */
+           const char *prodname,  /* I - Product name or NULL */
+           dist_t *dist,          /* I - Distribution or NULL */
+           cache_file_t **files)  /* O - Files */
+{
+    DIR *dir;             /* Directory */
+    DIRENT *dent;         /* Directory entry */
+    char filename[1024];  /* File in directory */
+    struct stat fileinfo; /* File information */
+    int num_files = 0,    /* Number of files */
+        alloc_files = 0;  /* Allocated files */
+    cache_file_t *temp;   /* New files array */
+
+    *files = NULL;
+
+    if ((dir = opendir(directory)) == NULL)
+        return (-1);
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (dent->d_name[0] == '.' ||
+            (dist && !manifest_is_output(dent->d_name, prodname, dist)) ||
+            strlen(dent->d_name) >= sizeof(temp->name))
+            continue;
+
+        snprintf(filename, sizeof(filename), "%s/%s", directory, dent->d_name);
+
+        if (stat(filename, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+            continue;
+
+        if (num_files >= alloc_files) {
+            if ((temp = realloc(*files, (size_t)(alloc_files + 16) *
+                                            sizeof(cache_file_t))) == NULL)
+                break;
+
+            *files = temp;
+            alloc_files += 16;
+        }
+
+        temp = *files + num_files;
+        strlcpy(temp->name, dent->d_name, sizeof(temp->name));
+        temp->size = fileinfo.st_size;
+        temp->mtime = fileinfo.st_mtime;
+        temp->ino = fileinfo.st_ino;
+        num_files++;
+    }
+
+    closedir(dir);
+
+    return (num_files);
+}
+
+/*
+ * 'cache_strip_remove()' - Remove the files for a stripped executable.
+ */
+
+static void                     /* O - Nothing */
+cache_strip_remove(const char *name) /* I - "xx/digest" */
+{
+    DIR *dir;            /* Strip cache subdirectory */
+    DIRENT *dent;        /* Directory entry */
+    char filename[1024]; /* File in subdirectory */
+    const char *digest;  /* Digest of file */
+    size_t len;          /* Length of digest */
+
+    snprintf(filename, sizeof(filename), "%s/strip/%.2s", CacheDir, name);
+
+    if ((dir = opendir(filename)) == NULL)
+        return;
+
+    digest = name + 3;
+    len = strlen(digest);
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (strncmp(dent->d_name, digest, len) ||
+            (dent->d_name[len] && dent->d_name[len] != '.'))
+            continue;
+
+        snprintf(filename, sizeof(filename), "%s/strip/%.2s/%s", CacheDir, name,
+                 dent->d_name);
+        unlink(filename);
+    }
+
+    closedir(dir);
+}
@@ -50,9 +50,29 @@ add_size(FILE *fpControl,       /* Control file stream */
     return 1;
 }
 
+/*
+ * Local types...
+ */
+
+typedef struct /**** Subpackage build task ****/
+{
+    const char *prodname,     /* Product short name */
+        *directory,           /* Directory for distribution files */
+        *platname;            /* Platform name */
+    dist_t *dist;             /* Distribution information */
+    struct utsname *platform; /* Platform information */
+    const char *subpackage;   /* Subpackage */
+    manifest_t *manifest;     /* Build manifest or NULL */
+} debpkg_t;
+
+/*
+ * Local functions...
+ */
+
 static int make_subpackage(const char *prodname, const char *directory,
                            const char *platname, dist_t *dist, struct utsname *platform,
-                           const char *subpackage);
+                           const char *subpackage, manifest_t *manifest);
+static int make_subpackage_task(debpkg_t *pkg);
 
 /*
  * 'make_deb()' - Make a Debian software distribution package.
@@ -66,9 +86,12 @@ make_deb(const char *prodname,     /* I - Product short name */
          struct utsname *platform) /* I - Platform information */
 {
     int i;              /* Looping var */
+    int status;         /* Exit status of build tasks */
     tarf_t *tarfile;    /* Distribution tar file */
     char name[1024],    /* Full product name */
         filename[1024]; /* File to archive */
+    tasks_t *tasks;     /* Build tasks */
+    debpkg_t *pkgs;     /* Package build data */
     char *sep;
 
     /*
@@ -101,13 +124,49 @@ make_deb(const char *prodname,     /* I - Product short name */
             platname = "amd64";
     }
 
-    if (make_subpackage(prodname, directory, platname, dist, platform, NULL))
+    /*
+     * Build the main package and subpackages, several at a time...
+     */
+
+    if ((tasks = tasks_new()) == NULL ||
+        (pkgs = calloc((size_t)dist->num_subpackages + 1, sizeof(debpkg_t))) == NULL) {
+        fputs("epm: Unable to allocate memory for build tasks!\n", stderr);
+        tasks_delete(tasks);
         return (1);
+    }
 
-    for (i = 0; i < dist->num_subpackages; i++)
-        if (make_subpackage(prodname, directory, platname, dist, platform,
-                            dist->subpackages[i]))
-            return (1);
+    for (i = 0; i <= dist->num_subpackages; i++) {
+        pkgs[i].prodname = prodname;
+        pkgs[i].directory = directory;
+        pkgs[i].platname = platname;
+        pkgs[i].dist = dist;
+        pkgs[i].platform = platform;
+        pkgs[i].subpackage = i ? dist->subpackages[i - 1] : NULL;
+
+        /*
+         * The individual packages are only kept, and so can be skipped when
+         * up to date, with -k or when there are no subpackages...
+         */
+
+        if ((KeepFiles || !dist->num_subpackages) &&
+            (pkgs[i].manifest = manifest_new("deb", platname, 0)) != NULL)
+            manifest_add_dist(pkgs[i].manifest, dist, pkgs[i].subpackage);
+
+        tasks_add(tasks, i ? dist->subpackages[i - 1] : prodname,
+                  (task_cb_t)make_subpackage_task, pkgs + i);
+    }
+
+    status = tasks_run(tasks, MaxJobs);
+
+    tasks_delete(tasks);
+
+    for (i = 0; i <= dist->num_subpackages; i++)
+        manifest_delete(pkgs[i].manifest);
+
+    free(pkgs);
+
+    if (status)
+        return (1);
 
     /*
      * Build a compressed tar file to hold all of the subpackages...
@@ -189,19 +248,21 @@ make_subpackage(const char *prodname,     /* I - Product short name */
                 const char *platname,     /* I - Platform name */
                 dist_t *dist,             /* I - Distribution information */
                 struct utsname *platform, /* I - Platform information */
-                const char *subpackage)   /* I - Subpackage */
+                const char *subpackage,   /* I - Subpackage */
+                manifest_t *manifest)     /* I - Build manifest or NULL */
 {
     int i, j;                      /* Looping vars */
     const char *header;            /* Dependency header string */
     FILE *fp;                      /* Control file */
     char prodfull[255],            /* Full name of product */
         name[1024],                /* Full product name */
-        filename[1024];            /* Destination filename */
+        filename[1024],            /* Destination filename */
+        manifestname[1024];        /* Build manifest filename */
     command_t *c;                  /* Current command */
     depend_t *d;                   /* Current dependency */
     file_t *file;                  /* Current distribution file */
-    struct passwd *pwd;            /* Pointer to user record */
-    struct group *grp;             /* Pointer to group record */
+    uid_t uid;                     /* User ID */
+    gid_t gid;                     /* Group ID */
     static const char *depends[] = /* Dependency names */
         {"Depends:", "Conflicts:", "Replaces:", "Provides:"};
     char *sep;
@@ -234,15 +295,33 @@ make_subpackage(const char *prodname,     /* I - Product short name */
         strlcat(name, platname, sizeof(name));
     }
 
+    /*
+     * Skip the package if it is up to date...
+     */
+
+    if (manifest) {
+        snprintf(filename, sizeof(filename), "%s/%s.deb", directory, name);
+        snprintf(manifestname, sizeof(manifestname), "%s.manifest", filename);
+
+        manifest_add_output(manifest, filename);
+
+        if (!ForceBuild && manifest_check(manifest, manifestname)) {
+            if (Verbosity)
+                tasks_printf("Debian %s distribution is up to date.\n", name);
+
+            return (0);
+        }
+    }
+
     if (Verbosity)
-        printf("Creating Debian %s distribution...\n", name);
+        tasks_printf("Creating Debian %s distribution...\n", name);
 
     /*
      * Write the control file for DPKG...
      */
 
     if (Verbosity)
-        puts("Creating control file...");
+        tasks_printf("Creating control file...\n");
 
     snprintf(filename, sizeof(filename), "%s/%s", directory, name);
     mkdir(filename, 0777);
@@ -346,7 +425,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
 
     if (i) {
         if (Verbosity)
-            puts("Creating preinst script...");
+            tasks_printf("Creating preinst script...\n");
 
         snprintf(filename, sizeof(filename), "%s/%s/DEBIAN/preinst", directory, name);
 
@@ -383,7 +462,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
 
     if (i) {
         if (Verbosity)
-            puts("Creating postinst script...");
+            tasks_printf("Creating postinst script...\n");
 
         snprintf(filename, sizeof(filename), "%s/%s/DEBIAN/postinst", directory, name);
 
@@ -431,7 +510,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
 
     if (i) {
         if (Verbosity)
-            puts("Creating prerm script...");
+            tasks_printf("Creating prerm script...\n");
 
         snprintf(filename, sizeof(filename), "%s/%s/DEBIAN/prerm", directory, name);
 
@@ -472,7 +551,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
 
     if (i) {
         if (Verbosity)
-            puts("Creating postrm script...");
+            tasks_printf("Creating postrm script...\n");
 
         snprintf(filename, sizeof(filename), "%s/%s/DEBIAN/postrm", directory, name);
 
@@ -506,7 +585,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
      */
 
     if (Verbosity)
-        puts("Creating conffiles...");
+        tasks_printf("Creating conffiles...\n");
 
     snprintf(filename, sizeof(filename), "%s/%s/DEBIAN/conffiles", directory, name);
 
@@ -530,7 +609,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
          */
 
         if (Verbosity)
-            puts("Calculating Installed-Size...");
+            tasks_printf("Calculating Installed-Size...\n");
 
         snprintf(filename, sizeof(filename), "%s/%s/DEBIAN/control", directory, name);
         if ((fp = fopen(filename, "a")) == NULL) {
@@ -549,7 +628,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
      */
 
     if (Verbosity)
-        puts("Copying temporary distribution files...");
+        tasks_printf("Copying temporary distribution files...\n");
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++) {
         if (file->subpackage != subpackage)
@@ -559,11 +638,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
          * Find the username and groupname IDs...
          */
 
-        pwd = getpwnam(file->user);
-        grp = getgrnam(file->group);
-
-        endpwent();
-        endgrent();
+        get_owner(file->user, file->group, &uid, &gid);
 
         /*
          * Copy the file or make the directory or make the symlink as needed...
@@ -575,10 +650,9 @@ make_subpackage(const char *prodname,     /* I - Product short name */
             snprintf(filename, sizeof(filename), "%s/%s%s", directory, name, file->dst);
 
             if (Verbosity > 1)
-                printf("%s -> %s...\n", file->src, filename);
+                tasks_printf("%s -> %s...\n", file->src, filename);
 
-            if (copy_file(filename, file->src, file->mode, pwd ? pwd->pw_uid : 0,
-                          grp ? grp->gr_gid : 0))
+            if (copy_file(filename, file->src, file->mode, uid, gid))
                 return (1);
             break;
         case 'i':
@@ -586,26 +660,24 @@ make_subpackage(const char *prodname,     /* I - Product short name */
                      file->dst);
 
             if (Verbosity > 1)
-                printf("%s -> %s...\n", file->src, filename);
+                tasks_printf("%s -> %s...\n", file->src, filename);
 
-            if (copy_file(filename, file->src, file->mode, pwd ? pwd->pw_uid : 0,
-                          grp ? grp->gr_gid : 0))
+            if (copy_file(filename, file->src, file->mode, uid, gid))
                 return (1);
             break;
         case 'd':
             snprintf(filename, sizeof(filename), "%s/%s%s", directory, name, file->dst);
 
             if (Verbosity > 1)
-                printf("Directory %s...\n", filename);
+                tasks_printf("Directory %s...\n", filename);
 
-            make_directory(filename, file->mode, pwd ? pwd->pw_uid : 0,
-                           grp ? grp->gr_gid : 0);
+            make_directory(filename, file->mode, uid, gid);
             break;
         case 'l':
             snprintf(filename, sizeof(filename), "%s/%s%s", directory, name, file->dst);
 
             if (Verbosity > 1)
-                printf("%s -> %s...\n", file->src, filename);
+                tasks_printf("%s -> %s...\n", file->src, filename);
 
             make_link(filename, file->src);
             break;
@@ -617,7 +689,7 @@ make_subpackage(const char *prodname,     /* I - Product short name */
      */
 
     if (Verbosity)
-        printf("Building Debian %s binary distribution...\n", name);
+        tasks_printf("Building Debian %s binary distribution...\n", name);
 
     if (geteuid() && !run_command(NULL, "fakeroot --version")) {
         if (run_command(directory, "fakeroot dpkg --build %s", name))
@@ -631,11 +703,25 @@ make_subpackage(const char *prodname,     /* I - Product short name */
 
     if (!KeepFiles) {
         if (Verbosity)
-            printf("Removing temporary %s distribution files...\n", name);
+            tasks_printf("Removing temporary %s distribution files...\n", name);
 
         snprintf(filename, sizeof(filename), "%s/%s", directory, name);
         unlink_directory(filename);
     }
 
+    if (manifest)
+        manifest_write(manifest, manifestname);
+
     return (0);
 }
+
+/*
+ * 'make_subpackage_task()' - Make a subpackage as a build task.
+ */
+
+static int                         /* O - 0 = success, 1 = fail */
+make_subpackage_task(debpkg_t *pkg) /* I - Package build data */
+{
+    return (make_subpackage(pkg->prodname, pkg->directory, pkg->platname, pkg->dist,
+                            pkg->platform, pkg->subpackage, pkg->manifest));
+}
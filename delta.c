@@ -0,0 +1,546 @@
+/*
+ * Binary delta functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A delta file describes how to make a new file from an old one.  It
+ * starts with a header containing the size and SHA-256 digest of both
+ * files:
+ *
+ *     "EPMDELTA" old-size old-digest new-size new-digest
+ *
+ * followed by copy ('C' offset length) and insert ('I' length bytes)
+ * instructions and an end ('E') instruction.  Sizes and offsets are stored
+ * as big-endian 64-bit integers and lengths as big-endian 32-bit integers.
+ *
+ * Deltas are found by indexing each block of the old file using a rolling
+ * checksum and then looking up the checksum at every offset of the new
+ * file, as rsync does.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <fcntl.h>
+
+/*
+ * Local constants...
+ */
+
+#define DELTA_BLOCK 64         /* Size of indexed blocks */
+#define DELTA_HEADER 88        /* Size of delta header */
+#define DELTA_PROBES 16        /* Maximum hash table probes */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Block index entry ****/
+{
+    unsigned hash; /* Rolling checksum of block */
+    size_t pos;    /* Offset of block + 1, 0 if unused */
+} delta_block_t;
+
+/*
+ * Local functions...
+ */
+
+static int delta_copy(FILE *fp, size_t offset, size_t length);
+static unsigned char *delta_get(const char *filename, size_t *size);
+static unsigned delta_hash(const unsigned char *data, unsigned *a, unsigned *b);
+static int delta_insert(FILE *fp, const unsigned char *data, size_t length);
+static void delta_put(unsigned char *buffer, unsigned long long value, int bytes);
+static unsigned long long delta_value(const unsigned char *buffer, int bytes);
+
+/*
+ * 'delta_apply()' - Make a new file from an old file and a delta file.
+ *
+ * The old file must match the digest in the delta file and the new file
+ * must match once it has been written.
+ */
+
+int                           /* O - 0 on success, 1 if old file differs, -1 on error */
+delta_apply(const char *oldfile,   /* I - Old file */
+            const char *deltafile, /* I - Delta file */
+            const char *newfile,   /* I - New file */
+            mode_t mode)           /* I - Permissions of new file */
+{
+    int status;                          /* Return status */
+    unsigned char *olddata;              /* Old file data */
+    size_t oldsize;                      /* Old file size */
+    FILE *deltafp,                       /* Delta file */
+        *newfp;                          /* New file */
+    unsigned char header[DELTA_HEADER],  /* Delta header */
+        op[13],                          /* Instruction */
+        buffer[65536],                   /* Copy buffer */
+        digest[SHA256_SIZE];             /* Digest of file */
+    unsigned long long offset,           /* Copy offset */
+        newsize;                         /* Size of new file */
+    size_t length,                       /* Length of instruction */
+        bytes;                           /* Bytes to copy */
+    sha256_t ctx;                        /* Digest of new file */
+    int fd;                              /* New file descriptor */
+
+    if ((deltafp = fopen(deltafile, "rb")) == NULL) {
+        fprintf(stderr, "epm: Unable to open \"%s\" - %s\n", deltafile, strerror(errno));
+        return (-1);
+    }
+
+    if (fread(header, 1, sizeof(header), deltafp) != sizeof(header) ||
+        memcmp(header, "EPMDELTA", 8)) {
+        fprintf(stderr, "epm: \"%s\" is not a delta file.\n", deltafile);
+        fclose(deltafp);
+        return (-1);
+    }
+
+    /*
+     * Make sure the old file is the one the delta was made from...
+     */
+
+    if ((olddata = delta_get(oldfile, &oldsize)) == NULL) {
+        fclose(deltafp);
+        return (1);
+    }
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, olddata, oldsize);
+    sha256_final(&ctx, digest);
+
+    if (oldsize != delta_value(header + 8, 8) || memcmp(digest, header + 16, SHA256_SIZE)) {
+        free(olddata);
+        fclose(deltafp);
+        return (1);
+    }
+
+    /*
+     * Write the new file...
+     */
+
+    newsize = delta_value(header + 48, 8);
+
+    if ((fd = open(newfile, O_WRONLY | O_CREAT | O_TRUNC, mode)) < 0 ||
+        (newfp = fdopen(fd, "wb")) == NULL) {
+        fprintf(stderr, "epm: Unable to create \"%s\" - %s\n", newfile, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        free(olddata);
+        fclose(deltafp);
+        return (-1);
+    }
+
+    sha256_init(&ctx);
+    status = -1;
+
+    while (fread(op, 1, 1, deltafp) == 1) {
+        if (op[0] == 'E') {
+            status = 0;
+            break;
+        } else if (op[0] == 'C') {
+            if (fread(op + 1, 1, 12, deltafp) != 12)
+                break;
+
+            offset = delta_value(op + 1, 8);
+            length = (size_t)delta_value(op + 9, 4);
+
+            if (offset > oldsize || length > oldsize - offset)
+                break;
+
+            sha256_update(&ctx, olddata + offset, length);
+
+            if (fwrite(olddata + offset, 1, length, newfp) != length)
+                break;
+        } else if (op[0] == 'I') {
+            if (fread(op + 1, 1, 4, deltafp) != 4)
+                break;
+
+            for (length = (size_t)delta_value(op + 1, 4); length > 0; length -= bytes) {
+                bytes = length > sizeof(buffer) ? sizeof(buffer) : length;
+
+                if (fread(buffer, 1, bytes, deltafp) != bytes)
+                    break;
+
+                sha256_update(&ctx, buffer, bytes);
+
+                if (fwrite(buffer, 1, bytes, newfp) != bytes)
+                    break;
+            }
+
+            if (length > 0)
+                break;
+        } else
+            break;
+    }
+
+    sha256_final(&ctx, digest);
+
+    if (fclose(newfp))
+        status = -1;
+
+    if (!status && memcmp(digest, header + 56, SHA256_SIZE))
+        status = -1;
+
+    if (!status) {
+        struct stat fileinfo; /* New file information */
+
+        if (stat(newfile, &fileinfo) || (unsigned long long)fileinfo.st_size != newsize)
+            status = -1;
+    }
+
+    if (status) {
+        fprintf(stderr, "epm: Unable to apply delta \"%s\" to \"%s\".\n", deltafile,
+                oldfile);
+        unlink(newfile);
+    }
+
+    free(olddata);
+    fclose(deltafp);
+
+    return (status);
+}
+
+/*
+ * 'delta_create()' - Make a delta file from an old and a new file.
+ */
+
+int                             /* O - 0 on success, -1 on error */
+delta_create(const char *oldfile,   /* I - Old file */
+             const char *newfile,   /* I - New file */
+             const char *deltafile) /* I - Delta file */
+{
+    int status;                         /* Return status */
+    unsigned char *olddata,             /* Old file data */
+        *newdata;                       /* New file data */
+    size_t oldsize,                     /* Old file size */
+        newsize,                        /* New file size */
+        i,                              /* Looping var */
+        nblocks,                        /* Number of old blocks */
+        mask,                           /* Hash table mask */
+        slot,                           /* Hash table slot */
+        pos,                            /* Position in new file */
+        start,                          /* Start of pending insert */
+        match,                          /* Matching position in old file */
+        length;                         /* Length of match */
+    int probe;                          /* Probe count */
+    unsigned hash,                      /* Rolling checksum */
+        a, b;                           /* Checksum sums */
+    delta_block_t *blocks;              /* Block index */
+    FILE *fp;                           /* Delta file */
+    unsigned char header[DELTA_HEADER]; /* Delta header */
+    sha256_t ctx;                       /* Digest context */
+
+    if ((olddata = delta_get(oldfile, &oldsize)) == NULL)
+        return (-1);
+
+    if ((newdata = delta_get(newfile, &newsize)) == NULL) {
+        free(olddata);
+        return (-1);
+    }
+
+    /*
+     * Index the blocks in the old file...
+     */
+
+    nblocks = oldsize / DELTA_BLOCK;
+
+    for (mask = 1023; mask < nblocks * 2; mask = mask * 2 + 1)
+        ;
+
+    if ((blocks = calloc(mask + 1, sizeof(delta_block_t))) == NULL) {
+        fputs("epm: Out of memory creating delta!\n", stderr);
+        free(olddata);
+        free(newdata);
+        return (-1);
+    }
+
+    for (i = 0; i < nblocks; i++) {
+        hash = delta_hash(olddata + i * DELTA_BLOCK, &a, &b);
+
+        for (slot = (hash * 2654435761U) & mask, probe = 0;
+             blocks[slot].pos && probe < DELTA_PROBES; slot = (slot + 1) & mask, probe++)
+            ;
+
+        if (!blocks[slot].pos) {
+            blocks[slot].hash = hash;
+            blocks[slot].pos = i * DELTA_BLOCK + 1;
+        }
+    }
+
+    /*
+     * Write the header...
+     */
+
+    if ((fp = fopen(deltafile, "wb")) == NULL) {
+        fprintf(stderr, "epm: Unable to create \"%s\" - %s\n", deltafile,
+                strerror(errno));
+        free(blocks);
+        free(olddata);
+        free(newdata);
+        return (-1);
+    }
+
+    memcpy(header, "EPMDELTA", 8);
+    delta_put(header + 8, oldsize, 8);
+    sha256_init(&ctx);
+    sha256_update(&ctx, olddata, oldsize);
+    sha256_final(&ctx, header + 16);
+    delta_put(header + 48, newsize, 8);
+    sha256_init(&ctx);
+    sha256_update(&ctx, newdata, newsize);
+    sha256_final(&ctx, header + 56);
+
+    status = fwrite(header, 1, sizeof(header), fp) == sizeof(header) ? 0 : -1;
+
+    /*
+     * Then look for each block in the new file...
+     */
+
+    pos = 0;
+    start = 0;
+    hash = 0;
+    a = b = 0;
+
+    if (nblocks > 0 && newsize >= DELTA_BLOCK)
+        hash = delta_hash(newdata, &a, &b);
+
+    while (!status && nblocks > 0 && pos + DELTA_BLOCK <= newsize) {
+        match = 0;
+
+        for (slot = (hash * 2654435761U) & mask, probe = 0;
+             blocks[slot].pos && probe < DELTA_PROBES; slot = (slot + 1) & mask, probe++)
+            if (blocks[slot].hash == hash &&
+                !memcmp(olddata + blocks[slot].pos - 1, newdata + pos, DELTA_BLOCK)) {
+                match = blocks[slot].pos;
+                break;
+            }
+
+        if (match) {
+            /*
+             * Extend the match in both directions...
+             */
+
+            match--;
+
+            while (pos > start && match > 0 && olddata[match - 1] == newdata[pos - 1]) {
+                match--;
+                pos--;
+            }
+
+            for (length = 0; match + length < oldsize && pos + length < newsize &&
+                             olddata[match + length] == newdata[pos + length];
+                 length++)
+                ;
+
+            if (pos > start)
+                status = delta_insert(fp, newdata + start, pos - start);
+
+            if (!status)
+                status = delta_copy(fp, match, length);
+
+            pos += length;
+            start = pos;
+
+            if (pos + DELTA_BLOCK <= newsize)
+                hash = delta_hash(newdata + pos, &a, &b);
+        } else if (pos + DELTA_BLOCK < newsize) {
+            /*
+             * Roll the checksum forward one byte...
+             */
+
+            a = (a - newdata[pos] + newdata[pos + DELTA_BLOCK]) & 0xffff;
+            b = (b - DELTA_BLOCK * newdata[pos] + a) & 0xffff;
+            hash = a | (b << 16);
+            pos++;
+        } else
+            break;
+    }
+
+    if (!status && start < newsize)
+        status = delta_insert(fp, newdata + start, newsize - start);
+
+    if (!status && putc('E', fp) == EOF)
+        status = -1;
+
+    if (fclose(fp))
+        status = -1;
+
+    if (status) {
+        fprintf(stderr, "epm: Unable to write \"%s\" - %s\n", deltafile, strerror(errno));
+        unlink(deltafile);
+    }
+
+    free(blocks);
+    free(olddata);
+    free(newdata);
+
+    return (status);
+}
+
+/*
+ * 'delta_copy()' - Write copy instructions.
+ */
+
+static int               /* O - 0 on success, -1 on error */
+delta_copy(FILE *fp,     /* I - Delta file */
+           size_t offset, /* I - Offset in old file */
+           size_t length) /* I - Number of bytes */
+{
+    unsigned char op[13]; /* Instruction */
+    size_t bytes;         /* Bytes in this instruction */
+
+    for (; length > 0; offset += bytes, length -= bytes) {
+        bytes = length > 0x7fffffff ? 0x7fffffff : length;
+
+        op[0] = 'C';
+        delta_put(op + 1, offset, 8);
+        delta_put(op + 9, bytes, 4);
+
+        if (fwrite(op, 1, sizeof(op), fp) != sizeof(op))
+            return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'delta_get()' - Read a file into memory.
+ */
+
+static unsigned char *          /* O - File data or NULL on error */
+delta_get(const char *filename, /* I - File to read */
+          size_t *size)         /* O - Size of file */
+{
+    int fd;                /* File descriptor */
+    struct stat fileinfo;  /* File information */
+    unsigned char *data;   /* File data */
+    size_t total;          /* Total bytes read */
+    ssize_t bytes;         /* Bytes read */
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "epm: Unable to open \"%s\" - %s\n", filename, strerror(errno));
+        return (NULL);
+    }
+
+    if (fstat(fd, &fileinfo) ||
+        (data = malloc((size_t)fileinfo.st_size + 1)) == NULL) {
+        fprintf(stderr, "epm: Unable to read \"%s\" - %s\n", filename, strerror(errno));
+        close(fd);
+        return (NULL);
+    }
+
+    for (total = 0; total < (size_t)fileinfo.st_size; total += (size_t)bytes)
+        if ((bytes = read(fd, data + total, (size_t)fileinfo.st_size - total)) <= 0) {
+            if (bytes < 0 && errno == EINTR) {
+                bytes = 0;
+                continue;
+            }
+
+            fprintf(stderr, "epm: Unable to read \"%s\" - %s\n", filename,
+                    bytes < 0 ? strerror(errno) : "Short read");
+            free(data);
+            close(fd);
+            return (NULL);
+        }
+
+    close(fd);
+
+    *size = total;
+
+    return (data);
+}
+
+/*
+ * 'delta_hash()' - Compute the rolling checksum of a block.
+ */
+
+static unsigned                          /* O - Checksum */
+delta_hash(const unsigned char *data,    /* I - Block */
+           unsigned *a,                  /* O - Sum of bytes */
+           unsigned *b)                  /* O - Weighted sum of bytes */
+{
+    int i; /* Looping var */
+
+    for (i = 0, *a = 0, *b = 0; i < DELTA_BLOCK; i++) {
+        *a += data[i];
+        *b += (unsigned)(DELTA_BLOCK - i) * data[i];
+    }
+
+    *a &= 0xffff;
+    *b &= 0xffff;
+
+    return (*a | (*b << 16));
+}
+
+/*
+ * 'delta_insert()' - Write insert instructions.
+ */
+
+static int                      /* O - 0 on success, -1 on error */
+delta_insert(FILE *fp,          /* I - Delta file */
+             const unsigned char *data, /* I - Bytes to insert */
+             size_t length)     /* I - Number of bytes */
+{
+    unsigned char op[5]; /* Instruction */
+    size_t bytes;        /* Bytes in this instruction */
+
+    for (; length > 0; data += bytes, length -= bytes) {
+        bytes = length > 0x7fffffff ? 0x7fffffff : length;
+
+        op[0] = 'I';
+        delta_put(op + 1, bytes, 4);
+
+        if (fwrite(op, 1, sizeof(op), fp) != sizeof(op) ||
+            fwrite(data, 1, bytes, fp) != bytes)
+            return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'delta_put()' - Store a big-endian integer.
+ */
+
+static void                        /* O - Nothing */
+delta_put(unsigned char *buffer,   /* I - Buffer */
+          unsigned long long value, /* I - Value */
+          int bytes)               /* I - Number of bytes */
+{
+    while (bytes > 0) {
+        bytes--;
+        buffer[bytes] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+/*
+ * 'delta_value()' - Get a big-endian integer.
+ */
+
+static unsigned long long              /* O - Value */
+delta_value(const unsigned char *buffer, /* I - Buffer */
+            int bytes)                 /* I - Number of bytes */
+{
+    unsigned long long value; /* Value */
+
+    for (value = 0; bytes > 0; bytes--, buffer++)
+        value = (value << 8) | *buffer;
+
+    return (value);
+}
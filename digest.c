@@ -0,0 +1,654 @@
+/*
+ * File digest functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The SHA-256 digests of distribution files are computed by several threads
+ * at once and remembered in the "CacheDir/digests" file, so files that have
+ * not changed since the last build are never read again.  Each line of the
+ * digest cache contains:
+ *
+ *     digest size mtime inode device path
+ *
+ * The path is always absolute so that builds in different directories can
+ * share a cache directory.  A cached digest is only used when the size,
+ * modification time, inode number, and device of the file are unchanged,
+ * and entries for files that no longer match are dropped when the cache is
+ * saved.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local constants...
+ */
+
+#define DIGEST_HEADER "# EPM digest cache 2" /* First line of cache */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Digest cache entry ****/
+{
+    char *path;                /* Filename */
+    long long size,            /* Size of file */
+        mtime;                 /* Modification time */
+    unsigned long long inode,  /* Inode number */
+        device;                /* Device number */
+    int seen;                  /* 1 if used by this build */
+    char hex[SHA256_HEX_SIZE]; /* SHA-256 digest */
+} digest_entry_t;
+
+typedef struct /**** File to digest ****/
+{
+    const char *path;          /* Filename */
+    char key[1024];            /* Absolute filename */
+    int status,                /* 0 on success, -1 on error */
+        cached;                /* 1 if the digest came from the cache */
+    digest_entry_t entry;      /* Digest and file information */
+} digest_job_t;
+
+typedef struct /**** Digests to compute ****/
+{
+    int num_jobs,              /* Number of files */
+        next_job;              /* Next file to digest */
+    digest_job_t *jobs;        /* Files */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mutex;     /* Lock for next_job */
+#endif /* HAVE_PTHREAD_H */
+} digest_work_t;
+
+/*
+ * Local globals...
+ */
+
+static char DigestCwd[1024] = "";  /* Current directory */
+static int DigestLoaded = 0;        /* 1 if the cache has been loaded */
+static int DigestChanged = 0;       /* 1 if the cache needs to be saved */
+static int DigestCount = 0;         /* Number of cache entries */
+static int DigestAlloc = 0;         /* Allocated cache entries */
+static digest_entry_t *Digests = NULL; /* Cache entries, sorted by path */
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t DigestMutex = PTHREAD_MUTEX_INITIALIZER;
+/* Lock for the cache */
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local functions...
+ */
+
+static int digest_add(digest_entry_t *entry);
+static int digest_compare(digest_entry_t *a, digest_entry_t *b);
+static int digest_compare_jobs(digest_job_t *a, digest_job_t *b);
+static int digest_compute(const char *path, char *key, size_t keysize,
+                          digest_entry_t *entry, int *cached);
+static void digest_load(void);
+static void digest_lock(void);
+static digest_entry_t *digest_lookup(const char *path);
+static void digest_unlock(void);
+static void *digest_worker(digest_work_t *work);
+
+/*
+ * 'digest_file()' - Get the SHA-256 digest of a file as a hex string.
+ *
+ * The digest cache is used if the file has not changed.  New digests are
+ * written by the next call to digest_save().  This function can be called
+ * from any thread.
+ */
+
+int                               /* O - 0 on success, -1 on error */
+digest_file(const char *filename, /* I - File to digest */
+            char *hex,            /* O - Hex digest string */
+            size_t hexsize)       /* I - Size of hex digest string */
+{
+    digest_entry_t entry; /* Digest and file information */
+    char key[1024];       /* Absolute filename */
+    int cached;           /* Digest from the cache? */
+
+    digest_lock();
+    digest_load();
+    digest_unlock();
+
+    if (digest_compute(filename, key, sizeof(key), &entry, &cached))
+        return (-1);
+
+    if (!cached) {
+        digest_lock();
+        digest_add(&entry);
+        digest_unlock();
+    }
+
+    strlcpy(hex, entry.hex, hexsize);
+
+    return (0);
+}
+
+/*
+ * 'digest_files()' - Compute the digests of all files in a distribution.
+ *
+ * The files are read by up to "MaxJobs" threads and the results are saved
+ * in the digest cache, so later calls to digest_file() for the same files
+ * do not read them again.
+ */
+
+int                     /* O - 0 on success, -1 on error */
+digest_files(dist_t *dist) /* I - Distribution */
+{
+    int i;                /* Looping var */
+    file_t *file;         /* Current file */
+    digest_work_t work;   /* Files to digest */
+    digest_job_t *job;    /* Current file */
+    int num_cached,       /* Number of cached digests */
+        status;           /* Return status */
+#ifdef HAVE_PTHREAD_H
+    int num_threads,      /* Number of threads */
+        max_threads;      /* Maximum number of threads */
+    pthread_t *threads;   /* Worker threads */
+#endif /* HAVE_PTHREAD_H */
+
+    memset(&work, 0, sizeof(work));
+
+    if ((work.jobs = calloc((size_t)dist->num_files + 1, sizeof(digest_job_t))) == NULL) {
+        fputs("epm: Unable to allocate memory for file digests!\n", stderr);
+        return (-1);
+    }
+
+    /*
+     * Make a sorted list of the unique source files...
+     */
+
+    for (i = dist->num_files, file = dist->files; i > 0; i--, file++) {
+        if (file->type == 'R' || !strchr("cfi", tolower(file->type)))
+            continue;
+
+        work.jobs[work.num_jobs++].path = file->src;
+    }
+
+    if (work.num_jobs > 1) {
+        qsort(work.jobs, (size_t)work.num_jobs, sizeof(digest_job_t),
+              (int (*)(const void *, const void *))digest_compare_jobs);
+
+        for (i = 1, job = work.jobs + 1; i < work.num_jobs; i++)
+            if (strcmp(work.jobs[i].path, job[-1].path))
+                *job++ = work.jobs[i];
+
+        work.num_jobs = (int)(job - work.jobs);
+    }
+
+    digest_lock();
+    digest_load();
+    digest_unlock();
+
+    /*
+     * Then compute the digests...
+     */
+
+#ifdef HAVE_PTHREAD_H
+    if ((max_threads = MaxJobs) <= 0 &&
+        (max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        max_threads = 1;
+
+    if (max_threads > work.num_jobs)
+        max_threads = work.num_jobs;
+
+    pthread_mutex_init(&work.mutex, NULL);
+
+    if (max_threads > 1 &&
+        (threads = calloc((size_t)max_threads, sizeof(pthread_t))) != NULL) {
+        for (num_threads = 0; num_threads < max_threads - 1; num_threads++)
+            if (pthread_create(threads + num_threads, NULL,
+                               (void *(*)(void *))digest_worker, &work))
+                break;
+
+        digest_worker(&work);
+
+        for (i = 0; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
+
+        free(threads);
+    } else
+#endif /* HAVE_PTHREAD_H */
+        digest_worker(&work);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&work.mutex);
+#endif /* HAVE_PTHREAD_H */
+
+    /*
+     * Finally add the new digests to the cache...
+     */
+
+    digest_lock();
+
+    for (i = work.num_jobs, job = work.jobs, num_cached = 0, status = 0; i > 0;
+         i--, job++) {
+        if (job->status) {
+            fprintf(stderr, "epm: Unable to read \"%s\" - %s\n", job->path,
+                    strerror(job->status));
+            status = -1;
+        } else if (job->cached)
+            num_cached++;
+        else
+            digest_add(&job->entry);
+    }
+
+    digest_unlock();
+    digest_save();
+
+    if (Verbosity > 1)
+        printf("Computed digests of %d files, %d from the digest cache.\n",
+               work.num_jobs - num_cached, num_cached);
+
+    free(work.jobs);
+
+    return (status);
+}
+
+/*
+ * 'digest_save()' - Save the digest cache if it has changed.
+ *
+ * Entries that were not used by this build are only kept if the file still
+ * exists with the same size, modification time, inode, and device.
+ */
+
+void /* O - Nothing */
+digest_save(void) {
+    int i;                    /* Looping var */
+    FILE *fp;                 /* Digest cache file */
+    digest_entry_t *entry;    /* Current entry */
+    struct stat fileinfo;     /* File information */
+    char filename[1024],      /* Digest cache filename */
+        tempname[1024];       /* Temporary filename */
+
+    digest_lock();
+
+    if (!DigestChanged || !CacheDir) {
+        digest_unlock();
+        return;
+    }
+
+    DigestChanged = 0;
+
+    make_directory(CacheDir, 0755, (uid_t)-1, (gid_t)-1);
+
+    snprintf(filename, sizeof(filename), "%s/digests", CacheDir);
+    snprintf(tempname, sizeof(tempname), "%s/digests.%d", CacheDir, (int)getpid());
+
+    if ((fp = fopen(tempname, "w")) == NULL) {
+        if (Verbosity > 1)
+            fprintf(stderr, "epm: Unable to create digest cache \"%s\" - %s\n", tempname,
+                    strerror(errno));
+        digest_unlock();
+        return;
+    }
+
+    fputs(DIGEST_HEADER "\n", fp);
+
+    for (i = DigestCount, entry = Digests; i > 0; i--, entry++) {
+        if (!entry->seen &&
+            (stat(entry->path, &fileinfo) ||
+             (long long)fileinfo.st_size != entry->size ||
+             (long long)fileinfo.st_mtime != entry->mtime ||
+             (unsigned long long)fileinfo.st_ino != entry->inode ||
+             (unsigned long long)fileinfo.st_dev != entry->device))
+            continue;
+
+        fprintf(fp, "%s %lld %lld %llu %llu %s\n", entry->hex, entry->size, entry->mtime,
+                entry->inode, entry->device, entry->path);
+    }
+
+    if (fclose(fp) || rename(tempname, filename)) {
+        if (Verbosity > 1)
+            fprintf(stderr, "epm: Unable to write digest cache \"%s\" - %s\n", filename,
+                    strerror(errno));
+        unlink(tempname);
+    }
+
+    digest_unlock();
+}
+
+/*
+ * 'digest_add()' - Add or update a digest cache entry.
+ *
+ * The cache must be locked.
+ */
+
+static int                     /* O - 0 on success, -1 on error */
+digest_add(digest_entry_t *entry) /* I - Entry to add */
+{
+    digest_entry_t *match; /* Existing entry */
+    int left,              /* Left side of binary search */
+        right,             /* Right side of binary search */
+        middle;            /* Middle of binary search */
+
+    /*
+     * Don't remember files that might still be changing; the modification
+     * time only has a resolution of one second...
+     */
+
+    if (entry->mtime >= (long long)time(NULL) - 1 || strchr(entry->path, '\n'))
+        return (0);
+
+    if ((match = digest_lookup(entry->path)) != NULL) {
+        match->size = entry->size;
+        match->mtime = entry->mtime;
+        match->inode = entry->inode;
+        match->device = entry->device;
+        match->seen = 1;
+        strlcpy(match->hex, entry->hex, sizeof(match->hex));
+
+        DigestChanged = 1;
+        return (0);
+    }
+
+    if (DigestCount >= DigestAlloc) {
+        digest_entry_t *temp; /* New entries */
+        int alloc;            /* New allocation */
+
+        alloc = DigestAlloc ? 2 * DigestAlloc : 1024;
+
+        if ((temp = realloc(Digests, (size_t)alloc * sizeof(digest_entry_t))) == NULL)
+            return (-1);
+
+        Digests = temp;
+        DigestAlloc = alloc;
+    }
+
+    /*
+     * Find the insertion point to keep the entries sorted...
+     */
+
+    for (left = 0, right = DigestCount; left < right;) {
+        middle = (left + right) / 2;
+
+        if (strcmp(entry->path, Digests[middle].path) > 0)
+            left = middle + 1;
+        else
+            right = middle;
+    }
+
+    if (left < DigestCount)
+        memmove(Digests + left + 1, Digests + left,
+                (size_t)(DigestCount - left) * sizeof(digest_entry_t));
+
+    Digests[left] = *entry;
+    Digests[left].seen = 1;
+
+    if ((Digests[left].path = strdup(entry->path)) == NULL) {
+        memmove(Digests + left, Digests + left + 1,
+                (size_t)(DigestCount - left) * sizeof(digest_entry_t));
+        return (-1);
+    }
+
+    DigestCount++;
+    DigestChanged = 1;
+
+    return (0);
+}
+
+/*
+ * 'digest_compare()' - Compare two digest cache entries.
+ */
+
+static int                   /* O - Result of comparison */
+digest_compare(digest_entry_t *a, /* I - First entry */
+               digest_entry_t *b) /* I - Second entry */
+{
+    return (strcmp(a->path, b->path));
+}
+
+/*
+ * 'digest_compare_jobs()' - Compare two files to digest.
+ */
+
+static int                     /* O - Result of comparison */
+digest_compare_jobs(digest_job_t *a, /* I - First file */
+                    digest_job_t *b) /* I - Second file */
+{
+    return (strcmp(a->path, b->path));
+}
+
+/*
+ * 'digest_compute()' - Get the digest of a file from the cache or by reading
+ *                      it.
+ *
+ * The cache is locked while searching but not while reading the file.
+ */
+
+static int                    /* O - 0 on success, -1 on error */
+digest_compute(const char *path, /* I - File to digest */
+               char *key,        /* I - Buffer for absolute filename */
+               size_t keysize,   /* I - Size of buffer */
+               digest_entry_t *entry, /* O - Digest and file information */
+               int *cached)     /* O - 1 if the digest came from the cache */
+{
+    struct stat fileinfo;  /* File information */
+    digest_entry_t *match; /* Cache entry */
+
+    *cached = 0;
+
+    if (stat(path, &fileinfo))
+        return (-1);
+
+    memset(entry, 0, sizeof(digest_entry_t));
+
+    if (path[0] == '/' || !DigestCwd[0])
+        strlcpy(key, path, keysize);
+    else
+        snprintf(key, keysize, "%s/%s", DigestCwd, path);
+
+    entry->path = key;
+    entry->size = (long long)fileinfo.st_size;
+    entry->mtime = (long long)fileinfo.st_mtime;
+    entry->inode = (unsigned long long)fileinfo.st_ino;
+    entry->device = (unsigned long long)fileinfo.st_dev;
+
+    digest_lock();
+
+    if ((match = digest_lookup(key)) != NULL && match->size == entry->size &&
+        match->mtime == entry->mtime && match->inode == entry->inode &&
+        match->device == entry->device) {
+        strlcpy(entry->hex, match->hex, sizeof(entry->hex));
+        match->seen = 1;
+        *cached = 1;
+    }
+
+    digest_unlock();
+
+    if (*cached)
+        return (0);
+
+    return (sha256_file(path, entry->hex, sizeof(entry->hex)));
+}
+
+/*
+ * 'digest_load()' - Load the digest cache.
+ *
+ * The cache must be locked.
+ */
+
+static void /* O - Nothing */
+digest_load(void) {
+    FILE *fp;              /* Digest cache file */
+    char filename[1024],   /* Digest cache filename */
+        line[2048],        /* Line from file */
+        *path,             /* Filename in line */
+        *ptr;              /* Pointer into line */
+    digest_entry_t entry;  /* Cache entry */
+    int pos;               /* Position of filename in line */
+
+    if (DigestLoaded || !CacheDir)
+        return;
+
+    DigestLoaded = 1;
+
+    if (!getcwd(DigestCwd, sizeof(DigestCwd)))
+        DigestCwd[0] = '\0';
+
+    snprintf(filename, sizeof(filename), "%s/digests", CacheDir);
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return;
+
+    /*
+     * Ignore caches written in an older format, they will be replaced...
+     */
+
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, DIGEST_HEADER "\n")) {
+        fclose(fp);
+        DigestChanged = 1;
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#')
+            continue;
+
+        if ((ptr = strchr(line, '\n')) == NULL)
+            continue;
+
+        *ptr = '\0';
+        pos = 0;
+
+        memset(&entry, 0, sizeof(entry));
+
+        if (sscanf(line, "%64s%lld%lld%llu%llu %n", entry.hex, &entry.size, &entry.mtime,
+                   &entry.inode, &entry.device, &pos) < 5 ||
+            !pos || strlen(entry.hex) != SHA256_HEX_SIZE - 1)
+            continue;
+
+        path = line + pos;
+
+        if (*path != '/')
+            continue;
+
+        if (DigestCount >= DigestAlloc) {
+            digest_entry_t *temp; /* New entries */
+            int alloc;            /* New allocation */
+
+            alloc = DigestAlloc ? 2 * DigestAlloc : 1024;
+
+            if ((temp = realloc(Digests, (size_t)alloc * sizeof(digest_entry_t))) ==
+                NULL)
+                break;
+
+            Digests = temp;
+            DigestAlloc = alloc;
+        }
+
+        if ((entry.path = strdup(path)) == NULL)
+            break;
+
+        Digests[DigestCount++] = entry;
+    }
+
+    fclose(fp);
+
+    /*
+     * The file is normally sorted already, but don't count on it...
+     */
+
+    if (DigestCount > 1)
+        qsort(Digests, (size_t)DigestCount, sizeof(digest_entry_t),
+              (int (*)(const void *, const void *))digest_compare);
+}
+
+/*
+ * 'digest_lock()' - Lock the digest cache.
+ */
+
+static void /* O - Nothing */
+digest_lock(void) {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&DigestMutex);
+#endif /* HAVE_PTHREAD_H */
+}
+
+/*
+ * 'digest_lookup()' - Find a digest cache entry.
+ *
+ * The cache must be locked.
+ */
+
+static digest_entry_t *     /* O - Matching entry or NULL */
+digest_lookup(const char *path) /* I - Filename */
+{
+    digest_entry_t key; /* Search key */
+
+    if (DigestCount == 0)
+        return (NULL);
+
+    key.path = (char *)path;
+
+    return ((digest_entry_t *)bsearch(&key, Digests, (size_t)DigestCount,
+                                      sizeof(digest_entry_t),
+                                      (int (*)(const void *, const void *))digest_compare));
+}
+
+/*
+ * 'digest_unlock()' - Unlock the digest cache.
+ */
+
+static void /* O - Nothing */
+digest_unlock(void) {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&DigestMutex);
+#endif /* HAVE_PTHREAD_H */
+}
+
+/*
+ * 'digest_worker()' - Compute digests until there are no more files.
+ */
+
+static void *              /* O - Thread exit value (unused) */
+digest_worker(digest_work_t *work) /* I - Files to digest */
+{
+    digest_job_t *job; /* Current file */
+
+    for (;;) {
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&work->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        if (work->next_job < work->num_jobs)
+            job = work->jobs + work->next_job++;
+        else
+            job = NULL;
+
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_unlock(&work->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        if (!job)
+            break;
+
+        if (digest_compute(job->path, job->key, sizeof(job->key), &job->entry,
+                           &job->cached))
+            job->status = errno ? errno : EIO;
+    }
+
+    return (NULL);
+}
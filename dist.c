@@ -45,6 +45,8 @@ static char *get_line(char *buffer, int size, FILE *fp, struct utsname *platform
                       const char *format, int *skip);
 static char *get_string(char **src, char *dst, size_t dstsize);
 static int patmatch(const char *, const char *);
+static int read_binary(dist_t *dist, FILE *fp, const char *filename,
+                       const char *subpkg);
 static int sort_subpackages(char **a, char **b);
 static void update_architecture(char *buffer, size_t bufsize);
 
@@ -305,11 +307,16 @@ add_file(dist_t *dist,       /* I - Distribution */
 {
     file_t *file; /* New file */
 
+    /*
+     * Grow the array by doubling whenever the count reaches a power of 2, so
+     * adding N files takes O(N) time...
+     */
+
     if (dist->num_files == 0)
         dist->files = (file_t *)malloc(sizeof(file_t));
-    else
+    else if ((dist->num_files & (dist->num_files - 1)) == 0)
         dist->files =
-            (file_t *)realloc(dist->files, sizeof(file_t) * (dist->num_files + 1));
+            (file_t *)realloc(dist->files, sizeof(file_t) * 2 * dist->num_files);
 
     file = dist->files + dist->num_files;
     dist->num_files++;
@@ -759,7 +766,17 @@ read_dist(const char *filename,     /* I - Main distribution list file */
                         fprintf(stderr, "epm: Unable to include \"%s\" -\n     %s\n",
                                 temp, strerror(errno));
                         listlevel--;
-                    }
+                    } else if (fgets(buf, sizeof(buf), listfiles[listlevel]) &&
+                               !strcmp(buf, LIST_BINARY)) {
+                        /*
+                         * Binary list from mkepmlist...
+                         */
+
+                        read_binary(dist, listfiles[listlevel], temp, subpkg);
+                        fclose(listfiles[listlevel]);
+                        listlevel--;
+                    } else
+                        rewind(listfiles[listlevel]);
                 } else if (!strcmp(line, "%description"))
                     add_description(dist, listfiles[listlevel], temp, subpkg);
                 else if (!strcmp(line, "%preinstall"))
@@ -2059,6 +2076,117 @@ patmatch(const char *s,   /* I - String to match against */
     return (*s == *pat);
 }
 
+/*
+ * 'read_binary()' - Read the files in a binary list.
+ *
+ * Each file is a type character, the permissions as two bytes (MSB first),
+ * and the user, group, destination, and source strings, each followed by a
+ * nul.  Nothing is expanded or matched as a wildcard, since the strings are
+ * the actual names of the files.
+ */
+
+static int                  /* O - 0 on success, -1 on error */
+read_binary(dist_t *dist,   /* I - Distribution */
+            FILE *fp,       /* I - File to read from */
+            const char *filename, /* I - Name of file */
+            const char *subpkg) /* I - Subpackage */
+{
+    int i;                  /* Looping var */
+    char *data,             /* File data */
+        *ptr,               /* Pointer into data */
+        *end,               /* End of data */
+        *next,              /* End of current string */
+        *strings[4];        /* User, group, destination, and source */
+    size_t alloc,           /* Allocated bytes */
+        used;               /* Used bytes */
+    file_t *file;           /* Distribution file */
+
+    /*
+     * Load the whole file...
+     */
+
+    alloc = 65536;
+    used = 0;
+
+    if ((data = malloc(alloc)) == NULL) {
+        perror("epm: Out of memory reading binary list");
+        return (-1);
+    }
+
+    for (;;) {
+        used += fread(data + used, 1, alloc - used, fp);
+
+        if (used < alloc)
+            break;
+
+        alloc *= 2;
+
+        if ((ptr = realloc(data, alloc)) == NULL) {
+            perror("epm: Out of memory reading binary list");
+            free(data);
+            return (-1);
+        }
+
+        data = ptr;
+    }
+
+    /*
+     * Then add the files...
+     */
+
+    for (ptr = data, end = data + used; ptr < end;) {
+        if ((end - ptr) < 3)
+            break;
+
+        file = add_file(dist, subpkg);
+
+        file->type = ptr[0];
+        file->mode = (mode_t)(((ptr[1] & 255) << 8) | (ptr[2] & 255));
+
+        for (i = 0, ptr += 3; i < 4; i++, ptr = next + 1) {
+            if ((next = memchr(ptr, '\0', (size_t)(end - ptr))) == NULL)
+                break;
+
+            strings[i] = ptr;
+        }
+
+        if (i < 4) {
+            dist->num_files--;
+            break;
+        }
+
+        strlcpy(file->user, strings[0], sizeof(file->user));
+        strlcpy(file->group, strings[1], sizeof(file->group));
+        strlcpy(file->dst, strings[2], sizeof(file->dst));
+
+        if (tolower(file->type) == 'd' || file->type == 'R') {
+            file->src[0] = '\0';
+            strlcpy(file->options, strings[3], sizeof(file->options));
+        } else {
+            strlcpy(file->src, strings[3], sizeof(file->src));
+            file->options[0] = '\0';
+        }
+
+#ifdef __osf__ /* Remap group "sys" to "system" */
+        if (!strcmp(file->group, "sys"))
+            strlcpy(file->group, "system", sizeof(file->group));
+#elif defined(__linux) /* Remap group "sys" to "root" */
+        if (!strcmp(file->group, "sys"))
+            strlcpy(file->group, "root", sizeof(file->group));
+#endif                 /* __osf__ */
+    }
+
+    if (ptr < end) {
+        free(data);
+        fprintf(stderr, "epm: Truncated binary list file \"%s\".\n", filename);
+        return (-1);
+    }
+
+    free(data);
+
+    return (0);
+}
+
 /*
  * 'sort_subpackages()' - Compare two subpackage names.
  */
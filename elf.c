@@ -0,0 +1,782 @@
+/*
+ * ELF object functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <fcntl.h>
+
+/*
+ * ELF constants (we don't rely on <elf.h> since not every platform has it,
+ * and we need to handle both byte orders and word sizes)...
+ */
+
+#define ELF_CLASS32 1         /* 32-bit objects */
+#define ELF_CLASS64 2         /* 64-bit objects */
+#define ELF_DATA2LSB 1        /* Little-endian */
+#define ELF_DATA2MSB 2        /* Big-endian */
+#define ELF_ET_EXEC 2         /* Executable file */
+#define ELF_ET_DYN 3          /* Shared object file */
+#define ELF_SHT_SYMTAB 2      /* Symbol table */
+#define ELF_SHT_STRTAB 3      /* String table */
+#define ELF_SHT_RELA 4        /* Relocations with addends */
+#define ELF_SHT_NOTE 7        /* Notes */
+#define ELF_SHT_NOBITS 8      /* No file data */
+#define ELF_SHT_REL 9         /* Relocations */
+#define ELF_SHF_ALLOC 0x2     /* Section occupies memory */
+#define ELF_SHF_INFO_LINK 0x40 /* sh_info holds a section index */
+#define ELF_NT_GNU_BUILD_ID 3 /* GNU build ID note */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** ELF section header (native form) ****/
+{
+    unsigned name,            /* Name offset in section name table */
+        type;                 /* Section type */
+    unsigned long long flags, /* Section flags */
+        addr,                 /* Virtual address */
+        offset,               /* File offset */
+        size;                 /* Size in bytes */
+    unsigned link,            /* Link to another section */
+        info;                 /* Extra information */
+    unsigned long long align, /* Alignment */
+        entsize;              /* Entry size */
+} elf_shdr_t;
+
+typedef struct /**** ELF object file ****/
+{
+    unsigned char *data;         /* File contents */
+    size_t length;               /* Length of file */
+    int is64,                    /* 64-bit object? */
+        msb;                     /* Big-endian object? */
+    int type;                    /* Object type */
+    unsigned long long phoff,    /* Program header offset */
+        shoff;                   /* Section header offset */
+    unsigned phentsize,          /* Program header entry size */
+        phnum,                   /* Number of program headers */
+        shentsize,               /* Section header entry size */
+        shnum,                   /* Number of sections */
+        shstrndx;                /* Section name table index */
+    elf_shdr_t *shdrs;           /* Section headers */
+} elf_t;
+
+/*
+ * Local functions...
+ */
+
+static void elf_close(elf_t *elf);
+static unsigned long long elf_get(elf_t *elf, size_t offset, int bytes);
+static int elf_get_buildid(elf_t *elf, char *buildid, size_t buildidsize);
+static const char *elf_name(elf_t *elf, elf_shdr_t *shdr);
+static int elf_open(elf_t *elf, const char *filename);
+static void elf_put(elf_t *elf, unsigned char *ptr, unsigned long long value,
+                    int bytes);
+static void elf_put_shdr(elf_t *elf, unsigned char *ptr, elf_shdr_t *shdr);
+static int elf_write(const char *filename, const unsigned char *data, size_t length);
+
+/*
+ * 'elf_buildid()' - Get the GNU build ID of an ELF object as a hex string.
+ */
+
+int                             /* O - 0 on success, -1 if none */
+elf_buildid(const char *filename, /* I - ELF object file */
+            char *buildid,        /* O - Hex build ID */
+            size_t buildidsize)   /* I - Size of build ID buffer */
+{
+    elf_t elf;  /* ELF object */
+    int status; /* Return status */
+
+    *buildid = '\0';
+
+    if (elf_open(&elf, filename))
+        return (-1);
+
+    status = elf_get_buildid(&elf, buildid, buildidsize);
+
+    elf_close(&elf);
+
+    return (status);
+}
+
+/*
+ * 'elf_strip()' - Strip debugging information and symbols from an ELF object.
+ *
+ * The ".debug*", ".zdebug*", ".symtab" and associated ".strtab" sections are
+ * removed and the result is written to "dst".  If "debugfile" is not NULL,
+ * the removed sections are written to it as a separate debug information
+ * file suitable for use with the object's build ID.
+ *
+ * Returns 1 for objects that cannot be handled here (not ELF, relocatable
+ * objects, unusual section layouts, etc.) so that the caller can fall back
+ * to the strip command.
+ */
+
+int                           /* O - 0 on success, 1 if unsupported, -1 on error */
+elf_strip(const char *src,       /* I - Source object file */
+          const char *dst,       /* I - Stripped object file */
+          const char *debugfile, /* I - Debug information file or NULL */
+          char *buildid,         /* O - Hex build ID or empty string */
+          size_t buildidsize)    /* I - Size of build ID buffer */
+{
+    elf_t elf;                      /* ELF object */
+    unsigned i,                     /* Looping var */
+        newnum;                     /* Number of sections kept */
+    unsigned *map;                  /* Old to new section index */
+    char *removed;                  /* Removed sections */
+    const char *name;               /* Section name */
+    elf_shdr_t *shdr,               /* Current section */
+        newshdr;                    /* Updated section */
+    unsigned long long keep_end,    /* End of loadable data */
+        end,                        /* End of section/segment */
+        offset,                     /* Output offset */
+        shoff,                      /* Section header offset */
+        align;                      /* Section alignment */
+    unsigned char *out;             /* Output data */
+    size_t outlen;                  /* Length of output data */
+    int ehsize;                     /* ELF header size */
+    int status;                     /* Return status */
+
+    if (buildid && buildidsize > 0)
+        *buildid = '\0';
+
+    if ((status = elf_open(&elf, src)) != 0)
+        return (status);
+
+    if (elf.type != ELF_ET_EXEC && elf.type != ELF_ET_DYN) {
+        elf_close(&elf);
+        return (1);
+    }
+
+    if (buildid)
+        elf_get_buildid(&elf, buildid, buildidsize);
+
+    map = calloc(elf.shnum, sizeof(unsigned));
+    removed = calloc(elf.shnum, 1);
+
+    if (!map || !removed) {
+        free(map);
+        free(removed);
+        elf_close(&elf);
+        return (-1);
+    }
+
+    /*
+     * Figure out which sections to remove...
+     */
+
+    for (i = 1, shdr = elf.shdrs + 1; i < elf.shnum; i++, shdr++) {
+        if (shdr->flags & ELF_SHF_ALLOC)
+            continue;
+
+        name = elf_name(&elf, shdr);
+
+        if (shdr->type == ELF_SHT_SYMTAB || !strncmp(name, ".debug", 6) ||
+            !strncmp(name, ".zdebug", 7)) {
+            removed[i] = 1;
+
+            if (shdr->type == ELF_SHT_SYMTAB && shdr->link < elf.shnum &&
+                shdr->link != elf.shstrndx &&
+                elf.shdrs[shdr->link].type == ELF_SHT_STRTAB &&
+                !(elf.shdrs[shdr->link].flags & ELF_SHF_ALLOC))
+                removed[shdr->link] = 1;
+        }
+    }
+
+    /*
+     * Relocations for removed sections go with them...
+     */
+
+    for (i = 1, shdr = elf.shdrs + 1; i < elf.shnum; i++, shdr++)
+        if ((shdr->type == ELF_SHT_REL || shdr->type == ELF_SHT_RELA) &&
+            !(shdr->flags & ELF_SHF_ALLOC) &&
+            ((shdr->info < elf.shnum && removed[shdr->info]) ||
+             (shdr->link < elf.shnum && removed[shdr->link])))
+            removed[i] = 1;
+
+    /*
+     * Build the section index map; allocated sections must keep their
+     * indices since the dynamic symbol table refers to them...
+     */
+
+    for (i = 0, newnum = 0; i < elf.shnum; i++) {
+        if (removed[i])
+            continue;
+
+        if ((elf.shdrs[i].flags & ELF_SHF_ALLOC) && newnum != i)
+            break;
+
+        map[i] = newnum++;
+    }
+
+    if (i < elf.shnum || newnum == elf.shnum) {
+        /*
+         * Unusual section order or nothing to strip...
+         */
+
+        status = i < elf.shnum ? 1 : elf_write(dst, elf.data, elf.length) ? -1 : 0;
+
+        free(map);
+        free(removed);
+        elf_close(&elf);
+
+        return (status);
+    }
+
+    /*
+     * Find the end of the loadable data; everything before it is copied
+     * verbatim...
+     */
+
+    ehsize = elf.is64 ? 64 : 52;
+    keep_end = (unsigned long long)ehsize;
+
+    if (elf.phnum > 0 && (end = elf.phoff + (unsigned long long)elf.phnum * elf.phentsize) > keep_end)
+        keep_end = end;
+
+    for (i = 0; i < elf.phnum; i++) {
+        size_t ph = (size_t)(elf.phoff + (unsigned long long)i * elf.phentsize);
+        /* Offset of program header */
+        unsigned long long p_offset, /* Segment offset */
+            p_filesz;                /* Segment size in file */
+
+        if (elf.is64) {
+            p_offset = elf_get(&elf, ph + 8, 8);
+            p_filesz = elf_get(&elf, ph + 32, 8);
+        } else {
+            p_offset = elf_get(&elf, ph + 4, 4);
+            p_filesz = elf_get(&elf, ph + 16, 4);
+        }
+
+        if ((end = p_offset + p_filesz) > keep_end)
+            keep_end = end;
+    }
+
+    for (i = 1, shdr = elf.shdrs + 1; i < elf.shnum; i++, shdr++)
+        if ((shdr->flags & ELF_SHF_ALLOC) && shdr->type != ELF_SHT_NOBITS &&
+            (end = shdr->offset + shdr->size) > keep_end)
+            keep_end = end;
+
+    if (keep_end > elf.length) {
+        free(map);
+        free(removed);
+        elf_close(&elf);
+        return (1);
+    }
+
+    /*
+     * Allocate the output buffer; the stripped object is never larger than
+     * the original plus alignment padding and the new section headers...
+     */
+
+    outlen = elf.length + (size_t)elf.shnum * (elf.shentsize + 16) + 16;
+
+    if ((out = calloc(outlen, 1)) == NULL) {
+        free(map);
+        free(removed);
+        elf_close(&elf);
+        return (-1);
+    }
+
+    memcpy(out, elf.data, (size_t)keep_end);
+    offset = keep_end;
+
+    /*
+     * Append the remaining non-allocated sections that we keep...
+     */
+
+    for (i = 1, shdr = elf.shdrs + 1; i < elf.shnum; i++, shdr++) {
+        if (removed[i] || (shdr->flags & ELF_SHF_ALLOC) || shdr->type == ELF_SHT_NOBITS)
+            continue;
+
+        if (shdr->offset + shdr->size <= keep_end)
+            continue;
+
+        if ((align = shdr->align) > 1)
+            offset = (offset + align - 1) / align * align;
+
+        if (shdr->offset + shdr->size > elf.length || offset + shdr->size > outlen) {
+            free(out);
+            free(map);
+            free(removed);
+            elf_close(&elf);
+            return (1);
+        }
+
+        memcpy(out + offset, elf.data + shdr->offset, (size_t)shdr->size);
+        shdr->offset = offset;
+        offset += shdr->size;
+    }
+
+    /*
+     * Then write the new section header table...
+     */
+
+    align = elf.is64 ? 8 : 4;
+    shoff = (offset + align - 1) / align * align;
+
+    for (i = 0, shdr = elf.shdrs; i < elf.shnum; i++, shdr++) {
+        if (removed[i])
+            continue;
+
+        newshdr = *shdr;
+
+        if (newshdr.link < elf.shnum)
+            newshdr.link = removed[newshdr.link] ? 0 : map[newshdr.link];
+
+        if ((newshdr.type == ELF_SHT_REL || newshdr.type == ELF_SHT_RELA ||
+             (newshdr.flags & ELF_SHF_INFO_LINK)) &&
+            newshdr.info < elf.shnum)
+            newshdr.info = removed[newshdr.info] ? 0 : map[newshdr.info];
+
+        elf_put_shdr(&elf, out + shoff + (size_t)map[i] * elf.shentsize, &newshdr);
+    }
+
+    offset = shoff + (unsigned long long)newnum * elf.shentsize;
+
+    /*
+     * Update the ELF header...
+     */
+
+    if (elf.is64) {
+        elf_put(&elf, out + 40, shoff, 8);
+        elf_put(&elf, out + 60, newnum, 2);
+        elf_put(&elf, out + 62, map[elf.shstrndx], 2);
+    } else {
+        elf_put(&elf, out + 32, shoff, 4);
+        elf_put(&elf, out + 48, newnum, 2);
+        elf_put(&elf, out + 50, map[elf.shstrndx], 2);
+    }
+
+    status = elf_write(dst, out, (size_t)offset) ? -1 : 0;
+
+    /*
+     * Write the debug information file, which has the same section headers
+     * as the original object, with the removed sections (plus notes and
+     * section names) carrying data and everything else marked "no bits"...
+     */
+
+    if (!status && debugfile) {
+        memset(out, 0, outlen);
+        memcpy(out, elf.data, (size_t)ehsize);
+        offset = (unsigned long long)ehsize;
+
+        for (i = 1, shdr = elf.shdrs + 1; i < elf.shnum; i++, shdr++) {
+            /*
+             * Section offsets for kept sections were updated above, so
+             * re-read the original header...
+             */
+
+            size_t sh = (size_t)(elf.shoff + (unsigned long long)i * elf.shentsize);
+            /* Offset of section header */
+
+            shdr->offset = elf.is64 ? elf_get(&elf, sh + 24, 8) : elf_get(&elf, sh + 16, 4);
+
+            if ((removed[i] || shdr->type == ELF_SHT_NOTE || i == elf.shstrndx) &&
+                shdr->type != ELF_SHT_NOBITS) {
+                if ((align = shdr->align) > 1)
+                    offset = (offset + align - 1) / align * align;
+
+                if (offset + shdr->size > outlen) {
+                    status = 1;
+                    break;
+                }
+
+                memcpy(out + offset, elf.data + shdr->offset, (size_t)shdr->size);
+                shdr->offset = offset;
+                offset += shdr->size;
+            } else if (shdr->type != ELF_SHT_NOBITS) {
+                shdr->type = ELF_SHT_NOBITS;
+                shdr->offset = offset;
+            }
+        }
+
+        align = elf.is64 ? 8 : 4;
+        shoff = (offset + align - 1) / align * align;
+        offset = shoff + (unsigned long long)elf.shnum * elf.shentsize;
+
+        if (!status && offset > outlen)
+            status = 1;
+
+        if (!status) {
+            for (i = 0, shdr = elf.shdrs; i < elf.shnum; i++, shdr++)
+                elf_put_shdr(&elf, out + shoff + (size_t)i * elf.shentsize, shdr);
+
+            if (elf.is64) {
+                elf_put(&elf, out + 32, 0, 8); /* e_phoff */
+                elf_put(&elf, out + 40, shoff, 8);
+                elf_put(&elf, out + 56, 0, 2); /* e_phnum */
+            } else {
+                elf_put(&elf, out + 28, 0, 4); /* e_phoff */
+                elf_put(&elf, out + 32, shoff, 4);
+                elf_put(&elf, out + 44, 0, 2); /* e_phnum */
+            }
+
+            status = elf_write(debugfile, out, (size_t)offset) ? -1 : 0;
+        }
+    }
+
+    free(out);
+    free(map);
+    free(removed);
+    elf_close(&elf);
+
+    return (status);
+}
+
+/*
+ * 'elf_close()' - Free memory used by an ELF object.
+ */
+
+static void        /* O - Nothing */
+elf_close(elf_t *elf) /* I - ELF object */
+{
+    free(elf->data);
+    free(elf->shdrs);
+}
+
+/*
+ * 'elf_get()' - Get a value from an ELF object.
+ */
+
+static unsigned long long /* O - Value */
+elf_get(elf_t *elf,       /* I - ELF object */
+        size_t offset,    /* I - Offset in file */
+        int bytes)        /* I - Size of value */
+{
+    unsigned long long value; /* Value */
+    const unsigned char *ptr; /* Pointer to value */
+    int i;                    /* Looping var */
+
+    if (offset + (size_t)bytes > elf->length)
+        return (0);
+
+    ptr = elf->data + offset;
+
+    for (i = 0, value = 0; i < bytes; i++)
+        if (elf->msb)
+            value = (value << 8) | ptr[i];
+        else
+            value |= (unsigned long long)ptr[i] << (8 * i);
+
+    return (value);
+}
+
+/*
+ * 'elf_get_buildid()' - Find the GNU build ID note.
+ */
+
+static int                       /* O - 0 on success, -1 if none */
+elf_get_buildid(elf_t *elf,      /* I - ELF object */
+                char *buildid,   /* O - Hex build ID */
+                size_t buildidsize) /* I - Size of build ID buffer */
+{
+    unsigned i;                       /* Looping var */
+    elf_shdr_t *shdr;                 /* Current section */
+    size_t ptr,                       /* Offset of current note */
+        end;                          /* End of notes */
+    unsigned namesz,                  /* Name size */
+        descsz,                       /* Descriptor size */
+        type;                         /* Note type */
+    static const char *hexdigits = "0123456789abcdef";
+    /* Hex digits */
+
+    for (i = 1, shdr = elf->shdrs + 1; i < elf->shnum; i++, shdr++) {
+        if (shdr->type != ELF_SHT_NOTE || shdr->offset + shdr->size > elf->length)
+            continue;
+
+        for (ptr = (size_t)shdr->offset, end = ptr + (size_t)shdr->size; ptr + 12 <= end;) {
+            namesz = (unsigned)elf_get(elf, ptr, 4);
+            descsz = (unsigned)elf_get(elf, ptr + 4, 4);
+            type = (unsigned)elf_get(elf, ptr + 8, 4);
+            ptr += 12;
+
+            if (type == ELF_NT_GNU_BUILD_ID && namesz == 4 && ptr + 4 + descsz <= end &&
+                !memcmp(elf->data + ptr, "GNU", 4) && descsz > 0 &&
+                (size_t)descsz * 2 < buildidsize) {
+                unsigned j; /* Looping var */
+
+                for (j = 0, ptr += 4; j < descsz; j++, ptr++) {
+                    buildid[2 * j] = hexdigits[elf->data[ptr] >> 4];
+                    buildid[2 * j + 1] = hexdigits[elf->data[ptr] & 15];
+                }
+
+                buildid[2 * descsz] = '\0';
+                return (0);
+            }
+
+            ptr += ((namesz + 3) & ~3U) + ((descsz + 3) & ~3U);
+        }
+    }
+
+    return (-1);
+}
+
+/*
+ * 'elf_name()' - Get the name of a section.
+ */
+
+static const char *   /* O - Section name */
+elf_name(elf_t *elf,       /* I - ELF object */
+         elf_shdr_t *shdr) /* I - Section header */
+{
+    elf_shdr_t *names; /* Section name table */
+
+    names = elf->shdrs + elf->shstrndx;
+
+    if (shdr->name >= names->size || names->offset + names->size > elf->length ||
+        elf->data[names->offset + names->size - 1])
+        return ("");
+
+    return ((const char *)elf->data + names->offset + shdr->name);
+}
+
+/*
+ * 'elf_open()' - Load an ELF object.
+ */
+
+static int                   /* O - 0 on success, 1 if unsupported, -1 on error */
+elf_open(elf_t *elf,          /* I - ELF object */
+         const char *filename) /* I - File to load */
+{
+    int fd;               /* File descriptor */
+    struct stat fileinfo; /* File information */
+    ssize_t bytes;        /* Bytes read */
+    size_t total;         /* Total bytes read */
+    unsigned i;           /* Looping var */
+    size_t sh;            /* Offset of section header */
+    elf_shdr_t *shdr;     /* Current section header */
+
+    memset(elf, 0, sizeof(elf_t));
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return (-1);
+
+    if (fstat(fd, &fileinfo) || fileinfo.st_size < 64 ||
+        (elf->data = malloc((size_t)fileinfo.st_size)) == NULL) {
+        close(fd);
+        return (fileinfo.st_size < 64 ? 1 : -1);
+    }
+
+    for (total = 0; total < (size_t)fileinfo.st_size; total += (size_t)bytes)
+        if ((bytes = read(fd, elf->data + total, (size_t)fileinfo.st_size - total)) <= 0) {
+            if (bytes < 0 && errno == EINTR) {
+                bytes = 0;
+                continue;
+            }
+
+            close(fd);
+            elf_close(elf);
+            return (-1);
+        }
+
+    close(fd);
+
+    elf->length = total;
+
+    /*
+     * Validate the ELF header...
+     */
+
+    if (memcmp(elf->data, "\177ELF", 4) ||
+        (elf->data[4] != ELF_CLASS32 && elf->data[4] != ELF_CLASS64) ||
+        (elf->data[5] != ELF_DATA2LSB && elf->data[5] != ELF_DATA2MSB)) {
+        elf_close(elf);
+        return (1);
+    }
+
+    elf->is64 = elf->data[4] == ELF_CLASS64;
+    elf->msb = elf->data[5] == ELF_DATA2MSB;
+    elf->type = (int)elf_get(elf, 16, 2);
+
+    if (elf->is64) {
+        elf->phoff = elf_get(elf, 32, 8);
+        elf->shoff = elf_get(elf, 40, 8);
+        elf->phentsize = (unsigned)elf_get(elf, 54, 2);
+        elf->phnum = (unsigned)elf_get(elf, 56, 2);
+        elf->shentsize = (unsigned)elf_get(elf, 58, 2);
+        elf->shnum = (unsigned)elf_get(elf, 60, 2);
+        elf->shstrndx = (unsigned)elf_get(elf, 62, 2);
+    } else {
+        elf->phoff = elf_get(elf, 28, 4);
+        elf->shoff = elf_get(elf, 32, 4);
+        elf->phentsize = (unsigned)elf_get(elf, 42, 2);
+        elf->phnum = (unsigned)elf_get(elf, 44, 2);
+        elf->shentsize = (unsigned)elf_get(elf, 46, 2);
+        elf->shnum = (unsigned)elf_get(elf, 48, 2);
+        elf->shstrndx = (unsigned)elf_get(elf, 50, 2);
+    }
+
+    /*
+     * Extended section numbering (shnum == 0 or shstrndx == SHN_XINDEX) is
+     * left to the strip command...
+     */
+
+    if (elf->shnum == 0 || elf->shstrndx == 0 || elf->shstrndx >= elf->shnum ||
+        elf->shentsize != (elf->is64 ? 64U : 40U) ||
+        elf->shoff + (unsigned long long)elf->shnum * elf->shentsize > elf->length ||
+        (elf->phnum > 0 && (elf->phentsize != (elf->is64 ? 56U : 32U) ||
+                            elf->phoff + (unsigned long long)elf->phnum *
+                                             elf->phentsize >
+                                elf->length))) {
+        elf_close(elf);
+        return (1);
+    }
+
+    /*
+     * Load the section headers...
+     */
+
+    if ((elf->shdrs = calloc(elf->shnum, sizeof(elf_shdr_t))) == NULL) {
+        elf_close(elf);
+        return (-1);
+    }
+
+    for (i = 0, shdr = elf->shdrs; i < elf->shnum; i++, shdr++) {
+        sh = (size_t)(elf->shoff + (unsigned long long)i * elf->shentsize);
+
+        shdr->name = (unsigned)elf_get(elf, sh, 4);
+        shdr->type = (unsigned)elf_get(elf, sh + 4, 4);
+
+        if (elf->is64) {
+            shdr->flags = elf_get(elf, sh + 8, 8);
+            shdr->addr = elf_get(elf, sh + 16, 8);
+            shdr->offset = elf_get(elf, sh + 24, 8);
+            shdr->size = elf_get(elf, sh + 32, 8);
+            shdr->link = (unsigned)elf_get(elf, sh + 40, 4);
+            shdr->info = (unsigned)elf_get(elf, sh + 44, 4);
+            shdr->align = elf_get(elf, sh + 48, 8);
+            shdr->entsize = elf_get(elf, sh + 56, 8);
+        } else {
+            shdr->flags = elf_get(elf, sh + 8, 4);
+            shdr->addr = elf_get(elf, sh + 12, 4);
+            shdr->offset = elf_get(elf, sh + 16, 4);
+            shdr->size = elf_get(elf, sh + 20, 4);
+            shdr->link = (unsigned)elf_get(elf, sh + 24, 4);
+            shdr->info = (unsigned)elf_get(elf, sh + 28, 4);
+            shdr->align = elf_get(elf, sh + 32, 4);
+            shdr->entsize = elf_get(elf, sh + 36, 4);
+        }
+
+        if (shdr->type != ELF_SHT_NOBITS && i > 0 &&
+            shdr->offset + shdr->size > elf->length) {
+            elf_close(elf);
+            return (1);
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * 'elf_put()' - Store a value in an ELF object.
+ */
+
+static void                    /* O - Nothing */
+elf_put(elf_t *elf,            /* I - ELF object */
+        unsigned char *ptr,    /* I - Pointer to value */
+        unsigned long long value, /* I - Value */
+        int bytes)             /* I - Size of value */
+{
+    int i; /* Looping var */
+
+    for (i = 0; i < bytes; i++)
+        if (elf->msb)
+            ptr[bytes - i - 1] = (unsigned char)(value >> (8 * i));
+        else
+            ptr[i] = (unsigned char)(value >> (8 * i));
+}
+
+/*
+ * 'elf_put_shdr()' - Store a section header in an ELF object.
+ */
+
+static void                /* O - Nothing */
+elf_put_shdr(elf_t *elf,         /* I - ELF object */
+             unsigned char *ptr, /* I - Pointer to section header */
+             elf_shdr_t *shdr)   /* I - Section header */
+{
+    elf_put(elf, ptr, shdr->name, 4);
+    elf_put(elf, ptr + 4, shdr->type, 4);
+
+    if (elf->is64) {
+        elf_put(elf, ptr + 8, shdr->flags, 8);
+        elf_put(elf, ptr + 16, shdr->addr, 8);
+        elf_put(elf, ptr + 24, shdr->offset, 8);
+        elf_put(elf, ptr + 32, shdr->size, 8);
+        elf_put(elf, ptr + 40, shdr->link, 4);
+        elf_put(elf, ptr + 44, shdr->info, 4);
+        elf_put(elf, ptr + 48, shdr->align, 8);
+        elf_put(elf, ptr + 56, shdr->entsize, 8);
+    } else {
+        elf_put(elf, ptr + 8, shdr->flags, 4);
+        elf_put(elf, ptr + 12, shdr->addr, 4);
+        elf_put(elf, ptr + 16, shdr->offset, 4);
+        elf_put(elf, ptr + 20, shdr->size, 4);
+        elf_put(elf, ptr + 24, shdr->link, 4);
+        elf_put(elf, ptr + 28, shdr->info, 4);
+        elf_put(elf, ptr + 32, shdr->align, 4);
+        elf_put(elf, ptr + 36, shdr->entsize, 4);
+    }
+}
+
+/*
+ * 'elf_write()' - Write a buffer to a new file.
+ */
+
+static int                     /* O - 0 on success, -1 on error */
+elf_write(const char *filename,   /* I - File to create */
+          const unsigned char *data, /* I - Data */
+          size_t length)         /* I - Length of data */
+{
+    int fd;        /* File descriptor */
+    ssize_t bytes; /* Bytes written */
+
+    if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0755)) < 0) {
+        fprintf(stderr, "epm: Unable to create \"%s\" -\n     %s\n", filename,
+                strerror(errno));
+        return (-1);
+    }
+
+    while (length > 0) {
+        if ((bytes = write(fd, data, length)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "epm: Unable to write to \"%s\" -\n     %s\n", filename,
+                    strerror(errno));
+            close(fd);
+            unlink(filename);
+            return (-1);
+        }
+
+        data += bytes;
+        length -= (size_t)bytes;
+    }
+
+    if (close(fd)) {
+        unlink(filename);
+        return (-1);
+    }
+
+    return (0);
+}
@@ -28,9 +28,17 @@
  * Globals...
  */
 
+const char *BuildOptions = "";
+const char *CacheDir = NULL;
+int CacheSize = -1;
 int CompressFiles = EPM_COMPRESS;
 const char *DataDir = EPM_DATADIR;
+int DeltaPatch = 0;
+int ForceBuild = 0;
+const char *HelperProgram = EPM_LIBDIR "/epmhelper";
 int KeepFiles = 0;
+int MaxJobs = 0;
+const char *PatchFrom = NULL;
 const char *SetupProgram = EPM_LIBDIR "/setup";
 const char *SoftwareDir = EPM_SOFTWARE;
 const char *UninstProgram = EPM_LIBDIR "/uninst";
@@ -55,6 +63,7 @@ main(int argc,     /* I - Number of command-line args */
 {
     int i;                   /* Looping var */
     int strip;               /* 1 if we should strip executables */
+    int debuginfo;           /* 1 if we should package debug information */
     struct utsname platform; /* UNIX name info */
     char *namefmt,           /* Name format to use */
         *custom_name,        /* User-supplied system name */
@@ -62,12 +71,19 @@ main(int argc,     /* I - Number of command-line args */
         prodname[256],       /* Product name */
         listname[256],       /* List file name */
         directory[255],      /* Name of install directory */
+        cachedir[1024],      /* Default cache directory */
         *temp,               /* Temporary string pointer */
         *setup,              /* Setup GUI image */
         *types;              /* Setup GUI install types */
     dist_t *dist;            /* Software distribution */
+    manifest_t *manifest;    /* Build manifest */
+    char manifestname[1024], /* Build manifest file */
+        options[4096];       /* Options that affect the packages */
     int format;              /* Distribution format */
     int show_depend;         /* Show dependencies */
+    int show_cache_stats;    /* Show package cache statistics */
+    cache_t *cache;          /* Package cache lookup */
+    char key[SHA256_HEX_SIZE]; /* Package cache key */
     static char *formats[] = /* Distribution format strings */
         {"portable", "aix", "bsd", "deb", "inst",  "rpm",       "rpm",      "macos",
          "macos",    "pkg", "rpm", "rpm", "setld", "slackware", "swinstall"};
@@ -88,6 +104,7 @@ main(int argc,     /* I - Number of command-line args */
     }
 
     strip = 1;
+    debuginfo = 0;
     format = PACKAGE_PORTABLE;
     setup = NULL;
     types = NULL;
@@ -97,6 +114,7 @@ main(int argc,     /* I - Number of command-line args */
     listname[0] = '\0';
     directory[0] = '\0';
     show_depend = 0;
+    show_cache_stats = 0;
 
     for (i = 1; i < argc; i++)
         if (argv[i][0] == '-') {
@@ -204,6 +222,27 @@ main(int argc,     /* I - Number of command-line args */
                 strip = 0;
                 break;
 
+            case 'j': /* Maximum concurrent jobs */
+                if (argv[i][2])
+                    temp = argv[i] + 2;
+                else {
+                    i++;
+                    if (i >= argc) {
+                        puts("epm: Expected number of jobs.");
+                        usage();
+                    }
+
+                    temp = argv[i];
+                }
+
+                if ((MaxJobs = atoi(temp)) < 1) {
+                    puts("epm: Number of jobs must be 1 or more.");
+                    usage();
+                }
+
+                run_jobs(MaxJobs);
+                break;
+
             case 'k': /* Keep intermediate files */
                 KeepFiles = 1;
                 break;
@@ -258,7 +297,25 @@ main(int argc,     /* I - Number of command-line args */
                 break;
 
             case '-': /* --option */
-                if (!strcmp(argv[i], "--data-dir")) {
+                if (!strcmp(argv[i], "--cache-dir")) {
+                    i++;
+                    if (i < argc)
+                        CacheDir = argv[i];
+                    else {
+                        puts("epm: Expected cache directory.");
+                        usage();
+                    }
+                } else if (!strcmp(argv[i], "--cache-size")) {
+                    i++;
+                    if (i < argc)
+                        CacheSize = atoi(argv[i]);
+                    else {
+                        puts("epm: Expected cache size in megabytes.");
+                        usage();
+                    }
+                } else if (!strcmp(argv[i], "--cache-stats"))
+                    show_cache_stats = 1;
+                else if (!strcmp(argv[i], "--data-dir")) {
                     i++;
                     if (i < argc)
                         DataDir = argv[i];
@@ -266,9 +323,23 @@ main(int argc,     /* I - Number of command-line args */
                         puts("epm: Expected data directory.");
                         usage();
                     }
-                } else if (!strcmp(argv[i], "--depend"))
+                } else if (!strcmp(argv[i], "--debuginfo"))
+                    debuginfo = 1;
+                else if (!strcmp(argv[i], "--delta"))
+                    DeltaPatch = 1;
+                else if (!strcmp(argv[i], "--depend"))
                     show_depend = 1;
-                else if (!strcmp(argv[i], "--keep-files"))
+                else if (!strcmp(argv[i], "--force"))
+                    ForceBuild = 1;
+                else if (!strcmp(argv[i], "--helper-program")) {
+                    i++;
+                    if (i < argc)
+                        HelperProgram = argv[i];
+                    else {
+                        puts("epm: Expected helper program.");
+                        usage();
+                    }
+                } else if (!strcmp(argv[i], "--keep-files"))
                     KeepFiles = 1;
                 else if (!strcmp(argv[i], "--aoo-mode"))
                     AooMode = 1;
@@ -280,6 +351,14 @@ main(int argc,     /* I - Number of command-line args */
                         puts("epm: Expected output directory.");
                         usage();
                     }
+                } else if (!strcmp(argv[i], "--patch-from")) {
+                    i++;
+                    if (i < argc)
+                        PatchFrom = argv[i];
+                    else {
+                        puts("epm: Expected previous release.");
+                        usage();
+                    }
                 } else if (!strcmp(argv[i], "--setup-image")) {
                     i++;
                     if (i < argc)
@@ -345,11 +424,34 @@ main(int argc,     /* I - Number of command-line args */
             usage();
         }
 
+    /*
+     * Collect the options that affect the packages for the build manifest;
+     * the verbosity, number of jobs, output and cache directories, and
+     * --force don't...
+     */
+
+    options[0] = '\0';
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--cache-dir") ||
+            !strcmp(argv[i], "--cache-size") || !strcmp(argv[i], "--output-dir"))
+            i++;
+        else if (strncmp(argv[i], "-j", 2) && strncmp(argv[i], "-v", 2) &&
+                 strcmp(argv[i], "--cache-stats") && strcmp(argv[i], "--force")) {
+            if (options[0])
+                strlcat(options, " ", sizeof(options));
+
+            strlcat(options, argv[i], sizeof(options));
+        }
+    }
+
+    BuildOptions = options;
+
     /*
      * Check for product name and list file...
      */
 
-    if (!prodname[0]) {
+    if (!prodname[0] && !show_cache_stats) {
         puts("epm: No product name specified!");
         usage();
     }
@@ -379,6 +481,38 @@ main(int argc,     /* I - Number of command-line args */
                      platform.release, platform.machine);
     }
 
+    /*
+     * The package cache key needs the digest of every file, so only use the
+     * package cache when a cache directory or size is given...
+     */
+
+    if (CacheSize < 0)
+        CacheSize = (CacheDir || show_cache_stats) ? 1024 : 0;
+
+    /*
+     * Use the per-user cache directory unless told otherwise...
+     */
+
+    if (!CacheDir) {
+        if ((temp = getenv("XDG_CACHE_HOME")) != NULL && temp[0])
+            snprintf(cachedir, sizeof(cachedir), "%s/epm", temp);
+        else if ((temp = getenv("HOME")) != NULL && temp[0])
+            snprintf(cachedir, sizeof(cachedir), "%s/.cache/epm", temp);
+        else
+            snprintf(cachedir, sizeof(cachedir), "%s/.cache", directory);
+
+        CacheDir = cachedir;
+    }
+
+    /*
+     * Show the package cache statistics?
+     */
+
+    if (show_cache_stats) {
+        cache_stats();
+        return (0);
+    }
+
     platname[0] = '\0';
 
     if (custom_name)
@@ -450,6 +584,84 @@ main(int argc,     /* I - Number of command-line args */
         return (0);
     }
 
+    /*
+     * Patch files are only selected automatically for portable
+     * distributions...
+     */
+
+    if (PatchFrom && format != PACKAGE_PORTABLE) {
+        puts("epm: The --patch-from option is only supported for portable "
+             "distributions.");
+        free_dist(dist);
+
+        return (1);
+    }
+
+    /*
+     * Skip the build if the packages are up to date...
+     */
+
+    make_directory(directory, 0, getuid(), getgid());
+
+    snprintf(manifestname, sizeof(manifestname), "%s/%s.%s.manifest", directory,
+             prodname, formats[format]);
+
+    if ((manifest = manifest_new(formats[format], platname, 0)) != NULL) {
+        manifest_add_dist(manifest, dist, NULL);
+
+        for (i = 0; i < dist->num_subpackages; i++)
+            manifest_add_dist(manifest, dist, dist->subpackages[i]);
+
+        if (!ForceBuild && manifest_check(manifest, manifestname)) {
+            if (Verbosity)
+                puts("Packages are up to date.");
+
+            manifest_delete(manifest);
+            free_dist(dist);
+
+            return (0);
+        }
+    }
+
+    /*
+     * Then look for the same packages in the package cache; the cache key
+     * is based on the file contents so it is the same in any directory...
+     */
+
+    cache = NULL;
+
+    if (CacheSize > 0 && !KeepFiles) {
+        manifest_t *contents; /* Content manifest for the cache key */
+
+        digest_files(dist);
+
+        if ((contents = manifest_new(formats[format], platname, 1)) != NULL) {
+            manifest_add_dist(contents, dist, NULL);
+
+            for (i = 0; i < dist->num_subpackages; i++)
+                manifest_add_dist(contents, dist, dist->subpackages[i]);
+
+            manifest_digest(contents, key, sizeof(key));
+            manifest_delete(contents);
+
+            cache = cache_new(directory, prodname, dist, key);
+        }
+
+        if (cache && !ForceBuild && cache_fetch(cache)) {
+            if (manifest && !manifest_add_outputs(manifest, directory, prodname, dist))
+                manifest_write(manifest, manifestname);
+
+            manifest_delete(manifest);
+            cache_delete(cache);
+            free_dist(dist);
+
+            if (Verbosity)
+                puts("Done!");
+
+            return (0);
+        }
+    }
+
     /*
      * Strip executables as needed...
      */
@@ -458,14 +670,46 @@ main(int argc,     /* I - Number of command-line args */
         if (Verbosity)
             puts("Stripping executables in distribution...");
 
-        strip_execs(dist);
+        /*
+         * Debug subpackages are named "debuginfo" for RPM and "dbg" for
+         * everything else...
+         */
+
+        if (debuginfo)
+            strip_execs(dist, strcmp(formats[format], "rpm") ? "dbg" : "debuginfo");
+        else
+            strip_execs(dist, NULL);
     }
 
     /*
-     * Make build directory...
+     * Compute the digests for the portable file lists, then select the patch
+     * files by comparing with the previous release...
      */
 
-    make_directory(directory, 0, getuid(), getgid());
+    if (DeltaPatch && !PatchFrom) {
+        puts("epm: The --delta option requires --patch-from.");
+        DeltaPatch = 0;
+    } else if (DeltaPatch && access(HelperProgram, X_OK)) {
+        puts("epm: Helper program not installed, creating patch without deltas.");
+        DeltaPatch = 0;
+    }
+
+    if ((format == PACKAGE_PORTABLE && digest_files(dist)) ||
+        (PatchFrom && filelist_patch(dist, prodname, PatchFrom, directory))) {
+        if (cache)
+            cache_delete(cache);
+
+        if (manifest) {
+            unlink(manifestname);
+            manifest_delete(manifest);
+        }
+
+        free_dist(dist);
+
+        puts("Packaging failed!");
+
+        return (1);
+    }
 
     /*
      * Make the distribution in the correct format...
@@ -532,6 +776,30 @@ main(int argc,     /* I - Number of command-line args */
         break;
     }
 
+    /*
+     * Save the new packages in the package cache...
+     */
+
+    if (cache) {
+        if (!i)
+            cache_store(cache);
+
+        cache_delete(cache);
+    }
+
+    /*
+     * Record what the packages were built from...
+     */
+
+    if (manifest) {
+        if (!i && !manifest_add_outputs(manifest, directory, prodname, dist))
+            manifest_write(manifest, manifestname);
+        else
+            unlink(manifestname);
+
+        manifest_delete(manifest);
+    }
+
     /*
      * All done!
      */
@@ -603,6 +871,8 @@ static void usage(void) {
          "{aix,bsd,deb,depot,inst,macos,macos-signed,native,pkg,portable,rpm,rpm-signed,"
          "setld,slackware,swinstall,tardist}");
     puts("    Set distribution format.");
+    puts("-j jobs");
+    puts("    Run up to the given number of build steps at the same time.");
     puts("-k");
     puts("    Keep intermediate files (spec files, etc.)");
     puts("-m name");
@@ -627,10 +897,25 @@ static void usage(void) {
 #else
     puts("    Compress files in packages.");
 #endif /* EPM_COMPRESS == 1 */
+    puts("--cache-dir /foo/bar/directory");
+    puts("    Use the named build cache directory instead of ~/.cache/epm.");
+    puts("--cache-size megabytes");
+    puts("    Enable the package cache and limit it to the given size; 0 disables it.");
+    puts("--cache-stats");
+    puts("    Show the package cache statistics.");
     puts("--data-dir /foo/bar/directory");
     puts("    Use the named setup data file directory instead of " EPM_DATADIR ".");
+    puts("--debuginfo");
+    puts("    Put debugging information from stripped executables in a separate");
+    puts("    \"dbg\" or \"debuginfo\" subpackage.");
+    puts("--delta");
+    puts("    Use binary deltas for changed files in patch distributions.");
+    puts("--force");
+    puts("    Build the packages even if they are up to date.");
     puts("--help");
     puts("    Show this usage message.");
+    puts("--helper-program /foo/bar/epmhelper");
+    puts("    Use the named helper program instead of " EPM_LIBDIR "/epmhelper.");
     puts("--keep-files");
     puts("    Keep temporary distribution files in the output directory.");
     puts("--aoo-mode");
@@ -638,6 +923,9 @@ static void usage(void) {
          "use.");
     puts("--output-dir /foo/bar/directory");
     puts("    Enable the setup GUI and use \"setup.xpm\" for the setup image.");
+    puts("--patch-from previous-release");
+    puts("    Make a patch distribution with the files that changed since the");
+    puts("    previous portable distribution or file list.");
     puts("--setup-image setup.xpm");
     puts("    Enable the setup GUI and use \"setup.xpm\" for the setup image.");
     puts("--setup-program /foo/bar/setup");
@@ -134,6 +134,37 @@ enum {
     DEPEND_PROVIDES  /* This product provides */
 };
 
+/*
+ * SHA-256 digest sizes...
+ */
+
+#define SHA256_BLOCK 64    /* Number of bytes in a block */
+#define SHA256_SIZE 32     /* Number of bytes in a digest */
+#define SHA256_HEX_SIZE 65 /* Number of bytes in a hex digest string */
+
+/*
+ * Binary list files...
+ */
+
+#define LIST_BINARY "#%epm binary list 1\n" /* First line of a binary list */
+
+/*
+ * Installed product index files in the software directory...
+ */
+
+#define SOFTWARE_INDEX "products.index" /* Index of installed products */
+#define SOFTWARE_RPMCACHE "rpm.cache"   /* Cached RPM database query */
+
+/*
+ * Directory filter results...
+ */
+
+enum {
+    WALK_KEEP,  /* Keep the entry */
+    WALK_PRUNE, /* Keep the entry but don't read the subdirectory */
+    WALK_SKIP   /* Skip the entry */
+};
+
 /*
  * Structures...
  */
@@ -163,11 +194,20 @@ typedef union /**** TAR record format ****/
 
 typedef struct /**** TAR file ****/
 {
-    FILE *file;     /* File to write to */
-    int blocks,     /* Number of blocks written */
-        compressed; /* Compressed output? */
+    FILE *file;          /* File to write to */
+    int blocks,          /* Number of blocks written */
+        compressed;      /* Compressed output? */
+    char pathname[1024]; /* Last pathname written */
 } tarf_t;
 
+typedef struct /**** SHA-256 digest context ****/
+{
+    unsigned state[8];                  /* Hash state */
+    unsigned long long length;          /* Total bytes added */
+    size_t used;                        /* Bytes used in buffer */
+    unsigned char buffer[SHA256_BLOCK]; /* Partial block */
+} sha256_t;
+
 typedef struct /**** File to install ****/
 {
     int type;               /* Type of file */
@@ -227,13 +267,78 @@ typedef struct /**** Distribution Structure ****/
     file_t *files;               /* Files */
 } dist_t;
 
+typedef struct /**** Package header information ****/
+{
+    int type;               /* Package type */
+    char product[64];       /* Product name */
+    char name[256];         /* Product long name */
+    char version[32];       /* Product version string */
+    int vernumber;          /* Product version number */
+    int rootsize,           /* Size of root files in kbytes */
+        usrsize;            /* Size of /usr files in kbytes */
+    int num_depends;        /* Number of dependencies */
+    depend_t *depends;      /* Dependencies */
+} pkginfo_t;
+
+typedef struct cache_s cache_t;       /**** Package cache lookup ****/
+
+typedef struct manifest_s manifest_t; /**** Build manifest ****/
+
+typedef struct run_job_s run_job_t; /**** Running external program ****/
+
+typedef struct task_s task_t;       /**** Build task ****/
+typedef struct tasks_s tasks_t;     /**** Build task graph ****/
+typedef int (*task_cb_t)(void *data); /**** Build task function ****/
+
+typedef struct walk_dir_s walk_dir_t; /**** Directory in a tree ****/
+typedef int (*walk_cb_t)(walk_dir_t *dir, void *data); /**** Directory callback ****/
+typedef int (*walk_filter_t)(walk_dir_t *dir, const char *name,
+                             void *data); /**** Directory entry filter ****/
+
+typedef struct /**** Directory entry ****/
+{
+    char *name;               /* Filename */
+    int error;                /* errno value or 0 */
+    mode_t mode;              /* Type and permissions */
+    uid_t uid;                /* Owner */
+    gid_t gid;                /* Group */
+    long long size,           /* Size */
+        mtime,                /* Modification time */
+        ctime;                /* Change time */
+    unsigned long long inode; /* Inode number */
+    char *link;               /* Symbolic link text or NULL */
+    char *text;               /* Text saved by the callback or NULL */
+    int prune;                /* 1 = don't read the subdirectory */
+    walk_dir_t *dir;          /* Subdirectory contents or NULL */
+} walk_entry_t;
+
+struct walk_dir_s /**** Directory in a tree ****/
+{
+    char *path;               /* Path of directory */
+    int error;                /* errno value or 0 */
+    long long mtime,          /* Modification time */
+        ctime;                /* Change time */
+    unsigned long long inode; /* Inode number */
+    int num_entries,          /* Number of entries */
+        alloc_entries;        /* Allocated entries */
+    walk_entry_t *entries;    /* Entries, sorted by name */
+};
+
 /*
  * Globals...
  */
 
+extern const char *BuildOptions;  /* Options that affect the packages */
+extern const char *CacheDir;      /* Build cache directory */
+extern int CacheSize;             /* Maximum size of package cache in MB, 0 = off */
 extern int CompressFiles;         /* Compress package files? */
 extern const char *DataDir;       /* Directory for setup data files */
+extern int DeltaPatch;            /* Use deltas in patch distributions? */
+extern int ForceBuild;            /* Build even if up to date? */
+extern const char *HelperProgram; /* Installation helper program */
 extern int KeepFiles;             /* Keep intermediate files? */
+extern int MaxJobs;               /* Maximum concurrent build jobs */
+extern const char *PatchFrom;     /* Previous release for patch files */
 extern const char *SetupProgram;  /* Setup program */
 extern const char *SoftwareDir;   /* Software directory path */
 extern const char *UninstProgram; /* Uninstall program */
@@ -251,11 +356,31 @@ extern void add_description(dist_t *dist, FILE *fp, const char *description,
                             const char *subpkg);
 extern file_t *add_file(dist_t *dist, const char *subpkg);
 extern char *add_subpackage(dist_t *dist, const char *subpkg);
+extern void cache_delete(cache_t *cache);
+extern int cache_fetch(cache_t *cache);
+extern cache_t *cache_new(const char *directory, const char *prodname, dist_t *dist,
+                          const char *key);
+extern void cache_stats(void);
+extern int cache_store(cache_t *cache);
+extern void cache_strip_evict(time_t used);
 extern int copy_file(const char *dst, const char *src, mode_t mode, uid_t owner,
                      gid_t group);
+extern int delta_apply(const char *oldfile, const char *deltafile, const char *newfile,
+                       mode_t mode);
+extern int delta_create(const char *oldfile, const char *newfile, const char *deltafile);
+extern int digest_file(const char *filename, char *hex, size_t hexsize);
+extern int digest_files(dist_t *dist);
+extern void digest_save(void);
+extern int elf_buildid(const char *filename, char *buildid, size_t buildidsize);
+extern int elf_strip(const char *src, const char *dst, const char *debugfile,
+                     char *buildid, size_t buildidsize);
+extern int filelist_patch(dist_t *dist, const char *prodname, const char *filename,
+                          const char *directory);
+extern int filelist_write(dist_t *dist, const char *subpackage, const char *filename);
 extern char *find_subpackage(dist_t *dist, const char *subpkg);
 extern void free_dist(dist_t *dist);
 extern const char *get_option(file_t *file, const char *name, const char *defval);
+extern void get_owner(const char *user, const char *group, uid_t *uid, gid_t *gid);
 extern void get_platform(struct utsname *platform);
 extern const char *get_runlevels(file_t *file, const char *deflevels);
 extern int get_start(file_t *file, int defstart);
@@ -288,7 +413,20 @@ extern int make_slackware(const char *prodname, const char *directory,
                           const char *platname, dist_t *dist, struct utsname *platform);
 extern int make_swinstall(const char *prodname, const char *directory,
                           const char *platname, dist_t *dist, struct utsname *platform);
+extern void manifest_add_dist(manifest_t *manifest, dist_t *dist,
+                              const char *subpackage);
+extern int manifest_add_output(manifest_t *manifest, const char *filename);
+extern int manifest_add_outputs(manifest_t *manifest, const char *directory,
+                                const char *prodname, dist_t *dist);
+extern int manifest_check(manifest_t *manifest, const char *filename);
+extern void manifest_delete(manifest_t *manifest);
+extern char *manifest_digest(manifest_t *manifest, char *hex, size_t hexsize);
+extern int manifest_is_output(const char *name, const char *prodname, dist_t *dist);
+extern manifest_t *manifest_new(const char *format, const char *platname, int content);
+extern int manifest_write(manifest_t *manifest, const char *filename);
 extern dist_t *new_dist(void);
+extern void pkginfo_free(pkginfo_t *info);
+extern int pkginfo_read(const char *filename, pkginfo_t *info);
 extern int qprintf(FILE *fp, const char *format, ...);
 extern dist_t *read_dist(const char *filename, struct utsname *platform,
                          const char *format);
@@ -297,8 +435,34 @@ extern int run_command(const char *directory, const char *command, ...)
     __attribute__((__format__(__printf__, 2, 3)))
 #endif /* __GNUC__ */
     ;
+extern void run_jobs(int max_jobs);
+extern int run_max_jobs(void);
+extern run_job_t *run_start(const char *directory, const char *command, ...)
+#ifdef __GNUC__
+    __attribute__((__format__(__printf__, 2, 3)))
+#endif /* __GNUC__ */
+    ;
+extern run_job_t *run_startv(const char *directory, char **argv);
+extern int run_wait(run_job_t *job);
+extern int sha256_file(const char *filename, char *hex, size_t hexsize);
+extern void sha256_final(sha256_t *ctx, unsigned char *digest);
+extern char *sha256_hex(const unsigned char *digest, char *hex, size_t hexsize);
+extern void sha256_init(sha256_t *ctx);
+extern void sha256_update(sha256_t *ctx, const void *data, size_t len);
 extern void sort_dist_files(dist_t *dist);
-extern void strip_execs(dist_t *dist);
+extern void strip_execs(dist_t *dist, const char *debugpkg);
+extern task_t *tasks_add(tasks_t *tasks, const char *name, task_cb_t cb, void *data);
+extern int tasks_buffered(void);
+extern void tasks_delete(tasks_t *tasks);
+extern int tasks_depend(task_t *task, task_t *dep);
+extern tasks_t *tasks_new(void);
+extern void tasks_printf(const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((__format__(__printf__, 1, 2)))
+#endif /* __GNUC__ */
+    ;
+extern int tasks_run(tasks_t *tasks, int max_jobs);
+extern void tasks_write(const void *data, size_t bytes);
 extern int tar_close(tarf_t *tar);
 extern int tar_directory(tarf_t *tar, const char *srcpath, const char *dstpath);
 extern int tar_file(tarf_t *tar, const char *filename);
@@ -312,6 +476,10 @@ extern int tar_package(tarf_t *tar, const char *ext, const char *prodname,
 extern int unlink_directory(const char *directory);
 extern int unlink_package(const char *ext, const char *prodname, const char *directory,
                           const char *platname, dist_t *dist, const char *subpackage);
+extern walk_entry_t *walk_add(walk_dir_t *dir, const char *name);
+extern void walk_delete(walk_dir_t *dir);
+extern walk_dir_t *walk_tree(const char *path, int max_jobs, walk_cb_t cb,
+                             walk_filter_t filter, void *data);
 extern int write_dist(const char *listname, dist_t *dist);
 
 #ifdef __cplusplus
@@ -0,0 +1,1029 @@
+/*
+ * Installation helper program for the ESP Package Manager (EPM).
+ *
+ * Copyright 2020 by Jim Jagielski
+ * Copyright 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The helper program is included in portable distributions and run by the
+ * install, patch, and remove scripts for the jobs that are too slow to do
+ * with shell commands.  It is also copied to the software directory so the
+ * installed files can be verified later.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Installed file to verify ****/
+{
+    char type;                 /* Type of file */
+    mode_t mode;               /* Permissions */
+    uid_t uid;                 /* Owner or -1 if unknown */
+    gid_t gid;                 /* Group or -1 if unknown */
+    long long size;            /* Size */
+    char digest[SHA256_HEX_SIZE]; /* SHA-256 digest */
+    char *path;                /* Installed path */
+    int problems;              /* Problems found (VERIFY_xxx bits) */
+} verify_file_t;
+
+typedef struct verify_s verify_t;
+
+struct verify_s /**** Files to verify or remove ****/
+{
+    int num_files,             /* Number of files */
+        alloc_files,           /* Allocated files */
+        next_file,             /* Next file to check */
+        digests;               /* 1 to check digests */
+    verify_file_t *files;      /* Files */
+    void (*one)(verify_t *verify, verify_file_t *file);
+                               /* Function to run for each file */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mutex;     /* Lock for next_file */
+#endif /* HAVE_PTHREAD_H */
+};
+
+/*
+ * Local constants...
+ */
+
+#define VERIFY_MISSING 1       /* File is missing */
+#define VERIFY_TYPE 2          /* Wrong type of file */
+#define VERIFY_MODE 4          /* Wrong permissions */
+#define VERIFY_OWNER 8         /* Wrong owner or group */
+#define VERIFY_SIZE 16         /* Wrong size */
+#define VERIFY_DIGEST 32       /* Wrong contents */
+
+/*
+ * Local functions...
+ */
+
+static int do_check(int argc, char *argv[]);
+static int do_delta(int argc, char *argv[]);
+static int do_install(int argc, char *argv[]);
+static int do_progress(int argc, char *argv[]);
+static int do_remove(int argc, char *argv[]);
+static int do_verify(int argc, char *argv[]);
+static void usage(void)
+#ifdef __GNUC__
+    __attribute__((__noreturn__))
+#endif /* __GNUC__ */
+    ;
+static int compare_dirs(const void *a, const void *b);
+static int compare_files(const char *a, const char *b);
+static void get_ids(const char *user, const char *group, uid_t *uid, gid_t *gid);
+static int make_dirs(const char *path);
+static void remove_one(verify_t *verify, verify_file_t *file);
+static void *run_worker(verify_t *verify);
+static void run_workers(verify_t *verify, int jobs);
+static void set_perms(const char *path, const char *mode, const char *user,
+                      const char *group);
+static int verify_load(verify_t *verify, const char *filename);
+static void verify_one(verify_t *verify, verify_file_t *file);
+
+/*
+ * 'main()' - Run a helper command.
+ */
+
+int                /* O - Exit status */
+main(int argc,     /* I - Number of command-line arguments */
+     char *argv[]) /* I - Command-line arguments */
+{
+    if (argc < 2)
+        usage();
+
+    if (!strcmp(argv[1], "check"))
+        return (do_check(argc - 2, argv + 2));
+    else if (!strcmp(argv[1], "delta"))
+        return (do_delta(argc - 2, argv + 2));
+    else if (!strcmp(argv[1], "install"))
+        return (do_install(argc - 2, argv + 2));
+    else if (!strcmp(argv[1], "progress"))
+        return (do_progress(argc - 2, argv + 2));
+    else if (!strcmp(argv[1], "remove"))
+        return (do_remove(argc - 2, argv + 2));
+    else if (!strcmp(argv[1], "verify"))
+        return (do_verify(argc - 2, argv + 2));
+    else if (!strcmp(argv[1], "--version")) {
+        puts(EPM_VERSION);
+        return (0);
+    }
+
+    usage();
+}
+
+/*
+ * 'do_check()' - Check the SHA-256 digest of a file.
+ *
+ * Usage: epmhelper check digest file
+ */
+
+static int         /* O - Exit status */
+do_check(int argc, /* I - Number of arguments */
+         char *argv[]) /* I - Arguments */
+{
+    char hex[SHA256_HEX_SIZE]; /* Digest of file */
+
+    if (argc != 2)
+        usage();
+
+    if (sha256_file(argv[1], hex, sizeof(hex)))
+        return (1);
+
+    return (strcmp(hex, argv[0]) ? 1 : 0);
+}
+
+/*
+ * 'do_delta()' - Apply a delta to a file.
+ *
+ * Usage: epmhelper delta oldfile deltafile newfile
+ *
+ * The new file gets the permissions of the delta file.
+ */
+
+static int         /* O - Exit status */
+do_delta(int argc, /* I - Number of arguments */
+         char *argv[]) /* I - Arguments */
+{
+    struct stat fileinfo; /* Delta file information */
+
+    if (argc != 3)
+        usage();
+
+    if (stat(argv[1], &fileinfo)) {
+        fprintf(stderr, "epmhelper: Unable to open \"%s\" - %s\n", argv[1],
+                strerror(errno));
+        return (1);
+    }
+
+    return (delta_apply(argv[0], argv[1], argv[2], fileinfo.st_mode & 07777) ? 1 : 0);
+}
+
+/*
+ * 'do_install()' - Back up files, make directories, and set permissions.
+ *
+ * Usage: epmhelper install <list
+ *
+ * Each line of the list is "op mode user group path", where "op" is one of:
+ *
+ *     o    Rename an existing file to "path.O"
+ *     d    Make a directory and set its owner, group, and permissions
+ *     p    Set the owner, group, and permissions of an installed file
+ *
+ * A "-" leaves the mode, user, or group alone.  Problems are reported and
+ * skipped like the shell commands this replaces, except for a directory that
+ * already exists as a regular file, which stops the installation with exit
+ * status 1.
+ */
+
+static int         /* O - Exit status */
+do_install(int argc, /* I - Number of arguments */
+           char *argv[]) /* I - Arguments */
+{
+    char line[2048],        /* Line from list */
+        *ptr,               /* Pointer into line */
+        *path,              /* Path from line */
+        op,                 /* Operation */
+        mode[16],           /* Permissions */
+        user[256],          /* Owner name */
+        group[256],         /* Group name */
+        backup[2048];       /* Backup filename */
+    int pos;                /* Position of path in line */
+    struct stat fileinfo;   /* File information */
+
+    (void)argv;
+
+    if (argc != 0)
+        usage();
+
+    while (fgets(line, sizeof(line), stdin)) {
+        if ((ptr = strchr(line, '\n')) == NULL)
+            continue;
+
+        *ptr = '\0';
+        pos = 0;
+
+        if (sscanf(line, "%c%15s%255s%255s %n", &op, mode, user, group, &pos) < 4 ||
+            !pos || !line[pos])
+            continue;
+
+        path = line + pos;
+
+        switch (op) {
+        case 'o':
+            /*
+             * Back up an old file, directory, or symlink...
+             */
+
+            if (lstat(path, &fileinfo) ||
+                (!S_ISDIR(fileinfo.st_mode) && !S_ISREG(fileinfo.st_mode) &&
+                 !S_ISLNK(fileinfo.st_mode)))
+                break;
+
+            snprintf(backup, sizeof(backup), "%s.O", path);
+
+            if (rename(path, backup))
+                fprintf(stderr, "epmhelper: Unable to back up \"%s\" - %s\n", path,
+                        strerror(errno));
+            break;
+
+        case 'd':
+            /*
+             * Make a directory...
+             */
+
+            if (lstat(path, &fileinfo)) {
+                if (make_dirs(path))
+                    break;
+            } else if (!S_ISDIR(fileinfo.st_mode) && !stat(path, &fileinfo) &&
+                       S_ISREG(fileinfo.st_mode)) {
+                printf("Error: %s already exists as a regular file!\n", path);
+                return (1);
+            }
+
+            set_perms(path, mode, user, group);
+            break;
+
+        case 'p':
+            /*
+             * Set permissions...
+             */
+
+            set_perms(path, mode, user, group);
+            break;
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * 'do_progress()' - Copy an archive and report the progress.
+ *
+ * Usage: epmhelper progress fd
+ *
+ * The standard input is copied to the standard output, and a "K kbytes"
+ * record is written to the file descriptor for about every megabyte that is
+ * copied.
+ */
+
+static int         /* O - Exit status */
+do_progress(int argc, /* I - Number of arguments */
+            char *argv[]) /* I - Arguments */
+{
+    int fd;                 /* Progress file descriptor */
+    ssize_t bytes,          /* Bytes read */
+        written;            /* Bytes written */
+    char *ptr;              /* Pointer into buffer */
+    long long copied,       /* Bytes copied */
+        reported;           /* Bytes reported */
+    int kbytes;             /* Kbytes to report */
+    char buffer[65536],     /* Copy buffer */
+        record[64];         /* Progress record */
+
+    if (argc != 1)
+        usage();
+
+    fd = atoi(argv[0]);
+    copied = 0;
+    reported = 0;
+
+    for (;;) {
+        if ((bytes = read(0, buffer, sizeof(buffer))) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            fprintf(stderr, "epmhelper: Unable to read archive - %s\n", strerror(errno));
+            return (1);
+        } else if (bytes == 0)
+            break;
+
+        copied += bytes;
+
+        for (ptr = buffer; bytes > 0; ptr += written, bytes -= written) {
+            if ((written = write(1, ptr, (size_t)bytes)) < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    written = 0;
+                    continue;
+                }
+
+                fprintf(stderr, "epmhelper: Unable to write archive - %s\n",
+                        strerror(errno));
+                return (1);
+            }
+        }
+
+        if (copied - reported >= 1048576 && fd >= 0) {
+            kbytes = (int)((copied - reported) / 1024);
+            reported += 1024 * (long long)kbytes;
+
+            snprintf(record, sizeof(record), "K %d\n", kbytes);
+            if (write(fd, record, strlen(record)) < 0)
+                fd = -1; /* Installer went away */
+        }
+    }
+
+    if (copied > reported && fd >= 0) {
+        snprintf(record, sizeof(record), "K %d\n", (int)((copied - reported + 1023) / 1024));
+        if (write(fd, record, strlen(record)) < 0)
+            fd = -1; /* Installer went away */
+    }
+
+    return (0);
+}
+
+/*
+ * 'do_remove()' - Remove installed files using their file list.
+ *
+ * Usage: epmhelper remove [-j jobs] filelist
+ *
+ * Files and symbolic links are removed on several threads and replaced by
+ * their ".O" backups, if any; files under /usr are left alone when /usr is
+ * not writable.  Configuration files are only removed when they match the
+ * new ".N" copy, and then empty directories are removed deepest first.
+ */
+
+static int         /* O - Exit status */
+do_remove(int argc, /* I - Number of arguments */
+          char *argv[]) /* I - Arguments */
+{
+    int i;                  /* Looping var */
+    verify_t list,          /* Installed files */
+        files;              /* Files to remove */
+    verify_file_t *file,    /* Current file */
+        **dirs;             /* Directories to remove */
+    int jobs,               /* Number of threads */
+        num_dirs,           /* Number of directories */
+        usr;                /* Remove files under /usr? */
+    const char *filename;   /* File list */
+    char newname[2048];     /* New configuration file */
+
+    memset(&list, 0, sizeof(list));
+    memset(&files, 0, sizeof(files));
+
+    for (i = 0, jobs = 0, filename = NULL; i < argc; i++) {
+        if (!strncmp(argv[i], "-j", 2)) {
+            if (argv[i][2])
+                jobs = atoi(argv[i] + 2);
+            else if (++i < argc)
+                jobs = atoi(argv[i]);
+            else
+                usage();
+
+            if (jobs < 1)
+                usage();
+        } else if (argv[i][0] == '-' || filename)
+            usage();
+        else
+            filename = argv[i];
+    }
+
+    if (!filename)
+        usage();
+
+    if (verify_load(&list, filename))
+        return (2);
+
+    if ((files.files = calloc((size_t)list.num_files + 1, sizeof(verify_file_t))) ==
+            NULL ||
+        (dirs = calloc((size_t)list.num_files + 1, sizeof(verify_file_t *))) == NULL) {
+        fputs("epmhelper: Unable to allocate memory for file list!\n", stderr);
+        return (2);
+    }
+
+    /*
+     * Remove the files and restore the backups...
+     */
+
+    usr = !access("/usr", W_OK);
+
+    for (i = list.num_files, file = list.files; i > 0; i--, file++)
+        if ((file->type == 'f' || file->type == 'l') &&
+            (usr || strncmp(file->path, "/usr", 4)))
+            files.files[files.num_files++] = *file;
+
+    /*
+     * Removing files mostly waits for the disk, so use more threads than
+     * CPUs by default...
+     */
+
+    if (!jobs && (jobs = 4 * (int)sysconf(_SC_NPROCESSORS_ONLN)) < 4)
+        jobs = 4;
+
+    files.one = remove_one;
+    run_workers(&files, jobs);
+
+    /*
+     * Remove configuration files that have not been changed...
+     */
+
+    for (i = list.num_files, file = list.files, num_dirs = 0; i > 0; i--, file++) {
+        if (file->type == 'c') {
+            snprintf(newname, sizeof(newname), "%s.N", file->path);
+
+            if (!compare_files(file->path, newname))
+                unlink(file->path);
+
+            unlink(newname);
+        } else if (file->type == 'd')
+            dirs[num_dirs++] = file;
+    }
+
+    /*
+     * Remove empty directories, longest paths (and thus subdirectories)
+     * first...
+     */
+
+    qsort(dirs, (size_t)num_dirs, sizeof(verify_file_t *), compare_dirs);
+
+    for (i = 0; i < num_dirs; i++)
+        rmdir(dirs[i]->path);
+
+    return (0);
+}
+
+/*
+ * 'do_verify()' - Verify installed files against their file lists.
+ *
+ * Usage: epmhelper verify [--digests] [-j jobs] filelist ...
+ *
+ * The type, permissions, ownership, and size of each file are checked, and
+ * the contents when the --digests option is used.  Configuration files are
+ * only checked for existence since they may be changed by the user.
+ */
+
+static int         /* O - Exit status */
+do_verify(int argc, /* I - Number of arguments */
+          char *argv[]) /* I - Arguments */
+{
+    int i;                  /* Looping var */
+    verify_t verify;        /* Files to verify */
+    verify_file_t *file;    /* Current file */
+    int jobs,               /* Number of threads */
+        num_lists,          /* Number of file lists */
+        num_changed;        /* Number of changed files */
+
+    memset(&verify, 0, sizeof(verify));
+
+    for (i = 0, jobs = 0, num_lists = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--digests"))
+            verify.digests = 1;
+        else if (!strncmp(argv[i], "-j", 2)) {
+            if (argv[i][2])
+                jobs = atoi(argv[i] + 2);
+            else if (++i < argc)
+                jobs = atoi(argv[i]);
+            else
+                usage();
+
+            if (jobs < 1)
+                usage();
+        } else if (argv[i][0] == '-')
+            usage();
+        else if (verify_load(&verify, argv[i]))
+            return (2);
+        else
+            num_lists++;
+    }
+
+    if (!num_lists)
+        usage();
+
+    /*
+     * Checking files mostly waits for the disk, so use more threads than
+     * CPUs by default...
+     */
+
+    if (!jobs && (jobs = 4 * (int)sysconf(_SC_NPROCESSORS_ONLN)) < 4)
+        jobs = 4;
+
+    verify.one = verify_one;
+    run_workers(&verify, jobs);
+
+    /*
+     * Report the problems in file list order...
+     */
+
+    for (i = verify.num_files, file = verify.files, num_changed = 0; i > 0; i--, file++) {
+        if (!file->problems)
+            continue;
+
+        num_changed++;
+
+        if (file->problems & VERIFY_MISSING) {
+            printf("%s: missing\n", file->path);
+            continue;
+        }
+
+        printf("%s:", file->path);
+        if (file->problems & VERIFY_TYPE)
+            fputs(" type", stdout);
+        if (file->problems & VERIFY_MODE)
+            fputs(" mode", stdout);
+        if (file->problems & VERIFY_OWNER)
+            fputs(" owner", stdout);
+        if (file->problems & VERIFY_SIZE)
+            fputs(" size", stdout);
+        if (file->problems & VERIFY_DIGEST)
+            fputs(" digest", stdout);
+        puts(" changed");
+    }
+
+    printf("%d files checked, %d changed.\n", verify.num_files, num_changed);
+
+    return (num_changed ? 1 : 0);
+}
+
+/*
+ * 'compare_dirs()' - Compare two directories for removal order.
+ */
+
+static int                  /* O - Result of comparison */
+compare_dirs(const void *a, /* I - First directory */
+             const void *b) /* I - Second directory */
+{
+    size_t alen = strlen((*(verify_file_t *const *)a)->path),
+                            /* Length of first path */
+        blen = strlen((*(verify_file_t *const *)b)->path);
+                            /* Length of second path */
+
+    return (alen < blen ? 1 : alen > blen ? -1 : 0);
+}
+
+/*
+ * 'compare_files()' - Compare the contents of two files.
+ */
+
+static int                    /* O - 0 if the same, 1 if different or missing */
+compare_files(const char *a,  /* I - First file */
+              const char *b)  /* I - Second file */
+{
+    int afd, bfd;             /* File descriptors */
+    ssize_t abytes, bbytes;   /* Bytes read */
+    int result;               /* Result of comparison */
+    char abuf[32768],         /* Buffer for first file */
+        bbuf[32768];          /* Buffer for second file */
+
+    if ((afd = open(a, O_RDONLY)) < 0)
+        return (1);
+
+    if ((bfd = open(b, O_RDONLY)) < 0) {
+        close(afd);
+        return (1);
+    }
+
+    for (result = 0; !result;) {
+        abytes = read(afd, abuf, sizeof(abuf));
+        bbytes = read(bfd, bbuf, sizeof(bbuf));
+
+        if (abytes < 0 || abytes != bbytes || memcmp(abuf, bbuf, (size_t)abytes))
+            result = 1;
+        else if (abytes == 0)
+            break;
+    }
+
+    close(afd);
+    close(bfd);
+
+    return (result);
+}
+
+/*
+ * 'get_ids()' - Look up the user and group IDs for a file.
+ *
+ * The last names are cached since most files have the same owner.
+ */
+
+static void
+get_ids(const char *user,  /* I - Owner name or "-" */
+        const char *group, /* I - Group name or "-" */
+        uid_t *uid,        /* O - Owner or -1 */
+        gid_t *gid)        /* O - Group or -1 */
+{
+    struct passwd *pw;             /* Owner information */
+    struct group *gr;              /* Group information */
+    static char lastuser[256] = "", /* Last owner name */
+        lastgroup[256] = "";       /* Last group name */
+    static uid_t lastuid = (uid_t)-1; /* Last owner */
+    static gid_t lastgid = (gid_t)-1; /* Last group */
+
+    if (!strcmp(user, "-"))
+        *uid = (uid_t)-1;
+    else {
+        if (strcmp(user, lastuser)) {
+            if ((pw = getpwnam(user)) != NULL)
+                lastuid = pw->pw_uid;
+            else {
+                fprintf(stderr, "epmhelper: Unknown user \"%s\"\n", user);
+                lastuid = (uid_t)-1;
+            }
+
+            strlcpy(lastuser, user, sizeof(lastuser));
+        }
+
+        *uid = lastuid;
+    }
+
+    if (!strcmp(group, "-"))
+        *gid = (gid_t)-1;
+    else {
+        if (strcmp(group, lastgroup)) {
+            if ((gr = getgrnam(group)) != NULL)
+                lastgid = gr->gr_gid;
+            else {
+                fprintf(stderr, "epmhelper: Unknown group \"%s\"\n", group);
+                lastgid = (gid_t)-1;
+            }
+
+            strlcpy(lastgroup, group, sizeof(lastgroup));
+        }
+
+        *gid = lastgid;
+    }
+}
+
+/*
+ * 'make_dirs()' - Make a directory and any missing parent directories.
+ */
+
+static int                /* O - 0 on success, -1 on error */
+make_dirs(const char *path) /* I - Directory */
+{
+    char temp[1024], /* Copy of path */
+        *ptr;        /* Pointer into path */
+
+    strlcpy(temp, path, sizeof(temp));
+
+    for (ptr = strchr(temp + 1, '/'); ptr; ptr = strchr(ptr + 1, '/')) {
+        *ptr = '\0';
+
+        if (mkdir(temp, 0777) && errno != EEXIST) {
+            fprintf(stderr, "epmhelper: Unable to create directory \"%s\" - %s\n", temp,
+                    strerror(errno));
+            return (-1);
+        }
+
+        *ptr = '/';
+    }
+
+    if (mkdir(temp, 0777) && errno != EEXIST) {
+        fprintf(stderr, "epmhelper: Unable to create directory \"%s\" - %s\n", temp,
+                strerror(errno));
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'remove_one()' - Remove a file and restore its backup.
+ */
+
+static void                   /* O - Nothing */
+remove_one(verify_t *verify,  /* I - Files to remove */
+           verify_file_t *file) /* I - File to remove */
+{
+    char backup[2048]; /* Backup filename */
+    struct stat fileinfo; /* Backup information */
+
+    (void)verify;
+
+    if (unlink(file->path) && errno != ENOENT)
+        fprintf(stderr, "epmhelper: Unable to remove \"%s\" - %s\n", file->path,
+                strerror(errno));
+
+    snprintf(backup, sizeof(backup), "%s.O", file->path);
+
+    if (!lstat(backup, &fileinfo) && rename(backup, file->path))
+        fprintf(stderr, "epmhelper: Unable to restore \"%s\" - %s\n", file->path,
+                strerror(errno));
+}
+
+/*
+ * 'run_worker()' - Run the function for files until there are no more.
+ */
+
+static void *             /* O - Thread exit value (unused) */
+run_worker(verify_t *verify) /* I - Files */
+{
+    verify_file_t *file; /* Current file */
+
+    for (;;) {
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&verify->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        if (verify->next_file < verify->num_files)
+            file = verify->files + verify->next_file++;
+        else
+            file = NULL;
+
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_unlock(&verify->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        if (!file)
+            break;
+
+        (verify->one)(verify, file);
+    }
+
+    return (NULL);
+}
+
+/*
+ * 'run_workers()' - Run a function for each file on several threads.
+ */
+
+static void                   /* O - Nothing */
+run_workers(verify_t *verify, /* I - Files */
+            int jobs)         /* I - Number of threads */
+{
+#ifdef HAVE_PTHREAD_H
+    int i;                    /* Looping var */
+    int num_threads;          /* Number of threads started */
+    pthread_t *threads;       /* Worker threads */
+#endif /* HAVE_PTHREAD_H */
+
+    if (jobs > verify->num_files)
+        jobs = verify->num_files;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&verify->mutex, NULL);
+
+    if (jobs > 1 && (threads = calloc((size_t)jobs, sizeof(pthread_t))) != NULL) {
+        for (num_threads = 0; num_threads < jobs - 1; num_threads++)
+            if (pthread_create(threads + num_threads, NULL,
+                               (void *(*)(void *))run_worker, verify))
+                break;
+
+        run_worker(verify);
+
+        for (i = 0; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
+
+        free(threads);
+    } else
+#endif /* HAVE_PTHREAD_H */
+        run_worker(verify);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&verify->mutex);
+#endif /* HAVE_PTHREAD_H */
+}
+
+/*
+ * 'set_perms()' - Set the owner, group, and permissions of a file.
+ *
+ * The owner is changed first since that clears the set-ID bits.
+ */
+
+static void
+set_perms(const char *path,  /* I - File */
+          const char *mode,  /* I - Permissions or "-" */
+          const char *user,  /* I - Owner name or "-" */
+          const char *group) /* I - Group name or "-" */
+{
+    uid_t uid; /* Owner */
+    gid_t gid; /* Group */
+
+    get_ids(user, group, &uid, &gid);
+
+    if (uid != (uid_t)-1 || gid != (gid_t)-1) {
+#ifdef HAVE_FCHOWNAT
+        if (fchownat(AT_FDCWD, path, uid, gid, 0))
+#else
+        if (chown(path, uid, gid))
+#endif /* HAVE_FCHOWNAT */
+            fprintf(stderr, "epmhelper: Unable to change owner of \"%s\" - %s\n", path,
+                    strerror(errno));
+    }
+
+    if (strcmp(mode, "-")) {
+#ifdef HAVE_FCHOWNAT
+        if (fchmodat(AT_FDCWD, path, (mode_t)strtol(mode, NULL, 8), 0))
+#else
+        if (chmod(path, (mode_t)strtol(mode, NULL, 8)))
+#endif /* HAVE_FCHOWNAT */
+            fprintf(stderr, "epmhelper: Unable to change permissions of \"%s\" - %s\n",
+                    path, strerror(errno));
+    }
+}
+
+/*
+ * 'usage()' - Show command-line usage instructions.
+ */
+
+static void usage(void) {
+    puts("Usage: epmhelper check digest file");
+    puts("       epmhelper delta oldfile deltafile newfile");
+    puts("       epmhelper install <list");
+    puts("       epmhelper progress fd");
+    puts("       epmhelper remove [-j jobs] filelist");
+    puts("       epmhelper verify [--digests] [-j jobs] filelist ...");
+    puts("       epmhelper --version");
+
+    exit(1);
+}
+
+/*
+ * 'verify_load()' - Load a file list.
+ */
+
+static int                   /* O - 0 on success, -1 on error */
+verify_load(verify_t *verify, /* I - Files to verify */
+            const char *filename) /* I - File list */
+{
+    FILE *fp;                /* File list */
+    char line[2048],         /* Line from file */
+        *ptr,                /* Pointer into line */
+        user[256],           /* Owner name */
+        group[256],          /* Group name */
+        lastuser[256],       /* Last owner name */
+        lastgroup[256];      /* Last group name */
+    unsigned mode;           /* Permissions */
+    int pos;                 /* Position of path in line */
+    uid_t lastuid;           /* Last owner */
+    gid_t lastgid;           /* Last group */
+    struct passwd *pw;       /* Owner information */
+    struct group *gr;        /* Group information */
+    verify_file_t *file;     /* Current file */
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "epmhelper: Unable to open \"%s\" - %s\n", filename,
+                strerror(errno));
+        return (-1);
+    }
+
+    lastuser[0] = '\0';
+    lastgroup[0] = '\0';
+    lastuid = (uid_t)-1;
+    lastgid = (gid_t)-1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || (ptr = strchr(line, '\n')) == NULL)
+            continue;
+
+        *ptr = '\0';
+
+        if (verify->num_files >= verify->alloc_files) {
+            int alloc = verify->alloc_files ? 2 * verify->alloc_files : 1024;
+            /* New allocation */
+
+            if ((file = realloc(verify->files, (size_t)alloc * sizeof(verify_file_t))) ==
+                NULL) {
+                fputs("epmhelper: Unable to allocate memory for file list!\n", stderr);
+                fclose(fp);
+                return (-1);
+            }
+
+            verify->files = file;
+            verify->alloc_files = alloc;
+        }
+
+        file = verify->files + verify->num_files;
+        memset(file, 0, sizeof(verify_file_t));
+        pos = 0;
+
+        if (sscanf(line, "%c%o%255s%255s%lld%64s %n", &file->type, &mode, user, group,
+                   &file->size, file->digest, &pos) < 6 ||
+            !pos || !line[pos])
+            continue;
+
+        file->mode = (mode_t)mode;
+
+        if (!strcmp(user, lastuser))
+            file->uid = lastuid;
+        else if ((pw = getpwnam(user)) != NULL)
+            file->uid = lastuid = pw->pw_uid;
+        else
+            file->uid = lastuid = (uid_t)-1;
+
+        strlcpy(lastuser, user, sizeof(lastuser));
+
+        if (!strcmp(group, lastgroup))
+            file->gid = lastgid;
+        else if ((gr = getgrnam(group)) != NULL)
+            file->gid = lastgid = gr->gr_gid;
+        else
+            file->gid = lastgid = (gid_t)-1;
+
+        strlcpy(lastgroup, group, sizeof(lastgroup));
+
+        if ((file->path = strdup(line + pos)) == NULL) {
+            fputs("epmhelper: Unable to allocate memory for file list!\n", stderr);
+            fclose(fp);
+            return (-1);
+        }
+
+        verify->num_files++;
+    }
+
+    fclose(fp);
+
+    return (0);
+}
+
+/*
+ * 'verify_one()' - Verify a single installed file.
+ */
+
+static void                /* O - Nothing */
+verify_one(verify_t *verify, /* I - Files to verify */
+           verify_file_t *file) /* I - File to verify */
+{
+    struct stat fileinfo;       /* File information */
+    char hex[SHA256_HEX_SIZE],  /* Digest of file */
+        link[1024];             /* Link text */
+    ssize_t bytes;              /* Length of link text */
+    sha256_t ctx;               /* Digest context */
+    unsigned char digest[SHA256_SIZE]; /* Binary digest */
+
+    if (lstat(file->path, &fileinfo)) {
+        file->problems = VERIFY_MISSING;
+        return;
+    }
+
+    switch (file->type) {
+    case 'c':
+        /*
+         * Configuration files belong to the user once installed...
+         */
+        break;
+
+    case 'd':
+        if (!S_ISDIR(fileinfo.st_mode))
+            file->problems |= VERIFY_TYPE;
+        break;
+
+    case 'l':
+        if (!S_ISLNK(fileinfo.st_mode)) {
+            file->problems |= VERIFY_TYPE;
+            break;
+        }
+
+        if ((long long)fileinfo.st_size != file->size)
+            file->problems |= VERIFY_SIZE;
+        else if (verify->digests) {
+            if ((bytes = readlink(file->path, link, sizeof(link))) < 0)
+                bytes = 0;
+
+            sha256_init(&ctx);
+            sha256_update(&ctx, link, (size_t)bytes);
+            sha256_final(&ctx, digest);
+            sha256_hex(digest, hex, sizeof(hex));
+
+            if (strcmp(hex, file->digest))
+                file->problems |= VERIFY_DIGEST;
+        }
+        break;
+
+    default:
+        if (!S_ISREG(fileinfo.st_mode)) {
+            file->problems |= VERIFY_TYPE;
+            break;
+        }
+
+        if ((long long)fileinfo.st_size != file->size)
+            file->problems |= VERIFY_SIZE;
+        else if (verify->digests &&
+                 (sha256_file(file->path, hex, sizeof(hex)) || strcmp(hex, file->digest)))
+            file->problems |= VERIFY_DIGEST;
+        break;
+    }
+
+    if (file->type == 'c' || file->type == 'l' || (file->problems & VERIFY_TYPE))
+        return;
+
+    if ((fileinfo.st_mode & 07777) != (file->mode & 07777))
+        file->problems |= VERIFY_MODE;
+
+    if ((file->uid != (uid_t)-1 && fileinfo.st_uid != file->uid) ||
+        (file->gid != (gid_t)-1 && fileinfo.st_gid != file->gid))
+        file->problems |= VERIFY_OWNER;
+}
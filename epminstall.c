@@ -23,6 +23,25 @@
  */
 
 #include "epm.h"
+#include <fcntl.h>
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Destination index ****/
+{
+    int num_slots;          /* Number of slots (power of 2) */
+    int used;               /* Number of used slots */
+    int *slots;             /* File numbers + 1, 0 if unused */
+} dstindex_t;
+
+typedef struct /**** Install records ****/
+{
+    char *data;             /* Record text */
+    size_t length,          /* Length of text */
+        alloc;              /* Allocated bytes */
+} records_t;
 
 /*
  * Global variable used by dist functions...
@@ -34,7 +53,15 @@ int Verbosity = 0;
  * Local functions...
  */
 
-static file_t *find_file(dist_t *dist, const char *dst);
+static int add_record(records_t *records, int op, int type, int mode, const char *user,
+                      const char *group, const char *dst, const char *src,
+                      const char *name);
+static int add_source(records_t *records, int op, int mode, const char *user,
+                      const char *group, const char *dst, const char *src);
+static int apply_records(dist_t *dist, dstindex_t *index, char *data);
+static file_t *find_file(dist_t *dist, dstindex_t *index, const char *dst);
+static unsigned hash_dst(const char *dst);
+static int index_add(dist_t *dist, dstindex_t *index, int number);
 static void info(void);
 static void usage(void)
 #ifdef __GNUC__
@@ -44,6 +71,10 @@ static void usage(void)
 
 /*
  * 'main()' - Add or replace files, directories, and symlinks.
+ *
+ * Each invocation is turned into install records, which are either applied
+ * to the list file right away or, in journal mode, appended to
+ * "listname.journal" and applied later by "epminstall --commit".
  */
 
 int                /* O - Exit status */
@@ -52,19 +83,25 @@ main(int argc,     /* I - Number of command-line arguments */
 {
     int i;                   /* Looping var */
     int mode,                /* Permissions */
-        directories;         /* Installing directories? */
+        directories,         /* Installing directories? */
+        journal,             /* Append to the journal? */
+        commit;              /* Apply the journal? */
+    int status;              /* Exit status */
+    int fd;                  /* Journal file */
     char *user,              /* Owner */
         *group,              /* Group */
         *listname,           /* List filename */
         *src,                /* Source filename */
+        *ptr,                /* Pointer into journal */
         dst[1024],           /* Destination filename */
-        linkname[1024];      /* Symlink name */
-    ssize_t linklen;         /* Length of symlink */
+        journalname[1024];   /* Journal filename */
     int num_files;           /* Number of files to install */
-    char *files[1000];       /* Files to install */
+    char **files;            /* Files to install */
+    ssize_t bytes;           /* Bytes written */
+    records_t records;       /* Install records */
     struct stat fileinfo;    /* File information */
     dist_t *dist;            /* Distribution */
-    file_t *file;            /* File in distribution */
+    dstindex_t index;        /* Destination index */
     struct utsname platform; /* Platform information */
 
     /*
@@ -76,10 +113,17 @@ main(int argc,     /* I - Number of command-line arguments */
     user = "root";
     group = "sys";
     directories = 0;
+    commit = 0;
+    journal = (ptr = getenv("EPMJOURNAL")) != NULL && *ptr;
 
     if ((listname = getenv("EPMLIST")) == NULL)
         listname = "epm.list";
 
+    if ((files = calloc((size_t)argc, sizeof(char *))) == NULL) {
+        fputs("epminstall: Out of memory!\n", stderr);
+        return (1);
+    }
+
     for (i = 1; i < argc; i++)
         if (strcmp(argv[i], "-b") == 0)
             continue;
@@ -107,6 +151,10 @@ main(int argc,     /* I - Number of command-line arguments */
                 usage();
         } else if (strcmp(argv[i], "-s") == 0)
             continue;
+        else if (strcmp(argv[i], "--commit") == 0)
+            commit = 1;
+        else if (strcmp(argv[i], "--journal") == 0)
+            journal = 1;
         else if (strcmp(argv[i], "--list-file") == 0) {
             i++;
             if (i < argc)
@@ -115,173 +163,133 @@ main(int argc,     /* I - Number of command-line arguments */
                 usage();
         } else if (argv[i][0] == '-')
             usage();
-        else if (num_files < (sizeof(files) / sizeof(files[0]))) {
+        else {
             files[num_files] = argv[i];
             num_files++;
-        } else {
-            fputs("epminstall: Too many filenames on command-line!\n", stderr);
-            usage();
         }
 
-    if (num_files == 0 || (num_files < 2 && !directories))
+    if (commit ? num_files > 0 : (num_files == 0 || (num_files < 2 && !directories)))
         usage();
 
-    get_platform(&platform);
+    snprintf(journalname, sizeof(journalname), "%s.journal", listname);
+    memset(&records, 0, sizeof(records));
 
-    if ((dist = read_dist(listname, &platform, "")) == NULL) {
-        fprintf(stderr, "epminstall: Unable to read list file \"%s\": %s\n", listname,
-                strerror(errno));
-        return (1);
-    }
+    if (commit) {
+        /*
+         * Load the journal...
+         */
 
-    /*
-     * Check to see if we are installing files or directories...
-     */
+        if ((fd = open(journalname, O_RDONLY)) < 0) {
+            if (errno == ENOENT)
+                return (0);
+
+            fprintf(stderr, "epminstall: Unable to open journal \"%s\": %s\n",
+                    journalname, strerror(errno));
+            return (1);
+        }
+
+        if (fstat(fd, &fileinfo) ||
+            (records.data = malloc((size_t)fileinfo.st_size + 1)) == NULL) {
+            fprintf(stderr, "epminstall: Unable to read journal \"%s\": %s\n",
+                    journalname, strerror(errno));
+            close(fd);
+            return (1);
+        }
+
+        while (records.length < (size_t)fileinfo.st_size &&
+               (bytes = read(fd, records.data + records.length,
+                             (size_t)fileinfo.st_size - records.length)) > 0)
+            records.length += (size_t)bytes;
+
+        close(fd);
+
+        records.data[records.length] = '\0';
+    } else if (directories) {
+        /*
+         * Add or replace each directory...
+         */
 
-    if (directories) {
         if (!mode)
             mode = 0755;
 
+        for (i = 0; i < num_files; i++)
+            if (add_record(&records, 'A', 'd', mode & 07777, user, group, files[i], "-", ""))
+                return (1);
+    } else if (num_files == 2) {
+        /*
+         * Install a file as the destination file or into the destination
+         * directory, depending on what the destination is...
+         */
+
+        if (add_source(&records, 'F', mode, user, group, files[1], files[0]))
+            return (1);
+    } else {
+        /*
+         * Install files into a directory...
+         */
+
+        num_files--;
+
+        if (add_record(&records, 'T', 'd', 0755, user, group, files[num_files], "-", ""))
+            return (1);
+
         for (i = 0; i < num_files; i++) {
-            /*
-             * Copy the directory name into a new file entry, which is cleared
-             * by add_file()...
-             */
+            if ((src = strrchr(files[i], '/')) != NULL)
+                src++;
+            else
+                src = files[i];
 
-            if ((file = find_file(dist, files[i])) == NULL)
-                file = add_file(dist, NULL);
+            snprintf(dst, sizeof(dst), "%s/%s", files[num_files], src);
 
-            file->type = 'd';
-            file->mode = mode & 07777;
-            strlcpy(file->user, user, sizeof(file->user));
-            strlcpy(file->group, group, sizeof(file->group));
-            strlcpy(file->dst, files[i], sizeof(file->dst));
-            strlcpy(file->src, "-", sizeof(file->src));
+            if (add_source(&records, 'A', mode, user, group, dst, files[i]))
+                return (1);
         }
-    } else {
+    }
+
+    if (journal && !commit) {
         /*
-         * Check to see if we have 1 or more files and a directory or
-         * a source and destination file...
+         * Append the records to the journal with a single write so that
+         * parallel invocations don't mix...
          */
 
-        if (num_files == 2) {
-            file = find_file(dist, files[1]);
-
-            if (file == NULL || file->type != 'd') {
-                if (!file)
-                    file = add_file(dist, NULL);
-
-                if (stat(files[0], &fileinfo)) {
-                    fprintf(stderr, "epminstall: Unable to stat \"%s\": %s\n", files[0],
-                            strerror(errno));
-                    fileinfo.st_mode = mode;
-                }
-
-                if (S_ISLNK(fileinfo.st_mode)) {
-                    file->type = 'l';
-
-                    if ((linklen = readlink(files[0], linkname, sizeof(linkname) - 1)) <
-                        0) {
-                        fprintf(stderr, "epminstall: Unable to read symlink \"%s\": %s\n",
-                                files[0], strerror(errno));
-                        files[0] = "BROKEN-LINK";
-                    } else {
-                        linkname[linklen] = '\0';
-                        files[0] = linkname;
-                    }
-                } else
-                    file->type = 'f';
-
-                if (mode)
-                    file->mode = mode & 07777;
-                else if (fileinfo.st_mode & 0111)
-                    file->mode = 0755;
-                else
-                    file->mode = 0644;
-
-                strlcpy(file->user, user, sizeof(file->user));
-                strlcpy(file->group, group, sizeof(file->group));
-                strlcpy(file->dst, files[1], sizeof(file->dst));
-                strlcpy(file->src, files[0], sizeof(file->src));
-            } else
-                num_files--;
+        if ((fd = open(journalname, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 ||
+            write(fd, records.data, records.length) != (ssize_t)records.length) {
+            fprintf(stderr, "epminstall: Unable to write journal \"%s\": %s\n",
+                    journalname, strerror(errno));
+
+            if (fd >= 0)
+                close(fd);
+
+            return (1);
         }
 
-        if (num_files != 2) {
-            if (num_files > 1)
-                num_files--;
+        close(fd);
 
-            if ((file = find_file(dist, files[num_files])) == NULL) {
-                /*
-                 * Add the installation directory to the file list...
-                 */
+        return (0);
+    }
 
-                file = add_file(dist, NULL);
+    /*
+     * Apply the records to the list file...
+     */
 
-                file->type = 'd';
-                file->mode = 0755;
-                strlcpy(file->user, user, sizeof(file->user));
-                strlcpy(file->group, group, sizeof(file->group));
-                strlcpy(file->dst, files[num_files], sizeof(file->dst));
-                strlcpy(file->src, "-", sizeof(file->src));
-            } else if (file->type != 'd') {
-                fprintf(stderr,
-                        "epminstall: Destination path \"%s\" is not a directory!\n",
-                        files[num_files]);
-                return (1);
-            }
+    get_platform(&platform);
 
-            for (i = 0; i < num_files; i++) {
-                /*
-                 * Add/update the file in the distribution...
-                 */
-
-                if ((src = strrchr(files[i], '/')) != NULL)
-                    src++;
-                else
-                    src = files[i];
-
-                snprintf(dst, sizeof(dst), "%s/%s", files[num_files], src);
-
-                if ((file = find_file(dist, dst)) == NULL)
-                    file = add_file(dist, NULL);
-
-                if (stat(files[i], &fileinfo)) {
-                    fprintf(stderr, "epminstall: Unable to stat \"%s\": %s\n", files[i],
-                            strerror(errno));
-                    fileinfo.st_mode = mode;
-                }
-
-                if (S_ISLNK(fileinfo.st_mode)) {
-                    file->type = 'l';
-
-                    if ((linklen = readlink(files[i], linkname, sizeof(linkname) - 1)) <
-                        0) {
-                        fprintf(stderr, "epminstall: Unable to read symlink \"%s\": %s\n",
-                                files[i], strerror(errno));
-                        files[i] = "BROKEN-LINK";
-                    } else {
-                        linkname[linklen] = '\0';
-                        files[i] = linkname;
-                    }
-                } else
-                    file->type = 'f';
-
-                if (mode)
-                    file->mode = mode & 07777;
-                else if (fileinfo.st_mode & 0111)
-                    file->mode = 0755;
-                else
-                    file->mode = 0644;
-
-                strlcpy(file->user, user, sizeof(file->user));
-                strlcpy(file->group, group, sizeof(file->group));
-                strlcpy(file->dst, dst, sizeof(file->dst));
-                strlcpy(file->src, files[i], sizeof(file->src));
-            }
-        }
+    if ((dist = read_dist(listname, &platform, "")) == NULL) {
+        fprintf(stderr, "epminstall: Unable to read list file \"%s\": %s\n", listname,
+                strerror(errno));
+        return (1);
     }
 
+    memset(&index, 0, sizeof(index));
+
+    for (i = 0; i < dist->num_files; i++)
+        if (index_add(dist, &index, i)) {
+            fputs("epminstall: Out of memory!\n", stderr);
+            return (1);
+        }
+
+    status = apply_records(dist, &index, records.data);
+
     /*
      * Sort the files to make the final list file easier to check...
      */
@@ -298,31 +306,303 @@ main(int argc,     /* I - Number of command-line arguments */
         return (1);
     }
 
+    if (commit)
+        unlink(journalname);
+
     /*
      * Return with no errors...
      */
 
+    return (status);
+}
+
+/*
+ * 'add_record()' - Add an install record.
+ *
+ * Records are lines of tab-separated fields: the operation, type,
+ * permissions, user, group, destination, source, and the name used when
+ * installing into a directory.  The operations are "A" to add or replace
+ * the destination, "T" to add the destination directory if needed, and "F"
+ * to install into the destination if it is a directory or as the
+ * destination otherwise.
+ */
+
+static int                     /* O - 0 on success, -1 on error */
+add_record(records_t *records, /* I - Install records */
+           int op,             /* I - Operation */
+           int type,           /* I - Type of file */
+           int mode,           /* I - Permissions */
+           const char *user,   /* I - Owner */
+           const char *group,  /* I - Group */
+           const char *dst,    /* I - Destination path */
+           const char *src,    /* I - Source path or symlink text */
+           const char *name)   /* I - Name in destination directory */
+{
+    char line[4096]; /* Record */
+    int length;      /* Length of record */
+    char *temp;      /* New buffer */
+
+    length = snprintf(line, sizeof(line), "%c\t%c\t%o\t%s\t%s\t%s\t%s\t%s\n", op, type,
+                      mode, user, group, dst, src, name);
+
+    if (length < 0 || length >= (int)sizeof(line) || strpbrk(dst, "\t\n") ||
+        strpbrk(src, "\t\n")) {
+        fprintf(stderr, "epminstall: Bad filename \"%s\".\n", dst);
+        return (-1);
+    }
+
+    if ((records->length + (size_t)length + 1) > records->alloc) {
+        if ((temp = realloc(records->data, records->alloc + 65536)) == NULL) {
+            fputs("epminstall: Out of memory!\n", stderr);
+            return (-1);
+        }
+
+        records->data = temp;
+        records->alloc += 65536;
+    }
+
+    memcpy(records->data + records->length, line, (size_t)length + 1);
+    records->length += (size_t)length;
+
     return (0);
 }
 
+/*
+ * 'add_source()' - Add an install record for a source file or symlink.
+ */
+
+static int                     /* O - 0 on success, -1 on error */
+add_source(records_t *records, /* I - Install records */
+           int op,             /* I - Operation */
+           int mode,           /* I - Permissions or 0 for default */
+           const char *user,   /* I - Owner */
+           const char *group,  /* I - Group */
+           const char *dst,    /* I - Destination path */
+           const char *src)    /* I - Source file */
+{
+    int type;              /* Type of file */
+    const char *name;      /* Name in destination directory */
+    char linkname[1024];   /* Symlink name */
+    ssize_t linklen;       /* Length of symlink */
+    struct stat fileinfo;  /* File information */
+
+    if ((name = strrchr(src, '/')) != NULL)
+        name++;
+    else
+        name = src;
+
+    if (stat(src, &fileinfo)) {
+        fprintf(stderr, "epminstall: Unable to stat \"%s\": %s\n", src, strerror(errno));
+        fileinfo.st_mode = (mode_t)mode;
+    }
+
+    if (S_ISLNK(fileinfo.st_mode)) {
+        type = 'l';
+
+        if ((linklen = readlink(src, linkname, sizeof(linkname) - 1)) < 0) {
+            fprintf(stderr, "epminstall: Unable to read symlink \"%s\": %s\n", src,
+                    strerror(errno));
+            src = "BROKEN-LINK";
+        } else {
+            linkname[linklen] = '\0';
+            src = linkname;
+        }
+    } else
+        type = 'f';
+
+    if (mode)
+        mode &= 07777;
+    else if (fileinfo.st_mode & 0111)
+        mode = 0755;
+    else
+        mode = 0644;
+
+    return (add_record(records, op, type, mode, user, group, dst, src, name));
+}
+
+/*
+ * 'apply_records()' - Apply install records to the distribution.
+ */
+
+static int                 /* O - 0 on success, 1 on error */
+apply_records(dist_t *dist, /* I - Distribution */
+              dstindex_t *index, /* I - Destination index */
+              char *data)  /* I - Install records */
+{
+    int i;                 /* Looping var */
+    int status;            /* Return status */
+    char *fields[8],       /* Fields in record */
+        *next;             /* Next record */
+    const char *dst;       /* Destination path */
+    char dstbuf[1024];     /* Destination in directory */
+    file_t *file;          /* File in distribution */
+
+    for (status = 0; data && *data; data = next) {
+        if ((next = strchr(data, '\n')) != NULL)
+            *next++ = '\0';
+        else
+            next = data + strlen(data);
+
+        for (i = 0, fields[0] = data; i < 7; i++) {
+            if ((fields[i + 1] = strchr(fields[i], '\t')) == NULL)
+                break;
+
+            *fields[i + 1]++ = '\0';
+        }
+
+        if (i < 7)
+            continue;
+
+        dst = fields[5];
+        file = find_file(dist, index, dst);
+
+        if (fields[0][0] == 'T') {
+            /*
+             * Installation directory...
+             */
+
+            if (file && file->type != 'd') {
+                fprintf(stderr,
+                        "epminstall: Destination path \"%s\" is not a directory!\n", dst);
+                status = 1;
+                continue;
+            } else if (file)
+                continue;
+        } else if (fields[0][0] == 'F' && file && file->type == 'd') {
+            /*
+             * Install into the destination directory...
+             */
+
+            snprintf(dstbuf, sizeof(dstbuf), "%s/%s", dst, fields[7]);
+            dst = dstbuf;
+            file = find_file(dist, index, dst);
+        }
+
+        if (!file) {
+            file = add_file(dist, NULL);
+
+            strlcpy(file->dst, dst, sizeof(file->dst));
+            file->options[0] = '\0';
+
+            if (index_add(dist, index, dist->num_files - 1)) {
+                fputs("epminstall: Out of memory!\n", stderr);
+                return (1);
+            }
+        }
+
+        file->type = fields[1][0];
+        file->mode = (mode_t)strtol(fields[2], NULL, 8);
+        strlcpy(file->user, fields[3], sizeof(file->user));
+        strlcpy(file->group, fields[4], sizeof(file->group));
+        strlcpy(file->src, fields[6], sizeof(file->src));
+
+#ifdef __osf__ /* Remap group "sys" to "system" like read_dist() */
+        if (!strcmp(file->group, "sys"))
+            strlcpy(file->group, "system", sizeof(file->group));
+#elif defined(__linux) /* Remap group "sys" to "root" like read_dist() */
+        if (!strcmp(file->group, "sys"))
+            strlcpy(file->group, "root", sizeof(file->group));
+#endif                 /* __osf__ */
+    }
+
+    return (status);
+}
+
 /*
  * 'find_file()' - Find a file in the distribution...
  */
 
-static file_t *            /* O - File entry or NULL */
-find_file(dist_t *dist,    /* I - Distribution to search */
-          const char *dst) /* I - Destination filename */
+static file_t *             /* O - File entry or NULL */
+find_file(dist_t *dist,     /* I - Distribution to search */
+          dstindex_t *index, /* I - Destination index */
+          const char *dst)  /* I - Destination filename */
 {
-    int i;        /* Looping var */
+    int slot;     /* Current slot */
     file_t *file; /* Current file */
 
-    for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
+    if (!index->num_slots)
+        return (NULL);
+
+    for (slot = (int)(hash_dst(dst) & (unsigned)(index->num_slots - 1));
+         index->slots[slot]; slot = (slot + 1) & (index->num_slots - 1)) {
+        file = dist->files + index->slots[slot] - 1;
+
         if (strcmp(file->dst, dst) == 0)
             return (file);
+    }
 
     return (NULL);
 }
 
+/*
+ * 'hash_dst()' - Compute the hash of a destination path.
+ */
+
+static unsigned           /* O - Hash value */
+hash_dst(const char *dst) /* I - Destination path */
+{
+    unsigned hash; /* Hash value */
+
+    for (hash = 2166136261U; *dst; dst++)
+        hash = (hash ^ (unsigned)(*dst & 255)) * 16777619U;
+
+    return (hash);
+}
+
+/*
+ * 'index_add()' - Add a file to the destination index.
+ *
+ * Only the first file with a given destination is indexed, just like the
+ * old linear search found.
+ */
+
+static int                 /* O - 0 on success, -1 on error */
+index_add(dist_t *dist,    /* I - Distribution */
+          dstindex_t *index, /* I - Destination index */
+          int number)      /* I - File number */
+{
+    int i;                 /* Looping var */
+    int slot;              /* Current slot */
+    int *slots,            /* Old slots */
+        num_slots;         /* Old number of slots */
+    const char *dst;       /* Destination path */
+
+    if ((index->used + 1) * 2 > index->num_slots) {
+        /*
+         * Double the size of the index...
+         */
+
+        slots = index->slots;
+        num_slots = index->num_slots;
+
+        index->num_slots = num_slots ? 2 * num_slots : 1024;
+        index->used = 0;
+
+        if ((index->slots = calloc((size_t)index->num_slots, sizeof(int))) == NULL) {
+            free(slots);
+            return (-1);
+        }
+
+        for (i = 0; i < num_slots; i++)
+            if (slots[i])
+                index_add(dist, index, slots[i] - 1);
+
+        free(slots);
+    }
+
+    dst = dist->files[number].dst;
+
+    for (slot = (int)(hash_dst(dst) & (unsigned)(index->num_slots - 1));
+         index->slots[slot]; slot = (slot + 1) & (index->num_slots - 1))
+        if (!strcmp(dist->files[index->slots[slot] - 1].dst, dst))
+            return (0);
+
+    index->slots[slot] = number + 1;
+    index->used++;
+
+    return (0);
+}
+
 /*
  * 'info()' - Show the EPM copyright and license.
  */
@@ -349,13 +629,20 @@ static void usage(void) {
     puts("Usage: epminstall [options] file1 file2 ... fileN directory");
     puts("       epminstall [options] file1 file2");
     puts("       epminstall [options] -d directory1 directory2 ... directoryN");
+    puts("       epminstall [options] --commit");
     puts("Options:");
     puts("-g group");
     puts("    Set group of installed file(s).");
     puts("-m mode");
     puts("    Set permissions of installed file(s).");
-    puts("-u owner");
+    puts("-o owner");
     puts("    Set owner of installed file(s).");
+    puts("--commit");
+    puts("    Apply the journal to the list file.");
+    puts("--journal");
+    puts("    Append to the journal instead of updating the list file.");
+    puts("--list-file filename.list");
+    puts("    Set the list file to update.");
 
     exit(1);
 }
@@ -23,6 +23,37 @@
  */
 
 #include "epm.h"
+#include <fcntl.h>
+#include <utime.h>
+
+/*
+ * Strip batching limits...
+ */
+
+#define STRIP_BATCH 64    /* Maximum number of files per strip command */
+#define STRIP_MAX_JOBS 16 /* Maximum number of concurrent strip commands */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Object file to strip ****/
+{
+    file_t *file;         /* Distribution file */
+    int same;             /* Index of identical object, -1 to strip, -2 if stripped */
+    char cachefile[1024], /* Stripped file in cache */
+        tempfile[1024];   /* Temporary file being stripped */
+} strip_t;
+
+/*
+ * Local functions...
+ */
+
+static run_job_t *strip_batch(const char **files, int num_files);
+static void strip_debug(dist_t *dist, const char *debugpkg);
+static void strip_finish(const char **temps, int num_temps, int success);
+static int strip_object(const unsigned char *header, ssize_t bytes);
+static int strip_wait(run_job_t *job);
 
 /*
  * 'copy_file()' - Copy a file.
@@ -177,48 +208,75 @@ make_link(const char *dst, /* I - Destination file */
 
 /*
  * 'strip_execs()' - Strip symbols from executable files in the distribution.
+ *
+ * Stripped copies are stored in the "strip" subdirectory of the cache
+ * directory, named by the SHA-256 digest of the unstripped file, and the
+ * distribution is updated to package the cached copy.  The source files
+ * are never modified.
+ *
+ * ELF objects are stripped directly; other objects (and ELF objects we
+ * can't handle) are stripped using the EPM_STRIP command.  When "debugpkg"
+ * is not NULL, the debugging information removed from ELF objects is added
+ * to the named subpackage under "/usr/lib/debug"; objects stripped using
+ * EPM_STRIP have a "nodebug" marker in the cache instead.
  */
 
-void strip_execs(dist_t *dist) /* I - Distribution to strip... */
+void strip_execs(dist_t *dist,         /* I - Distribution to strip... */
+                 const char *debugpkg) /* I - Debug subpackage or NULL */
 {
-    int i;          /* Looping var */
-    file_t *file;   /* Software file */
-    FILE *fp;       /* File pointer */
-    char header[4]; /* File header... */
+    int i, j;                        /* Looping vars */
+    file_t *file;                    /* Software file */
+    int fd;                          /* File descriptor */
+    unsigned char header[8];         /* File header... */
+    ssize_t bytes;                   /* Bytes read */
+    int is_elf;                      /* ELF object file? */
+    char hex[SHA256_HEX_SIZE],       /* Digest of unstripped file */
+        debugfile[1024],             /* Debug information file */
+        debugtemp[1024],             /* Temporary debug information file */
+        nodebug[1024];               /* No debug information marker */
+    int num_objects,                 /* Number of object files to strip */
+        num_cached;                  /* Number of object files already cached */
+    strip_t *objects,                /* Object files to strip */
+        *object;                     /* Current object file */
+    int *hashed,                     /* Object file indices + 1 by digest */
+        num_hashed;                  /* Size of hash table */
+    unsigned hash;                   /* Hash of digest */
+    char prefix[8];                  /* First hex digits of digest */
+    const char **temps;              /* Temporary files to strip */
+    int batch,                       /* Files per strip command */
+        max_jobs,                    /* Maximum concurrent strip commands */
+        num_jobs;                    /* Number of running strip commands */
+    run_job_t *jobs[STRIP_MAX_JOBS]; /* Running strip commands */
+    int starts[STRIP_MAX_JOBS],      /* First file in each running command */
+        counts[STRIP_MAX_JOBS];      /* Number of files in each running command */
+    time_t started;                  /* Time stripping started */
+
+    started = time(NULL);
 
     /*
-     * Loop through the distribution files and strip any executable
-     * files.
+     * Loop through the distribution files and collect any executable
+     * object files that are not already in the cache...
      */
 
-    for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
+    num_hashed = 2 * dist->num_files + 1;
+
+    if ((objects = calloc((size_t)dist->num_files + 1, sizeof(strip_t))) == NULL ||
+        (temps = calloc((size_t)dist->num_files + 1, sizeof(char *))) == NULL ||
+        (hashed = calloc((size_t)num_hashed, sizeof(int))) == NULL) {
+        fputs("epm: Unable to allocate memory for strip list!\n", stderr);
+        exit(1);
+    }
+
+    for (i = dist->num_files, file = dist->files, num_objects = 0, num_cached = 0;
+         i > 0; i--, file++)
         if (tolower(file->type) == 'f' && (file->mode & 0111) &&
             strstr(file->options, "nostrip()") == NULL) {
             /*
-             * OK, this file has executable permissions; see if it is a
-             * script...
+             * OK, this file has executable permissions; see if it is an
+             * object file...
              */
 
-            if ((fp = fopen(file->src, "rb")) != NULL) {
-                /*
-                 * Read the first 3 bytes of the file...
-                 */
-
-                if (fread(header, 1, sizeof(header) - 1, fp) == 0)
-                    continue;
-
-                header[sizeof(header) - 1] = '\0';
-
-                fclose(fp);
-
-                /*
-                 * Check for "#!/" or "#" + whitespace at the beginning of the file...
-                 */
-
-                if (!strncmp(header, "#!/", 3) ||
-                    (header[0] == '#' && isspace(header[1] & 255)))
-                    continue;
-            } else {
+            if ((fd = open(file->src, O_RDONLY)) < 0) {
                 /*
                  * File could not be opened; error out...
                  */
@@ -231,12 +289,441 @@ void strip_execs(dist_t *dist) /* I - Distribution to strip... */
                 exit(1);
             }
 
+            bytes = read(fd, header, sizeof(header));
+
+            close(fd);
+
+            if (!strip_object(header, bytes))
+                continue;
+
+            is_elf = bytes >= 4 && !memcmp(header, "\177ELF", 4);
+
+            /*
+             * Look for a stripped copy in the cache...
+             */
+
+            object = objects + num_objects;
+
+            if (digest_file(file->src, hex, sizeof(hex))) {
+                fprintf(stderr, "epm: Unable to read file \"%s\" -\n     %s\n",
+                        file->src, strerror(errno));
+                exit(1);
+            }
+
+            if (snprintf(object->cachefile, sizeof(object->cachefile), "%s/strip/%c%c/%s",
+                         CacheDir, hex[0], hex[1], hex) >= (int)sizeof(file->src)) {
+                fprintf(stderr, "epm: Cache directory \"%s\" is too long!\n", CacheDir);
+                exit(1);
+            }
+
+            snprintf(debugfile, sizeof(debugfile), "%s.debug", object->cachefile);
+            snprintf(nodebug, sizeof(nodebug), "%s.nodebug", object->cachefile);
+
+            if (!access(object->cachefile, R_OK) &&
+                (!debugpkg || !is_elf || !access(debugfile, R_OK) ||
+                 !access(nodebug, R_OK))) {
+                if (Verbosity > 1)
+                    printf("%s: using cached %s\n", file->src, object->cachefile);
+
+                utime(object->cachefile, NULL);
+
+                strlcpy(file->src, object->cachefile, sizeof(file->src));
+                num_cached++;
+                continue;
+            }
+
+            /*
+             * Not cached; strip a temporary copy, unless an identical file is
+             * already being stripped...
+             */
+
+            object->file = file;
+
             /*
-             * Strip executables...
+             * The digest is already random, so the first few hex digits make a
+             * good hash...
              */
 
-            run_command(NULL, EPM_STRIP " %s", file->src);
+            strlcpy(prefix, hex, sizeof(prefix));
+
+            for (hash = (unsigned)strtoul(prefix, NULL, 16) % (unsigned)num_hashed;
+                 hashed[hash] &&
+                 strcmp(objects[hashed[hash] - 1].cachefile, object->cachefile);
+                 hash = (hash + 1) % (unsigned)num_hashed)
+                ;
+
+            if (hashed[hash]) {
+                object->same = hashed[hash] - 1;
+                num_objects++;
+                continue;
+            }
+
+            hashed[hash] = num_objects + 1;
+
+            snprintf(object->tempfile, sizeof(object->tempfile), "%s.%d",
+                     object->cachefile, (int)getpid());
+
+            if (is_elf) {
+                /*
+                 * Try stripping ELF objects ourselves...
+                 */
+
+                snprintf(debugtemp, sizeof(debugtemp), "%s.debug", object->tempfile);
+                snprintf(debugfile, sizeof(debugfile), "%s/strip/%c%c", CacheDir, hex[0], hex[1]);
+                make_directory(debugfile, 0755, (uid_t)-1, (gid_t)-1);
+                snprintf(debugfile, sizeof(debugfile), "%s.debug", object->cachefile);
+
+                if (!elf_strip(file->src, object->tempfile, debugpkg ? debugtemp : NULL, NULL, 0) &&
+                    (!debugpkg || !rename(debugtemp, debugfile)) &&
+                    !rename(object->tempfile, object->cachefile)) {
+                    if (Verbosity > 1)
+                        printf("%s: stripped to %s\n", file->src, object->cachefile);
+
+                    object->same = -2;
+                    num_objects++;
+                    continue;
+                }
+
+                unlink(object->tempfile);
+
+                if (debugpkg)
+                    unlink(debugtemp);
+            }
+
+            object->same = -1;
+
+            if (copy_file(object->tempfile, file->src, 0755, (uid_t)-1, (gid_t)-1))
+                exit(1);
+
+            num_objects++;
+        }
+
+    if (Verbosity && num_cached > 0)
+        printf("Using %d cached stripped executables.\n", num_cached);
+
+    digest_save();
+
+    /*
+     * Make a list of the temporary files to strip...
+     */
+
+    for (i = 0, j = 0; i < num_objects; i++)
+        if (objects[i].same == -1)
+            temps[j++] = objects[i].tempfile;
+
+    /*
+     * Split the files into batches, one batch per strip command, so that
+     * every available processor gets some of the work...
+     */
+
+    if ((max_jobs = run_max_jobs()) > STRIP_MAX_JOBS)
+        max_jobs = STRIP_MAX_JOBS;
+
+    if ((batch = (j + max_jobs - 1) / max_jobs) > STRIP_BATCH)
+        batch = STRIP_BATCH;
+
+    if (Verbosity > 1 && j > 0)
+        printf("Stripping %d files using %d files per command...\n", j, batch);
+
+    /*
+     * Run the batches, waiting for the oldest command whenever all of the
+     * job slots are busy...  Files stripped successfully are moved into the
+     * cache.
+     */
+
+    for (i = 0, num_jobs = 0; i < j || num_jobs > 0;) {
+        if (i < j && num_jobs < max_jobs) {
+            starts[num_jobs] = i;
+            counts[num_jobs] = j - i < batch ? j - i : batch;
+
+            if ((jobs[num_jobs] = strip_batch(temps + i, counts[num_jobs])) != NULL)
+                num_jobs++;
+            else
+                strip_finish(temps + i, counts[num_jobs], 0);
+
+            i += batch;
+        } else {
+            strip_finish(temps + starts[0], counts[0], strip_wait(jobs[0]));
+
+            num_jobs--;
+            memmove(jobs, jobs + 1, (size_t)num_jobs * sizeof(run_job_t *));
+            memmove(starts, starts + 1, (size_t)num_jobs * sizeof(int));
+            memmove(counts, counts + 1, (size_t)num_jobs * sizeof(int));
+        }
+    }
+
+    /*
+     * Point the distribution at the stripped copies...
+     */
+
+    for (i = 0, object = objects; i < num_objects; i++, object++)
+        if (!access(object->cachefile, R_OK))
+            strlcpy(object->file->src, object->cachefile, sizeof(object->file->src));
+
+    free(objects);
+    free(temps);
+    free(hashed);
+
+    /*
+     * Keep the strip cache from growing without bounds...
+     */
+
+    if (num_objects > 0)
+        cache_strip_evict(started);
+
+    /*
+     * Add the debugging information to the debug subpackage...
+     */
+
+    if (debugpkg)
+        strip_debug(dist, debugpkg);
+}
+
+/*
+ * 'strip_batch()' - Start a strip command for a batch of files.
+ */
+
+static run_job_t *              /* O - Job or NULL on error */
+strip_batch(const char **files, /* I - Files to strip */
+            int num_files)      /* I - Number of files */
+{
+    int i;                              /* Looping var */
+    char command[1024],                 /* Strip command and options */
+        *ptr;                           /* Pointer into command */
+    const char *argv[STRIP_BATCH + 16]; /* Argument strings */
+    int argc;                           /* Number of arguments */
+
+    /*
+     * Split EPM_STRIP into the program and its options (IRIX uses several)...
+     */
+
+    strlcpy(command, EPM_STRIP, sizeof(command));
+
+    for (ptr = command, argc = 0; *ptr && argc < 15;) {
+        while (isspace(*ptr & 255))
+            *ptr++ = '\0';
+
+        if (!*ptr)
+            break;
+
+        argv[argc++] = ptr;
+
+        while (*ptr && !isspace(*ptr & 255))
+            ptr++;
+    }
+
+    for (i = 0; i < num_files; i++)
+        argv[argc++] = files[i];
+
+    argv[argc] = NULL;
+
+    if (Verbosity > 1) {
+        for (i = 0; i < argc; i++)
+            printf(i ? " %s" : "%s", argv[i]);
+        putchar('\n');
+    }
+
+    return (run_startv(NULL, (char **)argv));
+}
+
+/*
+ * 'strip_debug()' - Add split debugging information to a subpackage.
+ *
+ * Debug files are installed as "/usr/lib/debug/.build-id/xx/yyyy.debug"
+ * when the object has a GNU build ID, otherwise as
+ * "/usr/lib/debug/path/to/object.debug".  Copies of the same object have
+ * the same build ID and only get one debug file.
+ */
+
+static void                     /* O - Nothing */
+strip_debug(dist_t *dist,       /* I - Distribution */
+            const char *debugpkg) /* I - Debug subpackage */
+{
+    int i, j,                   /* Looping vars */
+        num_files;              /* Number of files before adding debug files */
+    file_t *file;               /* Current file */
+    const char *subpkg;         /* Debug subpackage pointer */
+    char src[1024],             /* Debug information file */
+        dst[1024],              /* Installed debug information file */
+        buildid[256],           /* Build ID */
+        description[1024];      /* Subpackage description */
+    int num_debug;              /* Number of debug files */
+
+    subpkg = NULL;
+
+    for (i = 0, num_debug = 0, num_files = dist->num_files; i < num_files; i++) {
+        /*
+         * add_file() may move the file array, so always index it...
+         */
+
+        file = dist->files + i;
+
+        if (tolower(file->type) != 'f' || strncmp(file->src, CacheDir, strlen(CacheDir)))
+            continue;
+
+        snprintf(src, sizeof(src), "%s.debug", file->src);
+
+        if (access(src, R_OK))
+            continue;
+
+        if (!elf_buildid(src, buildid, sizeof(buildid)) && strlen(buildid) > 2)
+            snprintf(dst, sizeof(dst), "/usr/lib/debug/.build-id/%c%c/%s.debug", buildid[0],
+                     buildid[1], buildid + 2);
+        else
+            snprintf(dst, sizeof(dst), "/usr/lib/debug%s.debug", file->dst);
+
+        for (j = num_files; j < dist->num_files; j++)
+            if (!strcmp(dist->files[j].dst, dst))
+                break;
+
+        if (j < dist->num_files)
+            continue;
+
+        if (!subpkg) {
+            subpkg = find_subpackage(dist, debugpkg);
+
+            snprintf(description, sizeof(description), "Debugging symbols for %s",
+                     dist->product);
+            add_description(dist, NULL, description, subpkg);
+            add_depend(dist, DEPEND_REQUIRES, dist->product, subpkg);
+        }
+
+        file = add_file(dist, subpkg);
+
+        file->type = 'f';
+        file->mode = 0644;
+        strlcpy(file->user, "root", sizeof(file->user));
+        strlcpy(file->group, "root", sizeof(file->group));
+        strlcpy(file->src, src, sizeof(file->src));
+        strlcpy(file->dst, dst, sizeof(file->dst));
+        file->options[0] = '\0';
+
+        num_debug++;
+    }
+
+    if (num_debug > 0) {
+        if (Verbosity)
+            printf("Adding %d debug information files to the \"%s\" subpackage.\n",
+                   num_debug, debugpkg);
+
+        sort_dist_files(dist);
+    }
+}
+
+/*
+ * 'strip_finish()' - Move a batch of stripped files into the cache.
+ *
+ * If the strip command failed, the temporary copies are removed and the
+ * unstripped source files are packaged instead.  Otherwise an empty
+ * "cachefile.nodebug" file records that there is no debugging information
+ * for the object, so the cached copy is also used with --debuginfo.
+ */
+
+static void                      /* O - Nothing */
+strip_finish(const char **temps, /* I - Temporary files */
+             int num_temps,      /* I - Number of files */
+             int success)        /* I - 1 if strip succeeded, 0 otherwise */
+{
+    int i;                /* Looping var */
+    int fd;               /* Marker file */
+    char cachefile[1024], /* Cache filename */
+        nodebug[1024],    /* No debugging information marker */
+        *ptr;             /* Pointer to PID extension */
+
+    for (i = 0; i < num_temps; i++) {
+        strlcpy(cachefile, temps[i], sizeof(cachefile));
+        if ((ptr = strrchr(cachefile, '.')) != NULL)
+            *ptr = '\0';
+
+        if (!success || rename(temps[i], cachefile)) {
+            if (success)
+                fprintf(stderr, "epm: Unable to rename \"%s\" to \"%s\": %s\n",
+                        temps[i], cachefile, strerror(errno));
+
+            unlink(temps[i]);
+            continue;
         }
+
+        snprintf(nodebug, sizeof(nodebug), "%s.nodebug", cachefile);
+
+        if ((fd = open(nodebug, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+            close(fd);
+    }
+}
+
+/*
+ * 'strip_object()' - See if a file header belongs to a strippable object file.
+ */
+
+static int                                /* O - 1 if object file, 0 otherwise */
+strip_object(const unsigned char *header, /* I - First bytes of file */
+             ssize_t bytes)               /* I - Number of bytes */
+{
+    unsigned magic; /* Big-endian magic number */
+
+    if (bytes < 4)
+        return (0);
+
+    magic = ((unsigned)header[0] << 24) | ((unsigned)header[1] << 16) |
+            ((unsigned)header[2] << 8) | header[3];
+
+    switch (magic) {
+    case 0x7f454c46: /* ELF */
+    case 0xfeedface: /* Mach-O, 32-bit big-endian */
+    case 0xcefaedfe: /* Mach-O, 32-bit little-endian */
+    case 0xfeedfacf: /* Mach-O, 64-bit big-endian */
+    case 0xcffaedfe: /* Mach-O, 64-bit little-endian */
+        return (1);
+
+    case 0xcafebabe: /* Mach-O universal binary or Java class file */
+        /*
+         * A universal binary has a small number of architectures after the
+         * magic number where a Java class file has its version number (45
+         * or more)...
+         */
+
+        return (bytes >= 8 && !header[4] && !header[5] && !header[6] && header[7] > 0 &&
+                header[7] < 30);
+    }
+
+    switch (magic >> 16) {
+    case 0x01df: /* XCOFF, 32-bit (AIX) */
+    case 0x01f7: /* XCOFF, 64-bit (AIX) */
+    case 0x0183: /* ECOFF (Tru64) */
+    case 0x0188: /* ECOFF (Tru64) */
+        return (1);
+    }
+
+    switch (magic & 0xffff) {
+    case 0x0107: /* SOM executable (HP-UX) */
+    case 0x0108: /* SOM shared executable (HP-UX) */
+    case 0x010b: /* SOM demand-loaded executable (HP-UX) */
+    case 0x010e: /* SOM shared library (HP-UX) */
+        return ((magic >> 16) == 0x0210 || (magic >> 16) == 0x020b ||
+                (magic >> 16) == 0x0214);
+    }
+
+    return (0);
+}
+
+/*
+ * 'strip_wait()' - Wait for a strip command to finish.
+ */
+
+static int                /* O - 1 on success, 0 on failure */
+strip_wait(run_job_t *job) /* I - Job */
+{
+    int status; /* Exit status */
+
+    if ((status = run_wait(job)) < 0) {
+        fprintf(stderr, "epm: Strip command crashed on signal %d!\n", -status);
+        return (0);
+    } else if (status) {
+        fprintf(stderr, "epm: Strip command exited with status %d!\n", status);
+        return (0);
+    }
+
+    return (1);
 }
 
 /*
@@ -291,7 +778,7 @@ unlink_directory(const char *directory) /* I - Directory */
          */
 
         if (Verbosity)
-            puts(filename);
+            tasks_printf("%s\n", filename);
 
         if (S_ISDIR(fileinfo.st_mode)) {
             /*
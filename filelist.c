@@ -0,0 +1,936 @@
+/*
+ * File list functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A file list records the installed path, type, permissions, owner, size,
+ * and SHA-256 digest of every file in a portable distribution, one file per
+ * line:
+ *
+ *     type mode user group size digest path
+ *
+ * The digest of a symbolic link is the digest of the link text, and
+ * directories use "-".  The file lists of a previous release are used to
+ * select the files that go into a patch distribution.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** File list entry ****/
+{
+    int type;                      /* Type of file */
+    unsigned mode;                 /* Permissions of file */
+    char user[32],                 /* Owner of file */
+        group[32];                 /* Group of file */
+    long long size;                /* Size of file */
+    char digest[SHA256_HEX_SIZE];  /* SHA-256 digest or "-" */
+    char *path;                    /* Installed path */
+    const char *subpackage;        /* Subpackage or NULL */
+    int used;                      /* 1 if the file is still in the distribution */
+} filelist_entry_t;
+
+typedef struct /**** File list ****/
+{
+    int num_entries,           /* Number of entries */
+        alloc_entries;         /* Allocated entries */
+    filelist_entry_t *entries; /* Entries */
+} filelist_t;
+
+typedef struct /**** Delta candidate ****/
+{
+    const char *path; /* Installed path */
+    int index;        /* Index of file in distribution */
+} filelist_delta_t;
+
+/*
+ * Local functions...
+ */
+
+static int filelist_add(filelist_t *list, char *buffer, const char *subpackage);
+static int filelist_compare(filelist_entry_t *a, filelist_entry_t *b);
+static int filelist_compare_deltas(filelist_delta_t *a, filelist_delta_t *b);
+static int filelist_digest(file_t *file, char *path, size_t pathsize, long long *size,
+                           char *hex, size_t hexsize);
+static int filelist_extract(dist_t *dist, const char *prodname, const char *filename,
+                            const char *directory, filelist_delta_t *deltas,
+                            int num_deltas);
+static void filelist_free(filelist_t *list);
+static int filelist_load(filelist_t *list, dist_t *dist, const char *prodname,
+                         const char *filename);
+static int filelist_load_package(filelist_t *list, dist_t *dist, const char *prodname,
+                                 const char *filename);
+static FILE *filelist_open(const char *filename, int *piped);
+static int filelist_subpackage(dist_t *dist, const char *prodname, const char *name,
+                               const char *ext, const char **subpackage);
+static int filelist_tar_data(FILE *fp, long long size, FILE *out, char *buffer);
+static int filelist_tar_next(FILE *fp, char *name, size_t namesize, long long *size);
+
+/*
+ * 'filelist_patch()' - Select the patch files from a previous release.
+ *
+ * Files that are new or have changed since the previous release are marked
+ * as patch files with an uppercase type, and files that are no longer in
+ * the distribution are added as removed ("R") files.  "filename" is a file
+ * list, a directory containing file lists, or a portable distribution.
+ *
+ * When making delta patches from a portable distribution, the previous
+ * version of each changed file is copied to the "prodname.old" directory
+ * and recorded with a "delta(filename)" option.
+ */
+
+int                                /* O - 0 on success, -1 on error */
+filelist_patch(dist_t *dist,       /* I - Distribution */
+               const char *prodname, /* I - Product name */
+               const char *filename, /* I - Previous release */
+               const char *directory) /* I - Output directory */
+{
+    int i;                        /* Looping var */
+    int status;                   /* Return status */
+    int num_deltas;               /* Number of delta candidates */
+    filelist_delta_t *deltas;     /* Delta candidates */
+    int changed,                  /* Number of changed files */
+        removed;                  /* Number of removed files */
+    file_t *file;                 /* Current file */
+    filelist_t list;              /* Previous file list */
+    filelist_entry_t key,         /* Search key */
+        *entry;                   /* Matching entry */
+    char path[1024];              /* Installed path */
+    char hex[SHA256_HEX_SIZE];    /* Digest of current file */
+    long long size;               /* Size of current file */
+
+    memset(&list, 0, sizeof(list));
+
+    if (filelist_load(&list, dist, prodname, filename)) {
+        filelist_free(&list);
+        return (-1);
+    }
+
+    if (list.num_entries == 0) {
+        fprintf(stderr, "epm: No file lists for \"%s\" found in \"%s\".\n", prodname,
+                filename);
+        filelist_free(&list);
+        return (-1);
+    }
+
+    if (list.num_entries > 1)
+        qsort(list.entries, (size_t)list.num_entries, sizeof(filelist_entry_t),
+              (int (*)(const void *, const void *))filelist_compare);
+
+    /*
+     * Compare the current files against the previous release; the size is
+     * checked first so that only files with the same size are read...
+     */
+
+    changed = 0;
+    memset(&key, 0, sizeof(key));
+
+    num_deltas = 0;
+
+    if ((deltas = calloc((size_t)dist->num_files + 1, sizeof(filelist_delta_t))) ==
+        NULL) {
+        fputs("epm: Out of memory comparing files!\n", stderr);
+        filelist_free(&list);
+        return (-1);
+    }
+
+    for (i = dist->num_files, file = dist->files; i > 0; i--, file++) {
+        if (file->type == 'R')
+            continue;
+
+        file->type = tolower(file->type);
+
+        if (filelist_digest(file, path, sizeof(path), &size, NULL, 0)) {
+            free(deltas);
+            filelist_free(&list);
+            return (-1);
+        }
+
+        key.path = path;
+        entry = bsearch(&key, list.entries, (size_t)list.num_entries,
+                        sizeof(filelist_entry_t),
+                        (int (*)(const void *, const void *))filelist_compare);
+
+        if (entry) {
+            entry->used = 1;
+
+            if (entry->type == file->type && entry->mode == (unsigned)file->mode &&
+                !strcmp(entry->user, file->user) && !strcmp(entry->group, file->group) &&
+                entry->size == size) {
+                if (file->type == 'd')
+                    continue;
+
+                if (filelist_digest(file, path, sizeof(path), &size, hex, sizeof(hex))) {
+                    free(deltas);
+                    filelist_free(&list);
+                    return (-1);
+                }
+
+                if (!strcmp(entry->digest, hex))
+                    continue;
+            }
+        }
+
+        if (Verbosity > 1)
+            printf("    %s %s\n", entry ? "changed" : "added  ", path);
+
+        file->type = toupper(file->type);
+        changed++;
+
+        if (file->type == 'F' && entry && entry->type == 'f') {
+            deltas[num_deltas].path = file->dst;
+            deltas[num_deltas].index = (int)(file - dist->files);
+            num_deltas++;
+        }
+    }
+
+    /*
+     * Get the previous versions of changed files for delta patches...
+     */
+
+    status = 0;
+
+    if (DeltaPatch && num_deltas > 0) {
+        if (num_deltas > 1)
+            qsort(deltas, (size_t)num_deltas, sizeof(filelist_delta_t),
+                  (int (*)(const void *, const void *))filelist_compare_deltas);
+
+        status = filelist_extract(dist, prodname, filename, directory, deltas,
+                                  num_deltas);
+    }
+
+    free(deltas);
+
+    if (status) {
+        filelist_free(&list);
+        return (-1);
+    }
+
+    /*
+     * Then remove the files that are no longer used; directories and
+     * configuration files are left alone since they may contain local
+     * changes...
+     */
+
+    removed = 0;
+
+    for (i = 0, entry = list.entries; i < list.num_entries; i++, entry++) {
+        if (entry->used || entry->type == 'c' || entry->type == 'd')
+            continue;
+
+        if (Verbosity > 1)
+            printf("    removed %s\n", entry->path);
+
+        file = add_file(dist, entry->subpackage);
+        file->type = 'R';
+        file->mode = (mode_t)entry->mode;
+        strlcpy(file->user, entry->user, sizeof(file->user));
+        strlcpy(file->group, entry->group, sizeof(file->group));
+        strlcpy(file->dst, entry->path, sizeof(file->dst));
+        file->src[0] = '\0';
+        file->options[0] = '\0';
+        removed++;
+    }
+
+    filelist_free(&list);
+
+    if (Verbosity)
+        printf("Patch from %s has %d new or changed and %d removed files.\n", filename,
+               changed, removed);
+
+    if (!changed && !removed)
+        fprintf(stderr, "epm: No files have changed since \"%s\".\n", filename);
+
+    return (0);
+}
+
+/*
+ * 'filelist_write()' - Write the file list for a package or subpackage.
+ */
+
+int                                   /* O - 0 on success, -1 on error */
+filelist_write(dist_t *dist,          /* I - Distribution */
+               const char *subpackage, /* I - Subpackage or NULL */
+               const char *filename)   /* I - File list to write */
+{
+    int i;                     /* Looping var */
+    FILE *fp;                  /* File list */
+    file_t *file;              /* Current file */
+    char path[1024];           /* Installed path */
+    char hex[SHA256_HEX_SIZE]; /* Digest of file */
+    long long size;            /* Size of file */
+
+    if ((fp = fopen(filename, "w")) == NULL) {
+        fprintf(stderr, "epm: Unable to create file list \"%s\" - %s\n", filename,
+                strerror(errno));
+        return (-1);
+    }
+
+    fputs("# EPM file list\n", fp);
+
+    for (i = dist->num_files, file = dist->files; i > 0; i--, file++) {
+        if (file->subpackage != subpackage || file->type == 'R')
+            continue;
+
+        if (filelist_digest(file, path, sizeof(path), &size, hex, sizeof(hex))) {
+            fclose(fp);
+            unlink(filename);
+            return (-1);
+        }
+
+        fprintf(fp, "%c %04o %s %s %lld %s %s\n", tolower(file->type),
+                (unsigned)file->mode, file->user, file->group, size, hex, path);
+    }
+
+    if (fclose(fp)) {
+        fprintf(stderr, "epm: Unable to write file list \"%s\" - %s\n", filename,
+                strerror(errno));
+        unlink(filename);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'filelist_add()' - Add the lines in a file list buffer.
+ */
+
+static int                        /* O - 0 on success, -1 on error */
+filelist_add(filelist_t *list,    /* I - File list */
+             char *buffer,        /* I - File list data (modified) */
+             const char *subpackage) /* I - Subpackage or NULL */
+{
+    char *line,                /* Current line */
+        *next;                 /* Next line */
+    int pathpos;               /* Offset of path in line */
+    char type;                 /* Type of file */
+    filelist_entry_t *entry;   /* New entry */
+
+    for (line = buffer; *line; line = next) {
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+
+        if (!line[0] || line[0] == '#')
+            continue;
+
+        if (list->num_entries >= list->alloc_entries) {
+            filelist_entry_t *temp; /* New entries array */
+
+            if ((temp = realloc(list->entries, (size_t)(list->alloc_entries + 1024) *
+                                                   sizeof(filelist_entry_t))) == NULL) {
+                fputs("epm: Out of memory reading file list!\n", stderr);
+                return (-1);
+            }
+
+            list->entries = temp;
+            list->alloc_entries += 1024;
+        }
+
+        entry = list->entries + list->num_entries;
+        memset(entry, 0, sizeof(filelist_entry_t));
+        pathpos = 0;
+
+        if (sscanf(line, "%c%o%31s%31s%lld%64s %n", &type, &entry->mode,
+                   entry->user, entry->group, &entry->size, entry->digest,
+                   &pathpos) < 6 ||
+            !pathpos || !line[pathpos]) {
+            fprintf(stderr, "epm: Bad file list line \"%s\".\n", line);
+            return (-1);
+        }
+
+        entry->type = tolower(type & 255);
+        entry->subpackage = subpackage;
+
+        if ((entry->path = strdup(line + pathpos)) == NULL) {
+            fputs("epm: Out of memory reading file list!\n", stderr);
+            return (-1);
+        }
+
+        list->num_entries++;
+    }
+
+    return (0);
+}
+
+/*
+ * 'filelist_compare()' - Compare two file list entries.
+ */
+
+static int                         /* O - Result of comparison */
+filelist_compare(filelist_entry_t *a, /* I - First entry */
+                 filelist_entry_t *b) /* I - Second entry */
+{
+    return (strcmp(a->path, b->path));
+}
+
+/*
+ * 'filelist_compare_deltas()' - Compare two delta candidates.
+ */
+
+static int                                /* O - Result of comparison */
+filelist_compare_deltas(filelist_delta_t *a, /* I - First candidate */
+                        filelist_delta_t *b) /* I - Second candidate */
+{
+    return (strcmp(a->path, b->path));
+}
+
+/*
+ * 'filelist_digest()' - Get the installed path, size, and digest of a file.
+ *
+ * The digest is only computed when "hex" is not NULL.
+ */
+
+static int                     /* O - 0 on success, -1 on error */
+filelist_digest(file_t *file,  /* I - File */
+                char *path,    /* O - Installed path */
+                size_t pathsize, /* I - Size of path buffer */
+                long long *size, /* O - Size of file */
+                char *hex,     /* O - Digest or NULL */
+                size_t hexsize) /* I - Size of digest buffer */
+{
+    struct stat fileinfo;                 /* File information */
+    sha256_t ctx;                         /* Digest of link text */
+    unsigned char digest[SHA256_SIZE];    /* Binary digest */
+
+    if (tolower(file->type) == 'i')
+        snprintf(path, pathsize, "%s/init.d/%s", SoftwareDir, file->dst);
+    else
+        strlcpy(path, file->dst, pathsize);
+
+    switch (tolower(file->type)) {
+    case 'd':
+        *size = 0;
+        if (hex)
+            strlcpy(hex, "-", hexsize);
+        break;
+
+    case 'l':
+        *size = (long long)strlen(file->src);
+        if (hex) {
+            sha256_init(&ctx);
+            sha256_update(&ctx, file->src, strlen(file->src));
+            sha256_final(&ctx, digest);
+            sha256_hex(digest, hex, hexsize);
+        }
+        break;
+
+    default:
+        if (stat(file->src, &fileinfo)) {
+            fprintf(stderr, "epm: Unable to stat \"%s\" - %s\n", file->src,
+                    strerror(errno));
+            return (-1);
+        }
+
+        *size = (long long)fileinfo.st_size;
+
+        if (hex && digest_file(file->src, hex, hexsize)) {
+            fprintf(stderr, "epm: Unable to read \"%s\" - %s\n", file->src,
+                    strerror(errno));
+            return (-1);
+        }
+        break;
+    }
+
+    return (0);
+}
+
+/*
+ * 'filelist_extract()' - Copy the previous versions of changed files from a
+ *                        portable distribution.
+ */
+
+static int                                /* O - 0 on success, -1 on error */
+filelist_extract(dist_t *dist,            /* I - Distribution */
+                 const char *prodname,    /* I - Product name */
+                 const char *filename,    /* I - Distribution file */
+                 const char *directory,   /* I - Output directory */
+                 filelist_delta_t *deltas, /* I - Delta candidates */
+                 int num_deltas)          /* I - Number of candidates */
+{
+    FILE *fp,                 /* Distribution file */
+        *archivefp,           /* Software archive */
+        *out;                 /* Previous version of file */
+    int piped,                /* Distribution file is a pipe? */
+        archivepiped,         /* Software archive is a pipe? */
+        type,                 /* Member type */
+        status,               /* Return status */
+        count;                /* Number of previous versions */
+    long long size;           /* Size of member */
+    const char *subpackage;   /* Subpackage */
+    char olddir[1024],        /* Directory for previous versions */
+        archivename[1024],    /* Software archive */
+        oldname[1024],        /* Previous version of file */
+        option[1040],         /* Delta option */
+        name[258];            /* Member name */
+    filelist_delta_t key,     /* Search key */
+        *delta;               /* Matching candidate */
+    file_t *file;             /* Changed file */
+    struct stat oldinfo;      /* Directory information */
+
+    snprintf(olddir, sizeof(olddir), "%s/%s.old", directory, prodname);
+    snprintf(archivename, sizeof(archivename), "%s/archive", olddir);
+
+    if (!stat(olddir, &oldinfo))
+        unlink_directory(olddir);
+
+    make_directory(olddir, 0755, getuid(), getgid());
+
+    if ((fp = filelist_open(filename, &piped)) == NULL)
+        return (-1);
+
+    status = 0;
+    count = 0;
+
+    while (!status && (type = filelist_tar_next(fp, name, sizeof(name), &size)) >= 0) {
+        if ((type != TAR_NORMAL && type) ||
+            (filelist_subpackage(dist, prodname, name, ".sw", &subpackage) &&
+             filelist_subpackage(dist, prodname, name, ".ss", &subpackage))) {
+            status = filelist_tar_data(fp, size, NULL, NULL);
+            continue;
+        }
+
+        /*
+         * Copy the software archive so that it can be decompressed...
+         */
+
+        if ((out = fopen(archivename, "wb")) == NULL) {
+            fprintf(stderr, "epm: Unable to create \"%s\" - %s\n", archivename,
+                    strerror(errno));
+            status = -1;
+            break;
+        }
+
+        status = filelist_tar_data(fp, size, out, NULL);
+
+        if (fclose(out))
+            status = -1;
+
+        if (status || (archivefp = filelist_open(archivename, &archivepiped)) == NULL) {
+            status = -1;
+            break;
+        }
+
+        /*
+         * Then copy the previous versions of the changed files...
+         */
+
+        while (!status &&
+               (type = filelist_tar_next(archivefp, name + 1, sizeof(name) - 1, &size)) >=
+                   0) {
+            if (name[1] == '/')
+                key.path = name + 1;
+            else {
+                name[0] = '/';
+                key.path = name;
+            }
+
+            if (type == TAR_NORMAL || !type)
+                delta = bsearch(&key, deltas, (size_t)num_deltas, sizeof(filelist_delta_t),
+                                (int (*)(const void *, const void *))
+                                    filelist_compare_deltas);
+            else
+                delta = NULL;
+
+            if (!delta) {
+                status = filelist_tar_data(archivefp, size, NULL, NULL);
+                continue;
+            }
+
+            file = dist->files + delta->index;
+
+            snprintf(oldname, sizeof(oldname), "%s/%d", olddir, delta->index);
+            snprintf(option, sizeof(option), " delta(%s)", oldname);
+
+            if (strlen(file->options) + strlen(option) >= sizeof(file->options)) {
+                status = filelist_tar_data(archivefp, size, NULL, NULL);
+                continue;
+            }
+
+            if ((out = fopen(oldname, "wb")) == NULL) {
+                fprintf(stderr, "epm: Unable to create \"%s\" - %s\n", oldname,
+                        strerror(errno));
+                status = -1;
+                break;
+            }
+
+            status = filelist_tar_data(archivefp, size, out, NULL);
+
+            if (fclose(out))
+                status = -1;
+
+            if (!status) {
+                strlcat(file->options, option, sizeof(file->options));
+                count++;
+            }
+        }
+
+        if (archivepiped)
+            pclose(archivefp);
+        else
+            fclose(archivefp);
+
+        unlink(archivename);
+    }
+
+    if (piped)
+        pclose(fp);
+    else
+        fclose(fp);
+
+    if (status)
+        fprintf(stderr, "epm: Unable to read previous files from \"%s\".\n", filename);
+    else if (Verbosity)
+        printf("Found previous versions of %d of %d changed files.\n", count,
+               num_deltas);
+
+    return (status);
+}
+
+/*
+ * 'filelist_free()' - Free the memory used by a file list.
+ */
+
+static void                  /* O - Nothing */
+filelist_free(filelist_t *list) /* I - File list */
+{
+    int i; /* Looping var */
+
+    for (i = 0; i < list->num_entries; i++)
+        free(list->entries[i].path);
+
+    free(list->entries);
+}
+
+/*
+ * 'filelist_load()' - Load the file lists of a previous release.
+ */
+
+static int                      /* O - 0 on success, -1 on error */
+filelist_load(filelist_t *list, /* I - File list */
+              dist_t *dist,     /* I - Distribution */
+              const char *prodname, /* I - Product name */
+              const char *filename) /* I - File list, directory, or distribution */
+{
+    FILE *fp;                  /* File list */
+    DIR *dir;                  /* Directory */
+    DIRENT *dent;              /* Directory entry */
+    struct stat fileinfo;      /* File information */
+    char *buffer;              /* File list data */
+    const char *subpackage;    /* Subpackage */
+    char listname[1024];       /* File list in directory */
+    int status;                /* Load status */
+    unsigned char magic[2];    /* File magic */
+
+    if (stat(filename, &fileinfo)) {
+        fprintf(stderr, "epm: Unable to open \"%s\" - %s\n", filename, strerror(errno));
+        return (-1);
+    }
+
+    /*
+     * Directories contain the file lists from a "-k" build...
+     */
+
+    if (S_ISDIR(fileinfo.st_mode)) {
+        if ((dir = opendir(filename)) == NULL) {
+            fprintf(stderr, "epm: Unable to open directory \"%s\" - %s\n", filename,
+                    strerror(errno));
+            return (-1);
+        }
+
+        status = 0;
+
+        while (!status && (dent = readdir(dir)) != NULL) {
+            if (filelist_subpackage(dist, prodname, dent->d_name, ".files", &subpackage))
+                continue;
+
+            snprintf(listname, sizeof(listname), "%s/%s", filename, dent->d_name);
+            status = filelist_load(list, dist, prodname, listname);
+        }
+
+        closedir(dir);
+
+        return (status);
+    }
+
+    /*
+     * Portable distributions are gzip'd tar files...
+     */
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        fprintf(stderr, "epm: Unable to open \"%s\" - %s\n", filename, strerror(errno));
+        return (-1);
+    }
+
+    if (fread(magic, 1, 2, fp) == 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        fclose(fp);
+        return (filelist_load_package(list, dist, prodname, filename));
+    }
+
+    /*
+     * Otherwise read a single file list...
+     */
+
+    rewind(fp);
+
+    if ((buffer = malloc((size_t)fileinfo.st_size + 1)) == NULL) {
+        fputs("epm: Out of memory reading file list!\n", stderr);
+        fclose(fp);
+        return (-1);
+    }
+
+    buffer[fread(buffer, 1, (size_t)fileinfo.st_size, fp)] = '\0';
+    fclose(fp);
+
+    if (filelist_subpackage(dist, prodname, filename, ".files", &subpackage))
+        subpackage = NULL;
+
+    status = filelist_add(list, buffer, subpackage);
+
+    free(buffer);
+
+    return (status);
+}
+
+/*
+ * 'filelist_load_package()' - Load the file lists in a portable
+ *                             distribution.
+ */
+
+static int                              /* O - 0 on success, -1 on error */
+filelist_load_package(filelist_t *list, /* I - File list */
+                      dist_t *dist,     /* I - Distribution */
+                      const char *prodname, /* I - Product name */
+                      const char *filename) /* I - Distribution file */
+{
+    FILE *fp;               /* Distribution file */
+    int piped;              /* Distribution file is a pipe? */
+    int type;               /* Member type */
+    char name[257];         /* Member name */
+    char *buffer;           /* File list data */
+    const char *subpackage; /* Subpackage */
+    long long size;         /* Size of member */
+    int status;             /* Load status */
+
+    if ((fp = filelist_open(filename, &piped)) == NULL)
+        return (-1);
+
+    status = 0;
+
+    while (!status && (type = filelist_tar_next(fp, name, sizeof(name), &size)) >= 0) {
+        if ((type != TAR_NORMAL && type) ||
+            filelist_subpackage(dist, prodname, name, ".files", &subpackage)) {
+            status = filelist_tar_data(fp, size, NULL, NULL);
+            continue;
+        }
+
+        if ((buffer = malloc((size_t)size + 1)) == NULL) {
+            fputs("epm: Out of memory reading file list!\n", stderr);
+            status = -1;
+            break;
+        }
+
+        if ((status = filelist_tar_data(fp, size, NULL, buffer)) == 0) {
+            buffer[size] = '\0';
+            status = filelist_add(list, buffer, subpackage);
+        }
+
+        free(buffer);
+    }
+
+    if (piped)
+        pclose(fp);
+    else
+        fclose(fp);
+
+    if (status)
+        fprintf(stderr, "epm: Unable to read file lists from \"%s\".\n", filename);
+
+    return (status);
+}
+
+/*
+ * 'filelist_open()' - Open a tar file, decompressing it as needed.
+ */
+
+static FILE *                   /* O - File or NULL on error */
+filelist_open(const char *filename, /* I - Tar file */
+              int *piped)       /* O - 1 if the file is a pipe from gzip */
+{
+    FILE *fp;               /* Tar file */
+    unsigned char magic[2]; /* File magic */
+    char command[1280];     /* gzip command */
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        fprintf(stderr, "epm: Unable to open \"%s\" - %s\n", filename, strerror(errno));
+        return (NULL);
+    }
+
+    if (fread(magic, 1, 2, fp) != 2 || magic[0] != 0x1f || magic[1] != 0x8b) {
+        rewind(fp);
+        *piped = 0;
+        return (fp);
+    }
+
+    fclose(fp);
+
+    snprintf(command, sizeof(command), EPM_GZIP " -dc '%s'", filename);
+
+    if ((fp = popen(command, "r")) == NULL) {
+        fprintf(stderr, "epm: Unable to run \"%s\" - %s\n", command, strerror(errno));
+        return (NULL);
+    }
+
+    *piped = 1;
+
+    return (fp);
+}
+
+/*
+ * 'filelist_subpackage()' - Get the subpackage for a distribution file name.
+ *
+ * Distribution files are named "prodname.ext" or "prodname-subpackage.ext".
+ */
+
+static int                         /* O - 0 if a matching file, -1 otherwise */
+filelist_subpackage(dist_t *dist,  /* I - Distribution */
+                    const char *prodname, /* I - Product name */
+                    const char *name,     /* I - Distribution file name */
+                    const char *ext,      /* I - Extension with "." */
+                    const char **subpackage) /* O - Subpackage or NULL */
+{
+    int i;                /* Looping var */
+    const char *base;     /* Base name */
+    size_t baselen,       /* Length of base name */
+        extlen,           /* Length of extension */
+        prodlen;          /* Length of product name */
+
+    *subpackage = NULL;
+
+    if ((base = strrchr(name, '/')) != NULL)
+        base++;
+    else
+        base = name;
+
+    baselen = strlen(base);
+    extlen = strlen(ext);
+    prodlen = strlen(prodname);
+
+    if (baselen < prodlen + extlen || strcmp(base + baselen - extlen, ext) ||
+        strncmp(base, prodname, prodlen))
+        return (-1);
+
+    baselen -= extlen;
+
+    if (baselen == prodlen)
+        return (0);
+
+    if (base[prodlen] != '-')
+        return (-1);
+
+    /*
+     * Subpackages that no longer exist go with the main package...
+     */
+
+    base += prodlen + 1;
+    baselen -= prodlen + 1;
+
+    for (i = 0; i < dist->num_subpackages; i++)
+        if (strlen(dist->subpackages[i]) == baselen &&
+            !strncmp(dist->subpackages[i], base, baselen)) {
+            *subpackage = dist->subpackages[i];
+            break;
+        }
+
+    return (0);
+}
+
+/*
+ * 'filelist_tar_data()' - Read the data for a tar file member.
+ *
+ * The data is copied to "out" or "buffer" if not NULL and skipped otherwise.
+ */
+
+static int                   /* O - 0 on success, -1 on error */
+filelist_tar_data(FILE *fp,  /* I - Tar file */
+                  long long size, /* I - Size of member */
+                  FILE *out, /* I - File to copy to or NULL */
+                  char *buffer) /* I - Buffer to copy to or NULL */
+{
+    char block[8192]; /* Data blocks */
+    size_t bytes,     /* Bytes in this read */
+        valid;        /* Bytes of member data in this read */
+    long long total;  /* Total bytes including padding */
+
+    for (total = (size + 511) & ~511LL; total > 0; total -= (long long)bytes) {
+        bytes = total > (long long)sizeof(block) ? sizeof(block) : (size_t)total;
+
+        if (fread(block, 1, bytes, fp) != bytes)
+            return (-1);
+
+        if (size > 0) {
+            valid = size > (long long)bytes ? bytes : (size_t)size;
+
+            if (out && fwrite(block, 1, valid, out) != valid)
+                return (-1);
+
+            if (buffer) {
+                memcpy(buffer, block, valid);
+                buffer += valid;
+            }
+
+            size -= (long long)valid;
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * 'filelist_tar_next()' - Read the header of the next tar file member.
+ */
+
+static int                   /* O - Member type or -1 at the end */
+filelist_tar_next(FILE *fp,  /* I - Tar file */
+                  char *name, /* O - Member name */
+                  size_t namesize, /* I - Size of name buffer */
+                  long long *size) /* O - Size of member */
+{
+    unsigned char header[512]; /* Tar header block */
+
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) || !header[0])
+        return (-1);
+
+    if (!memcmp(header + 257, "ustar", 5) && header[345])
+        snprintf(name, namesize, "%.155s/%.100s", header + 345, header);
+    else
+        snprintf(name, namesize, "%.100s", header);
+
+    *size = strtoll((char *)header + 124, NULL, 8);
+
+    return (header[156]);
+}
@@ -19,15 +19,30 @@
 //
 
 #include "gui-common.h"
+#include <FL/Fl.H>
 #include <FL/filename.H>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+//
+// Local functions...
+//
+
+static int compare_index(const void *key, const void *entry);
+static int compare_lines(const void *a, const void *b);
+static time_t get_rpmdb_time(void);
+static int load_index(char **buffer, char ***entries, time_t *mtime);
+static void log_timeout_cb(gui_log_t *log);
+static void progress_cb(int fd, gui_progress_t *progress);
+static int progress_read(gui_progress_t *progress);
+
 //
 // 'gui_add_depend()' - Add a dependency to a distribution.
 //
@@ -117,31 +132,39 @@ gui_find_dist(const char *name, // I - Distribution name
 //
 
 void gui_get_installed(void) {
-    int i;            // Looping var
-    int num_files;    // Number of files
-    dirent **files;   // Files
-    const char *ext;  // Extension
-    gui_dist_t *temp; // Pointer to current distribution
-    FILE *fp;         // File to read from
-    char line[1024];  // Line from file...
+    int i;                   // Looping var
+    int num_files;           // Number of files
+    dirent **files;          // Files
+    const char *ext;         // Extension
+    gui_dist_t *temp;        // Pointer to current distribution
+    FILE *fp;                // File to read from
+    char line[1024];         // Line from file...
+    char *indexbuf;          // Index of installed products
+    char **entries;          // Product lines in the index
+    char **entry;            // Matching product line
+    int num_entries;         // Number of product lines
+    time_t index_time;       // Modification time of index
+    struct stat fileinfo;    // Information on removal script
+    FILE *cache;             // RPM query cache
+    char cachetemp[1024];    // Temporary RPM query cache file
+    int cached;              // Reading the RPM query cache?
+    time_t rpm_time;         // Modification time of RPM database
+    long cache_time;         // Modification time recorded in cache
 
     // See if there are any installed files...
     NumInstalled = 0;
     Installed = (gui_dist_t *)0;
 
+    // Load the index of installed products so that we only need to open
+    // the removal scripts of products installed without it...
+    num_entries = load_index(&indexbuf, &entries, &index_time);
+
     if ((num_files = fl_filename_list(EPM_SOFTWARE, &files)) > 0) {
         // Build a distribution list...
         for (i = 0; i < num_files; i++) {
             ext = fl_filename_ext(files[i]->d_name);
 
             if (!strcmp(ext, ".remove")) {
-                // Found a .remove script...
-                snprintf(line, sizeof(line), EPM_SOFTWARE "/%s", files[i]->d_name);
-                if ((fp = fopen(line, "r")) == NULL) {
-                    perror("setup: Unable to open removal script");
-                    exit(1);
-                }
-
                 // Add a new distribution entry...
                 temp = gui_add_dist(&NumInstalled, &Installed);
                 temp->type = PACKAGE_PORTABLE;
@@ -149,6 +172,26 @@ void gui_get_installed(void) {
                 strncpy(temp->product, files[i]->d_name, sizeof(temp->product) - 1);
                 *strrchr(temp->product, '.') = '\0'; // Drop .remove
 
+                snprintf(line, sizeof(line), EPM_SOFTWARE "/%s", files[i]->d_name);
+
+                // Use the index entry unless the removal script is newer...
+                if (num_entries > 0 && !stat(line, &fileinfo) &&
+                    fileinfo.st_mtime <= index_time &&
+                    (entry = (char **)bsearch(temp->product, entries, num_entries,
+                                              sizeof(char *), compare_index)) != NULL &&
+                    sscanf(*entry, "%*[^\t]\t%31[^\t]\t%d\t%d\t%d\t%255[^\t]",
+                           temp->version, &(temp->vernumber), &(temp->rootsize),
+                           &(temp->usrsize), temp->name) == 5) {
+                    free(files[i]);
+                    continue;
+                }
+
+                // Found a .remove script...
+                if ((fp = fopen(line, "r")) == NULL) {
+                    perror("setup: Unable to open removal script");
+                    exit(1);
+                }
+
                 // Read info from the removal script...
                 while (fgets(line, sizeof(line), fp)) {
                     // Only read distribution info lines...
@@ -178,16 +221,50 @@ void gui_get_installed(void) {
         free(files);
     }
 
-    // Get a list of RPM packages that are installed...
-    if (!access("/bin/rpm", 0) &&
-        (fp = popen("/bin/rpm -qa --qf "
-                    "'%{NAME}|%{VERSION}|%{SIZE}|%{SUMMARY}\\n'",
-                    "r")) != NULL) {
+    // The dependency lines in the index are not loaded since uninst would
+    // then act on them...
+    if (indexbuf) {
+        free(entries);
+        free(indexbuf);
+    }
+
+    // Get a list of RPM packages that are installed, reusing the last query
+    // when the RPM database has not changed since...
+    if (!access("/bin/rpm", 0)) {
+        rpm_time = get_rpmdb_time();
+        cache = NULL;
+        cached = 0;
+
+        if (rpm_time && (fp = fopen(EPM_SOFTWARE "/" SOFTWARE_RPMCACHE, "r")) != NULL) {
+            if (fgets(line, sizeof(line), fp) &&
+                sscanf(line, "# rpmdb %ld", &cache_time) == 1 && cache_time == (long)rpm_time)
+                cached = 1;
+            else
+                fclose(fp);
+        }
+
+        if (!cached) {
+            snprintf(cachetemp, sizeof(cachetemp), EPM_SOFTWARE "/" SOFTWARE_RPMCACHE ".%d",
+                     (int)getpid());
+
+            if ((fp = popen("/bin/rpm -qa --qf "
+                            "'%{NAME}|%{VERSION}|%{SIZE}|%{SUMMARY}\\n'",
+                            "r")) != NULL &&
+                rpm_time && (cache = fopen(cachetemp, "w")) != NULL)
+                fprintf(cache, "# rpmdb %ld\n", (long)rpm_time);
+        }
+    } else
+        fp = NULL;
+
+    if (fp) {
         char *version,    // Version number
             *size,        // Size of package
             *description; // Summary string
 
         while (fgets(line, sizeof(line), fp)) {
+            if (cache)
+                fputs(line, cache);
+
             // Drop the trailing newline...
             line[strlen(line) - 1] = '\0';
 
@@ -215,7 +292,17 @@ void gui_get_installed(void) {
             temp->rootsize = (int)(atof(size) / 1024.0 + 0.5);
         }
 
-        pclose(fp);
+        if (cached)
+            fclose(fp);
+        else {
+            i = pclose(fp);
+
+            // Only keep the cache if the query succeeded...
+            if (cache && (fclose(cache) || i))
+                unlink(cachetemp);
+            else if (cache)
+                rename(cachetemp, EPM_SOFTWARE "/" SOFTWARE_RPMCACHE);
+        }
     }
 
     if (NumInstalled > 1)
@@ -290,6 +377,320 @@ void gui_load_file(Fl_Help_View *hv,     // I - Help widget
     fclose(fp);
 }
 
+//
+// 'gui_log_add()' - Add a line to a log.
+//
+// The line is written to the spool file right away, but the log widget is
+// only updated every GUI_LOG_DELAY seconds and keeps the last GUI_LOG_LINES
+// lines.
+//
+
+void gui_log_add(gui_log_t *log,   // I - Log
+                 const char *line) // I - Line to add
+{
+    int fd;                 // Spool file descriptor
+    const char *tmpdir;     // Temporary directory
+    char *temp;             // Copy of line
+    char message[1100];     // Spool file message
+
+    if (!log->spool && log->spoolname[0] != '-') {
+        // Create the spool file for the full log...
+        if ((tmpdir = getenv("TMPDIR")) == NULL || !*tmpdir)
+            tmpdir = "/tmp";
+
+        snprintf(log->spoolname, sizeof(log->spoolname), "%s/epm-%s.XXXXXX", tmpdir,
+                 log->name);
+
+        if ((fd = mkstemp(log->spoolname)) < 0 ||
+            (log->spool = fdopen(fd, "w")) == NULL) {
+            if (fd >= 0)
+                close(fd);
+
+            // Don't try again...
+            strlcpy(log->spoolname, "-", sizeof(log->spoolname));
+        } else {
+            snprintf(message, sizeof(message), "Full log saved to \"%s\".",
+                     log->spoolname);
+            gui_log_add(log, message);
+        }
+    }
+
+    if (log->spool) {
+        fputs(line, log->spool);
+        putc('\n', log->spool);
+    }
+
+    // Queue the line for the widget, dropping the oldest pending line if
+    // the widget would not show it anyway...
+    if ((temp = strdup(line)) == NULL)
+        return;
+
+    if (log->num_pending == GUI_LOG_LINES) {
+        free(log->pending[log->first_pending]);
+        log->pending[log->first_pending] = temp;
+        log->first_pending = (log->first_pending + 1) % GUI_LOG_LINES;
+    } else {
+        log->pending[(log->first_pending + log->num_pending) % GUI_LOG_LINES] = temp;
+        log->num_pending++;
+    }
+
+    if (!log->scheduled) {
+        Fl::add_timeout(GUI_LOG_DELAY, (Fl_Timeout_Handler)log_timeout_cb, log);
+        log->scheduled = 1;
+    }
+}
+
+//
+// 'gui_log_flush()' - Show the pending lines in the log widget.
+//
+
+void gui_log_flush(gui_log_t *log) // I - Log
+{
+    int i;            // Looping var
+    char *line;       // Current line
+
+    if (log->scheduled) {
+        Fl::remove_timeout((Fl_Timeout_Handler)log_timeout_cb, log);
+        log->scheduled = 0;
+    }
+
+    if (log->spool)
+        fflush(log->spool);
+
+    if (!log->num_pending)
+        return;
+
+    for (i = 0; i < log->num_pending; i++) {
+        line = log->pending[(log->first_pending + i) % GUI_LOG_LINES];
+        log->browser->add(line);
+        free(line);
+    }
+
+    log->first_pending = 0;
+    log->num_pending = 0;
+
+    while (log->browser->size() > GUI_LOG_LINES)
+        log->browser->remove(1);
+
+    log->browser->bottomline(log->browser->size());
+}
+
+//
+// 'gui_log_open()' - Initialize a log.
+//
+// The spool file is created when the first line is added.
+//
+
+void gui_log_open(gui_log_t *log,       // I - Log
+                  Fl_Browser *browser,  // I - Log widget
+                  const char *name)     // I - Program name
+{
+    memset(log, 0, sizeof(gui_log_t));
+
+    log->browser = browser;
+    log->name = name;
+}
+
+//
+// 'gui_progress_close()' - Read the last progress records and close the pipe.
+//
+
+void gui_progress_close(gui_progress_t *progress) // I - Progress
+{
+    // The pipe is non-blocking, so this only reads what the script wrote
+    // before it exited - anything it started may keep the pipe open...
+    while (progress->fd >= 0 && progress_read(progress) > 0)
+        ;
+
+    if (progress->fd >= 0) {
+        Fl::remove_fd(progress->fd);
+        close(progress->fd);
+        progress->fd = -1;
+    }
+}
+
+//
+// 'gui_progress_fraction()' - Get the fraction of work done by a script.
+//
+
+double                                             // O - Fraction from 0.0 to 1.0
+gui_progress_fraction(const gui_progress_t *progress) // I - Progress
+{
+    if (progress->total <= 0)
+        return (0.0);
+    else if (progress->done >= progress->total)
+        return (1.0);
+    else
+        return ((double)progress->done / (double)progress->total);
+}
+
+//
+// 'gui_progress_open()' - Start reading progress records from a script.
+//
+// Scripts write one record per line to the pipe:
+//
+//     T units    Total units of work, sent first
+//     K units    Units of work done since the last "K" record
+//
+// The units are kbytes of files backed up and archives extracted for install
+// and patch scripts, and files and directories removed for remove scripts.
+// Unknown records are ignored.
+//
+
+void gui_progress_open(gui_progress_t *progress, // I - Progress
+                       int fd)                   // I - Pipe from script
+{
+    memset(progress, 0, sizeof(gui_progress_t));
+
+    progress->fd = fd;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Fl::add_fd(fd, (void (*)(int, void *))progress_cb, progress);
+}
+
+//
+// 'gui_progress_show()' - Show the progress and estimated time left.
+//
+// The widget is only changed when the value or label changes, so this can
+// be called after every event.
+//
+
+void gui_progress_show(Fl_Progress *widget,  // I - Progress widget
+                       const char *message,  // I - Progress message
+                       double fraction,      // I - Fraction of work done
+                       time_t start)         // I - Time work started
+{
+    int elapsed,      // Seconds since start
+        remaining;    // Estimated seconds left
+    float value;      // Percentage done
+    char label[1024]; // Progress label
+
+    // Only estimate the time left once the rate is somewhat known...
+    elapsed = (int)(time(NULL) - start);
+
+    if (fraction >= 0.01 && fraction < 1.0 && elapsed >= 5) {
+        remaining = (int)(elapsed * (1.0 - fraction) / fraction);
+
+        snprintf(label, sizeof(label), "%s (%d:%02d left)", message, remaining / 60,
+                 remaining % 60);
+    } else
+        strlcpy(label, message, sizeof(label));
+
+    value = (float)(100.0 * fraction);
+
+    if (widget->value() < value - 0.1f || widget->value() > value + 0.1f)
+        widget->value(value);
+
+    if (!widget->label() || strcmp(widget->label(), label))
+        widget->copy_label(label);
+}
+
+//
+// 'gui_ring_line()' - Get the next line from a line splitter.
+//
+// A partial line is returned when "flush" is set or when it fills the
+// buffer, so the buffer always has room after this returns NULL.
+//
+
+const char *                        // O - Line or NULL if none
+gui_ring_line(gui_ring_t *ring,     // I - Line splitter
+              char *line,           // I - Line buffer
+              size_t linesize,      // I - Size of line buffer
+              int flush)            // I - Return a partial line?
+{
+    int i,                          // Looping var
+        len,                        // Length of line
+        offset,                     // Offset of current segment
+        bytes;                      // Bytes in current segment
+    char *nl;                       // Newline
+    size_t count;                   // Bytes to copy
+
+    // Look for a newline in the bytes we have not searched yet, which are
+    // at most two segments of the ring...
+    len = -1;
+
+    while (ring->scanned < ring->used && len < 0) {
+        offset = (ring->head + ring->scanned) % (int)sizeof(ring->data);
+        bytes = (int)sizeof(ring->data) - offset;
+
+        if (bytes > ring->used - ring->scanned)
+            bytes = ring->used - ring->scanned;
+
+        if ((nl = (char *)memchr(ring->data + offset, '\n', (size_t)bytes)) != NULL)
+            len = ring->scanned + (int)(nl - ring->data - offset);
+        else
+            ring->scanned += bytes;
+    }
+
+    if (len < 0) {
+        if (ring->used == 0 || (!flush && ring->used < (int)sizeof(ring->data)))
+            return (NULL);
+
+        len = ring->used;
+    }
+
+    // Copy the line out of the ring...
+    for (i = 0, offset = ring->head; i < len && (size_t)i < linesize - 1; i += (int)count) {
+        count = sizeof(ring->data) - (size_t)offset;
+
+        if (count > (size_t)(len - i))
+            count = (size_t)(len - i);
+        if (count > linesize - 1 - (size_t)i)
+            count = linesize - 1 - (size_t)i;
+
+        memcpy(line + i, ring->data + offset, count);
+        offset = (offset + (int)count) % (int)sizeof(ring->data);
+    }
+
+    line[i] = '\0';
+
+    // Consume the line and its newline...
+    if (len < ring->used)
+        len++;
+
+    ring->head = (ring->head + len) % (int)sizeof(ring->data);
+    ring->used -= len;
+    ring->scanned = 0;
+
+    if (!ring->used)
+        ring->head = 0;
+
+    return (line);
+}
+
+//
+// 'gui_ring_read()' - Read from a pipe into a line splitter.
+//
+
+int                               // O - Bytes read, 0 on end of file, -1 on error
+gui_ring_read(gui_ring_t *ring,   // I - Line splitter
+              int fd)             // I - Pipe to read from
+{
+    struct iovec iov[2];          // Free space in the ring
+    int tail,                     // Offset of first free byte
+        free_bytes;               // Number of free bytes
+    ssize_t bytes;                // Bytes read
+
+    tail = (ring->head + ring->used) % (int)sizeof(ring->data);
+    free_bytes = (int)sizeof(ring->data) - ring->used;
+
+    iov[0].iov_base = ring->data + tail;
+    iov[0].iov_len = (size_t)((int)sizeof(ring->data) - tail);
+
+    if (iov[0].iov_len > (size_t)free_bytes)
+        iov[0].iov_len = (size_t)free_bytes;
+
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = (size_t)free_bytes - iov[0].iov_len;
+
+    if ((bytes = readv(fd, iov, iov[1].iov_len ? 2 : 1)) > 0)
+        ring->used += (int)bytes;
+
+    return ((int)bytes);
+}
+
 //
 // 'gui_sort_dists()' - Compare two distribution names...
 //
@@ -300,3 +701,189 @@ gui_sort_dists(const gui_dist_t *d0, // I - First distribution
 {
     return (strcmp(d0->name, d1->name));
 }
+
+//
+// 'compare_index()' - Compare a product name with an index line.
+//
+
+static int                       // O - Result of comparison
+compare_index(const void *key,   // I - Product name
+              const void *entry) // I - Index line
+{
+    const unsigned char *k = (const unsigned char *)key, // Product name
+        *e = *(const unsigned char *const *)entry;        // Index line
+
+    // The product name in the index line ends with a tab, which sorts
+    // before any other character in a product name...
+    while (*k && *k == *e) {
+        k++;
+        e++;
+    }
+
+    return ((*k ? *k : '\t') - *e);
+}
+
+//
+// 'compare_lines()' - Compare two index lines.
+//
+
+static int                   // O - Result of comparison
+compare_lines(const void *a, // I - First line
+              const void *b) // I - Second line
+{
+    return (strcmp(*(const char *const *)a, *(const char *const *)b));
+}
+
+//
+// 'get_rpmdb_time()' - Get the last modification time of the RPM database.
+//
+
+static time_t               // O - Modification time or 0 if not found
+get_rpmdb_time(void) {
+    int i;                  // Looping var
+    DIR *dir;               // Database directory
+    struct dirent *dent;    // Directory entry
+    struct stat fileinfo;   // File information
+    char filename[1024];    // Database file
+    time_t mtime;           // Latest modification time
+    static const char *const dirs[] = // Database directories
+        {"/var/lib/rpm", "/usr/lib/sysimage/rpm"};
+
+    mtime = 0;
+
+    for (i = 0; i < (int)(sizeof(dirs) / sizeof(dirs[0])); i++) {
+        if ((dir = opendir(dirs[i])) == NULL)
+            continue;
+
+        while ((dent = readdir(dir)) != NULL) {
+            snprintf(filename, sizeof(filename), "%s/%s", dirs[i], dent->d_name);
+
+            if (!stat(filename, &fileinfo) && fileinfo.st_mtime > mtime)
+                mtime = fileinfo.st_mtime;
+        }
+
+        closedir(dir);
+    }
+
+    return (mtime);
+}
+
+//
+// 'load_index()' - Load the index of installed products.
+//
+
+static int                     // O - Number of product lines
+load_index(char **buffer,      // O - Index buffer
+           char ***entries,    // O - Product lines, sorted by product
+           time_t *mtime)      // O - Modification time of index
+{
+    int fd;                    // Index file
+    struct stat fileinfo;      // Index information
+    ssize_t bytes;             // Bytes read
+    size_t total;              // Total bytes read
+    int num_entries;           // Number of product lines
+    char *ptr,                 // Pointer into buffer
+        *next;                 // Next line
+
+    *buffer = NULL;
+    *entries = NULL;
+    *mtime = 0;
+
+    if ((fd = open(EPM_SOFTWARE "/" SOFTWARE_INDEX, O_RDONLY)) < 0)
+        return (0);
+
+    if (fstat(fd, &fileinfo) || (*buffer = (char *)malloc(fileinfo.st_size + 1)) == NULL) {
+        close(fd);
+        return (0);
+    }
+
+    // Read the whole index in one go...
+    for (total = 0; total < (size_t)fileinfo.st_size; total += bytes)
+        if ((bytes = read(fd, *buffer + total, fileinfo.st_size - total)) <= 0)
+            break;
+
+    close(fd);
+
+    (*buffer)[total] = '\0';
+    *mtime = fileinfo.st_mtime;
+
+    // Count the product lines, the most there can be is one per line...
+    for (num_entries = 1, ptr = *buffer; *ptr; ptr++)
+        if (*ptr == '\n')
+            num_entries++;
+
+    if ((*entries = (char **)malloc(num_entries * sizeof(char *))) == NULL) {
+        free(*buffer);
+        *buffer = NULL;
+        return (0);
+    }
+
+    for (num_entries = 0, ptr = *buffer; *ptr; ptr = next) {
+        if ((next = strchr(ptr, '\n')) != NULL)
+            *next++ = '\0';
+        else
+            next = ptr + strlen(ptr);
+
+        if (!strncmp(ptr, "P\t", 2))
+            (*entries)[num_entries++] = ptr + 2;
+    }
+
+    if (num_entries > 1)
+        qsort(*entries, num_entries, sizeof(char *), compare_lines);
+
+    return (num_entries);
+}
+
+//
+// 'log_timeout_cb()' - Update the log widget.
+//
+
+static void                    // O - Nothing
+log_timeout_cb(gui_log_t *log) // I - Log
+{
+    log->scheduled = 0;
+
+    gui_log_flush(log);
+}
+
+//
+// 'progress_cb()' - Read progress records from a script.
+//
+
+static void
+progress_cb(int,                      // I - Pipe to read from
+            gui_progress_t *progress) // I - Progress
+{
+    progress_read(progress);
+}
+
+//
+// 'progress_read()' - Read and parse progress records.
+//
+// The pipe is closed at end of file.
+//
+
+static int                              // O - Bytes read, 0 on end of file, -1 on error
+progress_read(gui_progress_t *progress) // I - Progress
+{
+    int bytes;         // Bytes read
+    const char *line;  // Record from script
+    char buffer[1024]; // Record buffer
+
+    bytes = gui_ring_read(&(progress->ring), progress->fd);
+
+    while ((line = gui_ring_line(&(progress->ring), buffer, sizeof(buffer), 0)) != NULL) {
+        if (line[0] == 'T' && line[1] == ' ')
+            progress->total = atoi(line + 2);
+        else if (line[0] == 'K' && line[1] == ' ')
+            progress->done += atoi(line + 2);
+    }
+
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EINTR)) {
+        Fl::remove_fd(progress->fd);
+        close(progress->fd);
+        progress->fd = -1;
+    }
+
+    return (bytes);
+}
@@ -27,7 +27,9 @@
 
 #include "epm.h"
 #include "epmstring.h"
+#include <FL/Fl_Browser.H>
 #include <FL/Fl_Help_View.H>
+#include <FL/Fl_Progress.H>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -65,6 +67,45 @@ struct gui_intype_t //// Installation types
     int size;          // Size of products in kbytes
 };
 
+//
+// Log structures...
+//
+
+#define GUI_LOG_LINES 2000  // Lines kept in the log widget
+#define GUI_LOG_DELAY 0.05  // Seconds between log widget updates
+
+struct gui_ring_t //// Line splitter for a pipe
+{
+    char data[8192]; // Ring buffer
+    int head,        // Offset of first byte
+        used,        // Number of bytes used
+        scanned;     // Number of bytes searched for a newline
+};
+
+struct gui_log_t //// Installation or removal log
+{
+    Fl_Browser *browser;          // Log widget
+    const char *name;             // Program name for the spool file
+    FILE *spool;                  // Full log
+    char spoolname[1024];         // Full log filename
+    char *pending[GUI_LOG_LINES]; // Lines waiting for the widget
+    int first_pending,            // First pending line
+        num_pending;              // Number of pending lines
+    int scheduled;                // Widget update scheduled?
+};
+
+//
+// Progress structures...
+//
+
+struct gui_progress_t //// Progress records from a script
+{
+    int fd;          // Pipe from script or -1 when closed
+    gui_ring_t ring; // Records from script
+    int total,       // Total units of work or 0 if unknown
+        done;        // Units of work done
+};
+
 //
 // Define a C API function type for comparisons...
 //
@@ -99,6 +140,16 @@ gui_dist_t *gui_add_dist(int *num_d, gui_dist_t **d);
 gui_dist_t *gui_find_dist(const char *name, int num_d, gui_dist_t *d);
 void gui_get_installed(void);
 void gui_load_file(Fl_Help_View *hv, const char *filename);
+void gui_log_add(gui_log_t *log, const char *line);
+void gui_log_flush(gui_log_t *log);
+void gui_log_open(gui_log_t *log, Fl_Browser *browser, const char *name);
+void gui_progress_close(gui_progress_t *progress);
+double gui_progress_fraction(const gui_progress_t *progress);
+void gui_progress_open(gui_progress_t *progress, int fd);
+void gui_progress_show(Fl_Progress *widget, const char *message, double fraction,
+                       time_t start);
+const char *gui_ring_line(gui_ring_t *ring, char *line, size_t linesize, int flush);
+int gui_ring_read(gui_ring_t *ring, int fd);
 int gui_sort_dists(const gui_dist_t *d0, const gui_dist_t *d1);
 
 #endif // !_GUI_COMMON_H_
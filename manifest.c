@@ -0,0 +1,551 @@
+/*
+ * Build manifest functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A build manifest records everything a package was built from - the EPM
+ * version, format, platform, command-line options, the resolved list file
+ * data, and the size, modification time, and inode of every source file and
+ * of any previous release used for patch files - followed by the size and
+ * modification time of each package file that was produced.  A package is
+ * up to date when a new manifest has the same inputs and all of the recorded
+ * package files are unchanged.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <stdarg.h>
+
+/*
+ * Local types...
+ */
+
+struct manifest_s /**** Build manifest ****/
+{
+    int content;        /* 1 to use file contents instead of file information */
+    char *inputs;       /* Input lines */
+    size_t used,        /* Bytes of input lines */
+        alloc;          /* Allocated bytes */
+    int num_outputs,    /* Number of package files */
+        alloc_outputs;  /* Allocated package files */
+    char **outputs;     /* Package files */
+};
+
+/*
+ * Local functions...
+ */
+
+static int manifest_compare(char **a, char **b);
+static void manifest_printf(manifest_t *manifest, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((__format__(__printf__, 2, 3)))
+#endif /* __GNUC__ */
+    ;
+static void manifest_source(manifest_t *manifest, const char *name,
+                            const char *filename);
+static void manifest_string(manifest_t *manifest, const char *name, const char *s);
+
+/*
+ * 'manifest_add_dist()' - Add the list file data for a package or subpackage.
+ */
+
+void                                  /* O - Nothing */
+manifest_add_dist(manifest_t *manifest, /* I - Build manifest */
+                  dist_t *dist,         /* I - Distribution */
+                  const char *subpackage) /* I - Subpackage or NULL */
+{
+    int i;              /* Looping var */
+    description_t *d;   /* Current description */
+    depend_t *dep;      /* Current dependency */
+    command_t *c;       /* Current command */
+    file_t *file;       /* Current file */
+    char name[256];     /* Line name */
+
+    manifest_string(manifest, "subpackage", subpackage ? subpackage : "");
+    manifest_string(manifest, "product", dist->product);
+    manifest_string(manifest, "version", dist->version);
+    manifest_printf(manifest, "vernumber %d %d\n", dist->vernumber, dist->epoch);
+    manifest_string(manifest, "release", dist->release);
+    manifest_string(manifest, "copyright", dist->copyright);
+    manifest_string(manifest, "vendor", dist->vendor);
+    manifest_string(manifest, "packager", dist->packager);
+    manifest_source(manifest, "license", dist->license);
+    manifest_source(manifest, "readme", dist->readme);
+
+    for (i = dist->num_descriptions, d = dist->descriptions; i > 0; i--, d++)
+        if (d->subpackage == subpackage)
+            manifest_string(manifest, "description", d->description);
+
+    for (i = dist->num_depends, dep = dist->depends; i > 0; i--, dep++)
+        if (dep->subpackage == subpackage) {
+            snprintf(name, sizeof(name), "depend %d %s %s", dep->type, dep->version[0],
+                     dep->version[1]);
+            manifest_string(manifest, name, dep->product);
+        }
+
+    for (i = dist->num_commands, c = dist->commands; i > 0; i--, c++)
+        if (c->subpackage == subpackage) {
+            snprintf(name, sizeof(name), "command %d %s", c->type,
+                     c->section ? c->section : "-");
+            manifest_string(manifest, name, c->command);
+        }
+
+    for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
+        if (file->subpackage == subpackage) {
+            snprintf(name, sizeof(name), "file %c %04o %s %s %s", file->type,
+                     (unsigned)file->mode, file->user, file->group, file->dst);
+
+            if (tolower(file->type) == 'd' || tolower(file->type) == 'l')
+                manifest_string(manifest, name, file->src);
+            else
+                manifest_source(manifest, name, file->src);
+
+            if (file->options[0])
+                manifest_string(manifest, "options", file->options);
+        }
+}
+
+/*
+ * 'manifest_add_output()' - Add a package file to a build manifest.
+ */
+
+int                                      /* O - 0 on success, -1 on error */
+manifest_add_output(manifest_t *manifest, /* I - Build manifest */
+                    const char *filename) /* I - Package file */
+{
+    char **temp; /* New outputs array */
+
+    if (manifest->num_outputs >= manifest->alloc_outputs) {
+        if ((temp = realloc(manifest->outputs, (size_t)(manifest->alloc_outputs + 16) *
+                                                   sizeof(char *))) == NULL)
+            return (-1);
+
+        manifest->outputs = temp;
+        manifest->alloc_outputs += 16;
+    }
+
+    if ((manifest->outputs[manifest->num_outputs] = strdup(filename)) == NULL)
+        return (-1);
+
+    manifest->num_outputs++;
+
+    return (0);
+}
+
+/*
+ * 'manifest_add_outputs()' - Add the package files for a product.
+ *
+ * All regular files in the directory that are named for the product (see
+ * 'manifest_is_output()') are added.
+ */
+
+int                                       /* O - 0 on success, -1 on error */
+manifest_add_outputs(manifest_t *manifest, /* I - Build manifest */
+                     const char *directory, /* I - Output directory */
+                     const char *prodname,  /* I - Product name */
+                     dist_t *dist)          /* I - Distribution */
+{
+    DIR *dir;            /* Directory */
+    DIRENT *dent;        /* Directory entry */
+    char filename[1024]; /* Package file */
+    struct stat fileinfo; /* File information */
+    int status = 0;      /* Return status */
+
+    if ((dir = opendir(directory)) == NULL)
+        return (-1);
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (!manifest_is_output(dent->d_name, prodname, dist))
+            continue;
+
+        snprintf(filename, sizeof(filename), "%s/%s", directory, dent->d_name);
+
+        if (stat(filename, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+            continue;
+
+        if (manifest_add_output(manifest, filename))
+            status = -1;
+    }
+
+    closedir(dir);
+
+    /*
+     * Sort the files so the manifest doesn't depend on the directory order...
+     */
+
+    if (manifest->num_outputs > 1)
+        qsort(manifest->outputs, (size_t)manifest->num_outputs, sizeof(char *),
+              (int (*)(const void *, const void *))manifest_compare);
+
+    return (status);
+}
+
+/*
+ * 'manifest_check()' - See if a previous build manifest is still current.
+ */
+
+int                                  /* O - 1 if up to date, 0 otherwise */
+manifest_check(manifest_t *manifest,  /* I - Build manifest */
+               const char *filename)  /* I - Manifest file */
+{
+    FILE *fp;               /* Manifest file */
+    char *buffer;           /* Manifest contents */
+    size_t bytes;           /* Bytes read */
+    struct stat fileinfo;   /* Manifest or package file information */
+    char *line,             /* Current output line */
+        *next,              /* Next line */
+        *name;              /* Package filename */
+    long long size,         /* Recorded size */
+        mtime;              /* Recorded modification time */
+    int num_outputs = 0;    /* Number of package files */
+
+    if (stat(filename, &fileinfo) || (size_t)fileinfo.st_size <= manifest->used)
+        return (0);
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return (0);
+
+    if ((buffer = malloc((size_t)fileinfo.st_size + 1)) == NULL) {
+        fclose(fp);
+        return (0);
+    }
+
+    bytes = fread(buffer, 1, (size_t)fileinfo.st_size, fp);
+    buffer[bytes] = '\0';
+    fclose(fp);
+
+    /*
+     * The inputs must match exactly...
+     */
+
+    if (bytes <= manifest->used || memcmp(buffer, manifest->inputs, manifest->used)) {
+        free(buffer);
+        return (0);
+    }
+
+    /*
+     * And every package file must still be there, unchanged...
+     */
+
+    for (line = buffer + manifest->used; *line; line = next) {
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+
+        if (sscanf(line, "output %lld %lld", &size, &mtime) != 2 ||
+            (name = strchr(line + 7, ' ')) == NULL ||
+            (name = strchr(name + 1, ' ')) == NULL ||
+            stat(name + 1, &fileinfo) || (long long)fileinfo.st_size != size ||
+            (long long)fileinfo.st_mtime != mtime) {
+            free(buffer);
+            return (0);
+        }
+
+        num_outputs++;
+    }
+
+    free(buffer);
+
+    return (num_outputs > 0);
+}
+
+/*
+ * 'manifest_delete()' - Free a build manifest.
+ */
+
+void                               /* O - Nothing */
+manifest_delete(manifest_t *manifest) /* I - Build manifest */
+{
+    int i; /* Looping var */
+
+    if (!manifest)
+        return;
+
+    for (i = 0; i < manifest->num_outputs; i++)
+        free(manifest->outputs[i]);
+
+    free(manifest->outputs);
+    free(manifest->inputs);
+    free(manifest);
+}
+
+/*
+ * 'manifest_digest()' - Get the SHA-256 digest of the manifest inputs.
+ */
+
+char *                               /* O - Hex digest */
+manifest_digest(manifest_t *manifest, /* I - Build manifest */
+                char *hex,            /* I - Hex digest buffer */
+                size_t hexsize)       /* I - Size of buffer */
+{
+    sha256_t ctx;                       /* Digest context */
+    unsigned char digest[SHA256_SIZE];  /* Digest */
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, manifest->inputs, manifest->used);
+    sha256_final(&ctx, digest);
+
+    return (sha256_hex(digest, hex, hexsize));
+}
+
+/*
+ * 'manifest_is_output()' - Determine whether a file is a package file for a
+ *                          product.
+ *
+ * Package files are named "prodname-version...", "prodname-subpackage-...",
+ * or "prodname.ext", so another product whose name starts with the same
+ * characters is not matched.  Build manifests are never package files.
+ */
+
+int                                   /* O - 1 if a package file, 0 otherwise */
+manifest_is_output(const char *name,     /* I - Filename */
+                   const char *prodname, /* I - Product name */
+                   dist_t *dist)         /* I - Distribution */
+{
+    int i;              /* Looping var */
+    size_t len;         /* Length of name */
+
+    len = strlen(name);
+
+    if (len > 9 && !strcmp(name + len - 9, ".manifest"))
+        return (0);
+
+    len = strlen(prodname);
+
+    if (strncmp(name, prodname, len))
+        return (0);
+
+    name += len;
+
+    if (*name == '.')
+        return (1);
+    else if (*name++ != '-')
+        return (0);
+
+    if (!strncmp(name, dist->version, strlen(dist->version)))
+        return (1);
+
+    for (i = 0; i < dist->num_subpackages; i++) {
+        len = strlen(dist->subpackages[i]);
+
+        if (!strncmp(name, dist->subpackages[i], len) && name[len] == '-')
+            return (1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'manifest_new()' - Create a build manifest.
+ *
+ * Content manifests record the SHA-256 digest of each source file instead
+ * of its name, size, modification time, and inode, so that the same
+ * sources give the same manifest in any build directory.
+ */
+
+manifest_t *                      /* O - Build manifest or NULL on error */
+manifest_new(const char *format,   /* I - Package format */
+             const char *platname, /* I - Platform name */
+             int content)          /* I - 1 for a content manifest */
+{
+    manifest_t *manifest; /* Build manifest */
+
+    if ((manifest = calloc(1, sizeof(manifest_t))) == NULL)
+        return (NULL);
+
+    manifest->content = content;
+
+    manifest_printf(manifest, "# EPM build manifest\n");
+    manifest_string(manifest, "epm", EPM_VERSION);
+    manifest_string(manifest, "format", format);
+    manifest_string(manifest, "platform", platname);
+    manifest_string(manifest, "options", BuildOptions);
+    manifest_printf(manifest, "flags %d %d %d\n", CompressFiles, KeepFiles, AooMode);
+
+    if (PatchFrom)
+        manifest_source(manifest, "patch-from", PatchFrom);
+
+    return (manifest);
+}
+
+/*
+ * 'manifest_write()' - Write a build manifest.
+ */
+
+int                                 /* O - 0 on success, -1 on error */
+manifest_write(manifest_t *manifest, /* I - Build manifest */
+               const char *filename) /* I - Manifest file */
+{
+    FILE *fp;             /* Manifest file */
+    int i;                /* Looping var */
+    struct stat fileinfo; /* Package file information */
+    char tempname[1024];  /* Temporary manifest file */
+
+    snprintf(tempname, sizeof(tempname), "%s.tmp", filename);
+
+    if ((fp = fopen(tempname, "w")) == NULL) {
+        fprintf(stderr, "epm: Unable to create build manifest \"%s\": %s\n", tempname,
+                strerror(errno));
+        return (-1);
+    }
+
+    fwrite(manifest->inputs, 1, manifest->used, fp);
+
+    for (i = 0; i < manifest->num_outputs; i++)
+        if (!stat(manifest->outputs[i], &fileinfo))
+            fprintf(fp, "output %lld %lld %s\n", (long long)fileinfo.st_size,
+                    (long long)fileinfo.st_mtime, manifest->outputs[i]);
+
+    if (fclose(fp) || rename(tempname, filename)) {
+        fprintf(stderr, "epm: Unable to write build manifest \"%s\": %s\n", filename,
+                strerror(errno));
+        unlink(tempname);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'manifest_compare()' - Compare two package filenames.
+ */
+
+static int                /* O - Result of comparison */
+manifest_compare(char **a, /* I - First filename */
+                 char **b) /* I - Second filename */
+{
+    return (strcmp(*a, *b));
+}
+
+/*
+ * 'manifest_printf()' - Add a formatted line to the manifest inputs.
+ */
+
+static void                         /* O - Nothing */
+manifest_printf(manifest_t *manifest, /* I - Build manifest */
+                const char *format,   /* I - printf-style format string */
+                ...)                  /* I - Additional arguments as needed */
+{
+    va_list ap;    /* Argument pointer */
+    int bytes;     /* Length of formatted string */
+    char *temp;    /* New buffer */
+    size_t alloc;  /* New size of buffer */
+
+    va_start(ap, format);
+    bytes = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+
+    if (bytes < 0)
+        return;
+
+    if (manifest->used + (size_t)bytes + 1 > manifest->alloc) {
+        for (alloc = manifest->alloc ? manifest->alloc : 4096;
+             alloc < manifest->used + (size_t)bytes + 1; alloc *= 2)
+            ;
+
+        if ((temp = realloc(manifest->inputs, alloc)) == NULL) {
+            fputs("epm: Unable to allocate memory for build manifest!\n", stderr);
+            exit(1);
+        }
+
+        manifest->inputs = temp;
+        manifest->alloc = alloc;
+    }
+
+    va_start(ap, format);
+    vsnprintf(manifest->inputs + manifest->used, manifest->alloc - manifest->used, format,
+              ap);
+    va_end(ap);
+
+    manifest->used += (size_t)bytes;
+}
+
+/*
+ * 'manifest_source()' - Add a source file to the manifest inputs.
+ */
+
+static void                        /* O - Nothing */
+manifest_source(manifest_t *manifest, /* I - Build manifest */
+                const char *name,     /* I - Line name */
+                const char *filename) /* I - Source file */
+{
+    struct stat fileinfo;    /* Source file information */
+    char hex[SHA256_HEX_SIZE]; /* Digest of source file */
+
+    if (manifest->content) {
+        if (!filename[0] || digest_file(filename, hex, sizeof(hex)))
+            strlcpy(hex, "-", sizeof(hex));
+
+        manifest_printf(manifest, "%s %s\n", name, hex);
+        return;
+    }
+
+    if (!filename[0] || stat(filename, &fileinfo))
+        manifest_printf(manifest, "%s - - -", name);
+    else
+        manifest_printf(manifest, "%s %lld %lld %llu", name, (long long)fileinfo.st_size,
+                        (long long)fileinfo.st_mtime,
+                        (unsigned long long)fileinfo.st_ino);
+
+    manifest_string(manifest, "", filename);
+}
+
+/*
+ * 'manifest_string()' - Add a named string to the manifest inputs.
+ *
+ * Backslashes and newlines are escaped so that each string is on a single
+ * line.
+ */
+
+static void                         /* O - Nothing */
+manifest_string(manifest_t *manifest, /* I - Build manifest */
+                const char *name,     /* I - Line name or "" to continue a line */
+                const char *s)        /* I - String */
+{
+    char buffer[1024], /* Escaped string */
+        *bufptr;       /* Pointer into buffer */
+
+    if (name[0])
+        manifest_printf(manifest, "%s", name);
+
+    manifest_printf(manifest, " ");
+
+    for (bufptr = buffer; *s; s++) {
+        if (bufptr >= (buffer + sizeof(buffer) - 3)) {
+            *bufptr = '\0';
+            manifest_printf(manifest, "%s", buffer);
+            bufptr = buffer;
+        }
+
+        if (*s == '\\') {
+            *bufptr++ = '\\';
+            *bufptr++ = '\\';
+        } else if (*s == '\n') {
+            *bufptr++ = '\\';
+            *bufptr++ = 'n';
+        } else
+            *bufptr++ = *s;
+    }
+
+    *bufptr = '\0';
+    manifest_printf(manifest, "%s\n", buffer);
+}
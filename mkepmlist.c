@@ -20,6 +20,7 @@
  */
 
 #include "epm.h"
+#include <fnmatch.h>
 
 /*
  * Lookup hash table structure...
@@ -32,19 +33,79 @@ struct node {
     char *name;  /* User or group name */
 };
 
+/*
+ * Exclude and prune patterns...
+ */
+
+enum {
+    PATTERN_LITERAL, /* Exact name or path */
+    PATTERN_PREFIX,  /* Name or path followed by "*" */
+    PATTERN_SUFFIX,  /* "*" followed by the end of a name */
+    PATTERN_GLOB     /* Anything else, matched using fnmatch() */
+};
+
+struct pattern {
+    int action;          /* WALK_PRUNE or WALK_SKIP */
+    int kind;            /* PATTERN_xxx */
+    int path;            /* 1 = match path below the directory, 0 = name */
+    const char *pattern; /* Pattern from the command-line */
+    const char *text;    /* Text to compare */
+    size_t len;          /* Length of text */
+};
+
+/*
+ * Directory saved by a previous run...
+ */
+
+struct saved {
+    char *src,              /* Source path */
+        *dst;               /* Destination path */
+    char *user,             /* -u option or "-" */
+        *group;             /* -g option or "-" */
+    long long mtime,        /* Modification time */
+        ctime;              /* Change time */
+    unsigned long long inode; /* Inode number */
+    int num_lines,          /* Number of list lines */
+        alloc_lines;        /* Allocated list lines */
+    char **lines;           /* List lines for the entries */
+};
+
+/*
+ * Directory being listed...
+ */
+
+struct root {
+    const char *src,        /* Source path */
+        *dst;               /* Destination path */
+};
+
 /*
  * Globals...
  */
 
 char *DefaultUser = NULL,   /* Default user for entries */
     *DefaultGroup = NULL;   /* Default group for entries */
+int Binary = 0;             /* Write a binary list? */
+int Jobs = 0;               /* Number of threads for reading directories */
+int NumPatterns = 0;        /* Number of exclude and prune patterns */
+struct pattern *Patterns = NULL; /* Exclude and prune patterns */
 struct node Users[HASH_M];  /* Hash table for users */
 struct node Groups[HASH_M]; /* Hash table for groups */
+int NumSaved = 0;           /* Number of saved directories */
+struct saved *Saved = NULL; /* Directories saved by a previous run */
+time_t StartTime;           /* Time we started */
+FILE *StateFile = NULL;     /* Directory state file or NULL */
 
 /*
  * Functions...
  */
 
+int add_pattern(int action, const char *pattern);
+int filter_entry(walk_dir_t *dir, const char *name, struct root *root);
+char *format_record(char *line, size_t linesize, int type, unsigned mode, const char *user,
+                    const char *group, const char *dst, const char *src);
+void free_saved(void);
+char *get_dst(char *dst, size_t dstsize, struct root *root, const char *src);
 char *get_group(gid_t gid);
 char *get_user(uid_t uid);
 void hash_deinit(struct node *a);
@@ -53,9 +114,21 @@ void hash_init(struct node *a);
 char *hash_insert(struct node *a, unsigned id, const char *name);
 char *hash_search(struct node *a, unsigned id);
 void info(void);
+int load_state(const char *listname);
+void print_entry(const struct stat *info, const char *dst, const char *src,
+                 const char *link);
+void print_line(const char *line);
+void print_record(int type, unsigned mode, const char *user, const char *group,
+                  const char *dst, const char *src);
 int process_dir(const char *srcpath, const char *dstpath);
 int process_file(const char *src, const char *dstpath);
+int process_tree(walk_dir_t *dir, const char *dstpath);
 char *quote_string(char *q, const char *s, size_t qsize);
+char *read_record(FILE *fp, char *line, size_t linesize);
+int reuse_dir(walk_dir_t *dir, struct root *root);
+int saved_compare_dst(struct saved *a, struct saved *b);
+int saved_compare_src(struct saved *a, struct saved *b);
+const char *unquote_string(char *s, const char *q, size_t ssize);
 void usage(void);
 
 /*
@@ -67,10 +140,16 @@ main(int argc,     /* I - Number of command-line arguments */
      char *argv[]) /* I - Command-line arguments */
 {
     int i;              /* Looping var */
+    int status;         /* Exit status */
     const char *prefix, /* Installation prefix */
-        *dstpath;       /* Destination path  */
+        *dstpath,       /* Destination path  */
+        *output,        /* Output file or NULL */
+        *since;         /* Previous list or NULL */
     char dst[1024],     /* Destination */
         *ptr;           /* Pointer into filename */
+    char outtemp[1024], /* Temporary output file */
+        statename[1024], /* State file */
+        statetemp[1024]; /* Temporary state file */
     struct stat info;   /* File information */
 
     /*
@@ -80,12 +159,105 @@ main(int argc,     /* I - Number of command-line arguments */
     hash_init(Users);
     hash_init(Groups);
 
+    /*
+     * Load any previous list and open the output files before anything else,
+     * since the new list may replace the previous one...
+     */
+
+    StartTime = time(NULL);
+    output = NULL;
+    since = NULL;
+
+    for (i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--since") == 0) {
+            /*
+             * --since previous.list
+             */
+
+            i++;
+
+            if (i >= argc)
+                usage();
+
+            since = argv[i];
+        } else if (strcmp(argv[i], "--exclude") == 0 || strcmp(argv[i], "--prune") == 0) {
+            /*
+             * --exclude pattern
+             * --prune pattern
+             */
+
+            i++;
+
+            if (i >= argc)
+                usage();
+
+            if (add_pattern(argv[i - 1][2] == 'e' ? WALK_SKIP : WALK_PRUNE, argv[i]))
+                return (1);
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            /*
+             * --binary
+             */
+
+            Binary = 1;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            /*
+             * -o filename
+             */
+
+            i++;
+
+            if (i >= argc)
+                usage();
+
+            output = argv[i];
+        } else if (strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "-g") == 0 ||
+                   strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--prefix") == 0)
+            i++;
+
+    if (since && load_state(since))
+        return (1);
+
+    if (output) {
+        snprintf(outtemp, sizeof(outtemp), "%s.N", output);
+        snprintf(statename, sizeof(statename), "%s.state", output);
+        snprintf(statetemp, sizeof(statetemp), "%s.state.N", output);
+
+        if (!freopen(outtemp, "w", stdout)) {
+            fprintf(stderr, "mkepmlist: Unable to create \"%s\": %s.\n", outtemp,
+                    strerror(errno));
+            return (1);
+        }
+
+        if ((StateFile = fopen(statetemp, "w")) == NULL) {
+            fprintf(stderr, "mkepmlist: Unable to create \"%s\": %s.\n", statetemp,
+                    strerror(errno));
+            unlink(outtemp);
+            return (1);
+        }
+
+        fputs("# mkepmlist state\n", StateFile);
+
+        for (i = 0; i < NumPatterns; i++)
+            fprintf(StateFile, "%c %s\n", Patterns[i].action == WALK_SKIP ? 'x' : 'p',
+                    quote_string(dst, Patterns[i].pattern, sizeof(dst)));
+    }
+
+    /*
+     * Buffer the list in large blocks...
+     */
+
+    setvbuf(stdout, NULL, _IOFBF, 262144);
+
+    if (Binary)
+        fputs(LIST_BINARY, stdout);
+
     /*
      * Loop through the command-line arguments, processing directories as
      * needed...
      */
 
     prefix = NULL;
+    status = 0;
 
     for (i = 1; i < argc; i++)
         if (strcmp(argv[i], "-u") == 0) {
@@ -110,6 +282,20 @@ main(int argc,     /* I - Number of command-line arguments */
                 usage();
 
             DefaultGroup = argv[i];
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            /*
+             * -j jobs
+             */
+
+            if (argv[i][2])
+                Jobs = atoi(argv[i] + 2);
+            else if (++i < argc)
+                Jobs = atoi(argv[i]);
+            else
+                usage();
+
+            if (Jobs < 1)
+                usage();
         } else if (strcmp(argv[i], "--prefix") == 0) {
             i++;
 
@@ -117,6 +303,17 @@ main(int argc,     /* I - Number of command-line arguments */
                 usage();
 
             prefix = argv[i];
+        } else if (strcmp(argv[i], "--since") == 0 || strcmp(argv[i], "-o") == 0 ||
+                   strcmp(argv[i], "--exclude") == 0 || strcmp(argv[i], "--prune") == 0) {
+            /*
+             * Already handled above...
+             */
+
+            i++;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            /*
+             * Already handled above...
+             */
         } else if (argv[i][0] == '-') {
             /*
              * Unknown option...
@@ -173,22 +370,255 @@ main(int argc,     /* I - Number of command-line arguments */
                             *ptr = '\0';
                     }
 
-                    process_file(argv[i], dstpath);
-                } else
-                    process_dir(argv[i], dstpath);
+                    if (process_file(argv[i], dstpath))
+                        status = 1;
+                } else if (process_dir(argv[i], dstpath))
+                    status = 1;
+            } else {
+                fprintf(stderr, "mkepmlist: Unable to stat \"%s\": %s.\n", argv[i],
+                        strerror(errno));
+                status = 1;
             }
         }
 
+    /*
+     * Move the new list and state files into place...
+     */
+
+    if (output) {
+        if (fclose(stdout) | fclose(StateFile)) {
+            fprintf(stderr, "mkepmlist: Unable to write \"%s\": %s.\n", outtemp,
+                    strerror(errno));
+            unlink(outtemp);
+            unlink(statetemp);
+            status = 1;
+        } else if (rename(outtemp, output) || rename(statetemp, statename)) {
+            fprintf(stderr, "mkepmlist: Unable to create \"%s\": %s.\n", output,
+                    strerror(errno));
+            status = 1;
+        }
+    }
+
     /*
      * Free any memory we have left allocated...
      */
 
     hash_deinit(Users);
     hash_deinit(Groups);
+    free_saved();
+    free(Patterns);
+
+    return (status);
+}
+
+/*
+ * 'add_pattern()' - Add an exclude or prune pattern.
+ *
+ * Patterns without a slash match the names of entries at any level, others
+ * match the path below the directory being listed.  Common patterns are
+ * compared directly instead of using fnmatch().
+ */
+
+int                      /* O - 0 on success, -1 on error */
+add_pattern(int action,  /* I - WALK_PRUNE or WALK_SKIP */
+            const char *pattern) /* I - Pattern */
+{
+    struct pattern *temp; /* New pattern */
+    size_t len;           /* Length of pattern */
+
+    if ((temp = realloc(Patterns, (size_t)(NumPatterns + 1) * sizeof(struct pattern))) ==
+        NULL) {
+        fputs("mkepmlist: Out of memory!\n", stderr);
+        return (-1);
+    }
+
+    Patterns = temp;
+    temp += NumPatterns;
+    NumPatterns++;
+
+    temp->action = action;
+    temp->pattern = pattern;
+    temp->path = strchr(pattern, '/') != NULL;
+
+    if (*pattern == '/')
+        pattern++;
+
+    len = strlen(pattern);
+
+    if (!strpbrk(pattern, "*?[\\")) {
+        temp->kind = PATTERN_LITERAL;
+        temp->text = pattern;
+        temp->len = len;
+    } else if (len > 1 && pattern[len - 1] == '*' && strcspn(pattern, "*?[\\") == len - 1) {
+        temp->kind = PATTERN_PREFIX;
+        temp->text = pattern;
+        temp->len = len - 1;
+    } else if (!temp->path && len > 1 && pattern[0] == '*' &&
+               !strpbrk(pattern + 1, "*?[\\")) {
+        temp->kind = PATTERN_SUFFIX;
+        temp->text = pattern + 1;
+        temp->len = len - 1;
+    } else {
+        temp->kind = PATTERN_GLOB;
+        temp->text = pattern;
+        temp->len = len;
+    }
 
     return (0);
 }
 
+/*
+ * 'filter_entry()' - Check an entry against the exclude and prune patterns.
+ *
+ * This is called by the tree scan for each entry; the first matching pattern
+ * wins.
+ */
+
+int                           /* O - WALK_KEEP, WALK_PRUNE, or WALK_SKIP */
+filter_entry(walk_dir_t *dir, /* I - Directory */
+             const char *name, /* I - Name of entry */
+             struct root *root) /* I - Directory being listed */
+{
+    int i;                    /* Looping var */
+    struct pattern *pattern;  /* Current pattern */
+    const char *subject,      /* String to match */
+        *relpath;             /* Directory path below the root */
+    size_t len;               /* Length of subject */
+    char path[1024];          /* Path below the root */
+
+    path[0] = '\0';
+
+    for (i = NumPatterns, pattern = Patterns; i > 0; i--, pattern++) {
+        if (pattern->path) {
+            if (!path[0]) {
+                relpath = dir->path + strlen(root->src);
+
+                if (*relpath == '/')
+                    relpath++;
+
+                if (*relpath)
+                    snprintf(path, sizeof(path), "%s/%s", relpath, name);
+                else
+                    strlcpy(path, name, sizeof(path));
+            }
+
+            subject = path;
+        } else
+            subject = name;
+
+        switch (pattern->kind) {
+            case PATTERN_LITERAL:
+                if (!strcmp(subject, pattern->text))
+                    return (pattern->action);
+                break;
+
+            case PATTERN_PREFIX:
+                if (!strncmp(subject, pattern->text, pattern->len))
+                    return (pattern->action);
+                break;
+
+            case PATTERN_SUFFIX:
+                len = strlen(subject);
+
+                if (len >= pattern->len &&
+                    !strcmp(subject + len - pattern->len, pattern->text))
+                    return (pattern->action);
+                break;
+
+            default:
+                if (!fnmatch(pattern->text, subject, pattern->path ? FNM_PATHNAME : 0))
+                    return (pattern->action);
+                break;
+        }
+    }
+
+    return (WALK_KEEP);
+}
+
+/*
+ * 'format_record()' - Format the list file line for a file, directory, or
+ *                     symlink.
+ */
+
+char *                        /* O - Line */
+format_record(char *line,     /* I - Line buffer */
+              size_t linesize, /* I - Size of line buffer */
+              int type,       /* I - Type of file */
+              unsigned mode,  /* I - Permissions */
+              const char *user, /* I - User name */
+              const char *group, /* I - Group name */
+              const char *dst, /* I - Destination path */
+              const char *src) /* I - Source path or symlink text */
+{
+    char qdst[1024], /* Quoted destination */
+        qsrc[1024];  /* Quoted source/link */
+
+    if (type == 'd')
+        snprintf(line, linesize, "d %o %s %s %s -", mode, user, group,
+                 quote_string(qdst, dst, sizeof(qdst)));
+    else
+        snprintf(line, linesize, "%c %o %s %s %s %s", type, mode, user, group,
+                 quote_string(qdst, dst, sizeof(qdst)),
+                 quote_string(qsrc, src, sizeof(qsrc)));
+
+    return (line);
+}
+
+/*
+ * 'free_saved()' - Free the directories saved by a previous run.
+ */
+
+void free_saved(void) {
+    int i, j;            /* Looping vars */
+    struct saved *saved; /* Current directory */
+
+    for (i = NumSaved, saved = Saved; i > 0; i--, saved++) {
+        free(saved->src);
+        free(saved->dst);
+        free(saved->user);
+        free(saved->group);
+
+        for (j = 0; j < saved->num_lines; j++)
+            free(saved->lines[j]);
+
+        free(saved->lines);
+    }
+
+    free(Saved);
+
+    NumSaved = 0;
+    Saved = NULL;
+}
+
+/*
+ * 'get_dst()' - Get the destination path for a directory being listed.
+ */
+
+char *                   /* O - Destination path */
+get_dst(char *dst,       /* I - Destination buffer */
+        size_t dstsize,  /* I - Size of destination buffer */
+        struct root *root, /* I - Directory being listed */
+        const char *src) /* I - Source path below the directory */
+{
+    size_t dstlen; /* Length of destination path */
+
+    src += strlen(root->src);
+
+    if (*src == '/')
+        src++;
+
+    dstlen = strlen(root->dst);
+
+    if (!*src)
+        strlcpy(dst, root->dst, dstsize);
+    else if (dstlen > 0 && root->dst[dstlen - 1] == '/')
+        snprintf(dst, dstsize, "%s%s", root->dst, src);
+    else
+        snprintf(dst, dstsize, "%s/%s", root->dst, src);
+
+    return (dst);
+}
+
 /*
  * 'get_group()' - Get a group name for the given group ID.
  */
@@ -389,62 +819,337 @@ void info(void) {
 }
 
 /*
- * 'process_dir()' - Process a directory...
+ * 'load_state()' - Load the directories saved by a previous run.
+ *
+ * The list lines of each saved directory are kept so that unchanged
+ * directories can be listed without reading them.  A missing list or state
+ * file, or a state file saved with different exclude and prune patterns, is
+ * not an error; everything is simply read again.
  */
 
 int                              /* O - 0 on success, -1 on error */
-process_dir(const char *srcpath, /* I - Source path */
-            const char *dstpath) /* I - Destination path */
+load_state(const char *listname) /* I - Previous list file */
 {
-    DIR *dir;            /* Directory to read from */
-    struct dirent *dent; /* Current directory entry */
-    size_t srclen;       /* Length of source path */
-    char src[1024];      /* Temporary source path */
+    FILE *fp;                    /* State or list file */
+    int i;                       /* Looping var */
+    int alloc;                   /* Allocated directories */
+    int patterns;                /* Number of matching patterns or -1 */
+    int binary;                  /* Binary list? */
+    int pos;                     /* Position after stamps */
+    long long mtime,             /* Modification time */
+        ctime;                   /* Change time */
+    unsigned long long inode;    /* Inode number */
+    const char *lineptr;         /* Pointer into line */
+    char *ptr;                   /* Pointer into line or path */
+    char **lines;                /* New list lines */
+    struct saved key,            /* Search key */
+        *saved;                  /* Current directory */
+    char filename[1024],         /* State file */
+        line[4096],              /* Line from file */
+        user[256],               /* User name or "-" */
+        group[256],              /* Group name or "-" */
+        src[1024],               /* Source path */
+        dst[1024];               /* Destination path */
 
     /*
-     * Try opening the source directory...
+     * Read the directory stamps...
      */
 
-    if ((dir = opendir(srcpath)) == NULL) {
-        fprintf(stderr, "mkepmlist: Unable to open directory \"%s\": %s.\n", srcpath,
-                strerror(errno));
+    snprintf(filename, sizeof(filename), "%s.state", listname);
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        if (errno == ENOENT)
+            return (0);
 
+        fprintf(stderr, "mkepmlist: Unable to open \"%s\": %s.\n", filename,
+                strerror(errno));
         return (-1);
     }
 
+    alloc = NumSaved;
+    patterns = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if ((line[0] == 'x' || line[0] == 'p') && line[1] == ' ') {
+            /*
+             * Entries were only saved for the same exclude and prune patterns...
+             */
+
+            unquote_string(src, line + 2, sizeof(src));
+
+            if (patterns >= 0 && patterns < NumPatterns &&
+                Patterns[patterns].action == (line[0] == 'x' ? WALK_SKIP : WALK_PRUNE) &&
+                !strcmp(Patterns[patterns].pattern, src))
+                patterns++;
+            else
+                patterns = -1;
+
+            continue;
+        }
+
+        if (sscanf(line, "d %lld %lld %llu%n", &mtime, &ctime, &inode, &pos) < 3)
+            continue;
+
+        lineptr = unquote_string(user, line + pos, sizeof(user));
+        lineptr = unquote_string(group, lineptr, sizeof(group));
+        lineptr = unquote_string(src, lineptr, sizeof(src));
+        unquote_string(dst, lineptr, sizeof(dst));
+
+        if (!src[0] || !user[0] || !group[0])
+            continue;
+
+        if (NumSaved >= alloc) {
+            if ((saved = realloc(Saved, (size_t)(alloc + 256) * sizeof(struct saved))) ==
+                NULL) {
+                fputs("mkepmlist: Out of memory!\n", stderr);
+                fclose(fp);
+                return (-1);
+            }
+
+            Saved = saved;
+            alloc += 256;
+        }
+
+        saved = Saved + NumSaved;
+        memset(saved, 0, sizeof(struct saved));
+
+        saved->mtime = mtime;
+        saved->ctime = ctime;
+        saved->inode = inode;
+
+        NumSaved++;
+
+        if ((saved->src = strdup(src)) == NULL || (saved->dst = strdup(dst)) == NULL ||
+            (saved->user = strdup(user)) == NULL || (saved->group = strdup(group)) == NULL) {
+            fputs("mkepmlist: Out of memory!\n", stderr);
+            fclose(fp);
+            return (-1);
+        }
+    }
+
+    fclose(fp);
+
+    if (patterns != NumPatterns) {
+        free_saved();
+        return (0);
+    }
+
+    if (!NumSaved)
+        return (0);
+
     /*
-     * Read from the directory...
+     * Group the lines of the previous list by directory; directories that
+     * were listed more than once can't be reused...
      */
 
-    srclen = strlen(srcpath);
+    qsort(Saved, (size_t)NumSaved, sizeof(struct saved),
+          (int (*)(const void *, const void *))saved_compare_dst);
 
-    while ((dent = readdir(dir)) != NULL) {
-        /*
-         * Skip "." and ".."...
-         */
+    for (i = 1; i < NumSaved; i++)
+        if (!strcmp(Saved[i - 1].dst, Saved[i].dst))
+            Saved[i - 1].mtime = Saved[i].mtime = -1;
+
+    if ((fp = fopen(listname, "rb")) == NULL) {
+        if (errno == ENOENT) {
+            free_saved();
+            return (0);
+        }
+
+        fprintf(stderr, "mkepmlist: Unable to open \"%s\": %s.\n", listname,
+                strerror(errno));
+        return (-1);
+    }
+
+    if (fgets(line, sizeof(line), fp) && !strcmp(line, LIST_BINARY))
+        binary = 1;
+    else {
+        binary = 0;
+        rewind(fp);
+    }
 
-        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+    while (binary ? read_record(fp, line, sizeof(line)) != NULL
+                  : fgets(line, sizeof(line), fp) != NULL) {
+        if ((line[0] != 'd' && line[0] != 'f' && line[0] != 'l') || line[1] != ' ')
             continue;
 
-        /*
-         * Process file...
-         */
+        if ((ptr = strchr(line, '\n')) != NULL)
+            *ptr = '\0';
 
-        if (srclen > 0 && srcpath[srclen - 1] == '/')
-            snprintf(src, sizeof(src), "%s%s", srcpath, dent->d_name);
-        else
-            snprintf(src, sizeof(src), "%s/%s", srcpath, dent->d_name);
+        lineptr = unquote_string(dst, line + 2, sizeof(dst));
+        lineptr = unquote_string(dst, lineptr, sizeof(dst));
+        lineptr = unquote_string(dst, lineptr, sizeof(dst));
+        unquote_string(dst, lineptr, sizeof(dst));
+
+        if ((ptr = strrchr(dst, '/')) == NULL)
+            continue;
+
+        *ptr = '\0';
+        key.dst = dst;
+
+        if ((saved = bsearch(&key, Saved, (size_t)NumSaved, sizeof(struct saved),
+                             (int (*)(const void *, const void *))saved_compare_dst)) ==
+                NULL &&
+            ptr == dst) {
+            /*
+             * Entries of "/" also have an empty parent...
+             */
+
+            key.dst = "/";
+            saved = bsearch(&key, Saved, (size_t)NumSaved, sizeof(struct saved),
+                            (int (*)(const void *, const void *))saved_compare_dst);
+        }
+
+        if (!saved)
+            continue;
 
-        if (process_file(src, dstpath)) {
-            closedir(dir);
+        if (saved->num_lines >= saved->alloc_lines) {
+            if ((lines = realloc(saved->lines, (size_t)(saved->alloc_lines + 16) *
+                                                   sizeof(char *))) == NULL) {
+                fputs("mkepmlist: Out of memory!\n", stderr);
+                fclose(fp);
+                return (-1);
+            }
+
+            saved->lines = lines;
+            saved->alloc_lines += 16;
+        }
+
+        if ((saved->lines[saved->num_lines] = strdup(line)) == NULL) {
+            fputs("mkepmlist: Out of memory!\n", stderr);
+            fclose(fp);
             return (-1);
         }
+
+        saved->num_lines++;
     }
 
-    closedir(dir);
+    fclose(fp);
+
+    /*
+     * Sort by source path for lookups while reading the new tree...
+     */
+
+    qsort(Saved, (size_t)NumSaved, sizeof(struct saved),
+          (int (*)(const void *, const void *))saved_compare_src);
+
     return (0);
 }
 
+/*
+ * 'print_entry()' - Print the list file line for a file, directory, or
+ *                   symlink.
+ */
+
+void                             /* O - Nothing */
+print_entry(const struct stat *info, /* I - File information */
+            const char *dst,     /* I - Destination path */
+            const char *src,     /* I - Source path */
+            const char *link)    /* I - Symlink text */
+{
+    unsigned mode = (unsigned)(info->st_mode & 07777); /* Permissions */
+
+    if (S_ISDIR(info->st_mode))
+        print_record('d', mode, get_user(info->st_uid), get_group(info->st_gid), dst, "");
+    else if (S_ISLNK(info->st_mode))
+        print_record('l', mode, get_user(info->st_uid), get_group(info->st_gid), dst, link);
+    else if (S_ISREG(info->st_mode))
+        print_record('f', mode, get_user(info->st_uid), get_group(info->st_gid), dst, src);
+}
+
+/*
+ * 'print_line()' - Print a list file line saved from a previous list.
+ */
+
+void                   /* O - Nothing */
+print_line(const char *line) /* I - List file line */
+{
+    int type;          /* Type of file */
+    unsigned mode;     /* Permissions */
+    char user[256],    /* User name */
+        group[256],    /* Group name */
+        dst[1024],     /* Destination path */
+        src[1024];     /* Source path or symlink text */
+
+    if (!Binary) {
+        puts(line);
+        return;
+    }
+
+    type = line[0];
+    line = unquote_string(src, line + 2, sizeof(src));
+    mode = (unsigned)strtoul(src, NULL, 8);
+    line = unquote_string(user, line, sizeof(user));
+    line = unquote_string(group, line, sizeof(group));
+    line = unquote_string(dst, line, sizeof(dst));
+    unquote_string(src, line, sizeof(src));
+
+    print_record(type, mode, user, group, dst, src);
+}
+
+/*
+ * 'print_record()' - Print a list file line or binary record.
+ *
+ * Binary records are described in read_binary() in dist.c.
+ */
+
+void                        /* O - Nothing */
+print_record(int type,      /* I - Type of file */
+             unsigned mode, /* I - Permissions */
+             const char *user, /* I - User name */
+             const char *group, /* I - Group name */
+             const char *dst, /* I - Destination path */
+             const char *src) /* I - Source path or symlink text */
+{
+    char line[4096]; /* List file line */
+
+    if (Binary) {
+        putchar(type);
+        putchar((int)((mode >> 8) & 255));
+        putchar((int)(mode & 255));
+        fwrite(user, strlen(user) + 1, 1, stdout);
+        fwrite(group, strlen(group) + 1, 1, stdout);
+        fwrite(dst, strlen(dst) + 1, 1, stdout);
+        fwrite(src, strlen(src) + 1, 1, stdout);
+    } else
+        puts(format_record(line, sizeof(line), type, mode, user, group, dst, src));
+}
+
+/*
+ * 'process_dir()' - Process a directory...
+ *
+ * The whole tree is read by several threads first, then listed in order.
+ * Directories that are unchanged since the "--since" list are not read.
+ */
+
+int                              /* O - 0 on success, -1 on error */
+process_dir(const char *srcpath, /* I - Source path */
+            const char *dstpath) /* I - Destination path */
+{
+    walk_dir_t *tree; /* Directory tree */
+    struct root root; /* Directory being listed */
+    int status;       /* Return status */
+
+    if (!Jobs && (Jobs = 4 * (int)sysconf(_SC_NPROCESSORS_ONLN)) < 4)
+        Jobs = 4;
+
+    root.src = srcpath;
+    root.dst = dstpath;
+
+    if ((tree = walk_tree(srcpath, Jobs, NumSaved ? (walk_cb_t)reuse_dir : NULL,
+                          NumPatterns ? (walk_filter_t)filter_entry : NULL, &root)) == NULL) {
+        fprintf(stderr, "mkepmlist: Unable to read directory \"%s\": %s.\n", srcpath,
+                strerror(errno));
+
+        return (-1);
+    }
+
+    status = process_tree(tree, dstpath);
+
+    walk_delete(tree);
+
+    return (status);
+}
+
 /*
  * 'process_file()' - Process a file...
  */
@@ -458,9 +1163,7 @@ process_file(const char *src,     /* I - Source path */
     ssize_t linklen;     /* Length of link path */
     size_t dstlen;       /* Length of destination path */
     char link[1024],     /* Link for source */
-        dst[1024],       /* Temporary destination path */
-        qdst[1024],      /* Quoted destination */
-        qsrc[1024];      /* Quoted source/link */
+        dst[1024];       /* Temporary destination path */
 
     /*
      * Get source file info...
@@ -483,26 +1186,9 @@ process_file(const char *src,     /* I - Source path */
         return (-1);
     }
 
-    /*
-     * Process accordingly...
-     */
-
-    if (S_ISDIR(srcinfo.st_mode)) {
-        /*
-         * Directory...
-         */
-
-        printf("d %o %s %s %s -\n", (unsigned)(srcinfo.st_mode & 07777),
-               get_user(srcinfo.st_uid), get_group(srcinfo.st_gid),
-               quote_string(qdst, dst, sizeof(qdst)));
-
-        if (process_dir(src, dst))
-            return (-1);
-    } else if (S_ISLNK(srcinfo.st_mode)) {
-        /*
-         * Symlink...
-         */
+    link[0] = '\0';
 
+    if (S_ISLNK(srcinfo.st_mode)) {
         if ((linklen = readlink(src, link, sizeof(link) - 1)) < 0) {
             fprintf(stderr, "mkepmlist: Unable to read symlink \"%s\": %s.\n", src,
                     strerror(errno));
@@ -510,25 +1196,106 @@ process_file(const char *src,     /* I - Source path */
         }
 
         link[linklen] = '\0';
+    }
 
-        printf("l %o %s %s %s %s\n", (unsigned)(srcinfo.st_mode & 07777),
-               get_user(srcinfo.st_uid), get_group(srcinfo.st_gid),
-               quote_string(qdst, dst, sizeof(qdst)),
-               quote_string(qsrc, link, sizeof(qsrc)));
-    } else if (S_ISREG(srcinfo.st_mode)) {
-        /*
-         * Regular file...
-         */
+    print_entry(&srcinfo, dst, src, link);
 
-        printf("f %o %s %s %s %s\n", (unsigned)(srcinfo.st_mode & 07777),
-               get_user(srcinfo.st_uid), get_group(srcinfo.st_gid),
-               quote_string(qdst, dst, sizeof(qdst)),
-               quote_string(qsrc, src, sizeof(qsrc)));
-    }
+    if (S_ISDIR(srcinfo.st_mode))
+        return (process_dir(src, dst));
 
     return (0);
 }
 
+/*
+ * 'process_tree()' - List the contents of a directory tree.
+ *
+ * Errors are reported in the same order as the list, and the rest of the
+ * tree is still listed.  Directories that were read without errors and have
+ * not changed in the last second are saved to the state file, if any.
+ */
+
+int                              /* O - 0 on success, -1 on error */
+process_tree(walk_dir_t *dir,    /* I - Directory tree */
+             const char *dstpath) /* I - Destination path */
+{
+    int i;               /* Looping var */
+    int status;          /* Return status */
+    int errors;          /* Errors in this directory */
+    walk_entry_t *entry; /* Current entry */
+    struct stat info;    /* File information */
+    size_t srclen,       /* Length of source path */
+        dstlen;          /* Length of destination path */
+    char src[1024],      /* Source path */
+        dst[1024];       /* Destination path */
+    char quser[256],     /* Quoted user name */
+        qgroup[256],     /* Quoted group name */
+        qsrc[1024],      /* Quoted source path */
+        qdst[1024];      /* Quoted destination path */
+
+    if (dir->error) {
+        fprintf(stderr, "mkepmlist: Unable to open directory \"%s\": %s.\n", dir->path,
+                strerror(dir->error));
+
+        if (!dir->num_entries)
+            return (-1);
+    }
+
+    srclen = strlen(dir->path);
+    dstlen = strlen(dstpath);
+    status = dir->error ? -1 : 0;
+    errors = 0;
+
+    memset(&info, 0, sizeof(info));
+
+    for (i = dir->num_entries, entry = dir->entries; i > 0; i--, entry++) {
+        if (srclen > 0 && dir->path[srclen - 1] == '/')
+            snprintf(src, sizeof(src), "%s%s", dir->path, entry->name);
+        else
+            snprintf(src, sizeof(src), "%s/%s", dir->path, entry->name);
+
+        if (dstlen > 0 && dstpath[dstlen - 1] == '/')
+            snprintf(dst, sizeof(dst), "%s%s", dstpath, entry->name);
+        else
+            snprintf(dst, sizeof(dst), "%s/%s", dstpath, entry->name);
+
+        if (entry->error) {
+            if (S_ISLNK(entry->mode))
+                fprintf(stderr, "mkepmlist: Unable to read symlink \"%s\": %s.\n", src,
+                        strerror(entry->error));
+            else
+                fprintf(stderr, "mkepmlist: Unable to stat \"%s\": %s.\n", src,
+                        strerror(entry->error));
+
+            status = -1;
+            errors++;
+            continue;
+        }
+
+        if (entry->text)
+            print_line(entry->text);
+        else {
+            info.st_mode = entry->mode;
+            info.st_uid = entry->uid;
+            info.st_gid = entry->gid;
+
+            print_entry(&info, dst, src, entry->link);
+        }
+
+        if (entry->dir && process_tree(entry->dir, dst))
+            status = -1;
+    }
+
+    if (StateFile && !dir->error && !errors && dir->mtime < StartTime - 1 &&
+        dir->ctime < StartTime - 1)
+        fprintf(StateFile, "d %lld %lld %llu %s %s %s %s\n", dir->mtime, dir->ctime,
+                dir->inode, quote_string(quser, DefaultUser ? DefaultUser : "-", sizeof(quser)),
+                quote_string(qgroup, DefaultGroup ? DefaultGroup : "-", sizeof(qgroup)),
+                quote_string(qsrc, dir->path, sizeof(qsrc)),
+                quote_string(qdst, dstpath, sizeof(qdst)));
+
+    return (status);
+}
+
 /*
  * 'quote_string()' - Quote space, backslash, and $ in a string...
  */
@@ -554,6 +1321,168 @@ quote_string(char *q,       /* I - Quoted string buffer */
     return (q);
 }
 
+/*
+ * 'read_record()' - Read a binary record as a list file line.
+ */
+
+char *                   /* O - Line or NULL at end of file */
+read_record(FILE *fp,    /* I - Binary list file */
+            char *line,  /* I - Line buffer */
+            size_t linesize) /* I - Size of line buffer */
+{
+    int i;               /* Looping var */
+    int ch;              /* Current character */
+    int type;            /* Type of file */
+    unsigned mode;       /* Permissions */
+    char *ptr,           /* Pointer into string */
+        strings[4][1024]; /* User, group, destination, and source */
+
+    if ((type = getc(fp)) == EOF)
+        return (NULL);
+
+    mode = (unsigned)(getc(fp) & 255) << 8;
+    mode |= (unsigned)(getc(fp) & 255);
+
+    for (i = 0; i < 4; i++) {
+        for (ptr = strings[i]; (ch = getc(fp)) != EOF && ch;)
+            if (ptr < (strings[i] + sizeof(strings[i]) - 1))
+                *ptr++ = (char)ch;
+
+        *ptr = '\0';
+
+        if (ch == EOF)
+            return (NULL);
+    }
+
+    return (format_record(line, linesize, type, mode, strings[0], strings[1], strings[2],
+                          strings[3]));
+}
+
+/*
+ * 'reuse_dir()' - Reuse the entries of an unchanged directory.
+ *
+ * This is called by the tree scan for each directory.  Only the directory
+ * itself is checked, so changes to the permissions or ownership of files in
+ * an otherwise unchanged directory are not noticed.
+ */
+
+int                        /* O - 1 if reused, 0 to read the directory */
+reuse_dir(walk_dir_t *dir, /* I - Directory */
+          struct root *root) /* I - Directory being listed */
+{
+    int i;                 /* Looping var */
+    unsigned mode;         /* Permissions */
+    struct saved key,      /* Search key */
+        *saved;            /* Saved directory */
+    walk_entry_t *entry;   /* New entry */
+    const char *lineptr;   /* Pointer into list line */
+    char *ptr;             /* Pointer into name */
+    char dst[1024],        /* Destination path */
+        name[1024];        /* Token from list line */
+
+    key.src = dir->path;
+
+    if ((saved = bsearch(&key, Saved, (size_t)NumSaved, sizeof(struct saved),
+                         (int (*)(const void *, const void *))saved_compare_src)) == NULL)
+        return (0);
+
+    if (saved->mtime != dir->mtime || saved->ctime != dir->ctime ||
+        saved->inode != dir->inode ||
+        strcmp(saved->user, DefaultUser ? DefaultUser : "-") ||
+        strcmp(saved->group, DefaultGroup ? DefaultGroup : "-") ||
+        strcmp(saved->dst, get_dst(dst, sizeof(dst), root, dir->path)))
+        return (0);
+
+    for (i = 0; i < saved->num_lines; i++) {
+        lineptr = unquote_string(name, saved->lines[i] + 2, sizeof(name));
+        mode = (unsigned)strtoul(name, NULL, 8) & 07777;
+        lineptr = unquote_string(name, lineptr, sizeof(name));
+        lineptr = unquote_string(name, lineptr, sizeof(name));
+        unquote_string(name, lineptr, sizeof(name));
+
+        if ((ptr = strrchr(name, '/')) == NULL)
+            continue;
+
+        if ((entry = walk_add(dir, ptr + 1)) == NULL) {
+            dir->error = ENOMEM;
+            break;
+        }
+
+        if (saved->lines[i][0] == 'd') {
+            /*
+             * Subdirectories are read again...
+             */
+
+            entry->mode = S_IFDIR | mode;
+            continue;
+        }
+
+        entry->mode = (saved->lines[i][0] == 'l' ? S_IFLNK : S_IFREG) | mode;
+
+        if ((entry->text = strdup(saved->lines[i])) == NULL) {
+            dir->error = ENOMEM;
+            break;
+        }
+    }
+
+    return (1);
+}
+
+/*
+ * 'saved_compare_dst()' - Compare two saved directories by destination.
+ */
+
+int                                /* O - Result of comparison */
+saved_compare_dst(struct saved *a, /* I - First directory */
+                  struct saved *b) /* I - Second directory */
+{
+    return (strcmp(a->dst, b->dst));
+}
+
+/*
+ * 'saved_compare_src()' - Compare two saved directories by source.
+ */
+
+int                                /* O - Result of comparison */
+saved_compare_src(struct saved *a, /* I - First directory */
+                  struct saved *b) /* I - Second directory */
+{
+    return (strcmp(a->src, b->src));
+}
+
+/*
+ * 'unquote_string()' - Copy a quoted string from a list or state line.
+ *
+ * Leading whitespace is skipped, and the string ends at the first unquoted
+ * whitespace.
+ */
+
+const char *                 /* O - Pointer after string */
+unquote_string(char *s,      /* I - String buffer */
+               const char *q, /* I - Quoted string */
+               size_t ssize) /* I - Size of buffer */
+{
+    char *sptr, *send;
+
+    while (*q == ' ' || *q == '\t')
+        q++;
+
+    for (sptr = s, send = s + ssize - 1; *q && *q != ' ' && *q != '\t' && *q != '\n';
+         q++) {
+        if (*q == '\\' && q[1])
+            q++;
+        else if (*q == '$' && q[1] == '$')
+            q++;
+
+        if (sptr < send)
+            *sptr++ = *q;
+    }
+
+    *sptr = '\0';
+
+    return (q);
+}
+
 /*
  * 'usage()' - Show command-line usage instructions.
  */
@@ -564,8 +1493,14 @@ void usage(void) {
     puts("Usage: mkepmlist [options] directory [... directory] >filename.list");
     puts("Options:");
     puts("-g group              Set group name for files.");
+    puts("-j jobs               Read directories using this many threads.");
+    puts("-o filename           Write the list and its state to a file.");
     puts("-u user               Set user name for files.");
+    puts("--binary              Write a binary list for %include.");
+    puts("--exclude pattern     Leave out matching files and directories.");
     puts("--prefix directory    Set directory prefix for files.");
+    puts("--prune pattern       List matching directories without their contents.");
+    puts("--since filename      Reuse unchanged directories from a previous list.");
 
     exit(1);
 }
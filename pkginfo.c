@@ -0,0 +1,404 @@
+/*
+ * Package header reading functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The setup program uses these functions to list the packages in a
+ * distribution directory.  RPM package headers are read directly from the
+ * package file instead of running "rpm -qp" for each package, and only the
+ * comment header at the top of portable installation and patch scripts is
+ * read.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <fcntl.h>
+
+/*
+ * RPM file format constants...
+ */
+
+#define RPM_LEAD_SIZE 96         /* Size of package lead */
+#define RPM_MAX_INDEX 65536      /* Maximum number of header index entries */
+#define RPM_MAX_DATA 0x10000000  /* Maximum size of header data */
+
+#define RPM_TAG_NAME 1000        /* Package name */
+#define RPM_TAG_VERSION 1001     /* Package version */
+#define RPM_TAG_SUMMARY 1004     /* One-line description */
+#define RPM_TAG_SIZE 1009        /* Installed size */
+#define RPM_TAG_LONGSIZE 5009    /* Installed size (64-bit) */
+
+#define RPM_TYPE_INT32 4         /* 32-bit integer */
+#define RPM_TYPE_INT64 5         /* 64-bit integer */
+#define RPM_TYPE_STRING 6        /* String */
+#define RPM_TYPE_I18NSTRING 9    /* Localized strings */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** RPM header being read ****/
+{
+    int fd;                      /* Package file */
+    unsigned char *index;        /* Header index entries */
+    unsigned num_index;          /* Number of index entries */
+    off_t data;                  /* Offset of header data in file */
+    unsigned datasize;           /* Size of header data */
+} rpmhdr_t;
+
+/*
+ * Local functions...
+ */
+
+static int add_pkgdepend(pkginfo_t *info, int type, const char *line);
+static unsigned get_be32(const unsigned char *buffer);
+static int read_portable(const char *filename, pkginfo_t *info);
+static int read_rpm(const char *filename, pkginfo_t *info);
+static int read_rpm_number(rpmhdr_t *hdr, unsigned tag, long long *number);
+static int read_rpm_string(rpmhdr_t *hdr, unsigned tag, char *buffer, size_t bufsize);
+
+/*
+ * 'pkginfo_free()' - Free the memory used by package information.
+ */
+
+void                         /* O - Nothing */
+pkginfo_free(pkginfo_t *info) /* I - Package information */
+{
+    free(info->depends);
+
+    info->depends = NULL;
+    info->num_depends = 0;
+}
+
+/*
+ * 'pkginfo_read()' - Read the information for a package.
+ *
+ * Files ending in ".rpm" are read as RPM packages, anything else as a
+ * portable installation or patch script.
+ */
+
+int                                /* O - 0 on success, -1 on error */
+pkginfo_read(const char *filename, /* I - Package file */
+             pkginfo_t *info)      /* O - Package information */
+{
+    const char *ext; /* Extension */
+
+    memset(info, 0, sizeof(pkginfo_t));
+
+    if ((ext = strrchr(filename, '.')) != NULL && !strcmp(ext, ".rpm"))
+        return (read_rpm(filename, info));
+    else
+        return (read_portable(filename, info));
+}
+
+/*
+ * 'add_pkgdepend()' - Add a dependency from a script header line.
+ */
+
+static int                    /* O - 0 on success, -1 on error */
+add_pkgdepend(pkginfo_t *info, /* I - Package information */
+              int type,        /* I - Dependency type */
+              const char *line) /* I - Product and version numbers */
+{
+    depend_t *temp; /* New dependency */
+
+    if ((temp = realloc(info->depends, (size_t)(info->num_depends + 1) *
+                                           sizeof(depend_t))) == NULL)
+        return (-1);
+
+    info->depends = temp;
+    temp += info->num_depends;
+
+    memset(temp, 0, sizeof(depend_t));
+    temp->type = type;
+
+    if (sscanf(line, "%255s%d%d", temp->product, temp->vernumber,
+               temp->vernumber + 1) > 0)
+        info->num_depends++;
+
+    return (0);
+}
+
+/*
+ * 'get_be32()' - Get a big-endian 32-bit number.
+ */
+
+static unsigned                      /* O - Number */
+get_be32(const unsigned char *buffer) /* I - Buffer */
+{
+    return (((unsigned)buffer[0] << 24) | ((unsigned)buffer[1] << 16) |
+            ((unsigned)buffer[2] << 8) | (unsigned)buffer[3]);
+}
+
+/*
+ * 'read_portable()' - Read the header of a portable script.
+ *
+ * Scripts from older versions of EPM list their dependencies in the body of
+ * the script rather than the header, so the rest of the script is searched
+ * when the header has no dependencies.
+ */
+
+static int                          /* O - 0 on success, -1 on error */
+read_portable(const char *filename, /* I - Script file */
+              pkginfo_t *info)      /* O - Package information */
+{
+    FILE *fp;        /* Script file */
+    char line[1024], /* Line from file */
+        *ptr;        /* Pointer into line */
+    size_t len;      /* Length of line */
+    int ch;          /* Character from file */
+    int header;      /* 1 while reading the header comments */
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return (-1);
+
+    info->type = PACKAGE_PORTABLE;
+
+    if ((ptr = strrchr(filename, '/')) != NULL)
+        strlcpy(info->product, ptr + 1, sizeof(info->product));
+    else
+        strlcpy(info->product, filename, sizeof(info->product));
+
+    if ((ptr = strrchr(info->product, '.')) != NULL)
+        *ptr = '\0'; /* Drop .install */
+
+    /*
+     * The distribution info lines are all in the comment block at the top
+     * of the script; after that only look for old dependency lines...
+     */
+
+    for (header = 1; fgets(line, sizeof(line), fp);) {
+        if (header && line[0] != '#') {
+            if (info->num_depends > 0)
+                break;
+
+            header = 0;
+        }
+
+        if ((len = strlen(line)) > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        else {
+            /*
+             * Skip the rest of a long line...
+             */
+
+            while ((ch = getc(fp)) != EOF && ch != '\n')
+                ;
+        }
+
+        if (!header && strncmp(line, "#%incompat ", 11) && strncmp(line, "#%requires ", 11))
+            continue;
+
+        if (!strncmp(line, "#%product ", 10))
+            strlcpy(info->name, line + 10, sizeof(info->name));
+        else if (!strncmp(line, "#%version ", 10))
+            sscanf(line + 10, "%31s%d", info->version, &(info->vernumber));
+        else if (!strncmp(line, "#%rootsize ", 11))
+            info->rootsize = atoi(line + 11);
+        else if (!strncmp(line, "#%usrsize ", 10))
+            info->usrsize = atoi(line + 10);
+        else if (!strncmp(line, "#%incompat ", 11) || !strncmp(line, "#%requires ", 11)) {
+            if (add_pkgdepend(info, line[2] == 'i' ? DEPEND_INCOMPAT : DEPEND_REQUIRES,
+                              line + 11)) {
+                fclose(fp);
+                pkginfo_free(info);
+                return (-1);
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return (0);
+}
+
+/*
+ * 'read_rpm()' - Read the header of a RPM package.
+ *
+ * A package starts with a 96-byte lead, then a signature header padded to a
+ * multiple of 8 bytes, and then the main header.  Each header is a 16-byte
+ * intro, 16-byte index entries, and the data the entries point to; only the
+ * index and the data for the tags we need are read.
+ */
+
+static int                     /* O - 0 on success, -1 on error */
+read_rpm(const char *filename, /* I - Package file */
+         pkginfo_t *info)      /* O - Package information */
+{
+    rpmhdr_t hdr;                 /* Main header */
+    unsigned char buffer[RPM_LEAD_SIZE]; /* Lead and header intros */
+    off_t offset;                 /* Offset of main header */
+    size_t indexsize;             /* Size of index */
+    long long size;               /* Installed size */
+    static const unsigned char lead_magic[4] = {0xed, 0xab, 0xee, 0xdb},
+                               header_magic[4] = {0x8e, 0xad, 0xe8, 0x01};
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    if ((hdr.fd = open(filename, O_RDONLY)) < 0)
+        return (-1);
+
+    /*
+     * Check the lead and skip the signature header...
+     */
+
+    if (read(hdr.fd, buffer, RPM_LEAD_SIZE) != RPM_LEAD_SIZE ||
+        memcmp(buffer, lead_magic, 4))
+        goto fail;
+
+    if (read(hdr.fd, buffer, 16) != 16 || memcmp(buffer, header_magic, 4) ||
+        get_be32(buffer + 8) > RPM_MAX_INDEX || get_be32(buffer + 12) > RPM_MAX_DATA)
+        goto fail;
+
+    offset = RPM_LEAD_SIZE + 16 + 16 * (off_t)get_be32(buffer + 8) + get_be32(buffer + 12);
+    offset = (offset + 7) & ~(off_t)7;
+
+    /*
+     * Read the index of the main header...
+     */
+
+    if (pread(hdr.fd, buffer, 16, offset) != 16 || memcmp(buffer, header_magic, 4))
+        goto fail;
+
+    hdr.num_index = get_be32(buffer + 8);
+    hdr.datasize = get_be32(buffer + 12);
+
+    if (hdr.num_index == 0 || hdr.num_index > RPM_MAX_INDEX || hdr.datasize > RPM_MAX_DATA)
+        goto fail;
+
+    indexsize = 16 * (size_t)hdr.num_index;
+
+    if ((hdr.index = malloc(indexsize)) == NULL ||
+        pread(hdr.fd, hdr.index, indexsize, offset + 16) != (ssize_t)indexsize)
+        goto fail;
+
+    hdr.data = offset + 16 + (off_t)indexsize;
+
+    /*
+     * Get the tags setup needs...
+     */
+
+    if (read_rpm_string(&hdr, RPM_TAG_NAME, info->product, sizeof(info->product)) ||
+        read_rpm_string(&hdr, RPM_TAG_VERSION, info->version, sizeof(info->version)))
+        goto fail;
+
+    if (read_rpm_string(&hdr, RPM_TAG_SUMMARY, info->name, sizeof(info->name)))
+        strlcpy(info->name, info->product, sizeof(info->name));
+
+    if (!read_rpm_number(&hdr, RPM_TAG_LONGSIZE, &size) ||
+        !read_rpm_number(&hdr, RPM_TAG_SIZE, &size))
+        info->rootsize = (int)((size + 512) / 1024);
+
+    info->type = PACKAGE_RPM;
+    info->vernumber = get_vernumber(info->version);
+
+    free(hdr.index);
+    close(hdr.fd);
+
+    return (0);
+
+fail:
+
+    free(hdr.index);
+    close(hdr.fd);
+
+    return (-1);
+}
+
+/*
+ * 'read_rpm_number()' - Read an integer tag from a RPM header.
+ */
+
+static int                    /* O - 0 on success, -1 if not found */
+read_rpm_number(rpmhdr_t *hdr, /* I - RPM header */
+                unsigned tag,  /* I - Tag to read */
+                long long *number) /* O - Value */
+{
+    unsigned i;               /* Looping var */
+    unsigned char *entry,     /* Current index entry */
+        buffer[8];            /* Value */
+    unsigned type,            /* Type of value */
+        offset;               /* Offset of value in data */
+
+    for (i = hdr->num_index, entry = hdr->index; i > 0; i--, entry += 16)
+        if (get_be32(entry) == tag)
+            break;
+
+    if (!i)
+        return (-1);
+
+    type = get_be32(entry + 4);
+    offset = get_be32(entry + 8);
+
+    if (type == RPM_TYPE_INT32 && (size_t)offset + 4 <= hdr->datasize &&
+        pread(hdr->fd, buffer, 4, hdr->data + offset) == 4)
+        *number = get_be32(buffer);
+    else if (type == RPM_TYPE_INT64 && (size_t)offset + 8 <= hdr->datasize &&
+             pread(hdr->fd, buffer, 8, hdr->data + offset) == 8)
+        *number = ((long long)get_be32(buffer) << 32) | get_be32(buffer + 4);
+    else
+        return (-1);
+
+    return (0);
+}
+
+/*
+ * 'read_rpm_string()' - Read a string tag from a RPM header.
+ *
+ * For localized strings the first (untranslated) string is returned.
+ */
+
+static int                    /* O - 0 on success, -1 if not found */
+read_rpm_string(rpmhdr_t *hdr, /* I - RPM header */
+                unsigned tag,  /* I - Tag to read */
+                char *buffer,  /* O - String */
+                size_t bufsize) /* I - Size of string buffer */
+{
+    unsigned i;               /* Looping var */
+    unsigned char *entry;     /* Current index entry */
+    unsigned type,            /* Type of value */
+        offset;               /* Offset of value in data */
+    ssize_t bytes;            /* Bytes read */
+
+    for (i = hdr->num_index, entry = hdr->index; i > 0; i--, entry += 16)
+        if (get_be32(entry) == tag)
+            break;
+
+    if (!i)
+        return (-1);
+
+    type = get_be32(entry + 4);
+    offset = get_be32(entry + 8);
+
+    if ((type != RPM_TYPE_STRING && type != RPM_TYPE_I18NSTRING) ||
+        offset >= hdr->datasize)
+        return (-1);
+
+    if (bufsize - 1 > hdr->datasize - offset)
+        bufsize = hdr->datasize - offset + 1;
+
+    if ((bytes = pread(hdr->fd, buffer, bufsize - 1, hdr->data + offset)) < 0)
+        return (-1);
+
+    buffer[bytes] = '\0';
+
+    return (0);
+}
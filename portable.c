@@ -24,33 +24,84 @@
 
 #include "epm.h"
 
+/*
+ * Local types...
+ */
+
+typedef struct distfiles_s distfiles_t;
+
+typedef struct /**** Software distribution archive ****/
+{
+    distfiles_t *distfiles; /* Distribution file data */
+    const char *title,      /* Title for messages */
+        *ext;               /* Filename extension */
+    int usr,                /* 1 for /usr files, 0 for everything else */
+        patch;              /* 1 for patch files only */
+    int size,               /* Size of files in kbytes */
+        psize,              /* Size of patch files in kbytes */
+        bsize,              /* Size of files backed up on install in kbytes */
+        tsize;              /* Size of uncompressed archive in kbytes */
+} distarchive_t;
+
+struct distfiles_s /**** Software distribution files ****/
+{
+    const char *directory,    /* Directory */
+        *prodname,            /* Product name */
+        *subpackage;          /* Subpackage */
+    char prodfull[255];       /* Full name of product */
+    dist_t *dist;             /* Distribution */
+    time_t deftime;           /* Default file time */
+    int havepatchfiles;       /* 1 if we have patch files, 0 otherwise */
+    distarchive_t archives[4]; /* .sw, .ss, .psw, and .pss archives */
+    manifest_t *manifest;     /* Build manifest or NULL */
+    char manifestname[1024];  /* Build manifest filename */
+};
+
 /*
  * Local functions...
  */
 
 static void clean_distfiles(const char *directory, const char *prodname,
                             const char *platname, dist_t *dist, const char *subpackage);
+static int get_delta(file_t *file, char *oldname, size_t oldsize, char *deltaname,
+                     size_t deltasize);
 static int write_combined(const char *title, const char *directory, const char *prodname,
                           const char *platname, dist_t *dist, const char **files,
                           time_t deftime, const char *setup, const char *types);
+static int write_archive(distarchive_t *archive);
 static int write_commands(dist_t *dist, FILE *fp, int type, const char *subpackage);
-static FILE *write_common(dist_t *dist, const char *title, int rootsize, int usrsize,
-                          const char *filename, const char *subpackage);
+static FILE *write_common(dist_t *dist, const char *prodname, const char *title,
+                          int rootsize, int usrsize, const char *filename,
+                          const char *subpackage);
 static int write_confcheck(FILE *fp);
 static int write_depends(const char *prodname, dist_t *dist, FILE *fp,
                          const char *subpackage);
-static int write_distfiles(const char *directory, const char *prodname,
-                           const char *platname, dist_t *dist, time_t deftime,
-                           const char *subpackage);
+static void write_distfiles(tasks_t *tasks, distfiles_t *distfiles,
+                            const char *directory, const char *prodname,
+                            const char *platname, dist_t *dist, time_t deftime,
+                            const char *subpackage);
+static int write_docs(distfiles_t *distfiles);
+static void write_filelist(FILE *fp, const char *prodfull);
+static int write_files_task(distfiles_t *distfiles);
+static void write_helper_begin(FILE *fp);
+static void write_helper_end(FILE *fp);
+static void write_index(FILE *fp, dist_t *dist, const char *prodname,
+                        const char *prodfull, const char *subpackage, int install);
 static int write_install(dist_t *dist, const char *prodname, int rootsize, int usrsize,
-                         const char *directory, const char *subpackage);
+                         int roottar, int usrtar, int backupsize, const char *directory,
+                         const char *subpackage);
+static int write_install_task(distfiles_t *distfiles);
 static int write_instfiles(tarf_t *tarfile, const char *directory, const char *prodname,
                            const char *platname, const char **files, const char *destdir,
                            const char *subpackage);
+static int write_manifest_task(distfiles_t *distfiles);
 static int write_patch(dist_t *dist, const char *prodname, int rootsize, int usrsize,
-                       const char *directory, const char *subpackage);
+                       int roottar, int usrtar, const char *directory,
+                       const char *subpackage);
+static int write_patch_task(distfiles_t *distfiles);
 static int write_remove(dist_t *dist, const char *prodname, int rootsize, int usrsize,
                         const char *directory, const char *subpackage);
+static int write_remove_task(distfiles_t *distfiles);
 static int write_space_checks(const char *prodname, FILE *fp, const char *sw,
                               const char *ss, int rootsize, int usrsize);
 
@@ -69,12 +120,15 @@ make_portable(const char *prodname,     /* I - Product short name */
 {
     int i;                           /* Looping var */
     int havepatchfiles;              /* 1 if we have patch files, 0 otherwise */
+    int status;                      /* Exit status of build tasks */
     time_t deftime;                  /* File creation time */
     file_t *file;                    /* Software file */
+    tasks_t *tasks;                  /* Build tasks */
+    distfiles_t *pkgfiles;           /* Files for each (sub)package */
     static const char *distfiles[] = /* Distribution files */
-        {"install", "license", "readme", "remove", "ss", "sw", NULL};
+        {"install", "files", "license", "readme", "remove", "ss", "sw", NULL};
     static const char *patchfiles[] = /* Patch files */
-        {"patch", "license", "pss", "psw", "readme", "remove", NULL};
+        {"patch", "files", "license", "pss", "psw", "readme", "remove", NULL};
 
     REF(platform);
 
@@ -94,16 +148,33 @@ make_portable(const char *prodname,     /* I - Product short name */
     deftime = time(NULL);
 
     /*
-     * Build the main package and all of the subpackages...
+     * Build the main package and all of the subpackages; the files for
+     * each one are independent, so all of their tasks go in one graph...
      */
 
-    if (write_distfiles(directory, prodname, platname, dist, deftime, NULL))
+    if ((tasks = tasks_new()) == NULL ||
+        (pkgfiles = calloc((size_t)dist->num_subpackages + 1,
+                           sizeof(distfiles_t))) == NULL) {
+        fputs("epm: Unable to allocate memory for build tasks!\n", stderr);
+        tasks_delete(tasks);
         return (1);
+    }
 
-    for (i = 0; i < dist->num_subpackages; i++)
-        if (write_distfiles(directory, prodname, platname, dist, deftime,
-                            dist->subpackages[i]))
-            return (1);
+    for (i = 0; i <= dist->num_subpackages; i++)
+        write_distfiles(tasks, pkgfiles + i, directory, prodname, platname, dist,
+                        deftime, i ? dist->subpackages[i - 1] : NULL);
+
+    status = tasks_run(tasks, MaxJobs);
+
+    tasks_delete(tasks);
+
+    for (i = 0; i <= dist->num_subpackages; i++)
+        manifest_delete(pkgfiles[i].manifest);
+
+    free(pkgfiles);
+
+    if (status)
+        return (1);
 
     /*
      * Create the distribution archives...
@@ -127,6 +198,13 @@ make_portable(const char *prodname,     /* I - Product short name */
 
         for (i = 0; i < dist->num_subpackages; i++)
             clean_distfiles(directory, prodname, platname, dist, dist->subpackages[i]);
+
+        if (DeltaPatch) {
+            char olddir[1024]; /* Previous versions of patch files */
+
+            snprintf(olddir, sizeof(olddir), "%s/%s.old", directory, prodname);
+            unlink_directory(olddir);
+        }
     }
 
     /*
@@ -165,6 +243,9 @@ static void clean_distfiles(const char *directory,  /* I - Directory */
     if (Verbosity)
         printf("Removing %s temporary files...\n", prodfull);
 
+    snprintf(filename, sizeof(filename), "%s/%s.files", directory, prodfull);
+    unlink(filename);
+
     snprintf(filename, sizeof(filename), "%s/%s.install", directory, prodfull);
     unlink(filename);
 
@@ -174,7 +255,7 @@ static void clean_distfiles(const char *directory,  /* I - Directory */
     snprintf(filename, sizeof(filename), "%s/%s.patch", directory, prodfull);
     unlink(filename);
 
-    snprintf(filename, sizeof(filename), "%s/%s.psw", directory, prodfull);
+    snprintf(filename, sizeof(filename), "%s/%s.pss", directory, prodfull);
     unlink(filename);
 
     snprintf(filename, sizeof(filename), "%s/%s.psw", directory, prodfull);
@@ -193,6 +274,202 @@ static void clean_distfiles(const char *directory,  /* I - Directory */
     unlink(filename);
 }
 
+/*
+ * 'get_delta()' - Get the previous version and delta filenames for a patch
+ *                 file.
+ *
+ * The "delta(filename)" option is parsed here instead of using get_option()
+ * since the archives are written by several threads.
+ */
+
+static int                   /* O - 0 if the file has a previous version, -1 otherwise */
+get_delta(file_t *file,      /* I - File */
+          char *oldname,     /* I - Previous version filename buffer */
+          size_t oldsize,    /* I - Size of previous version buffer */
+          char *deltaname,   /* I - Delta filename buffer */
+          size_t deltasize)  /* I - Size of delta buffer */
+{
+    const char *start,   /* Start of filename */
+        *end;            /* End of filename */
+
+    if (file->type != 'F' || (start = strstr(file->options, "delta(")) == NULL)
+        return (-1);
+
+    start += 6;
+
+    if ((end = strchr(start, ')')) == NULL || (size_t)(end - start) >= oldsize)
+        return (-1);
+
+    memcpy(oldname, start, (size_t)(end - start));
+    oldname[end - start] = '\0';
+
+    snprintf(deltaname, deltasize, "%s.delta", oldname);
+
+    return (0);
+}
+
+/*
+ * 'write_archive()' - Write one of the software distribution archives.
+ */
+
+static int                     /* O - 0 on success, 1 on failure */
+write_archive(distarchive_t *archive) /* I - Archive to write */
+{
+    int i;                       /* Looping var */
+    distfiles_t *distfiles;      /* Distribution file data */
+    tarf_t *tarfile;             /* Distribution tar file */
+    char filename[1024];         /* Name of file */
+    char oldname[1024],          /* Name of previous version */
+        deltaname[1024];         /* Name of delta file */
+    const char *src;             /* File to archive */
+    struct stat srcstat;         /* Source file information */
+    file_t *file;                /* Software file */
+    int blocks;                  /* Blocks in archive */
+
+    distfiles = archive->distfiles;
+
+    if (Verbosity)
+        tasks_printf("Creating %s file...\n", archive->title);
+
+    snprintf(filename, sizeof(filename), "%s/%s.%s", distfiles->directory,
+             distfiles->prodfull, archive->ext);
+
+    unlink(filename);
+    if ((tarfile = tar_open(filename, CompressFiles)) == NULL) {
+        fprintf(stderr, "epm: Unable to create file \"%s\" -\n     %s\n", filename,
+                strerror(errno));
+        return (1);
+    }
+
+    for (i = distfiles->dist->num_files, file = distfiles->dist->files; i > 0;
+         i--, file++) {
+        if ((strncmp(file->dst, "/usr", 4) == 0) != archive->usr ||
+            file->subpackage != distfiles->subpackage)
+            continue;
+
+        if (archive->patch && !isupper(file->type & 255))
+            continue;
+
+        switch (tolower(file->type)) {
+        case 'f': /* Regular file */
+        case 'c': /* Config file */
+        case 'i': /* Init script */
+            if (stat(file->src, &srcstat)) {
+                fprintf(stderr, "epm: Cannot stat \"%s\": %s\n", file->src,
+                        strerror(errno));
+                tar_close(tarfile);
+                return (1);
+            }
+
+            archive->size += (srcstat.st_size + 1023) / 1024;
+
+            if (isupper(file->type & 255))
+                archive->psize += (srcstat.st_size + 1023) / 1024;
+
+            if (tolower(file->type) == 'f')
+                archive->bsize += (srcstat.st_size + 1023) / 1024;
+
+            /*
+             * Configuration files are extracted to the config file name with
+             * .N appended; add a bit of script magic to check if the config
+             * file already exists, and if not we copy the .N to the config
+             * file location...
+             */
+
+            if (tolower(file->type) == 'c')
+                snprintf(filename, sizeof(filename), "%s.N", file->dst);
+            else if (tolower(file->type) == 'i')
+                snprintf(filename, sizeof(filename), "%s/init.d/%s", SoftwareDir,
+                         file->dst);
+            else
+                strlcpy(filename, file->dst, sizeof(filename));
+
+            src = file->src;
+
+            if (archive->patch &&
+                !get_delta(file, oldname, sizeof(oldname), deltaname, sizeof(deltaname))) {
+                /*
+                 * Patch files with a previous version get a delta instead
+                 * when it is smaller than the file; the patch script
+                 * applies it with the helper program...
+                 */
+
+                struct stat deltastat; /* Delta file information */
+
+                if (delta_create(oldname, file->src, deltaname)) {
+                    tar_close(tarfile);
+                    return (1);
+                }
+
+                if (!stat(deltaname, &deltastat) &&
+                    deltastat.st_size < srcstat.st_size / 2) {
+                    src = deltaname;
+                    srcstat.st_size = deltastat.st_size;
+                    strlcat(filename, ".epmdelta", sizeof(filename));
+                } else
+                    unlink(deltaname);
+            }
+
+            if (Verbosity > 1)
+                tasks_printf("%s -> %s...\n", src, filename);
+
+            if (tar_header(tarfile, TAR_NORMAL, file->mode, srcstat.st_size,
+                           srcstat.st_mtime, file->user, file->group, filename,
+                           NULL) < 0) {
+                tar_close(tarfile);
+                return (1);
+            }
+
+            if (tar_file(tarfile, src) < 0) {
+                tar_close(tarfile);
+                return (1);
+            }
+            break;
+
+        case 'd': /* Create directory */
+            if (Verbosity > 1)
+                tasks_printf("Directory %s...\n", file->dst);
+
+            archive->size++;
+
+            if (isupper(file->type & 255))
+                archive->psize++;
+            break;
+
+        case 'l': /* Link file */
+            if (Verbosity > 1)
+                tasks_printf("%s -> %s...\n", file->src, file->dst);
+
+            if (tar_header(tarfile, TAR_SYMLINK, file->mode, 0, distfiles->deftime,
+                           file->user, file->group, file->dst, file->src) < 0) {
+                tar_close(tarfile);
+                return (1);
+            }
+
+            archive->size++;
+            archive->bsize++;
+
+            if (isupper(file->type & 255))
+                archive->psize++;
+            break;
+        }
+    }
+
+    /*
+     * The progress meter counts the uncompressed archive, which tar_close()
+     * ends with a zero block and pads to a multiple of TAR_BLOCKS blocks...
+     */
+
+    if ((blocks = tarfile->blocks) > 0)
+        blocks = (blocks + TAR_BLOCKS) / TAR_BLOCKS * TAR_BLOCKS;
+
+    archive->tsize = (int)(((long long)blocks * TAR_BLOCK + 1023) / 1024);
+
+    tar_close(tarfile);
+
+    return (0);
+}
+
 /*
  * 'write_combined()' - Write all of the distribution files in tar files.
  */
@@ -392,6 +669,48 @@ write_combined(const char *title,     /* I - Title */
             return (-1);
         }
 
+    /*
+     * Include the helper program for verifying the installed files; patches
+     * with deltas can't be installed without it...
+     */
+
+    if (stat(HelperProgram, &srcstat)) {
+        if (!strcmp(title, "patch")) {
+            char oldname[1024],  /* Previous version of file */
+                deltaname[1024]; /* Delta file */
+            file_t *file;        /* Software file */
+
+            for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
+                if (!get_delta(file, oldname, sizeof(oldname), deltaname,
+                               sizeof(deltaname)) &&
+                    !access(deltaname, 0))
+                    break;
+
+            if (i > 0) {
+                fprintf(stderr, "epm: Unable to stat helper program %s: %s\n",
+                        HelperProgram, strerror(errno));
+                tar_close(tarfile);
+                return (-1);
+            }
+        }
+    } else {
+        snprintf(filename, sizeof(filename), "%sepmhelper", destdir);
+
+        if (tar_header(tarfile, TAR_NORMAL, 0555, srcstat.st_size, srcstat.st_mtime,
+                       "root", "root", filename, NULL) < 0) {
+            tar_close(tarfile);
+            return (-1);
+        }
+
+        if (tar_file(tarfile, HelperProgram) < 0) {
+            tar_close(tarfile);
+            return (-1);
+        }
+
+        if (Verbosity)
+            printf("    %7.0fk epmhelper\n", (srcstat.st_size + 1023) / 1024.0);
+    }
+
     /*
      * Now the setup files...
      */
@@ -768,6 +1087,7 @@ write_commands(dist_t *dist,           /* I - Distribution */
 
 static FILE *                        /* O - File pointer */
 write_common(dist_t *dist,           /* I - Distribution */
+             const char *prodname,   /* I - Product name or NULL for no dependencies */
              const char *title,      /* I - "Installation", etc... */
              int rootsize,           /* I - Size of root files in kbytes */
              int usrsize,            /* I - Size of /usr files in kbytes */
@@ -779,6 +1099,9 @@ write_common(dist_t *dist,           /* I - Distribution */
     char line[1024], /* Line buffer */
         *start,      /* Start of line */
         *ptr;        /* Pointer into line */
+    depend_t *d;     /* Current dependency */
+    static const char *depends[] = /* Dependency strings */
+        {"requires", "incompat", "replaces", "provides"};
 
     /*
      * Remove any existing copy of the file...
@@ -866,6 +1189,20 @@ write_common(dist_t *dist,           /* I - Distribution */
 
     fprintf(fp, "#%%rootsize %d\n", rootsize);
     fprintf(fp, "#%%usrsize %d\n", usrsize);
+
+    if (prodname) {
+        /*
+         * List the dependencies in the header as well, so that setup only
+         * needs to read the header...
+         */
+
+        for (i = 0, d = dist->depends; i < dist->num_depends; i++, d++)
+            if (d->subpackage == subpackage)
+                fprintf(fp, "#%%%s %s %d %d\n", depends[(int)d->type],
+                        strcmp(d->product, "_self") ? d->product : prodname,
+                        d->vernumber[0], d->vernumber[1]);
+    }
+
     fputs("#\n", fp);
 
     fputs("PATH=/usr/gnu/bin:/usr/xpg4/bin:/bin:/usr/bin:/usr/ucb:${PATH}\n", fp);
@@ -904,6 +1241,40 @@ write_common(dist_t *dist,           /* I - Distribution */
 
     write_confcheck(fp);
 
+    /*
+     * Progress records for the setup and uninst programs are written to file
+     * descriptor 9 - see gui_progress_open() for the format.  The variable is
+     * cleared so that nested install and remove scripts stay quiet...
+     */
+
+    fputs("# Send progress records to the installer, if any...\n", fp);
+    fputs("if test \"x$EPM_PROGRESS_FD\" = x; then\n", fp);
+    fputs("	exec 9>/dev/null\n", fp);
+    fputs("	ac_meter=\"cat\"\n", fp);
+    fputs("else\n", fp);
+    fputs("	exec 9>&$EPM_PROGRESS_FD\n", fp);
+    fputs("	EPM_PROGRESS_FD=\"\"\n", fp);
+    fputs("	if test -x ./epmhelper; then\n", fp);
+    fputs("		ac_meter=\"./epmhelper progress 9\"\n", fp);
+    fputs("	else\n", fp);
+    fputs("		ac_meter=\"cat\"\n", fp);
+    fputs("	fi\n", fp);
+    fputs("fi\n", fp);
+
+    if (prodname && CompressFiles) {
+        /*
+         * Use pigz to decompress the archives when it is installed, since it
+         * reads, decompresses, and writes on separate threads...
+         */
+
+        fputs("# Use a parallel decompressor, if any...\n", fp);
+        fputs("if (pigz --version) >/dev/null 2>&1; then\n", fp);
+        fputs("	ac_gzip=\"pigz -dc\"\n", fp);
+        fputs("else\n", fp);
+        fputs("	ac_gzip=\"gzip -dc\"\n", fp);
+        fputs("fi\n", fp);
+    }
+
     /*
      * Return the file pointer...
      */
@@ -963,8 +1334,6 @@ write_depends(const char *prodname,   /* I - Product name */
     int i;                         /* Looping var */
     depend_t *d;                   /* Current dependency */
     const char *product;           /* Product/file to depend on */
-    static const char *depends[] = /* Dependency strings */
-        {"requires", "incompat", "replaces", "provides"};
 
     for (i = 0, d = dist->depends; i < dist->num_depends; i++, d++)
         if (d->subpackage == subpackage) {
@@ -973,9 +1342,6 @@ write_depends(const char *prodname,   /* I - Product name */
             else
                 product = d->product;
 
-            fprintf(fp, "#%%%s %s %d %d\n", depends[(int)d->type], product,
-                    d->vernumber[0], d->vernumber[1]);
-
             switch (d->type) {
             case DEPEND_REQUIRES:
                 if (product[0] == '/') {
@@ -1147,39 +1513,53 @@ write_depends(const char *prodname,   /* I - Product name */
 }
 
 /*
- * 'write_distfiles()' - Write a software distribution...
+ * 'write_distfiles()' - Add the tasks that write a software distribution.
+ *
+ * The license/readme copies, the four archives, and the install, patch,
+ * and remove scripts are independent build tasks; the scripts only need
+ * the sizes computed while writing the archives.
  */
 
-static int                              /* O - -1 on error, 0 on success */
-write_distfiles(const char *directory,  /* I - Directory */
+static void                             /* O - Nothing */
+write_distfiles(tasks_t *tasks,         /* I - Build tasks */
+                distfiles_t *distfiles, /* I - Distribution file data */
+                const char *directory,  /* I - Directory */
                 const char *prodname,   /* I - Product name */
                 const char *platname,   /* I - Platform name */
                 dist_t *dist,           /* I - Distribution */
                 time_t deftime,         /* I - Default file time */
                 const char *subpackage) /* I - Subpackage */
 {
-    int i;               /* Looping var */
-    int havepatchfiles;  /* 1 if we have patch files, 0 otherwise */
-    tarf_t *tarfile;     /* Distribution tar file */
-    char prodfull[255],  /* Full name of product */
-        swname[255],     /* Name of distribution tar file */
-        pswname[255],    /* Name of patch tar file */
-        filename[1024];  /* Name of temporary file */
-    struct stat srcstat; /* Source file information */
-    file_t *file;        /* Software file */
-    int rootsize,        /* Size of files in root partition */
-        usrsize;         /* Size of files in /usr partition */
-    int prootsize,       /* Size of patch files in root partition */
-        pusrsize;        /* Size of patch files in /usr partition */
+    int i;                   /* Looping var */
+    file_t *file;            /* Software file */
+    task_t *docs,            /* License and readme task */
+        *files,              /* File list task */
+        *archives[4],        /* Archive tasks */
+        *scripts[3],         /* Script tasks */
+        *manifest;           /* Build manifest task */
+    static const char *const titles[4] = /* Archive titles */
+        {"non-shared software distribution", "shared software distribution",
+         "non-shared software patch", "shared software patch"};
+    static const char *const exts[4] = /* Archive extensions */
+        {"sw", "ss", "psw", "pss"};
+
+    memset(distfiles, 0, sizeof(distfiles_t));
+
+    distfiles->directory = directory;
+    distfiles->prodname = prodname;
+    distfiles->dist = dist;
+    distfiles->deftime = deftime;
+    distfiles->subpackage = subpackage;
 
     /*
      * Figure out the full name of the distribution...
      */
 
     if (subpackage)
-        snprintf(prodfull, sizeof(prodfull), "%s-%s", prodname, subpackage);
+        snprintf(distfiles->prodfull, sizeof(distfiles->prodfull), "%s-%s", prodname,
+                 subpackage);
     else
-        strlcpy(prodfull, prodname, sizeof(prodfull));
+        strlcpy(distfiles->prodfull, prodname, sizeof(distfiles->prodfull));
 
     /*
      * See if we need to make a patch distribution...
@@ -1189,396 +1569,278 @@ write_distfiles(const char *directory,  /* I - Directory */
         if (isupper((int)file->type) && file->subpackage == subpackage)
             break;
 
-    havepatchfiles = i > 0;
+    distfiles->havepatchfiles = i > 0;
 
     /*
-     * Copy the license and readme files...
+     * The distribution files are only kept, and so can be skipped when up to
+     * date, with -k...
      */
 
-    if (Verbosity)
-        printf("Copying %s license and readme files...\n", prodfull);
+    if (KeepFiles && (distfiles->manifest = manifest_new("portable", platname, 0)) != NULL) {
+        manifest_add_dist(distfiles->manifest, dist, subpackage);
 
-    if (dist->license[0]) {
-        snprintf(filename, sizeof(filename), "%s/%s.license", directory, prodfull);
-        if (copy_file(filename, dist->license, 0444, getuid(), getgid()))
-            return (1);
-    }
+        snprintf(distfiles->manifestname, sizeof(distfiles->manifestname),
+                 "%s/%s.manifest", directory, distfiles->prodfull);
 
-    if (dist->readme[0]) {
-        snprintf(filename, sizeof(filename), "%s/%s.readme", directory, prodfull);
-        if (copy_file(filename, dist->readme, 0444, getuid(), getgid()))
-            return (1);
+        if (!ForceBuild && manifest_check(distfiles->manifest, distfiles->manifestname)) {
+            if (Verbosity)
+                printf("%s distribution files are up to date.\n", distfiles->prodfull);
+
+            return;
+        }
     }
 
     /*
-     * Create the non-shared software distribution file...
+     * Declare the build tasks...
      */
 
-    if (Verbosity)
-        puts("Creating non-shared software distribution file...");
+    docs = tasks_add(tasks, "docs", (task_cb_t)write_docs, distfiles);
+    files = tasks_add(tasks, "files", (task_cb_t)write_files_task, distfiles);
 
-    snprintf(swname, sizeof(swname), "%s.sw", prodfull);
-    snprintf(filename, sizeof(filename), "%s/%s", directory, swname);
+    for (i = 0; i < 4; i++) {
+        distfiles->archives[i].distfiles = distfiles;
+        distfiles->archives[i].title = titles[i];
+        distfiles->archives[i].ext = exts[i];
+        distfiles->archives[i].usr = i & 1;
+        distfiles->archives[i].patch = i > 1;
 
-    unlink(filename);
-    if ((tarfile = tar_open(filename, CompressFiles)) == NULL) {
-        fprintf(stderr, "epm: Unable to create file \"%s\" -\n     %s\n", filename,
-                strerror(errno));
-        return (1);
+        if (i < 2 || distfiles->havepatchfiles)
+            archives[i] = tasks_add(tasks, exts[i], (task_cb_t)write_archive,
+                                    distfiles->archives + i);
+        else
+            archives[i] = NULL;
     }
 
-    for (i = dist->num_files, file = dist->files, rootsize = 0, prootsize = 0; i > 0;
-         i--, file++)
-        if (strncmp(file->dst, "/usr", 4) != 0 && file->subpackage == subpackage)
-            switch (tolower(file->type)) {
-            case 'f': /* Regular file */
-            case 'c': /* Config file */
-            case 'i': /* Init script */
-                if (stat(file->src, &srcstat)) {
-                    fprintf(stderr, "epm: Cannot stat \"%s\": %s\n", file->src,
-                            strerror(errno));
-                    tar_close(tarfile);
-                    return (1);
-                }
-
-                rootsize += (srcstat.st_size + 1023) / 1024;
+    scripts[0] = tasks_add(tasks, "install", (task_cb_t)write_install_task, distfiles);
 
-                if (isupper(file->type & 255))
-                    prootsize += (srcstat.st_size + 1023) / 1024;
-
-                /*
-                 * Configuration files are extracted to the config file name with
-                 * .N appended; add a bit of script magic to check if the config
-                 * file already exists, and if not we copy the .N to the config
-                 * file location...
-                 */
-
-                if (tolower(file->type) == 'c')
-                    snprintf(filename, sizeof(filename), "%s.N", file->dst);
-                else if (tolower(file->type) == 'i')
-                    snprintf(filename, sizeof(filename), "%s/init.d/%s", SoftwareDir,
-                             file->dst);
-                else
-                    strlcpy(filename, file->dst, sizeof(filename));
-
-                if (Verbosity > 1)
-                    printf("%s -> %s...\n", file->src, filename);
+    if (distfiles->havepatchfiles)
+        scripts[1] = tasks_add(tasks, "patch", (task_cb_t)write_patch_task, distfiles);
+    else
+        scripts[1] = NULL;
 
-                if (tar_header(tarfile, TAR_NORMAL, file->mode, srcstat.st_size,
-                               srcstat.st_mtime, file->user, file->group, filename,
-                               NULL) < 0) {
-                    tar_close(tarfile);
-                    return (1);
-                }
+    scripts[2] = tasks_add(tasks, "remove", (task_cb_t)write_remove_task, distfiles);
 
-                if (tar_file(tarfile, file->src) < 0) {
-                    tar_close(tarfile);
-                    return (1);
-                }
-                break;
+    for (i = 0; i < 3; i++)
+        if (scripts[i]) {
+            tasks_depend(scripts[i], archives[0]);
+            tasks_depend(scripts[i], archives[1]);
+        }
 
-            case 'd': /* Create directory */
-                if (Verbosity > 1)
-                    printf("Directory %s...\n", file->dst);
+    /*
+     * The patch script needs to know which files have deltas...
+     */
 
-                rootsize++;
+    if (scripts[1]) {
+        tasks_depend(scripts[1], archives[2]);
+        tasks_depend(scripts[1], archives[3]);
+    }
 
-                if (isupper(file->type & 255))
-                    prootsize++;
-                break;
+    /*
+     * Record the build manifest once everything else is written...
+     */
 
-            case 'l': /* Link file */
-                if (Verbosity > 1)
-                    printf("%s -> %s...\n", file->src, file->dst);
+    if (distfiles->manifest) {
+        manifest = tasks_add(tasks, "manifest", (task_cb_t)write_manifest_task, distfiles);
 
-                if (tar_header(tarfile, TAR_SYMLINK, file->mode, 0, deftime, file->user,
-                               file->group, file->dst, file->src) < 0) {
-                    tar_close(tarfile);
-                    return (1);
-                }
+        tasks_depend(manifest, docs);
+        tasks_depend(manifest, files);
 
-                rootsize++;
+        for (i = 0; i < 4; i++)
+            if (archives[i])
+                tasks_depend(manifest, archives[i]);
 
-                if (isupper(file->type & 255))
-                    prootsize++;
-                break;
-            }
+        for (i = 0; i < 3; i++)
+            if (scripts[i])
+                tasks_depend(manifest, scripts[i]);
+    }
+}
 
-    tar_close(tarfile);
+/*
+ * 'write_docs()' - Copy the license and readme files.
+ */
 
-    /*
-     * Create the shared software distribution file...
-     */
+static int                        /* O - 0 on success, 1 on failure */
+write_docs(distfiles_t *distfiles) /* I - Distribution file data */
+{
+    char filename[1024]; /* Name of file */
 
     if (Verbosity)
-        puts("Creating shared software distribution file...");
+        tasks_printf("Copying %s license and readme files...\n", distfiles->prodfull);
 
-    snprintf(swname, sizeof(swname), "%s.ss", prodfull);
-    snprintf(filename, sizeof(filename), "%s/%s", directory, swname);
+    if (distfiles->dist->license[0]) {
+        snprintf(filename, sizeof(filename), "%s/%s.license", distfiles->directory,
+                 distfiles->prodfull);
+        if (copy_file(filename, distfiles->dist->license, 0444, getuid(), getgid()))
+            return (1);
+    }
 
-    unlink(filename);
-    if ((tarfile = tar_open(filename, CompressFiles)) == NULL) {
-        fprintf(stderr, "epm: Unable to create file \"%s\" -\n     %s\n", filename,
-                strerror(errno));
-        return (1);
+    if (distfiles->dist->readme[0]) {
+        snprintf(filename, sizeof(filename), "%s/%s.readme", distfiles->directory,
+                 distfiles->prodfull);
+        if (copy_file(filename, distfiles->dist->readme, 0444, getuid(), getgid()))
+            return (1);
     }
 
-    for (i = dist->num_files, file = dist->files, usrsize = 0, pusrsize = 0; i > 0;
-         i--, file++)
-        if (strncmp(file->dst, "/usr", 4) == 0 && file->subpackage == subpackage)
-            switch (tolower(file->type)) {
-            case 'f': /* Regular file */
-            case 'c': /* Config file */
-            case 'i': /* Init script */
-                if (stat(file->src, &srcstat)) {
-                    fprintf(stderr, "epm: Cannot stat \"%s\": %s\n", file->src,
-                            strerror(errno));
-                    tar_close(tarfile);
-                    return (1);
-                }
+    return (0);
+}
 
-                usrsize += (srcstat.st_size + 1023) / 1024;
+/*
+ * 'write_filelist()' - Copy the file list and helper program to the software
+ *                      directory so the installed files can be verified.
+ */
 
-                if (isupper(file->type & 255))
-                    pusrsize += (srcstat.st_size + 1023) / 1024;
+static void                 /* O - Nothing */
+write_filelist(FILE *fp,    /* I - Script file */
+               const char *prodfull) /* I - Full product name */
+{
+    fprintf(fp, "rm -f %s/%s.files\n", SoftwareDir, prodfull);
+    fprintf(fp, "cp %s.files %s\n", prodfull, SoftwareDir);
+    fprintf(fp, "chmod 444 %s/%s.files\n", SoftwareDir, prodfull);
+    fputs("if test -x epmhelper; then\n", fp);
+    fprintf(fp, "	rm -f %s/epmhelper\n", SoftwareDir);
+    fprintf(fp, "	cp epmhelper %s\n", SoftwareDir);
+    fprintf(fp, "	chmod 555 %s/epmhelper\n", SoftwareDir);
+    fputs("fi\n", fp);
+}
 
-                /*
-                 * Configuration files are extracted to the config file name with
-                 * .N appended; add a bit of script magic to check if the config
-                 * file already exists, and if not we copy the .N to the config
-                 * file location...
-                 */
+/*
+ * 'write_files_task()' - Write the file list for the distribution.
+ */
 
-                if (tolower(file->type) == 'c')
-                    snprintf(filename, sizeof(filename), "%s.N", file->dst);
-                else if (tolower(file->type) == 'i')
-                    snprintf(filename, sizeof(filename), "%s/init.d/%s", SoftwareDir,
-                             file->dst);
-                else
-                    strlcpy(filename, file->dst, sizeof(filename));
+static int                            /* O - 0 on success, 1 on failure */
+write_files_task(distfiles_t *distfiles) /* I - Distribution file data */
+{
+    char filename[1024]; /* File list */
 
-                if (Verbosity > 1)
-                    printf("%s -> %s...\n", file->src, filename);
+    if (Verbosity)
+        tasks_printf("Writing file list...\n");
 
-                if (tar_header(tarfile, TAR_NORMAL, file->mode, srcstat.st_size,
-                               srcstat.st_mtime, file->user, file->group, filename,
-                               NULL) < 0) {
-                    tar_close(tarfile);
-                    return (1);
-                }
+    snprintf(filename, sizeof(filename), "%s/%s.files", distfiles->directory,
+             distfiles->prodfull);
 
-                if (tar_file(tarfile, file->src) < 0) {
-                    tar_close(tarfile);
-                    return (1);
-                }
-                break;
+    return (filelist_write(distfiles->dist, distfiles->subpackage, filename) ? 1 : 0);
+}
 
-            case 'd': /* Create directory */
-                if (Verbosity > 1)
-                    printf("%s...\n", file->dst);
+/*
+ * 'write_helper_begin()' - Start a list of files for the install helper.
+ *
+ * The "epmhelper install" command backs up files, makes directories, and
+ * sets permissions from the list in a single process.  The shell commands
+ * that follow write_helper_end() are only run when the helper cannot be run,
+ * and must be followed by a "fi".
+ */
 
-                usrsize++;
+static void                   /* O - Nothing */
+write_helper_begin(FILE *fp)  /* I - Script file */
+{
+    fputs("if test -x ./epmhelper; then\n", fp);
+    fputs("	./epmhelper install <<'EPM-END-FILES'\n", fp);
+}
 
-                if (isupper(file->type & 255))
-                    pusrsize++;
-                break;
-
-            case 'l': /* Link file */
-                if (Verbosity > 1)
-                    printf("%s -> %s...\n", file->src, file->dst);
-
-                if (tar_header(tarfile, TAR_SYMLINK, file->mode, 0, deftime, file->user,
-                               file->group, file->dst, file->src) < 0) {
-                    tar_close(tarfile);
-                    return (1);
-                }
+/*
+ * 'write_helper_end()' - Finish a list of files for the install helper.
+ */
 
-                usrsize++;
+static void                 /* O - Nothing */
+write_helper_end(FILE *fp)  /* I - Script file */
+{
+    fputs("EPM-END-FILES\n", fp);
+    fputs("	ac_status=$?\n", fp);
+    fputs("else\n", fp);
+    fputs("	ac_status=2\n", fp);
+    fputs("fi\n", fp);
+    fputs("if test $ac_status = 1; then\n", fp);
+    fputs("	exit 1\n", fp);
+    fputs("elif test $ac_status != 0; then\n", fp);
+}
 
-                if (isupper(file->type & 255))
-                    pusrsize++;
-                break;
-            }
+/*
+ * 'write_index()' - Update the index of installed products.
+ *
+ * The index lets setup and uninst list the installed software without
+ * opening every ".remove" script.  Each product has a "P" line with the
+ * fields from the ".remove" header and one "D" line per dependency, all
+ * separated by tabs.
+ */
 
-    tar_close(tarfile);
+static void                    /* O - Nothing */
+write_index(FILE *fp,          /* I - Script file */
+            dist_t *dist,      /* I - Distribution */
+            const char *prodname, /* I - Product name */
+            const char *prodfull, /* I - Full product name */
+            const char *subpackage, /* I - Subpackage */
+            int install)       /* I - 1 = add product, 0 = remove product */
+{
+    int i;                         /* Looping var */
+    depend_t *d;                   /* Current dependency */
+    const char *product;           /* Product/file to depend on */
+    static const char *depends[] = /* Dependency strings */
+        {"requires", "incompat", "replaces", "provides"};
 
     /*
-     * Create the patch distribution files...
+     * Serialize updates with a lock directory.  If the lock cannot be taken
+     * the index is left alone - setup and uninst read the removal scripts
+     * that are newer than the index, so a stale index is only slower...
      */
 
-    if (havepatchfiles) {
-        if (Verbosity)
-            puts("Creating non-shared software patch file...");
-
-        snprintf(pswname, sizeof(pswname), "%s.psw", prodfull);
-        snprintf(filename, sizeof(filename), "%s/%s", directory, pswname);
-
-        unlink(filename);
-        if ((tarfile = tar_open(filename, CompressFiles)) == NULL) {
-            fprintf(stderr, "epm: Unable to create file \"%s\" -\n     %s\n", filename,
-                    strerror(errno));
-            return (1);
-        }
-
-        for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
-            if (strncmp(file->dst, "/usr", 4) != 0 && file->subpackage == subpackage)
-                switch (file->type) {
-                case 'C': /* Config file */
-                case 'F': /* Regular file */
-                case 'I': /* Init script */
-                    if (stat(file->src, &srcstat)) {
-                        fprintf(stderr, "epm: Cannot stat \"%s\": %s\n", file->src,
-                                strerror(errno));
-                        tar_close(tarfile);
-                        return (1);
-                    }
-
-                    /*
-                     * Configuration files are extracted to the config file name with
-                     * .N appended; add a bit of script magic to check if the config
-                     * file already exists, and if not we copy the .N to the config
-                     * file location...
-                     */
-
-                    if (file->type == 'C')
-                        snprintf(filename, sizeof(filename), "%s.N", file->dst);
-                    else if (file->type == 'I')
-                        snprintf(filename, sizeof(filename), "%s/init.d/%s", SoftwareDir,
-                                 file->dst);
-                    else
-                        strlcpy(filename, file->dst, sizeof(filename));
-
-                    if (Verbosity > 1)
-                        printf("%s -> %s...\n", file->src, filename);
-
-                    if (tar_header(tarfile, TAR_NORMAL, file->mode, srcstat.st_size,
-                                   srcstat.st_mtime, file->user, file->group, filename,
-                                   NULL) < 0) {
-                        tar_close(tarfile);
-                        return (1);
-                    }
-
-                    if (tar_file(tarfile, file->src) < 0) {
-                        tar_close(tarfile);
-                        return (1);
-                    }
-                    break;
-
-                case 'd': /* Create directory */
-                    if (Verbosity > 1)
-                        printf("%s...\n", file->dst);
-                    break;
-
-                case 'L': /* Link file */
-                    if (Verbosity > 1)
-                        printf("%s -> %s...\n", file->src, file->dst);
-
-                    if (tar_header(tarfile, TAR_SYMLINK, file->mode, 0, deftime,
-                                   file->user, file->group, file->dst, file->src) < 0) {
-                        tar_close(tarfile);
-                        return (1);
-                    }
-                    break;
-                }
-
-        tar_close(tarfile);
-
-        if (Verbosity)
-            puts("Creating shared software patch file...");
-
-        snprintf(pswname, sizeof(pswname), "%s.pss", prodfull);
-        snprintf(filename, sizeof(filename), "%s/%s", directory, pswname);
-
-        unlink(filename);
-        if ((tarfile = tar_open(filename, CompressFiles)) == NULL) {
-            fprintf(stderr, "epm: Unable to create file \"%s\" -\n     %s\n", filename,
-                    strerror(errno));
-            return (1);
-        }
-
-        for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
-            if (strncmp(file->dst, "/usr", 4) == 0 && file->subpackage == subpackage)
-                switch (file->type) {
-                case 'C': /* Config file */
-                case 'F': /* Regular file */
-                case 'I': /* Init script */
-                    if (stat(file->src, &srcstat)) {
-                        fprintf(stderr, "epm: Cannot stat \"%s\": %s\n", file->src,
-                                strerror(errno));
-                        tar_close(tarfile);
-                        return (1);
-                    }
-
-                    /*
-                     * Configuration files are extracted to the config file name with
-                     * .N appended; add a bit of script magic to check if the config
-                     * file already exists, and if not we copy the .N to the config
-                     * file location...
-                     */
-
-                    if (file->type == 'C')
-                        snprintf(filename, sizeof(filename), "%s.N", file->dst);
-                    else if (file->type == 'I')
-                        snprintf(filename, sizeof(filename), "%s/init.d/%s", SoftwareDir,
-                                 file->dst);
-                    else
-                        strlcpy(filename, file->dst, sizeof(filename));
-
-                    if (Verbosity > 1)
-                        printf("%s -> %s...\n", file->src, filename);
-
-                    if (tar_header(tarfile, TAR_NORMAL, file->mode, srcstat.st_size,
-                                   srcstat.st_mtime, file->user, file->group, filename,
-                                   NULL) < 0) {
-                        tar_close(tarfile);
-                        return (1);
-                    }
-
-                    if (tar_file(tarfile, file->src) < 0) {
-                        tar_close(tarfile);
-                        return (1);
-                    }
-                    break;
-
-                case 'd': /* Create directory */
-                    if (Verbosity > 1)
-                        printf("%s...\n", file->dst);
-                    break;
+    fputs("epm_i=0\n", fp);
+    fputs("epm_locked=0\n", fp);
+    fputs("while test $epm_i -lt 30; do\n", fp);
+    fprintf(fp, "	if mkdir %s/products.lock 2>/dev/null; then\n", SoftwareDir);
+    fputs("		epm_locked=1\n", fp);
+    fputs("		break\n", fp);
+    fputs("	fi\n", fp);
+    fputs("	sleep 1\n", fp);
+    fputs("	epm_i=`expr $epm_i + 1`\n", fp);
+    fputs("done\n", fp);
+
+    fputs("if test $epm_locked = 1; then\n", fp);
+    fputs("(\n", fp);
+    fprintf(fp, "if test -f %s/" SOFTWARE_INDEX "; then\n", SoftwareDir);
+    fprintf(fp, "	awk -F'\t' '$2 != \"%s\"' %s/" SOFTWARE_INDEX "\n", prodfull,
+            SoftwareDir);
+    fputs("else\n", fp);
+    fputs("	echo '# EPM installed products'\n", fp);
+    fputs("fi\n", fp);
 
-                case 'L': /* Link file */
-                    if (Verbosity > 1)
-                        printf("%s -> %s...\n", file->src, file->dst);
+    if (install) {
+        /*
+         * Take the product line from the header of the installed ".remove"
+         * script so that the index always agrees with it...
+         */
 
-                    if (tar_header(tarfile, TAR_SYMLINK, file->mode, 0, deftime,
-                                   file->user, file->group, file->dst, file->src) < 0) {
-                        tar_close(tarfile);
-                        return (1);
-                    }
-                    break;
-                }
+        fprintf(fp,
+                "awk 'BEGIN { OFS = \"\\t\" }\n"
+                "/^#%%product / { name = substr($0, 11) }\n"
+                "/^#%%version / { version = $2; vernumber = $3 }\n"
+                "/^#%%rootsize / { rootsize = $2 }\n"
+                "/^#%%usrsize / { usrsize = $2 }\n"
+                "/^#$/ { exit }\n"
+                "END { print \"P\", \"%s\", version, vernumber, rootsize, usrsize, "
+                "name }' %s/%s.remove\n",
+                prodfull, SoftwareDir, prodfull);
+
+        fputs("cat <<'EPM-END-INDEX'\n", fp);
+        for (i = 0, d = dist->depends; i < dist->num_depends; i++, d++)
+            if (d->subpackage == subpackage) {
+                if (!strcmp(d->product, "_self"))
+                    product = prodname;
+                else
+                    product = d->product;
 
-        tar_close(tarfile);
+                fprintf(fp, "D\t%s\t%s\t%s\t%d\t%d\n", prodfull,
+                        depends[(int)d->type], product, d->vernumber[0],
+                        d->vernumber[1]);
+            }
+        fputs("EPM-END-INDEX\n", fp);
     }
 
-    /*
-     * Create the scripts...
-     */
-
-    if (write_install(dist, prodname, rootsize, usrsize, directory, subpackage))
-        return (1);
-
-    if (havepatchfiles)
-        if (write_patch(dist, prodname, prootsize, pusrsize, directory, subpackage))
-            return (1);
-
-    if (write_remove(dist, prodname, rootsize, usrsize, directory, subpackage))
-        return (1);
-
-    /*
-     * Return...
-     */
-
-    return (0);
+    fprintf(fp, ") >%s/" SOFTWARE_INDEX ".$$\n", SoftwareDir);
+    fprintf(fp, "chmod 644 %s/" SOFTWARE_INDEX ".$$\n", SoftwareDir);
+    fprintf(fp, "mv -f %s/" SOFTWARE_INDEX ".$$ %s/" SOFTWARE_INDEX "\n", SoftwareDir,
+            SoftwareDir);
+    fprintf(fp, "rmdir %s/products.lock 2>/dev/null\n", SoftwareDir);
+    fputs("fi\n", fp);
 }
 
 /*
@@ -1590,20 +1852,24 @@ write_install(dist_t *dist,           /* I - Software distribution */
               const char *prodname,   /* I - Product name */
               int rootsize,           /* I - Size of root files in kbytes */
               int usrsize,            /* I - Size of /usr files in kbytes */
+              int roottar,            /* I - Size of root archive in kbytes */
+              int usrtar,             /* I - Size of /usr archive in kbytes */
+              int backupsize,         /* I - Size of files to back up in kbytes */
               const char *directory,  /* I - Directory */
               const char *subpackage) /* I - Subpackage */
 {
-    int i;                 /* Looping var */
+    int i, j;              /* Looping vars */
     int col;               /* Column in the output */
     FILE *scriptfile;      /* Install script */
     char prodfull[255];    /* Full product name */
     char filename[1024];   /* Name of temporary file */
-    file_t *file;          /* Software file */
+    file_t *file,          /* Software file */
+        *temp;             /* Software file for the helper */
     const char *runlevels; /* Run levels */
     int number;            /* Start/stop number */
 
     if (Verbosity)
-        puts("Writing installation script...");
+        tasks_printf("Writing installation script...\n");
 
     if (subpackage)
         snprintf(prodfull, sizeof(prodfull), "%s-%s", prodname, subpackage);
@@ -1612,8 +1878,8 @@ write_install(dist_t *dist,           /* I - Software distribution */
 
     snprintf(filename, sizeof(filename), "%s/%s.install", directory, prodfull);
 
-    if ((scriptfile = write_common(dist, "Installation", rootsize, usrsize, filename,
-                                   subpackage)) == NULL) {
+    if ((scriptfile = write_common(dist, prodname, "Installation", rootsize, usrsize,
+                                   filename, subpackage)) == NULL) {
         fprintf(stderr,
                 "epm: Unable to create installation script \"%s\" -\n"
                 "     %s\n",
@@ -1681,6 +1947,13 @@ write_install(dist_t *dist,           /* I - Software distribution */
     write_depends(prodname, dist, scriptfile, subpackage);
     write_commands(dist, scriptfile, COMMAND_PRE_INSTALL, subpackage);
 
+    /*
+     * Progress is counted in kbytes, for the files that are backed up and
+     * then for the archives as they are extracted...
+     */
+
+    fprintf(scriptfile, "echo T %d >&9\n", backupsize + roottar + usrtar);
+
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if ((tolower(file->type) == 'f' || tolower(file->type) == 'l') &&
             strncmp(file->dst, "/usr", 4) != 0 && file->subpackage == subpackage)
@@ -1690,6 +1963,13 @@ write_install(dist_t *dist,           /* I - Software distribution */
         fputs("echo Backing up old versions of non-shared files to be installed...\n",
               scriptfile);
 
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if ((tolower(temp->type) == 'f' || tolower(temp->type) == 'l') &&
+                strncmp(temp->dst, "/usr", 4) != 0 && temp->subpackage == subpackage)
+                fprintf(scriptfile, "o - - - %s\n", temp->dst);
+        write_helper_end(scriptfile);
+
         col = fputs("for file in", scriptfile);
         for (; i > 0; i--, file++)
             if ((tolower(file->type) == 'f' || tolower(file->type) == 'l') &&
@@ -1706,6 +1986,7 @@ write_install(dist_t *dist,           /* I - Software distribution */
         fputs("		mv -f \"$file\" \"$file.O\"\n", scriptfile);
         fputs("	fi\n", scriptfile);
         fputs("done\n", scriptfile);
+        fputs("fi\n", scriptfile);
     }
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
@@ -1718,6 +1999,13 @@ write_install(dist_t *dist,           /* I - Software distribution */
         fputs("	echo Backing up old versions of shared files to be installed...\n",
               scriptfile);
 
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if ((tolower(temp->type) == 'f' || tolower(temp->type) == 'l') &&
+                strncmp(temp->dst, "/usr", 4) == 0 && temp->subpackage == subpackage)
+                fprintf(scriptfile, "o - - - %s\n", temp->dst);
+        write_helper_end(scriptfile);
+
         col = fputs("	for file in", scriptfile);
         for (; i > 0; i--, file++)
             if ((tolower(file->type) == 'f' || tolower(file->type) == 'l') &&
@@ -1735,8 +2023,12 @@ write_install(dist_t *dist,           /* I - Software distribution */
         fputs("		fi\n", scriptfile);
         fputs("	done\n", scriptfile);
         fputs("fi\n", scriptfile);
+        fputs("fi\n", scriptfile);
     }
 
+    if (backupsize)
+        fprintf(scriptfile, "echo K %d >&9\n", backupsize);
+
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (tolower(file->type) == 'd' && file->subpackage == subpackage)
             break;
@@ -1744,6 +2036,13 @@ write_install(dist_t *dist,           /* I - Software distribution */
     if (i) {
         fputs("echo Creating installation directories...\n", scriptfile);
 
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if (tolower(temp->type) == 'd' && temp->subpackage == subpackage)
+                fprintf(scriptfile, "d %04o %s %s %s\n", (unsigned)temp->mode, temp->user,
+                        temp->group, temp->dst);
+        write_helper_end(scriptfile);
+
         for (; i > 0; i--, file++)
             if (tolower(file->type) == 'd' && file->subpackage == subpackage) {
                 qprintf(scriptfile, "if test ! -d %s -a ! -f %s -a ! -h %s; then\n",
@@ -1762,24 +2061,38 @@ write_install(dist_t *dist,           /* I - Software distribution */
                 qprintf(scriptfile, "chgrp %s %s\n", file->group, file->dst);
                 qprintf(scriptfile, "chmod %o %s\n", file->mode, file->dst);
             }
+
+        fputs("fi\n", scriptfile);
     }
 
     fputs("echo Installing software...\n", scriptfile);
 
+    /*
+     * The root and /usr archives hold different files, so they are extracted
+     * at the same time...
+     */
+
     if (rootsize) {
         if (CompressFiles)
-            fprintf(scriptfile, "gzip -dc %s.sw | $ac_tar -\n", prodfull);
+            fprintf(scriptfile, "$ac_gzip %s.sw | $ac_meter | $ac_tar -%s\n", prodfull,
+                    usrsize ? " &" : "");
         else
-            fprintf(scriptfile, "$ac_tar %s.sw\n", prodfull);
+            fprintf(scriptfile, "$ac_meter <%s.sw | $ac_tar -%s\n", prodfull,
+                    usrsize ? " &" : "");
     }
 
     if (usrsize) {
         fputs("if echo Write Test >/usr/.writetest 2>/dev/null; then\n", scriptfile);
         if (CompressFiles)
-            fprintf(scriptfile, "	gzip -dc %s.ss | $ac_tar -\n", prodfull);
+            fprintf(scriptfile, "	$ac_gzip %s.ss | $ac_meter | $ac_tar -\n", prodfull);
         else
-            fprintf(scriptfile, "	$ac_tar %s.ss\n", prodfull);
+            fprintf(scriptfile, "	$ac_meter <%s.ss | $ac_tar -\n", prodfull);
+        fputs("else\n", scriptfile);
+        fprintf(scriptfile, "	echo K %d >&9\n", usrtar);
         fputs("fi\n", scriptfile);
+
+        if (rootsize)
+            fputs("wait\n", scriptfile);
     }
 
     fprintf(scriptfile, "if test -d %s; then\n", SoftwareDir);
@@ -1789,6 +2102,8 @@ write_install(dist_t *dist,           /* I - Software distribution */
     fputs("fi\n", scriptfile);
     fprintf(scriptfile, "cp %s.remove %s\n", prodfull, SoftwareDir);
     fprintf(scriptfile, "chmod 544 %s/%s.remove\n", SoftwareDir, prodfull);
+    write_filelist(scriptfile, prodfull);
+    write_index(scriptfile, dist, prodname, prodfull, subpackage, 1);
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (tolower(file->type) == 'c' && file->subpackage == subpackage)
@@ -1817,31 +2132,94 @@ write_install(dist_t *dist,           /* I - Software distribution */
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (strncmp(file->dst, "/usr", 4) != 0 && strcmp(file->user, "root") != 0 &&
+            (tolower(file->type) == 'c' || tolower(file->type) == 'f') &&
             file->subpackage == subpackage)
-            switch (tolower(file->type)) {
-            case 'c':
-                qprintf(scriptfile, "chown %s %s.N\n", file->user, file->dst);
-                qprintf(scriptfile, "chgrp %s %s.N\n", file->group, file->dst);
-            case 'f':
-                qprintf(scriptfile, "chown %s %s\n", file->user, file->dst);
-                qprintf(scriptfile, "chgrp %s %s\n", file->group, file->dst);
-                break;
-            }
+            break;
+
+    if (i) {
+        /*
+         * Configuration files keep the permissions the user gave them; only
+         * the new copy gets the permissions from the list...
+         */
+
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if (strncmp(temp->dst, "/usr", 4) != 0 && strcmp(temp->user, "root") != 0 &&
+                temp->subpackage == subpackage)
+                switch (tolower(temp->type)) {
+                case 'c':
+                    fprintf(scriptfile, "p %04o %s %s %s.N\n", (unsigned)temp->mode,
+                            temp->user, temp->group, temp->dst);
+                    fprintf(scriptfile, "p - %s %s %s\n", temp->user, temp->group,
+                            temp->dst);
+                    break;
+                case 'f':
+                    fprintf(scriptfile, "p %04o %s %s %s\n", (unsigned)temp->mode,
+                            temp->user, temp->group, temp->dst);
+                    break;
+                }
+        write_helper_end(scriptfile);
+
+        for (; i > 0; i--, file++)
+            if (strncmp(file->dst, "/usr", 4) != 0 && strcmp(file->user, "root") != 0 &&
+                file->subpackage == subpackage)
+                switch (tolower(file->type)) {
+                case 'c':
+                    qprintf(scriptfile, "chown %s %s.N\n", file->user, file->dst);
+                    qprintf(scriptfile, "chgrp %s %s.N\n", file->group, file->dst);
+                case 'f':
+                    qprintf(scriptfile, "chown %s %s\n", file->user, file->dst);
+                    qprintf(scriptfile, "chgrp %s %s\n", file->group, file->dst);
+                    break;
+                }
+
+        fputs("fi\n", scriptfile);
+    }
 
     fputs("if test -f /usr/.writetest; then\n", scriptfile);
     fputs("	rm -f /usr/.writetest\n", scriptfile);
+
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (strncmp(file->dst, "/usr", 4) == 0 && strcmp(file->user, "root") != 0 &&
+            (tolower(file->type) == 'c' || tolower(file->type) == 'f') &&
             file->subpackage == subpackage)
-            switch (tolower(file->type)) {
-            case 'c':
-                qprintf(scriptfile, "	chown %s %s.N\n", file->user, file->dst);
-                qprintf(scriptfile, "	chgrp %s %s.N\n", file->group, file->dst);
-            case 'f':
-                qprintf(scriptfile, "	chown %s %s\n", file->user, file->dst);
-                qprintf(scriptfile, "	chgrp %s %s\n", file->group, file->dst);
-                break;
-            }
+            break;
+
+    if (i) {
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if (strncmp(temp->dst, "/usr", 4) == 0 && strcmp(temp->user, "root") != 0 &&
+                temp->subpackage == subpackage)
+                switch (tolower(temp->type)) {
+                case 'c':
+                    fprintf(scriptfile, "p %04o %s %s %s.N\n", (unsigned)temp->mode,
+                            temp->user, temp->group, temp->dst);
+                    fprintf(scriptfile, "p - %s %s %s\n", temp->user, temp->group,
+                            temp->dst);
+                    break;
+                case 'f':
+                    fprintf(scriptfile, "p %04o %s %s %s\n", (unsigned)temp->mode,
+                            temp->user, temp->group, temp->dst);
+                    break;
+                }
+        write_helper_end(scriptfile);
+
+        for (; i > 0; i--, file++)
+            if (strncmp(file->dst, "/usr", 4) == 0 && strcmp(file->user, "root") != 0 &&
+                file->subpackage == subpackage)
+                switch (tolower(file->type)) {
+                case 'c':
+                    qprintf(scriptfile, "	chown %s %s.N\n", file->user, file->dst);
+                    qprintf(scriptfile, "	chgrp %s %s.N\n", file->group, file->dst);
+                case 'f':
+                    qprintf(scriptfile, "	chown %s %s\n", file->user, file->dst);
+                    qprintf(scriptfile, "	chgrp %s %s\n", file->group, file->dst);
+                    break;
+                }
+
+        fputs("fi\n", scriptfile);
+    }
+
     fputs("fi\n", scriptfile);
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
@@ -1943,6 +2321,21 @@ write_install(dist_t *dist,           /* I - Software distribution */
     return (0);
 }
 
+/*
+ * 'write_install_task()' - Write the installation script once the archive
+ *                          sizes are known.
+ */
+
+static int                                 /* O - 0 on success, 1 on failure */
+write_install_task(distfiles_t *distfiles) /* I - Distribution file data */
+{
+    return (write_install(distfiles->dist, distfiles->prodname,
+                          distfiles->archives[0].size, distfiles->archives[1].size,
+                          distfiles->archives[0].tsize, distfiles->archives[1].tsize,
+                          distfiles->archives[0].bsize + distfiles->archives[1].bsize,
+                          distfiles->directory, distfiles->subpackage));
+}
+
 /*
  * 'write_instfiles()' - Write the installer files to the tar file...
  */
@@ -1997,6 +2390,31 @@ write_instfiles(tarf_t *tarfile,        /* I - Distribution tar file */
     return (0);
 }
 
+/*
+ * 'write_manifest_task()' - Write the build manifest for the distribution
+ *                           files.
+ */
+
+static int                                  /* O - 0 on success, 1 on failure */
+write_manifest_task(distfiles_t *distfiles) /* I - Distribution file data */
+{
+    int i;               /* Looping var */
+    char filename[1024]; /* Distribution file */
+    static const char *const exts[] = /* Distribution file extensions */
+        {"files", "install", "license", "patch", "pss", "psw", "readme", "remove", "ss",
+         "sw"};
+
+    for (i = 0; i < (int)(sizeof(exts) / sizeof(exts[0])); i++) {
+        snprintf(filename, sizeof(filename), "%s/%s.%s", distfiles->directory,
+                 distfiles->prodfull, exts[i]);
+
+        if (!access(filename, 0))
+            manifest_add_output(distfiles->manifest, filename);
+    }
+
+    return (manifest_write(distfiles->manifest, distfiles->manifestname) ? 1 : 0);
+}
+
 /*
  * 'write_patch()' - Write the patch script.
  */
@@ -2006,19 +2424,27 @@ write_patch(dist_t *dist,           /* I - Software distribution */
             const char *prodname,   /* I - Product name */
             int rootsize,           /* I - Size of root files in kbytes */
             int usrsize,            /* I - Size of /usr files in kbytes */
+            int roottar,            /* I - Size of root archive in kbytes */
+            int usrtar,             /* I - Size of /usr archive in kbytes */
             const char *directory,  /* I - Directory */
             const char *subpackage) /* I - Subpackage */
 {
-    int i;                 /* Looping var */
+    int i, j;              /* Looping vars */
     FILE *scriptfile;      /* Patch script */
     char filename[1024];   /* Name of temporary file */
     char prodfull[255];    /* Full product name */
-    file_t *file;          /* Software file */
+    file_t *file,          /* Software file */
+        *temp;             /* Software file for the helper */
     const char *runlevels; /* Run levels */
     int number;            /* Start/stop number */
+    int havedeltas;        /* 1 if we have delta files, 0 otherwise */
+    char oldname[1024],    /* Previous version of file */
+        deltaname[1024],   /* Delta file */
+        hex[SHA256_HEX_SIZE]; /* Digest of previous version */
+    const char *ext;       /* Full software archive extension */
 
     if (Verbosity)
-        puts("Writing patch script...");
+        tasks_printf("Writing patch script...\n");
 
     if (subpackage)
         snprintf(prodfull, sizeof(prodfull), "%s-%s", prodname, subpackage);
@@ -2027,8 +2453,8 @@ write_patch(dist_t *dist,           /* I - Software distribution */
 
     snprintf(filename, sizeof(filename), "%s/%s.patch", directory, prodfull);
 
-    if ((scriptfile = write_common(dist, "Patch", rootsize, usrsize, filename,
-                                   subpackage)) == NULL) {
+    if ((scriptfile = write_common(dist, prodname, "Patch", rootsize, usrsize,
+                                   filename, subpackage)) == NULL) {
         fprintf(stderr,
                 "epm: Unable to create patch script \"%s\" -\n"
                 "     %s\n",
@@ -2090,6 +2516,8 @@ write_patch(dist_t *dist,           /* I - Software distribution */
                        usrsize ? "pss" : NULL, rootsize, usrsize);
     write_depends(prodname, dist, scriptfile, subpackage);
 
+    fprintf(scriptfile, "echo T %d >&9\n", roottar + usrtar);
+
     fprintf(scriptfile, "if test ! -x %s/%s.remove; then\n", SoftwareDir, prodfull);
     fputs("	echo You do not appear to have the base software installed!\n",
           scriptfile);
@@ -2097,6 +2525,47 @@ write_patch(dist_t *dist,           /* I - Software distribution */
     fputs("	exit 1\n", scriptfile);
     fputs("fi\n", scriptfile);
 
+    /*
+     * Files with deltas can only be patched when they have not changed since
+     * the previous release; otherwise the new file is copied from the full
+     * distribution...
+     */
+
+    havedeltas = 0;
+
+    for (i = 0, file = dist->files; i < dist->num_files; i++, file++) {
+        if (file->subpackage != subpackage ||
+            get_delta(file, oldname, sizeof(oldname), deltaname, sizeof(deltaname)) ||
+            access(deltaname, 0))
+            continue;
+
+        if (sha256_file(oldname, hex, sizeof(hex))) {
+            fprintf(stderr, "epm: Unable to read \"%s\" - %s\n", oldname,
+                    strerror(errno));
+            fclose(scriptfile);
+            return (-1);
+        }
+
+        if (!havedeltas) {
+            fputs("echo Checking files to be patched...\n", scriptfile);
+            havedeltas = 1;
+        }
+
+        ext = strncmp(file->dst, "/usr", 4) ? "sw" : "ss";
+
+        qprintf(scriptfile, "if ./epmhelper check %s %s >/dev/null 2>&1; then\n", hex,
+                file->dst);
+        fprintf(scriptfile, "	ac_delta%d=1\n", i);
+        fprintf(scriptfile, "elif test -f %s.%s; then\n", prodfull, ext);
+        fprintf(scriptfile, "	ac_delta%d=0\n", i);
+        fputs("else\n", scriptfile);
+        qprintf(scriptfile, "	echo Error: %s has been changed and cannot be patched!\n",
+                file->dst);
+        fputs("	echo Please install the full distribution instead.\n", scriptfile);
+        fputs("	exit 1\n", scriptfile);
+        fputs("fi\n", scriptfile);
+    }
+
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (tolower(file->type) == 'i' && file->subpackage == subpackage)
             qprintf(scriptfile, "%s/init.d/%s stop\n", SoftwareDir, file->dst);
@@ -2110,6 +2579,13 @@ write_patch(dist_t *dist,           /* I - Software distribution */
     if (i) {
         fputs("echo Creating new installation directories...\n", scriptfile);
 
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if (temp->type == 'D' && temp->subpackage == subpackage)
+                fprintf(scriptfile, "d %04o %s %s %s\n", (unsigned)temp->mode, temp->user,
+                        temp->group, temp->dst);
+        write_helper_end(scriptfile);
+
         for (; i > 0; i--, file++)
             if (file->type == 'D' && file->subpackage == subpackage) {
                 qprintf(scriptfile, "if test ! -d %s -a ! -f %s -a ! -h %s; then\n",
@@ -2128,55 +2604,169 @@ write_patch(dist_t *dist,           /* I - Software distribution */
                 qprintf(scriptfile, "chgrp %s %s\n", file->group, file->dst);
                 qprintf(scriptfile, "chmod %o %s\n", file->mode, file->dst);
             }
+
+        fputs("fi\n", scriptfile);
     }
 
     fputs("echo Patching software...\n", scriptfile);
 
+    /*
+     * The root and /usr archives hold different files, so they are extracted
+     * at the same time...
+     */
+
     if (rootsize) {
         if (CompressFiles)
-            fprintf(scriptfile, "gzip -dc %s.psw | $ac_tar -\n", prodfull);
+            fprintf(scriptfile, "$ac_gzip %s.psw | $ac_meter | $ac_tar -%s\n", prodfull,
+                    usrsize ? " &" : "");
         else
-            fprintf(scriptfile, "$ac_tar %s.psw\n", prodfull);
+            fprintf(scriptfile, "$ac_meter <%s.psw | $ac_tar -%s\n", prodfull,
+                    usrsize ? " &" : "");
     }
 
     if (usrsize) {
         fputs("if echo Write Test >/usr/.writetest 2>/dev/null; then\n", scriptfile);
         if (CompressFiles)
-            fprintf(scriptfile, "	gzip -dc %s.pss | $ac_tar -\n", prodfull);
+            fprintf(scriptfile, "	$ac_gzip %s.pss | $ac_meter | $ac_tar -\n", prodfull);
         else
-            fprintf(scriptfile, "	$ac_tar %s.pss\n", prodfull);
+            fprintf(scriptfile, "	$ac_meter <%s.pss | $ac_tar -\n", prodfull);
+        fputs("else\n", scriptfile);
+        fprintf(scriptfile, "	echo K %d >&9\n", usrtar);
         fputs("fi\n", scriptfile);
+
+        if (rootsize)
+            fputs("wait\n", scriptfile);
+    }
+
+    if (havedeltas) {
+        /*
+         * Apply the deltas, collecting the files that need to be copied from
+         * the full distribution instead...
+         */
+
+        fputs("echo Applying deltas...\n", scriptfile);
+        fputs("ac_sw=\"\"\n", scriptfile);
+        fputs("ac_ss=\"\"\n", scriptfile);
+
+        for (i = 0, file = dist->files; i < dist->num_files; i++, file++) {
+            if (file->subpackage != subpackage ||
+                get_delta(file, oldname, sizeof(oldname), deltaname, sizeof(deltaname)) ||
+                access(deltaname, 0))
+                continue;
+
+            qprintf(scriptfile, "if test -f %s.epmdelta; then\n", file->dst);
+            fprintf(scriptfile, "	if test \"$ac_delta%d\" = 1 && ", i);
+            qprintf(scriptfile, "./epmhelper delta %s %s.epmdelta %s.epmnew; then\n",
+                    file->dst, file->dst, file->dst);
+            qprintf(scriptfile, "		mv -f %s.epmnew %s\n", file->dst, file->dst);
+            fputs("	else\n", scriptfile);
+            qprintf(scriptfile, "		ac_%s=\"$ac_%s %s\"\n",
+                    strncmp(file->dst, "/usr", 4) ? "sw" : "ss",
+                    strncmp(file->dst, "/usr", 4) ? "sw" : "ss", file->dst);
+            fputs("	fi\n", scriptfile);
+            qprintf(scriptfile, "	rm -f %s.epmdelta\n", file->dst);
+            fputs("fi\n", scriptfile);
+        }
+
+        for (i = 0; i < 2; i++) {
+            ext = i ? "ss" : "sw";
+
+            fprintf(scriptfile, "if test \"x$ac_%s\" != x; then\n", ext);
+            fprintf(scriptfile, "	if test -f %s.%s; then\n", prodfull, ext);
+            fputs("		echo Copying changed files from the full distribution...\n",
+                  scriptfile);
+            if (CompressFiles)
+                fprintf(scriptfile, "		$ac_gzip %s.%s | $ac_tar - $ac_%s\n", prodfull,
+                        ext, ext);
+            else
+                fprintf(scriptfile, "		$ac_tar %s.%s $ac_%s\n", prodfull, ext, ext);
+            fputs("	else\n", scriptfile);
+            fprintf(scriptfile, "		echo Error: Unable to patch$ac_%s!\n", ext);
+            fputs("		echo Please install the full distribution instead.\n",
+                  scriptfile);
+            fputs("		exit 1\n", scriptfile);
+            fputs("	fi\n", scriptfile);
+            fputs("fi\n", scriptfile);
+        }
     }
 
     fprintf(scriptfile, "rm -f %s/%s.remove\n", SoftwareDir, prodfull);
     fprintf(scriptfile, "cp %s.remove %s\n", prodfull, SoftwareDir);
     fprintf(scriptfile, "chmod 544 %s/%s.remove\n", SoftwareDir, prodfull);
+    write_filelist(scriptfile, prodfull);
+    write_index(scriptfile, dist, prodname, prodfull, subpackage, 1);
 
     fputs("echo Updating file permissions...\n", scriptfile);
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (strncmp(file->dst, "/usr", 4) != 0 && strcmp(file->user, "root") != 0 &&
-            file->subpackage == subpackage)
-            switch (file->type) {
-            case 'C':
-            case 'F':
-                qprintf(scriptfile, "chown %s %s\n", file->user, file->dst);
-                qprintf(scriptfile, "chgrp %s %s\n", file->group, file->dst);
-                break;
+            (file->type == 'C' || file->type == 'F') && file->subpackage == subpackage)
+            break;
+
+    if (i) {
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if (strncmp(temp->dst, "/usr", 4) != 0 && strcmp(temp->user, "root") != 0 &&
+                (temp->type == 'C' || temp->type == 'F') && temp->subpackage == subpackage) {
+                if (temp->type == 'C')
+                    fprintf(scriptfile, "p - %s %s %s\n", temp->user, temp->group,
+                            temp->dst);
+                else
+                    fprintf(scriptfile, "p %04o %s %s %s\n", (unsigned)temp->mode,
+                            temp->user, temp->group, temp->dst);
             }
+        write_helper_end(scriptfile);
+
+        for (; i > 0; i--, file++)
+            if (strncmp(file->dst, "/usr", 4) != 0 && strcmp(file->user, "root") != 0 &&
+                file->subpackage == subpackage)
+                switch (file->type) {
+                case 'C':
+                case 'F':
+                    qprintf(scriptfile, "chown %s %s\n", file->user, file->dst);
+                    qprintf(scriptfile, "chgrp %s %s\n", file->group, file->dst);
+                    break;
+                }
+
+        fputs("fi\n", scriptfile);
+    }
 
     fputs("if test -f /usr/.writetest; then\n", scriptfile);
     fputs("	rm -f /usr/.writetest\n", scriptfile);
+
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if (strncmp(file->dst, "/usr", 4) == 0 && strcmp(file->user, "root") != 0 &&
-            file->subpackage == subpackage)
-            switch (file->type) {
-            case 'C':
-            case 'F':
-                qprintf(scriptfile, "	chown %s %s\n", file->user, file->dst);
-                qprintf(scriptfile, "	chgrp %s %s\n", file->group, file->dst);
-                break;
+            (file->type == 'C' || file->type == 'F') && file->subpackage == subpackage)
+            break;
+
+    if (i) {
+        write_helper_begin(scriptfile);
+        for (j = i, temp = file; j > 0; j--, temp++)
+            if (strncmp(temp->dst, "/usr", 4) == 0 && strcmp(temp->user, "root") != 0 &&
+                (temp->type == 'C' || temp->type == 'F') && temp->subpackage == subpackage) {
+                if (temp->type == 'C')
+                    fprintf(scriptfile, "p - %s %s %s\n", temp->user, temp->group,
+                            temp->dst);
+                else
+                    fprintf(scriptfile, "p %04o %s %s %s\n", (unsigned)temp->mode,
+                            temp->user, temp->group, temp->dst);
             }
+        write_helper_end(scriptfile);
+
+        for (; i > 0; i--, file++)
+            if (strncmp(file->dst, "/usr", 4) == 0 && strcmp(file->user, "root") != 0 &&
+                file->subpackage == subpackage)
+                switch (file->type) {
+                case 'C':
+                case 'F':
+                    qprintf(scriptfile, "	chown %s %s\n", file->user, file->dst);
+                    qprintf(scriptfile, "	chgrp %s %s\n", file->group, file->dst);
+                    break;
+                }
+
+        fputs("fi\n", scriptfile);
+    }
+
     fputs("fi\n", scriptfile);
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
@@ -2318,6 +2908,20 @@ write_patch(dist_t *dist,           /* I - Software distribution */
     return (0);
 }
 
+/*
+ * 'write_patch_task()' - Write the patch script once the archive sizes are
+ *                        known.
+ */
+
+static int                               /* O - 0 on success, 1 on failure */
+write_patch_task(distfiles_t *distfiles) /* I - Distribution file data */
+{
+    return (write_patch(distfiles->dist, distfiles->prodname,
+                        distfiles->archives[0].psize, distfiles->archives[1].psize,
+                        distfiles->archives[2].tsize, distfiles->archives[3].tsize,
+                        distfiles->directory, distfiles->subpackage));
+}
+
 /*
  * 'write_remove()' - Write the removal script.
  */
@@ -2332,6 +2936,7 @@ write_remove(dist_t *dist,           /* I - Software distribution */
 {
     int i;                 /* Looping var */
     int col;               /* Current column */
+    int count;             /* Number of files to remove */
     FILE *scriptfile;      /* Remove script */
     char filename[1024];   /* Name of temporary file */
     char prodfull[255];    /* Full product name */
@@ -2340,7 +2945,7 @@ write_remove(dist_t *dist,           /* I - Software distribution */
     int number;            /* Start/stop number */
 
     if (Verbosity)
-        puts("Writing removal script...");
+        tasks_printf("Writing removal script...\n");
 
     if (subpackage)
         snprintf(prodfull, sizeof(prodfull), "%s-%s", prodname, subpackage);
@@ -2349,7 +2954,7 @@ write_remove(dist_t *dist,           /* I - Software distribution */
 
     snprintf(filename, sizeof(filename), "%s/%s.remove", directory, prodfull);
 
-    if ((scriptfile = write_common(dist, "Removal", rootsize, usrsize, filename,
+    if ((scriptfile = write_common(dist, NULL, "Removal", rootsize, usrsize, filename,
                                    subpackage)) == NULL) {
         fprintf(stderr,
                 "epm: Unable to create removal script \"%s\" -\n"
@@ -2465,6 +3070,35 @@ write_remove(dist_t *dist,           /* I - Software distribution */
 
     fputs("echo Removing/restoring installed files...\n", scriptfile);
 
+    /*
+     * Progress is counted in files and directories removed...
+     */
+
+    for (i = dist->num_files, file = dist->files, count = 0; i > 0; i--, file++)
+        if ((tolower(file->type) == 'f' || tolower(file->type) == 'l' ||
+             tolower(file->type) == 'd') &&
+            file->subpackage == subpackage)
+            count++;
+
+    fprintf(scriptfile, "echo T %d >&9\n", count);
+
+    /*
+     * The helper removes the files in the installed file list, restores the
+     * backups, and removes the directories; the shell commands are only run
+     * when it is missing or too old to know the "remove" command...
+     */
+
+    fprintf(scriptfile, "if test -x %s/epmhelper; then\n", SoftwareDir);
+    fprintf(scriptfile, "	%s/epmhelper remove %s/%s.files >/dev/null\n", SoftwareDir,
+            SoftwareDir, prodfull);
+    fputs("	ac_status=$?\n", scriptfile);
+    fputs("else\n", scriptfile);
+    fputs("	ac_status=2\n", scriptfile);
+    fputs("fi\n", scriptfile);
+    fputs("if test $ac_status = 0; then\n", scriptfile);
+    fprintf(scriptfile, "	echo K %d >&9\n", count);
+    fputs("else\n", scriptfile);
+
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
         if ((tolower(file->type) == 'f' || tolower(file->type) == 'l') &&
             strncmp(file->dst, "/usr", 4) != 0 && file->subpackage == subpackage)
@@ -2472,9 +3106,10 @@ write_remove(dist_t *dist,           /* I - Software distribution */
 
     if (i) {
         col = fputs("for file in", scriptfile);
-        for (; i > 0; i--, file++)
+        for (count = 0; i > 0; i--, file++)
             if ((tolower(file->type) == 'f' || tolower(file->type) == 'l') &&
                 strncmp(file->dst, "/usr", 4) != 0 && file->subpackage == subpackage) {
+                count++;
                 if (col > 80)
                     col = qprintf(scriptfile, " \\\n%s", file->dst) - 2;
                 else
@@ -2488,6 +3123,7 @@ write_remove(dist_t *dist,           /* I - Software distribution */
         fputs("		mv -f \"$file.O\" \"$file\"\n", scriptfile);
         fputs("	fi\n", scriptfile);
         fputs("done\n", scriptfile);
+        fprintf(scriptfile, "echo K %d >&9\n", count);
     }
 
     for (i = dist->num_files, file = dist->files; i > 0; i--, file++)
@@ -2498,9 +3134,10 @@ write_remove(dist_t *dist,           /* I - Software distribution */
     if (i) {
         fputs("if test -w /usr ; then\n", scriptfile);
         col = fputs("	for file in", scriptfile);
-        for (; i > 0; i--, file++)
+        for (count = 0; i > 0; i--, file++)
             if ((tolower(file->type) == 'f' || tolower(file->type) == 'l') &&
                 strncmp(file->dst, "/usr", 4) == 0 && file->subpackage == subpackage) {
+                count++;
                 if (col > 80)
                     col = qprintf(scriptfile, " \\\n%s", file->dst) - 2;
                 else
@@ -2516,6 +3153,7 @@ write_remove(dist_t *dist,           /* I - Software distribution */
         fputs("		fi\n", scriptfile);
         fputs("	done\n", scriptfile);
         fputs("fi\n", scriptfile);
+        fprintf(scriptfile, "echo K %d >&9\n", count);
     }
 
     fputs("echo Checking configuration files...\n", scriptfile);
@@ -2550,17 +3188,28 @@ write_remove(dist_t *dist,           /* I - Software distribution */
     if (i) {
         fputs("echo Removing empty installation directories...\n", scriptfile);
 
-        for (; i > 0; i--, file--)
+        for (count = 0; i > 0; i--, file--)
             if (tolower(file->type) == 'd' && file->subpackage == subpackage) {
+                count++;
                 qprintf(scriptfile, "if test -d %s; then\n", file->dst);
                 qprintf(scriptfile, "	rmdir %s >/dev/null 2>&1\n", file->dst);
                 fputs("fi\n", scriptfile);
             }
+
+        fprintf(scriptfile, "echo K %d >&9\n", count);
     }
 
+    fputs("fi\n", scriptfile);
+
     write_commands(dist, scriptfile, COMMAND_POST_REMOVE, subpackage);
 
+    fprintf(scriptfile, "rm -f %s/%s.files\n", SoftwareDir, prodfull);
+    fprintf(scriptfile, "if test \"`ls %s/*.files 2>/dev/null`\" = \"\"; then\n",
+            SoftwareDir);
+    fprintf(scriptfile, "	rm -f %s/epmhelper\n", SoftwareDir);
+    fputs("fi\n", scriptfile);
     fprintf(scriptfile, "rm -f %s/%s.remove\n", SoftwareDir, prodfull);
+    write_index(scriptfile, dist, prodname, prodfull, subpackage, 0);
 
     fputs("echo Removal is complete.\n", scriptfile);
 
@@ -2569,6 +3218,19 @@ write_remove(dist_t *dist,           /* I - Software distribution */
     return (0);
 }
 
+/*
+ * 'write_remove_task()' - Write the removal script once the archive sizes
+ *                         are known.
+ */
+
+static int                                /* O - 0 on success, 1 on failure */
+write_remove_task(distfiles_t *distfiles) /* I - Distribution file data */
+{
+    return (write_remove(distfiles->dist, distfiles->prodname,
+                         distfiles->archives[0].size, distfiles->archives[1].size,
+                         distfiles->directory, distfiles->subpackage));
+}
+
 /*
  * 'write_space_checks()' - Write disk space checks for the installer.
  */
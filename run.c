@@ -22,10 +22,67 @@
  * Include necessary headers...
  */
 
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE /* For posix_spawn_file_actions_addchdir_np() on Linux */
+#endif /* !_GNU_SOURCE */
 #include "epm.h"
 #include <fcntl.h>
 #include <stdarg.h>
 #include <sys/wait.h>
+#ifdef HAVE_SPAWN_H
+#    include <spawn.h>
+#endif /* HAVE_SPAWN_H */
+#ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local types...
+ */
+
+struct run_job_s /**** Running external program ****/
+{
+    pid_t pid;          /* Process ID */
+    int done,           /* 1 if the program has finished */
+        status,         /* Exit status */
+        outfd;          /* Captured output file or -1 */
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;   /* Thread that started the program */
+#endif /* HAVE_PTHREAD_H */
+    run_job_t *next;    /* Next running program */
+};
+
+/*
+ * Local globals...
+ */
+
+static int RunMaxJobs = 0;        /* Maximum number of running programs */
+static int RunNumJobs = 0;        /* Number of running programs */
+static run_job_t *RunJobs = NULL; /* Running programs, oldest first */
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t RunMutex = PTHREAD_MUTEX_INITIALIZER;
+/* Lock for the running list */
+static pthread_cond_t RunCond = PTHREAD_COND_INITIALIZER;
+/* Signalled when a program finishes */
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local functions...
+ */
+
+#if !defined(HAVE_SPAWN_H) || !defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+static int run_fork(run_job_t *job, const char *directory, char **argv);
+#endif /* !HAVE_SPAWN_H || !HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP */
+static int run_parse(char *argbuf, char **argv, int argsize);
+#ifdef HAVE_SPAWN_H
+static int run_posix_spawn(run_job_t *job, const char *directory, char **argv);
+#endif /* HAVE_SPAWN_H */
+static int run_reap(run_job_t *job);
+static run_job_t *run_spawn(const char *directory, char **argv, int capture,
+                            int max_jobs);
+static void run_unreserve(void);
+
+extern char **environ;
 
 /*
  * 'run_command()' - Run an external program.
@@ -37,11 +94,9 @@ run_command(const char *directory, /* I - Directory for command or NULL */
             ...)                   /* I - Additional arguments as needed */
 {
     va_list ap;         /* Argument pointer */
-    int pid,            /* Child process ID */
-        status,         /* Status of child */
-        argc;           /* Number of arguments */
+    int capture;        /* Capture output? */
+    run_job_t *job;     /* Running program */
     char argbuf[10240], /* Argument buffer */
-        *argptr,        /* Argument string pointer */
         *argv[100];     /* Argument strings */
 
     /*
@@ -50,19 +105,155 @@ run_command(const char *directory, /* I - Directory for command or NULL */
 
     va_start(ap, command);
     vsnprintf(argbuf, sizeof(argbuf) - 1, command, ap);
+    va_end(ap);
     argbuf[sizeof(argbuf) - 1] = '\0';
 
     if (Verbosity > 1)
-        puts(argbuf);
+        tasks_printf("%s\n", argbuf);
+
+    run_parse(argbuf, argv, (int)(sizeof(argv) / sizeof(argv[0])));
 
     /*
-     * Parse the argument string; arguments can be separated by whitespace
-     * and quoted by " and '...
+     * Execute the command and wait for it; verbose output goes straight to
+     * the terminal unless it has to be merged with the output of a concurrent
+     * build task, otherwise it is discarded...
      */
 
+    if ((capture = Verbosity > 1 && tasks_buffered()) == 0)
+        fflush(stdout);
+
+    if ((job = run_spawn(directory, argv, capture, 0)) == NULL)
+        return (1);
+
+    return (run_wait(job));
+}
+
+/*
+ * 'run_jobs()' - Set the maximum number of concurrently running programs.
+ *
+ * A value of 0 uses the number of online processors.
+ */
+
+void                 /* O - Nothing */
+run_jobs(int max_jobs) /* I - Maximum running programs or 0 */
+{
+    RunMaxJobs = max_jobs;
+}
+
+/*
+ * 'run_max_jobs()' - Get the maximum number of concurrently running programs.
+ */
+
+int                /* O - Maximum running programs */
+run_max_jobs(void) /* I - Nothing */
+{
+    int max_jobs; /* Maximum running programs */
+
+    if ((max_jobs = RunMaxJobs) <= 0 && (max_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        max_jobs = 1;
+
+    return (max_jobs);
+}
+
+/*
+ * 'run_start()' - Start an external program without waiting for it.
+ *
+ * When verbose output is enabled, the standard output and error of the
+ * program are captured and shown by 'run_wait()' so that the output of
+ * concurrent programs is never interleaved; otherwise they are discarded.  If the maximum number of
+ * programs are already running, this function first waits for the oldest
+ * one started by the calling thread to finish, or for another thread's
+ * program to finish if there are none.
+ */
+
+run_job_t *                      /* O - Job or NULL on error */
+run_start(const char *directory, /* I - Directory for command or NULL */
+          const char *command,   /* I - Command string */
+          ...)                   /* I - Additional arguments as needed */
+{
+    va_list ap;         /* Argument pointer */
+    char argbuf[10240], /* Argument buffer */
+        *argv[100];     /* Argument strings */
+
+    va_start(ap, command);
+    vsnprintf(argbuf, sizeof(argbuf) - 1, command, ap);
+    va_end(ap);
+    argbuf[sizeof(argbuf) - 1] = '\0';
+
+    if (Verbosity > 1)
+        tasks_printf("%s\n", argbuf);
+
+    run_parse(argbuf, argv, (int)(sizeof(argv) / sizeof(argv[0])));
+
+    return (run_startv(directory, argv));
+}
+
+/*
+ * 'run_startv()' - Start an external program using an argument array.
+ */
+
+run_job_t *                       /* O - Job or NULL on error */
+run_startv(const char *directory, /* I - Directory for command or NULL */
+           char **argv)           /* I - NULL-terminated arguments */
+{
+    return (run_spawn(directory, argv, Verbosity > 1, run_max_jobs()));
+}
+
+/*
+ * 'run_wait()' - Wait for an external program and free the job.
+ */
+
+int                 /* O - Exit status */
+run_wait(run_job_t *job) /* I - Job */
+{
+    int status;        /* Exit status */
+    char buffer[8192]; /* Output buffer */
+    ssize_t bytes;     /* Bytes read */
+
+    if (!job)
+        return (1);
+
+    run_reap(job);
+
+    if (job->outfd >= 0) {
+        /*
+         * Copy any captured output...
+         */
+
+        if (Verbosity > 1 && !lseek(job->outfd, 0, SEEK_SET)) {
+            while ((bytes = read(job->outfd, buffer, sizeof(buffer))) > 0)
+                tasks_write(buffer, (size_t)bytes);
+
+            if (!tasks_buffered())
+                fflush(stdout);
+        }
+
+        close(job->outfd);
+    }
+
+    status = job->status;
+    free(job);
+
+    return (status);
+}
+
+/*
+ * 'run_parse()' - Parse a command string into arguments.
+ *
+ * Arguments can be separated by whitespace and quoted by " and '...
+ */
+
+static int           /* O - Number of arguments */
+run_parse(char *argbuf, /* I - Command string */
+          char **argv,  /* O - Argument strings */
+          int argsize)  /* I - Size of argument array */
+{
+    int argc;     /* Number of arguments */
+    char *argptr; /* Argument string pointer */
+
     argv[0] = argbuf;
 
-    for (argptr = argbuf, argc = 1; *argptr != '\0' && argc < 99; argptr++)
+    for (argptr = argbuf, argc = 1; *argptr != '\0' && argc < (argsize - 1); argptr++)
         if (isspace(*argptr & 255)) {
             *argptr++ = '\0';
 
@@ -103,32 +294,247 @@ run_command(const char *directory, /* I - Directory for command or NULL */
 
     argv[argc] = NULL;
 
+    return (argc);
+}
+
+/*
+ * 'run_reap()' - Wait for a job to finish and remove it from the list.
+ */
+
+static int            /* O - Exit status */
+run_reap(run_job_t *job) /* I - Job */
+{
+    int status;       /* Status of child */
+    run_job_t *prev;  /* Previous job */
+    pid_t pid;        /* Process ID */
+
+    if (job->done)
+        return (job->status);
+
+    while ((pid = waitpid(job->pid, &status, 0)) < 0 && errno == EINTR)
+        ;
+
+    if (pid != job->pid) {
+        fprintf(stderr, "epm: Unable to get exit status of process %d: %s\n", (int)job->pid,
+                strerror(errno));
+        job->status = 1;
+    } else if (WIFSIGNALED(status))
+        job->status = -WTERMSIG(status);
+    else
+        job->status = WEXITSTATUS(status);
+
+    job->done = 1;
+
+    /*
+     * Remove the job from the running list...
+     */
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    if (RunJobs == job)
+        RunJobs = job->next;
+    else {
+        for (prev = RunJobs; prev && prev->next != job; prev = prev->next)
+            ;
+
+        if (prev)
+            prev->next = job->next;
+    }
+
+    RunNumJobs--;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_broadcast(&RunCond);
+    pthread_mutex_unlock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    return (job->status);
+}
+
+/*
+ * 'run_spawn()' - Start a program.
+ *
+ * Jobs are only reaped by the thread that started them, so when
+ * "max_jobs" programs are already running we wait for one of our own or,
+ * if none of them are ours, for another thread to reap one.
+ */
+
+static run_job_t *               /* O - Job or NULL on error */
+run_spawn(const char *directory, /* I - Directory for command or NULL */
+          char **argv,           /* I - Argument strings */
+          int capture,           /* I - Capture output? */
+          int max_jobs)          /* I - Maximum running programs or 0 for no limit */
+{
+    run_job_t *job,     /* New job */
+        *last;          /* Last running job */
+    int error;          /* Error code */
+    char outfile[1024]; /* Output file */
+    const char *tmpdir; /* Temporary directory */
+
     /*
-     * Execute the command...
+     * Wait for a free job slot and reserve it...
      */
 
-    if ((pid = fork()) == 0) {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    while (max_jobs > 0 && RunNumJobs >= max_jobs) {
+        for (last = RunJobs; last; last = last->next)
+#ifdef HAVE_PTHREAD_H
+            if (pthread_equal(last->thread, pthread_self()))
+#endif /* HAVE_PTHREAD_H */
+                break;
+
+        if (last) {
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_unlock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+            run_reap(last);
+
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_lock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+        } else {
+#ifdef HAVE_PTHREAD_H
+            pthread_cond_wait(&RunCond, &RunMutex);
+#else
+            break;
+#endif /* HAVE_PTHREAD_H */
+        }
+    }
+
+    RunNumJobs++;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    if ((job = calloc(1, sizeof(run_job_t))) == NULL) {
+        perror("epm: Unable to allocate memory for job");
+        run_unreserve();
+        return (NULL);
+    }
+
+    job->outfd = -1;
+#ifdef HAVE_PTHREAD_H
+    job->thread = pthread_self();
+#endif /* HAVE_PTHREAD_H */
+
+    if (capture) {
+        /*
+         * Capture output in an unlinked temporary file, which (unlike a pipe)
+         * can't block the program when nobody is reading...
+         */
+
+        if ((tmpdir = getenv("TMPDIR")) == NULL)
+            tmpdir = "/tmp";
+
+        snprintf(outfile, sizeof(outfile), "%s/epmXXXXXX", tmpdir);
+
+#ifdef HAVE_MKOSTEMP
+        if ((job->outfd = mkostemp(outfile, O_CLOEXEC)) >= 0)
+            unlink(outfile);
+#else
+        if ((job->outfd = mkstemp(outfile)) >= 0) {
+            unlink(outfile);
+            fcntl(job->outfd, F_SETFD, FD_CLOEXEC);
+        }
+#endif /* HAVE_MKOSTEMP */
+    }
+
+    /*
+     * Use posix_spawn() when we can, since fork() has to duplicate the
+     * address space of epm, which can be large for big distributions...
+     */
+
+#if defined(HAVE_SPAWN_H) && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+    error = run_posix_spawn(job, directory, argv);
+#elif defined(HAVE_SPAWN_H)
+    if (directory)
+        error = run_fork(job, directory, argv);
+    else
+        error = run_posix_spawn(job, NULL, argv);
+#else
+    error = run_fork(job, directory, argv);
+#endif /* HAVE_SPAWN_H && HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP */
+
+    if (error) {
+        if (job->outfd >= 0)
+            close(job->outfd);
+
+        free(job);
+        run_unreserve();
+        return (NULL);
+    }
+
+    /*
+     * Add the job to the end of the running list...
+     */
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    if (RunJobs) {
+        for (last = RunJobs; last->next; last = last->next)
+            ;
+
+        last->next = job;
+    } else
+        RunJobs = job;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    return (job);
+}
+
+#if !defined(HAVE_SPAWN_H) || !defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+/*
+ * 'run_fork()' - Start a program using fork() and execvp().
+ */
+
+static int                      /* O - 0 on success, -1 on error */
+run_fork(run_job_t *job,        /* I - Job */
+         const char *directory, /* I - Directory for command or NULL */
+         char **argv)           /* I - Argument strings */
+{
+    int nullfd; /* /dev/null */
+
+    if ((job->pid = fork()) == 0) {
         /*
          * Child comes here...  Redirect stdin, stdout, and stderr to /dev/null
-         * if !Verbosity...
+         * or the capture file...
          */
 
-        if (Verbosity < 2) {
-            close(0);
-            close(1);
-            close(2);
+        if (job->outfd >= 0 || Verbosity < 2) {
+            nullfd = open("/dev/null", O_RDWR);
+
+            dup2(nullfd, 0);
+            dup2(job->outfd >= 0 ? job->outfd : nullfd, 1);
+            dup2(job->outfd >= 0 ? job->outfd : nullfd, 2);
+
+            if (nullfd > 2)
+                close(nullfd);
 
-            open("/dev/null", O_RDWR);
-            dup(0);
-            dup(0);
+            if (job->outfd > 2)
+                close(job->outfd);
         }
 
         /*
          * Change directories...
          */
 
-        if (directory)
-            chdir(directory);
+        if (directory && chdir(directory)) {
+            fprintf(stderr, "epm: Unable to change to directory \"%s\": %s\n", directory,
+                    strerror(errno));
+            _exit(errno);
+        }
 
         /*
          * Execute the program; if an error occurs, exit with the UNIX error...
@@ -137,25 +543,88 @@ run_command(const char *directory, /* I - Directory for command or NULL */
         execvp(argv[0], argv);
         fprintf(stderr, "epm: Unable to execute \"%s\" program: %s\n", argv[0],
                 strerror(errno));
-        exit(errno);
-    } else if (pid < 0) {
+        _exit(errno);
+    } else if (job->pid < 0) {
         /*
          * Error - can't fork!
          */
 
         perror("epm: fork failed");
-        return (1);
+        return (-1);
     }
 
-    /*
-     * Fork successful - wait for the child and return the error status...
-     */
+    return (0);
+}
+#endif /* !HAVE_SPAWN_H || !HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP */
 
-    if (wait(&status) != pid) {
-        fputs("epm: Got exit status from wrong program!\n", stderr);
-        return (1);
-    } else if (WIFSIGNALED(status))
-        return (-WTERMSIG(status));
-    else
-        return (WEXITSTATUS(status));
+#ifdef HAVE_SPAWN_H
+/*
+ * 'run_posix_spawn()' - Start a program using posix_spawnp().
+ */
+
+static int                             /* O - 0 on success, -1 on error */
+run_posix_spawn(run_job_t *job,        /* I - Job */
+                const char *directory, /* I - Directory for command or NULL */
+                char **argv)           /* I - Argument strings */
+{
+    posix_spawn_file_actions_t actions; /* Spawn file actions */
+    int error;                          /* Spawn error */
+
+    if ((error = posix_spawn_file_actions_init(&actions)) != 0) {
+        fprintf(stderr, "epm: Unable to execute \"%s\" program: %s\n", argv[0],
+                strerror(error));
+        return (-1);
+    }
+
+    if (job->outfd >= 0) {
+        if ((error = posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY,
+                                                      0)) == 0 &&
+            (error = posix_spawn_file_actions_adddup2(&actions, job->outfd, 1)) == 0 &&
+            (error = posix_spawn_file_actions_adddup2(&actions, job->outfd, 2)) == 0)
+            error = posix_spawn_file_actions_addclose(&actions, job->outfd);
+    } else if (Verbosity < 2) {
+        if ((error = posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY,
+                                                      0)) == 0 &&
+            (error = posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY,
+                                                      0)) == 0)
+            error = posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    }
+
+#    ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+    if (!error && directory)
+        error = posix_spawn_file_actions_addchdir_np(&actions, directory);
+#    endif /* HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP */
+
+    if (!error)
+        error = posix_spawnp(&job->pid, argv[0], &actions, NULL, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (error) {
+        fprintf(stderr, "epm: Unable to execute \"%s\" program: %s\n", argv[0],
+                strerror(error));
+        return (-1);
+    }
+
+    return (0);
+}
+#endif /* HAVE_SPAWN_H */
+
+/*
+ * 'run_unreserve()' - Release a job slot reserved by 'run_spawn()'.
+ */
+
+static void          /* O - Nothing */
+run_unreserve(void) /* I - Nothing */
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
+
+    RunNumJobs--;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_broadcast(&RunCond);
+    pthread_mutex_unlock(&RunMutex);
+#endif /* HAVE_PTHREAD_H */
 }
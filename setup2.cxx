@@ -77,6 +77,88 @@ AuthorizationRef SetupAuthorizationRef;
 #define PANE_LICENSE 4
 #define PANE_INSTALL 5
 
+//
+// Number of threads used to read the package headers, and the number of
+// products that are installed at the same time...
+//
+
+#define SETUP_PROBE_JOBS 4
+#define SETUP_INSTALL_JOBS 4
+
+//
+// Package to read...
+//
+
+struct probe_t {
+    const char *filename; // Package file
+    pkginfo_t info;       // Package information
+    int status,           // 0 on success, -1 on error
+        error;            // Error number
+};
+
+//
+// Running installation...
+//
+
+struct job_t {
+    int product;          // Index into Dists
+    int fd;               // Pipe from child or -1 when closed
+#ifdef __APPLE__
+    FILE *fp;             // Pipe from authorized child
+#else
+    int pid;              // Child process ID or 0 when reaped
+#endif // __APPLE__
+    int status;           // Exit status
+    gui_ring_t ring;      // Output from child
+    gui_progress_t progress; // Progress records from child
+};
+
+//
+// Dependency graph of the products in the software list...
+//
+
+enum {
+    EDGE_REQUIRES,  // Requires product in the list
+    EDGE_MISSING,   // Requires product that is not available
+    EDGE_INCOMPAT,  // Incompatible with product in the list
+    EDGE_INSTALLED  // Incompatible with installed product
+};
+
+struct edge_t {
+    int type;      // Type of edge (EDGE_xxx)
+    int product;   // Index into Dists or Installed
+    const char *name; // Name of product
+};
+
+struct node_t {
+    int checked;          // Is the product selected?
+    int installed;        // Index into Installed or -1
+    int rootsize,         // Root size change in kbytes when selected
+        usrsize;          // /usr size change in kbytes when selected
+    int num_edges;        // Number of dependencies
+    edge_t *edges;        // Dependencies
+    int num_dependents;   // Number of products that require this one
+    int *dependents;      // Products that require this one
+};
+
+struct hash_t {
+    int size;             // Number of slots, a power of 2
+    int *slots;           // Product index + 1 or 0 if empty
+    gui_dist_t *d;        // Products
+};
+
+static node_t *Nodes = NULL;  // Nodes for the products in Dists
+static int RootSelected = 0,  // Root size change of the selection in kbytes
+    UsrSelected = 0;          // /usr size change of the selection in kbytes
+
+static gui_log_t Log;         // Installation log
+
+//
+// Verbosity of libepm functions...
+//
+
+int Verbosity = 0;
+
 //
 // Define a C API function type for comparisons...
 //
@@ -89,13 +171,23 @@ typedef int (*compare_func_t)(const void *, const void *);
 // Local functions...
 //
 
+void build_graph(void);
+int check_dist(int k);
+void deselect_dist(int k);
+int find_product(hash_t *hash, const char *name);
 void get_dists(const char *d);
-int install_dist(const gui_dist_t *dist);
+void hash_products(hash_t *hash, int num_d, gui_dist_t *d);
+int install_dist(const gui_dist_t *dist, job_t *job);
+int install_dists(void);
 int license_dist(const gui_dist_t *dist);
 void load_image(void);
 void load_readme(void);
 void load_types(void);
-void log_cb(int fd, int *fdptr);
+void log_cb(int fd, job_t *job);
+void log_line(job_t *job, const char *line);
+int probe_dist(probe_t *probe);
+void select_dist(int k, int checked);
+void sync_selection(void);
 void update_sizes(void);
 
 //
@@ -140,6 +232,8 @@ main(int argc,     // I - Number of command-line arguments
 
     w = make_window();
 
+    gui_log_open(&Log, InstallLog, "setup");
+
     Pane[PANE_WELCOME]->show();
     PrevButton->deactivate();
     NextButton->deactivate();
@@ -197,6 +291,214 @@ main(int argc,     // I - Number of command-line arguments
     return (0);
 }
 
+//
+// 'build_graph()' - Build the dependency graph for the software list.
+//
+// Each dependency is looked up once here, so that selecting a product only
+// needs to follow the edges of that product.
+//
+
+void build_graph(void) {
+    int i, j;               // Looping vars
+    gui_dist_t *dist;       // Current product
+    gui_depend_t *depend;   // Current dependency
+    node_t *node;           // Current node
+    edge_t *edge;           // Current edge
+    hash_t dists,           // Index of products in the list
+        installed;          // Index of installed products
+    int k;                  // Product index
+
+    if ((Nodes = (node_t *)calloc((size_t)NumDists, sizeof(node_t))) == NULL) {
+        perror("setup: Unable to allocate memory for distributions");
+        exit(1);
+    }
+
+    hash_products(&dists, NumDists, Dists);
+    hash_products(&installed, NumInstalled, Installed);
+
+    for (i = 0, dist = Dists, node = Nodes; i < NumDists; i++, dist++, node++) {
+        node->installed = find_product(&installed, dist->product);
+        node->rootsize = dist->rootsize;
+        node->usrsize = dist->usrsize;
+
+        if (node->installed >= 0) {
+            node->rootsize -= Installed[node->installed].rootsize;
+            node->usrsize -= Installed[node->installed].usrsize;
+        }
+
+        if (dist->num_depends == 0)
+            continue;
+
+        if ((node->edges = (edge_t *)calloc((size_t)dist->num_depends, sizeof(edge_t))) ==
+            NULL) {
+            perror("setup: Unable to allocate memory for dependencies");
+            exit(1);
+        }
+
+        // Resolve each dependency the same way list_cb() always has:
+        // required products come from the list first, incompatible products
+        // from the installed software first...
+        for (j = 0, depend = dist->depends, edge = node->edges; j < dist->num_depends;
+             j++, depend++) {
+            edge->name = depend->product;
+
+            if (depend->type == DEPEND_REQUIRES) {
+                if ((k = find_product(&dists, depend->product)) >= 0) {
+                    edge->type = EDGE_REQUIRES;
+                    edge->product = k;
+                } else if (find_product(&installed, depend->product) < 0)
+                    edge->type = EDGE_MISSING;
+                else
+                    continue; // Already installed
+            } else if (depend->type == DEPEND_INCOMPAT) {
+                if ((k = find_product(&installed, depend->product)) >= 0) {
+                    edge->type = EDGE_INSTALLED;
+                    edge->product = k;
+                } else if ((k = find_product(&dists, depend->product)) >= 0) {
+                    edge->type = EDGE_INCOMPAT;
+                    edge->product = k;
+                } else
+                    continue; // Not installed or available
+            } else
+                continue;
+
+            edge++;
+            node->num_edges++;
+        }
+    }
+
+    // Add the reverse edges for required products...
+    for (i = 0, node = Nodes; i < NumDists; i++, node++)
+        for (j = 0, edge = node->edges; j < node->num_edges; j++, edge++)
+            if (edge->type == EDGE_REQUIRES && edge->product != i)
+                Nodes[edge->product].num_dependents++;
+
+    for (i = 0, node = Nodes; i < NumDists; i++, node++)
+        if (node->num_dependents) {
+            if ((node->dependents = (int *)calloc((size_t)node->num_dependents,
+                                                  sizeof(int))) == NULL) {
+                perror("setup: Unable to allocate memory for dependencies");
+                exit(1);
+            }
+
+            node->num_dependents = 0;
+        }
+
+    for (i = 0, node = Nodes; i < NumDists; i++, node++)
+        for (j = 0, edge = node->edges; j < node->num_edges; j++, edge++)
+            if (edge->type == EDGE_REQUIRES && edge->product != i) {
+                node_t *req = Nodes + edge->product; // Required product
+
+                req->dependents[req->num_dependents++] = i;
+            }
+
+    free(dists.slots);
+    free(installed.slots);
+}
+
+//
+// 'check_dist()' - Select the products a newly selected product requires.
+//
+// If the product cannot be installed it is deselected along with the
+// products that require it.
+//
+
+int                // O - 0 if selected, -1 if deselected
+check_dist(int k)  // I - Product index
+{
+    int i;              // Looping var
+    node_t *node;       // Product node
+    edge_t *edge;       // Current dependency
+    gui_dist_t *dist;   // Product
+
+    node = Nodes + k;
+    dist = Dists + k;
+
+    for (i = 0, edge = node->edges; i < node->num_edges && node->checked; i++, edge++)
+        switch (edge->type) {
+        case EDGE_REQUIRES:
+            // Select the required product and what it requires in turn...
+            if (!Nodes[edge->product].checked) {
+                select_dist(edge->product, 1);
+                check_dist(edge->product);
+            }
+            break;
+
+        case EDGE_MISSING:
+            // Required but not installed or available!
+            fl_alert("%s requires %s to be installed, but it is not available "
+                     "for installation.",
+                     dist->name, edge->name);
+            deselect_dist(k);
+            break;
+
+        case EDGE_INSTALLED:
+            // Already installed!
+            fl_alert("%s is incompatible with %s. Please remove it before "
+                     "installing this software.",
+                     dist->name, Installed[edge->product].name);
+            deselect_dist(k);
+            break;
+
+        case EDGE_INCOMPAT:
+            // Software is in the list, is it selected?
+            if (!Nodes[edge->product].checked)
+                break;
+
+            // Yes, tell the user...
+            fl_alert("%s is incompatible with %s. Please deselect it before "
+                     "installing this software.",
+                     dist->name, Dists[edge->product].name);
+            deselect_dist(k);
+            break;
+        }
+
+    return (node->checked ? 0 : -1);
+}
+
+//
+// 'deselect_dist()' - Deselect a product and the products that require it.
+//
+
+void deselect_dist(int k) // I - Product index
+{
+    int i;        // Looping var
+    node_t *node; // Product node
+
+    node = Nodes + k;
+
+    select_dist(k, 0);
+
+    for (i = 0; i < node->num_dependents; i++)
+        if (Nodes[node->dependents[i]].checked)
+            deselect_dist(node->dependents[i]);
+}
+
+//
+// 'find_product()' - Find a product in a hash index.
+//
+
+int                              // O - Product index or -1 if not found
+find_product(hash_t *hash,       // I - Hash index
+             const char *name)   // I - Product name
+{
+    unsigned h;                  // Hash value
+    const char *ptr;             // Pointer into name
+
+    if (!hash->size)
+        return (-1);
+
+    for (h = 2166136261U, ptr = name; *ptr; ptr++)
+        h = (h ^ (unsigned char)*ptr) * 16777619U;
+
+    for (h &= (unsigned)hash->size - 1; hash->slots[h];
+         h = (h + 1) & ((unsigned)hash->size - 1))
+        if (!strcmp(hash->d[hash->slots[h] - 1].product, name))
+            return (hash->slots[h] - 1);
+
+    return (-1);
+}
+
 //
 // 'get_dists()' - Get a list of available software products.
 //
@@ -209,10 +511,12 @@ void get_dists(const char *d) // I - Directory to look in
     const char *ext;   // Extension
     gui_dist_t *temp,  // Pointer to current distribution
         *installed;    // Pointer to installed product
-    FILE *fp;          // File to read from
-    char line[1024],   // Line from file...
-        product[64];   // Product name...
-    int lowver, hiver; // Version numbers for dependencies
+    char line[1024];   // Line from file...
+    int num_probes;    // Number of packages to read
+    probe_t *probes,   // Packages to read
+        *probe;        // Current package
+    tasks_t *tasks;    // Tasks for reading packages
+    depend_t *depend;  // Current dependency
 
     // Get the files in the specified directory...
     if (chdir(d)) {
@@ -226,111 +530,69 @@ void get_dists(const char *d) // I - Directory to look in
         exit(1);
     }
 
-    // Build a distribution list...
-    NumDists = 0;
-    Dists = (gui_dist_t *)0;
+    // Read the package headers on a few threads...
+    if ((probes = (probe_t *)calloc((size_t)num_files, sizeof(probe_t))) == NULL ||
+        (tasks = tasks_new()) == NULL) {
+        perror("setup: Unable to allocate memory for distributions");
+        exit(1);
+    }
 
-    for (i = 0; i < num_files; i++) {
+    for (i = 0, num_probes = 0; i < num_files; i++) {
         ext = fl_filename_ext(files[i]->d_name);
-        if (!strcmp(ext, ".install") || !strcmp(ext, ".patch")) {
-            // Found a .install script...
-            if ((fp = fopen(files[i]->d_name, "r")) == NULL) {
-                perror("setup: Unable to open installation script");
-                exit(1);
-            }
 
-            // Add a new distribution entry...
-            temp = gui_add_dist(&NumDists, &Dists);
-            temp->type = PACKAGE_PORTABLE;
-            temp->filename = strdup(files[i]->d_name);
-
-            strncpy(temp->product, files[i]->d_name, sizeof(temp->product) - 1);
-            *strrchr(temp->product, '.') = '\0'; // Drop .install
-
-            // Read info from the installation script...
-            while (fgets(line, sizeof(line), fp) != NULL) {
-                // Only read distribution info lines...
-                if (strncmp(line, "#%", 2))
-                    continue;
-
-                // Drop the trailing newline...
-                line[strlen(line) - 1] = '\0';
-
-                // Copy data as needed...
-                if (strncmp(line, "#%product ", 10) == 0)
-                    strncpy(temp->name, line + 10, sizeof(temp->name) - 1);
-                else if (strncmp(line, "#%version ", 10) == 0)
-                    sscanf(line + 10, "%31s%d", temp->version, &(temp->vernumber));
-                else if (strncmp(line, "#%rootsize ", 11) == 0)
-                    temp->rootsize = atoi(line + 11);
-                else if (strncmp(line, "#%usrsize ", 10) == 0)
-                    temp->usrsize = atoi(line + 10);
-                else if (strncmp(line, "#%incompat ", 11) == 0 ||
-                         strncmp(line, "#%requires ", 11) == 0) {
-                    lowver = 0;
-                    hiver = 0;
-
-                    if (sscanf(line + 11, "%s%*s%d%*s%d", product, &lowver, &hiver) > 0)
-                        gui_add_depend(
-                            temp, (line[2] == 'i') ? DEPEND_INCOMPAT : DEPEND_REQUIRES,
-                            product, lowver, hiver);
-                }
-            }
+        if (!strcmp(ext, ".install") || !strcmp(ext, ".patch") || !strcmp(ext, ".rpm")) {
+            probe = probes + num_probes++;
+            probe->filename = files[i]->d_name;
 
-            fclose(fp);
-        } else if (!strcmp(ext, ".rpm")) {
-            // Found an RPM package...
-            char *version,    // Version number
-                *size,        // Size of package
-                *description; // Summary string
+            tasks_add(tasks, probe->filename, (task_cb_t)probe_dist, probe);
+        }
+    }
 
-            // Get the package information...
-            snprintf(line, sizeof(line),
-                     "rpm -qp --qf '%%{NAME}|%%{VERSION}|%%{SIZE}|%%{SUMMARY}\\n' %s",
-                     files[i]->d_name);
+    tasks_run(tasks, SETUP_PROBE_JOBS);
+    tasks_delete(tasks);
 
-            if ((fp = popen(line, "r")) == NULL) {
-                free(files[i]);
-                continue;
-            }
+    // Build a distribution list...
+    NumDists = 0;
+    Dists = (gui_dist_t *)0;
 
-            if (!fgets(line, sizeof(line), fp)) {
-                free(files[i]);
-                continue;
+    for (i = 0, probe = probes; i < num_probes; i++, probe++) {
+        if (probe->status) {
+            // RPM packages that cannot be read are skipped, but every script
+            // must be readable...
+            if (strcmp(fl_filename_ext(probe->filename), ".rpm")) {
+                fprintf(stderr,
+                        "setup: Unable to open installation script \"%s\": %s\n",
+                        probe->filename, strerror(probe->error));
+                exit(1);
             }
 
-            // Drop the trailing newline...
-            line[strlen(line) - 1] = '\0';
-
-            // Grab the different fields...
-            if ((version = strchr(line, '|')) == NULL)
-                continue;
-            *version++ = '\0';
+            continue;
+        }
 
-            if ((size = strchr(version, '|')) == NULL)
-                continue;
-            *size++ = '\0';
+        // Add a new distribution entry...
+        temp = gui_add_dist(&NumDists, &Dists);
+        temp->type = probe->info.type;
+        temp->filename = strdup(probe->filename);
 
-            if ((description = strchr(size, '|')) == NULL)
-                continue;
-            *description++ = '\0';
+        strlcpy(temp->product, probe->info.product, sizeof(temp->product));
+        strlcpy(temp->name, probe->info.name, sizeof(temp->name));
+        strlcpy(temp->version, probe->info.version, sizeof(temp->version));
+        temp->vernumber = probe->info.vernumber;
+        temp->rootsize = probe->info.rootsize;
+        temp->usrsize = probe->info.usrsize;
 
-            // Add a new distribution entry...
-            temp = gui_add_dist(&NumDists, &Dists);
-            temp->type = PACKAGE_RPM;
-            temp->filename = strdup(files[i]->d_name);
+        for (depend = probe->info.depends; depend < probe->info.depends + probe->info.num_depends;
+             depend++)
+            gui_add_depend(temp, depend->type, depend->product, depend->vernumber[0],
+                           depend->vernumber[1]);
 
-            strlcpy(temp->product, line, sizeof(temp->product));
-            strlcpy(temp->name, description, sizeof(temp->name));
-            strlcpy(temp->version, version, sizeof(temp->version));
-            temp->vernumber = get_vernumber(version);
-            temp->rootsize = (int)(atof(size) / 1024.0 + 0.5);
+        pkginfo_free(&(probe->info));
+    }
 
-            pclose(fp);
-        }
+    free(probes);
 
+    for (i = 0; i < num_files; i++)
         free(files[i]);
-    }
 
     free(files);
 
@@ -343,13 +605,17 @@ void get_dists(const char *d) // I - Directory to look in
     if (NumDists > 1)
         qsort(Dists, NumDists, sizeof(gui_dist_t), (compare_func_t)gui_sort_dists);
 
+    build_graph();
+
     for (i = 0, temp = Dists; i < NumDists; i++, temp++) {
         sprintf(line, "%s v%s", temp->name, temp->version);
 
-        if ((installed = gui_find_dist(temp->product, NumInstalled, Installed)) == NULL) {
+        if (Nodes[i].installed < 0) {
+            installed = NULL;
             strcat(line, " (new)");
             SoftwareList->add(line, 0);
-        } else if (installed->vernumber > temp->vernumber) {
+        } else if ((installed = Installed + Nodes[i].installed)->vernumber >
+                   temp->vernumber) {
             strcat(line, " (downgrade)");
             SoftwareList->add(line, 0);
         } else if (installed->vernumber == temp->vernumber) {
@@ -361,46 +627,105 @@ void get_dists(const char *d) // I - Directory to look in
         }
     }
 
+    sync_selection();
     update_sizes();
 }
 
 //
-// 'install_dist()' - Install a distribution...
+// 'hash_products()' - Build a hash index of products by name.
+//
+// When a product is listed more than once the first one is found, just
+// like gui_find_dist().
+//
+
+void hash_products(hash_t *hash,    // O - Hash index
+                   int num_d,       // I - Number of products
+                   gui_dist_t *d)   // I - Products
+{
+    int i;        // Looping var
+    unsigned h;   // Hash value
+    const char *ptr; // Pointer into name
+
+    hash->d = d;
+
+    for (hash->size = 16; hash->size < 2 * num_d; hash->size *= 2)
+        ;
+
+    if ((hash->slots = (int *)calloc((size_t)hash->size, sizeof(int))) == NULL) {
+        perror("setup: Unable to allocate memory for distributions");
+        exit(1);
+    }
+
+    for (i = 0; i < num_d; i++) {
+        for (h = 2166136261U, ptr = d[i].product; *ptr; ptr++)
+            h = (h ^ (unsigned char)*ptr) * 16777619U;
+
+        for (h &= (unsigned)hash->size - 1; hash->slots[h];
+             h = (h + 1) & ((unsigned)hash->size - 1))
+            if (!strcmp(d[hash->slots[h] - 1].product, d[i].product))
+                break;
+
+        if (!hash->slots[h])
+            hash->slots[h] = i + 1;
+    }
+}
+
+//
+// 'install_dist()' - Start installing a distribution...
+//
+// The output of the child is read by log_cb() and the child is reaped by
+// install_dists().
 //
 
-int                                  // O - Install status
-install_dist(const gui_dist_t *dist) // I - Distribution to install
+int                                  // O - 0 if started, 1 on error
+install_dist(const gui_dist_t *dist, // I - Distribution to install
+             job_t *job)             // I - Job for installation
 {
     char command[1024]; // Command string
-    int fds[2];         // Pipe FDs
-    int status = 0;     // Exit status
 #ifndef __APPLE__
-    int pid; // Process ID
-#endif       // !__APPLE__
+    int fds[2],         // Pipe FDs
+        pfds[2];        // Progress pipe FDs
+    char progenv[64];   // Progress environment variable
+#endif // !__APPLE__
+
+    job->product = dist - Dists;
+    job->status = 0;
+    memset(&(job->ring), 0, sizeof(job->ring));
+    memset(&(job->progress), 0, sizeof(job->progress));
+    job->progress.fd = -1;
 
     sprintf(command, "**** %s ****", dist->name);
-    InstallLog->add(command);
+    gui_log_add(&Log, command);
 
 #ifdef __APPLE__
     // Run the install script using Apple's authorization API...
-    FILE *fp = NULL;
     char *args[2] = {(char *)"now", NULL};
     OSStatus astatus;
 
+    job->fp = NULL;
+
     astatus = AuthorizationExecuteWithPrivileges(SetupAuthorizationRef, dist->filename,
-                                                 kAuthorizationFlagDefaults, args, &fp);
+                                                 kAuthorizationFlagDefaults, args,
+                                                 &(job->fp));
 
     if (astatus != errAuthorizationSuccess) {
-        InstallLog->add("Failed to execute install script!");
+        gui_log_add(&Log, "Failed to execute install script!");
         return (1);
     }
 
-    fds[0] = fileno(fp);
+    job->fd = fileno(job->fp);
 #else
+    // Portable install scripts also write progress records to a second
+    // pipe...
+    if (dist->type == PACKAGE_PORTABLE && !pipe(pfds))
+        snprintf(progenv, sizeof(progenv), "EPM_PROGRESS_FD=%d", pfds[1]);
+    else
+        pfds[0] = pfds[1] = -1;
+
     // Fork the command and redirect errors and info to stdout...
     pipe(fds);
 
-    if ((pid = fork()) == 0) {
+    if ((job->pid = fork()) == 0) {
         // Child comes here; start by redirecting stdout and stderr...
         close(1);
         close(2);
@@ -411,6 +736,11 @@ install_dist(const gui_dist_t *dist) // I - Distribution to install
         close(fds[0]);
         close(fds[1]);
 
+        if (pfds[0] >= 0) {
+            close(pfds[0]);
+            putenv(progenv);
+        }
+
         // Execute the command; if an error occurs, return it...
         if (dist->type == PACKAGE_PORTABLE)
             execl(dist->filename, dist->filename, "now", (char *)0);
@@ -418,61 +748,204 @@ install_dist(const gui_dist_t *dist) // I - Distribution to install
             execlp("rpm", "rpm", "-U", "--nodeps", dist->filename, (char *)0);
 
         exit(errno);
-    } else if (pid < 0) {
+    } else if (job->pid < 0) {
         // Unable to fork!
         sprintf(command, "Unable to install %s:", dist->name);
-        InstallLog->add(command);
+        gui_log_add(&Log, command);
 
         sprintf(command, "\t%s", strerror(errno));
-        InstallLog->add(command);
+        gui_log_add(&Log, command);
 
         close(fds[0]);
         close(fds[1]);
 
+        if (pfds[0] >= 0) {
+            close(pfds[0]);
+            close(pfds[1]);
+        }
+
+        job->pid = 0;
+
         return (1);
     }
 
-    // Close the output pipe (used by the child)...
+    if (pfds[0] >= 0) {
+        close(pfds[1]);
+        gui_progress_open(&(job->progress), pfds[0]);
+    }
+
+    // Close the output pipe (used by the child) and keep the other end from
+    // being inherited by the next child; it is non-blocking so that the
+    // output can be drained once the child exits...
     close(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    job->fd = fds[0];
 #endif // __APPLE__
 
     // Listen for data on the input pipe...
-    Fl::add_fd(fds[0], (void (*)(int, void *))log_cb, fds);
+    Fl::add_fd(job->fd, (void (*)(int, void *))log_cb, job);
+
+    return (0);
+}
+
+//
+// 'install_dists()' - Install the selected distributions.
+//
+// Products are started in list order as soon as the selected products they
+// require have been installed, with up to SETUP_INSTALL_JOBS products being
+// installed at a time.  RPM packages are installed one at a time since rpm
+// locks its database anyway.
+//
+
+int                 // O - Install status
+install_dists(void) {
+    int i, j;                       // Looping vars
+    int *waiting;                   // Number of required products to install
+    char *state;                    // 0 = pending, 1 = installing, 2 = done
+    job_t jobs[SETUP_INSTALL_JOBS]; // Running installations
+    job_t *job;                     // Current job
+    int num_jobs,                   // Number of running installations
+        rpm_running;                // Is a RPM package being installed?
+    int error;                      // Exit status of first failure
+    node_t *node;                   // Current product
+    edge_t *edge;                   // Current dependency
+    double size_total,              // Size of products to install
+        size_done,                  // Size of products installed
+        fraction;                   // Fraction of work done
+    time_t start;                   // Time installation started
+    static char message[1024];      // Progress message...
+
+    if ((waiting = (int *)calloc((size_t)NumDists, sizeof(int))) == NULL ||
+        (state = (char *)calloc((size_t)NumDists, 1)) == NULL) {
+        gui_log_add(&Log, "Unable to allocate memory for installation!");
+        return (1);
+    }
+
+    // Count the selected products each product has to wait for; progress
+    // is weighted by the size of each product...
+    for (i = 0, node = Nodes, size_total = 0.0; i < NumDists; i++, node++)
+        if (node->checked) {
+            size_total += Dists[i].rootsize + Dists[i].usrsize + 1;
+
+            for (j = 0, edge = node->edges; j < node->num_edges; j++, edge++)
+                if (edge->type == EDGE_REQUIRES && edge->product != i &&
+                    Nodes[edge->product].checked)
+                    waiting[i]++;
+        }
+
+    // Jobs stay in their slot while running since log_cb() gets a pointer
+    // to them...
+    for (j = 0; j < SETUP_INSTALL_JOBS; j++)
+        jobs[j].product = -1;
 
     // Show the user that we're busy...
     SetupWindow->cursor(FL_CURSOR_WAIT);
 
-    // Loop until the child is done...
-    while (fds[0]) // log_cb() will close and zero fds[0]...
-    {
-        // Wait for events...
-        Fl::wait();
+    start = time(NULL);
 
-#ifndef __APPLE__
-        // Check to see if the child went away...
-        if (waitpid(0, &status, WNOHANG) == pid)
+    for (num_jobs = 0, size_done = 0.0, rpm_running = 0, error = 0;;) {
+        // Start whatever can be started...
+        for (i = 0; i < NumDists && num_jobs < SETUP_INSTALL_JOBS && !error; i++) {
+            if (!Nodes[i].checked || state[i] || waiting[i] > 0 ||
+                (Dists[i].type != PACKAGE_PORTABLE && rpm_running))
+                continue;
+
+            for (job = jobs; job->product >= 0; job++)
+                ; // Find a free slot
+
+            if ((error = install_dist(Dists + i, job)) != 0) {
+                job->product = -1;
+                break;
+            }
+
+            state[i] = 1;
+            num_jobs++;
+
+            if (Dists[i].type != PACKAGE_PORTABLE)
+                rpm_running = 1;
+
+            if (num_jobs == 1)
+                sprintf(message, "Installing %s v%s...", Dists[i].name, Dists[i].version);
+            else
+                sprintf(message, "Installing %d products...", num_jobs);
+
+            Pane[PANE_INSTALL]->redraw();
+        }
+
+        if (num_jobs == 0)
             break;
-#endif // !__APPLE__
-    }
+
+        // Show the progress of the running installations...
+        for (job = jobs, fraction = size_done; job < jobs + SETUP_INSTALL_JOBS; job++)
+            if ((i = job->product) >= 0)
+                fraction += (Dists[i].rootsize + Dists[i].usrsize + 1) *
+                            gui_progress_fraction(&(job->progress));
+
+        gui_progress_show(InstallPercent, message, fraction / size_total, start);
+
+        // Wait for events, at least once a second for the time left...
+        Fl::wait(1.0);
+
+        // Check to see if any of the children are done...
+        for (job = jobs; job < jobs + SETUP_INSTALL_JOBS; job++) {
+            if ((i = job->product) < 0)
+                continue;
 
 #ifdef __APPLE__
-    fclose(fp);
+            if (job->fd >= 0)
+                continue; // log_cb() closes the pipe at end of file
+
+            fclose(job->fp);
+#else
+            if (job->pid && waitpid(job->pid, &(job->status), WNOHANG) == job->pid)
+                job->pid = 0;
+
+            if (job->pid && job->fd >= 0)
+                continue;
+
+            if (job->fd >= 0) {
+                // Read what is left in the pipe, log_cb() closes it...
+                while (job->fd >= 0)
+                    log_cb(job->fd, job);
+            } else if (job->pid) {
+                // Get the child's exit status...
+                waitpid(job->pid, &(job->status), 0);
+                job->pid = 0;
+            }
 #endif // __APPLE__
 
-    if (fds[0]) {
-        // Close the pipe - have all the data from the child...
-        Fl::remove_fd(fds[0]);
-        close(fds[0]);
-    } else {
-        // Get the child's exit status...
-        wait(&status);
+            gui_progress_close(&(job->progress));
+
+            if (job->status && !error)
+                error = job->status;
+
+            // Let the products that require this one go ahead...
+            for (node = Nodes; node < Nodes + NumDists; node++)
+                if (node->checked && !state[node - Nodes])
+                    for (edge = node->edges; edge < node->edges + node->num_edges; edge++)
+                        if (edge->type == EDGE_REQUIRES && edge->product == i)
+                            waiting[node - Nodes]--;
+
+            state[i] = 2;
+            size_done += Dists[i].rootsize + Dists[i].usrsize + 1;
+
+            if (Dists[i].type != PACKAGE_PORTABLE)
+                rpm_running = 0;
+
+            job->product = -1;
+            num_jobs--;
+        }
     }
 
     // Show the user that we're ready...
     SetupWindow->cursor(FL_CURSOR_DEFAULT);
 
-    // Return...
-    return (status);
+    free(waiting);
+    free(state);
+
+    return (error);
 }
 
 //
@@ -526,7 +999,7 @@ license_dist(const gui_dist_t *dist) // I - Distribution to license
             liclength = 0;
             snprintf(message, sizeof(message), "License not accepted for %s!",
                      dist->name);
-            InstallLog->add(message);
+            gui_log_add(&Log, message);
             return (1);
         }
     }
@@ -538,81 +1011,26 @@ license_dist(const gui_dist_t *dist) // I - Distribution to license
 // 'list_cb()' - Handle selections in the software list.
 //
 
-void list_cb(Fl_Check_Browser *, void *) {
-    int i, j, k;
-    gui_dist_t *dist, *dist2;
-    gui_depend_t *depend;
-
-    if (SoftwareList->nchecked() == 0) {
-        update_sizes();
+void list_cb(Fl_Check_Browser *w, // I - Software list or NULL
+             void *) {
+    int k; // Clicked product
+
+    if (w && (k = SoftwareList->value() - 1) >= 0 && k < NumDists) {
+        // Only the clicked product has changed...
+        if (SoftwareList->checked(k + 1) && !Nodes[k].checked) {
+            select_dist(k, 1);
+            check_dist(k);
+        } else if (!SoftwareList->checked(k + 1) && Nodes[k].checked)
+            deselect_dist(k);
+    } else {
+        // Any number of products may have changed, check them all...
+        sync_selection();
 
-        NextButton->deactivate();
-        return;
+        for (k = 0; k < NumDists; k++)
+            if (Nodes[k].checked)
+                check_dist(k);
     }
 
-    for (i = 0, dist = Dists; i < NumDists; i++, dist++)
-        if (SoftwareList->checked(i + 1)) {
-            // Check for required/incompatible products...
-            for (j = 0, depend = dist->depends; j < dist->num_depends; j++, depend++)
-                switch (depend->type) {
-                case DEPEND_REQUIRES:
-                    if ((dist2 = gui_find_dist(depend->product, NumDists, Dists)) !=
-                        NULL) {
-                        // Software is in the list, is it selected?
-                        k = dist2 - Dists;
-
-                        if (SoftwareList->checked(k + 1))
-                            continue;
-
-                        // Nope, select it unless we're unchecked another selection...
-                        if (SoftwareList->value() != (k + 1))
-                            SoftwareList->checked(k + 1, 1);
-                        else {
-                            SoftwareList->checked(i + 1, 0);
-                            break;
-                        }
-                    } else if ((dist2 = gui_find_dist(depend->product, NumInstalled,
-                                                      Installed)) == NULL) {
-                        // Required but not installed or available!
-                        fl_alert(
-                            "%s requires %s to be installed, but it is not available "
-                            "for installation.",
-                            dist->name, depend->product);
-                        SoftwareList->checked(i + 1, 0);
-                        break;
-                    }
-                    break;
-
-                case DEPEND_INCOMPAT:
-                    if ((dist2 = gui_find_dist(depend->product, NumInstalled,
-                                               Installed)) != NULL) {
-                        // Already installed!
-                        fl_alert("%s is incompatible with %s. Please remove it before "
-                                 "installing this software.",
-                                 dist->name, dist2->name);
-                        SoftwareList->checked(i + 1, 0);
-                        break;
-                    } else if ((dist2 = gui_find_dist(depend->product, NumDists,
-                                                      Dists)) != NULL) {
-                        // Software is in the list, is it selected?
-                        k = dist2 - Dists;
-
-                        // Software is in the list, is it selected?
-                        if (!SoftwareList->checked(k + 1))
-                            continue;
-
-                        // Yes, tell the user...
-                        fl_alert("%s is incompatible with %s. Please deselect it before "
-                                 "installing this software.",
-                                 dist->name, dist2->name);
-                        SoftwareList->checked(i + 1, 0);
-                        break;
-                    }
-                default:
-                    break;
-                }
-        }
-
     update_sizes();
 
     if (SoftwareList->nchecked())
@@ -793,42 +1211,46 @@ void load_types(void) {
 //
 
 void log_cb(int fd,     // I - Pipe to read from
-            int *fdptr) // O - Pipe to read from
+            job_t *job) // I - Installation job
 {
-    int bytes;                // Bytes read/to read
-    char *bufptr;             // Pointer into buffer
-    static int bufused = 0;   // Number of bytes used
-    static char buffer[8193]; // Buffer
+    int bytes;         // Bytes read
+    const char *line;  // Line from child
+    char buffer[8193]; // Line buffer
+
+    bytes = gui_ring_read(&(job->ring), fd);
 
-    bytes = 8192 - bufused;
-    if ((bytes = read(fd, buffer + bufused, bytes)) <= 0) {
-        // End of file; zero the FD to tell the install_dist() function to
-        // stop...
+#ifndef __APPLE__
+    if (bytes < 0 && errno == EAGAIN && job->pid)
+        return; // Nothing to read yet
+#endif // !__APPLE__
 
+    if (bytes <= 0) {
+        // End of file; tell install_dists() that all output has been read...
         Fl::remove_fd(fd);
         close(fd);
-        *fdptr = 0;
-
-        if (bufused > 0) {
-            // Add remaining text...
-            buffer[bufused] = '\0';
-            InstallLog->add(buffer);
-            bufused = 0;
-        }
-    } else {
-        // Add bytes to the buffer, then add lines as needed...
-        bufused += bytes;
-        buffer[bufused] = '\0';
-
-        while ((bufptr = strchr(buffer, '\n')) != NULL) {
-            *bufptr++ = '\0';
-            InstallLog->add(buffer);
-            strcpy(buffer, bufptr);
-            bufused -= bufptr - buffer;
-        }
+        job->fd = -1;
     }
 
-    InstallLog->bottomline(InstallLog->size());
+    // Add complete lines to the log, and anything left at end of file...
+    while ((line = gui_ring_line(&(job->ring), buffer, sizeof(buffer), bytes <= 0)) !=
+           NULL)
+        log_line(job, line);
+}
+
+//
+// 'log_line()' - Add a line from an installation to the log.
+//
+// Lines are prefixed with the product name since several products may be
+// installed at the same time.
+//
+
+void log_line(job_t *job,       // I - Installation job
+              const char *line) // I - Line from child
+{
+    char prefixed[8448]; // Line with product name
+
+    snprintf(prefixed, sizeof(prefixed), "%s: %s", Dists[job->product].product, line);
+    gui_log_add(&Log, prefixed);
 }
 
 //
@@ -837,9 +1259,7 @@ void log_cb(int fd,     // I - Pipe to read from
 
 void next_cb(Fl_Button *, void *) {
     int i;                          // Looping var
-    int progress;                   // Progress so far...
     int error;                      // Errors?
-    static char message[1024];      // Progress message...
     static char install_type[1024]; // EPM_INSTALL_TYPE env variable
     static int installing = 0;      // Installing software?
 
@@ -885,7 +1305,7 @@ void next_cb(Fl_Button *, void *) {
         // Show the licenses for each of the selected software packages...
         installing = 1;
 
-        for (i = 0, progress = 0, error = 0; i < NumDists; i++)
+        for (i = 0; i < NumDists; i++)
             if (SoftwareList->checked(i + 1) && license_dist(Dists + i)) {
                 InstallPercent->label("Installation Canceled!");
                 Pane[PANE_INSTALL]->redraw();
@@ -902,19 +1322,9 @@ void next_cb(Fl_Button *, void *) {
         CancelButton->deactivate();
         CancelButton->label("Close");
 
-        for (i = 0, progress = 0, error = 0; i < NumDists; i++)
-            if (SoftwareList->checked(i + 1)) {
-                sprintf(message, "Installing %s v%s...", Dists[i].name, Dists[i].version);
-
-                InstallPercent->value(100.0 * progress / SoftwareList->nchecked());
-                InstallPercent->label(message);
-                Pane[PANE_INSTALL]->redraw();
-
-                if ((error = install_dist(Dists + i)) != 0)
-                    break;
+        error = install_dists();
 
-                progress++;
-            }
+        gui_log_flush(&Log);
 
         InstallPercent->value(100.0);
 
@@ -941,6 +1351,66 @@ void next_cb(Fl_Button *, void *) {
     }
 }
 
+//
+// 'probe_dist()' - Read the header of a package.
+//
+// This function runs on one of the threads started by get_dists(), so it
+// must not touch any widgets or globals.
+//
+
+int                         // O - Always 0
+probe_dist(probe_t *probe)  // I - Package to read
+{
+    if ((probe->status = pkginfo_read(probe->filename, &(probe->info))) != 0)
+        probe->error = errno;
+
+    return (0);
+}
+
+//
+// 'select_dist()' - Select or deselect a product in the software list.
+//
+
+void select_dist(int k,       // I - Product index
+                 int checked) // I - 1 to select, 0 to deselect
+{
+    node_t *node = Nodes + k; // Product node
+
+    if (SoftwareList->checked(k + 1) != checked)
+        SoftwareList->checked(k + 1, checked);
+
+    if (node->checked != checked) {
+        node->checked = checked;
+
+        if (checked) {
+            RootSelected += node->rootsize;
+            UsrSelected += node->usrsize;
+        } else {
+            RootSelected -= node->rootsize;
+            UsrSelected -= node->usrsize;
+        }
+    }
+}
+
+//
+// 'sync_selection()' - Update the selection totals after changing the
+//                      software list directly.
+//
+
+void sync_selection(void) {
+    int i;        // Looping var
+    node_t *node; // Current node
+
+    RootSelected = 0;
+    UsrSelected = 0;
+
+    for (i = 0, node = Nodes; i < NumDists; i++, node++)
+        if ((node->checked = SoftwareList->checked(i + 1)) != 0) {
+            RootSelected += node->rootsize;
+            UsrSelected += node->usrsize;
+        }
+}
+
 //
 // 'type_cb()' - Handle selections in the type list.
 //
@@ -949,8 +1419,7 @@ void type_cb(Fl_Round_Button *w, void *) // I - Radio button widget
 {
     int i;            // Looping var
     gui_intype_t *dt; // Current install type
-    gui_dist_t *temp, // Current software
-        *installed;   // Installed software
+    gui_dist_t *temp; // Current software
 
     for (i = 0; i < (int)(sizeof(TypeButton) / sizeof(TypeButton[0])); i++)
         if (w == TypeButton[i])
@@ -969,11 +1438,12 @@ void type_cb(Fl_Round_Button *w, void *) // I - Radio button widget
 
     // And then any upgrade products...
     for (i = 0, temp = Dists; i < NumDists; i++, temp++) {
-        if ((installed = gui_find_dist(temp->product, NumInstalled, Installed)) != NULL &&
-            installed->vernumber < temp->vernumber)
+        if (Nodes[i].installed >= 0 &&
+            Installed[Nodes[i].installed].vernumber < temp->vernumber)
             SoftwareList->checked(i + 1, 1);
     }
 
+    sync_selection();
     update_sizes();
 
     NextButton->activate();
@@ -984,9 +1454,6 @@ void type_cb(Fl_Round_Button *w, void *) // I - Radio button widget
 //
 
 void update_sizes(void) {
-    int i;                       // Looping var
-    gui_dist_t *dist,            // Distribution
-        *installed;              // Installed distribution
     int rootsize,                // Total root size difference in kbytes
         usrsize;                 // Total /usr size difference in kbytes
     struct statfs rootpart,      // Available root partition
@@ -995,18 +1462,10 @@ void update_sizes(void) {
         usrfree;                 // Free space on /usr partition
     static char sizelabel[1024]; // Label for selected sizes...
 
-    // Get the sizes for the selected products...
-    for (i = 0, dist = Dists, rootsize = 0, usrsize = 0; i < NumDists; i++, dist++)
-        if (SoftwareList->checked(i + 1)) {
-            rootsize += dist->rootsize;
-            usrsize += dist->usrsize;
-
-            if ((installed = gui_find_dist(dist->product, NumInstalled, Installed)) !=
-                NULL) {
-                rootsize -= installed->rootsize;
-                usrsize -= installed->usrsize;
-            }
-        }
+    // Get the sizes for the selected products, which are kept up to date
+    // by select_dist()...
+    rootsize = RootSelected;
+    usrsize = UsrSelected;
 
         // Get the sizes of the root and /usr partition...
 #if defined(__sgi) || defined(__svr4__) || defined(__SVR4) || defined(M_XENIX)
@@ -0,0 +1,436 @@
+/*
+ * SHA-256 digest functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <fcntl.h>
+#ifdef HAVE_SYS_MMAN_H
+#    include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define SHA256_X86 1
+#    include <cpuid.h>
+#    include <immintrin.h>
+#endif /* __GNUC__ && (__x86_64__ || __i386__) */
+
+/*
+ * Local globals...
+ */
+
+static const unsigned sha256_k[64] = /* Round constants */
+    {0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+     0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+     0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+     0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+     0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+     0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+     0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+     0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+     0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+     0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#ifdef SHA256_X86
+static int sha256_accel = -1; /* 1 if the CPU has the SHA extensions */
+#endif /* SHA256_X86 */
+
+/*
+ * Local functions...
+ */
+
+static void sha256_blocks(sha256_t *ctx, const unsigned char *data, size_t blocks);
+static void sha256_transform(sha256_t *ctx, const unsigned char *data);
+#ifdef SHA256_X86
+static void sha256_transform_x86(sha256_t *ctx, const unsigned char *data, size_t blocks);
+#endif /* SHA256_X86 */
+
+#define SHA256_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * 'sha256_file()' - Compute the SHA-256 digest of a file as a hex string.
+ */
+
+int                               /* O - 0 on success, -1 on error */
+sha256_file(const char *filename, /* I - File to digest */
+            char *hex,            /* O - Hex digest string */
+            size_t hexsize)       /* I - Size of hex digest string */
+{
+    int fd;                      /* File descriptor */
+    ssize_t bytes;               /* Bytes read */
+    sha256_t ctx;                /* Digest context */
+    unsigned char buffer[65536], /* Read buffer */
+        digest[SHA256_SIZE];     /* Binary digest */
+#ifdef HAVE_SYS_MMAN_H
+    struct stat fileinfo; /* File information */
+    void *data;           /* Mapped file */
+#endif /* HAVE_SYS_MMAN_H */
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return (-1);
+
+    sha256_init(&ctx);
+
+#ifdef HAVE_SYS_MMAN_H
+    /*
+     * Map large files into memory rather than copying them through the
+     * read buffer...
+     */
+
+    if (!fstat(fd, &fileinfo) && S_ISREG(fileinfo.st_mode) &&
+        fileinfo.st_size >= (off_t)(4 * sizeof(buffer)) &&
+        (data = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) !=
+            MAP_FAILED) {
+#    ifdef MADV_SEQUENTIAL
+        madvise(data, (size_t)fileinfo.st_size, MADV_SEQUENTIAL);
+#    endif /* MADV_SEQUENTIAL */
+
+        sha256_update(&ctx, data, (size_t)fileinfo.st_size);
+        munmap(data, (size_t)fileinfo.st_size);
+        close(fd);
+
+        sha256_final(&ctx, digest);
+        sha256_hex(digest, hex, hexsize);
+
+        return (0);
+    }
+#endif /* HAVE_SYS_MMAN_H */
+
+    while ((bytes = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+
+            close(fd);
+            return (-1);
+        }
+
+        sha256_update(&ctx, buffer, (size_t)bytes);
+    }
+
+    close(fd);
+
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, hex, hexsize);
+
+    return (0);
+}
+
+/*
+ * 'sha256_final()' - Finish a SHA-256 digest.
+ */
+
+void                                /* O - Nothing */
+sha256_final(sha256_t *ctx,         /* I - Digest context */
+             unsigned char *digest) /* O - SHA256_SIZE byte digest */
+{
+    int i;                               /* Looping var */
+    unsigned long long bits;             /* Message length in bits */
+    unsigned char pad[SHA256_BLOCK * 2]; /* Padding */
+    size_t padlen;                       /* Padding length */
+
+    bits = ctx->length * 8;
+    padlen = (ctx->used < 56 ? 56 : 120) - ctx->used;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+
+    for (i = 0; i < 8; i++)
+        pad[padlen + i] = (unsigned char)(bits >> (56 - 8 * i));
+
+    sha256_update(ctx, pad, padlen + 8);
+
+    for (i = 0; i < 8; i++) {
+        digest[4 * i] = (unsigned char)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+/*
+ * 'sha256_hex()' - Convert a binary digest to a hex string.
+ */
+
+char *                                  /* O - Hex string */
+sha256_hex(const unsigned char *digest, /* I - SHA256_SIZE byte digest */
+           char *hex,                   /* O - Hex string buffer */
+           size_t hexsize)              /* I - Size of buffer */
+{
+    int i;                                             /* Looping var */
+    static const char *hexdigits = "0123456789abcdef"; /* Hex digits */
+
+    if (hexsize < SHA256_HEX_SIZE) {
+        if (hexsize > 0)
+            *hex = '\0';
+
+        return (hex);
+    }
+
+    for (i = 0; i < SHA256_SIZE; i++) {
+        hex[2 * i] = hexdigits[digest[i] >> 4];
+        hex[2 * i + 1] = hexdigits[digest[i] & 15];
+    }
+
+    hex[2 * SHA256_SIZE] = '\0';
+
+    return (hex);
+}
+
+/*
+ * 'sha256_init()' - Start a SHA-256 digest.
+ */
+
+void                       /* O - Nothing */
+sha256_init(sha256_t *ctx) /* I - Digest context */
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+/*
+ * 'sha256_update()' - Add data to a SHA-256 digest.
+ */
+
+void                            /* O - Nothing */
+sha256_update(sha256_t *ctx,    /* I - Digest context */
+              const void *data, /* I - Data */
+              size_t len)       /* I - Length of data */
+{
+    const unsigned char *ptr; /* Pointer into data */
+    size_t bytes;             /* Bytes to copy */
+
+    ptr = (const unsigned char *)data;
+    ctx->length += len;
+
+    if (ctx->used > 0) {
+        /*
+         * Fill the partial block first...
+         */
+
+        if ((bytes = SHA256_BLOCK - ctx->used) > len)
+            bytes = len;
+
+        memcpy(ctx->buffer + ctx->used, ptr, bytes);
+        ctx->used += bytes;
+        ptr += bytes;
+        len -= bytes;
+
+        if (ctx->used < SHA256_BLOCK)
+            return;
+
+        sha256_blocks(ctx, ctx->buffer, 1);
+        ctx->used = 0;
+    }
+
+    if (len >= SHA256_BLOCK) {
+        bytes = len - len % SHA256_BLOCK;
+
+        sha256_blocks(ctx, ptr, bytes / SHA256_BLOCK);
+        ptr += bytes;
+        len -= bytes;
+    }
+
+    if (len > 0) {
+        memcpy(ctx->buffer, ptr, len);
+        ctx->used = len;
+    }
+}
+
+/*
+ * 'sha256_blocks()' - Process one or more 64-byte blocks.
+ *
+ * The SHA instructions are used when the CPU has them.
+ */
+
+static void                            /* O - Nothing */
+sha256_blocks(sha256_t *ctx,           /* I - Digest context */
+              const unsigned char *data, /* I - Blocks of data */
+              size_t blocks)           /* I - Number of blocks */
+{
+#ifdef SHA256_X86
+    if (sha256_accel < 0) {
+        unsigned eax, ebx, ecx, edx; /* CPUID registers */
+        int accel = 0;               /* SHA extensions available? */
+
+        if (__get_cpuid_max(0, NULL) >= 7 && __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+            (ecx & (1 << 9)) && (ecx & (1 << 19))) {
+            /*
+             * SSSE3 and SSE4.1 are present, check for SHA...
+             */
+
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            accel = (ebx & (1 << 29)) != 0;
+        }
+
+        sha256_accel = accel;
+    }
+
+    if (sha256_accel) {
+        sha256_transform_x86(ctx, data, blocks);
+        return;
+    }
+#endif /* SHA256_X86 */
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK)
+        sha256_transform(ctx, data);
+}
+
+/*
+ * 'sha256_transform()' - Process a single 64-byte block.
+ */
+
+static void                                /* O - Nothing */
+sha256_transform(sha256_t *ctx,            /* I - Digest context */
+                 const unsigned char *data) /* I - SHA256_BLOCK bytes of data */
+{
+    int i;                      /* Looping var */
+    unsigned w[64],             /* Message schedule */
+        a, b, c, d, e, f, g, h, /* Working variables */
+        t1, t2;                 /* Temporaries */
+
+    for (i = 0; i < 16; i++, data += 4)
+        w[i] = ((unsigned)data[0] << 24) | ((unsigned)data[1] << 16) |
+               ((unsigned)data[2] << 8) | data[3];
+
+    for (; i < 64; i++)
+        w[i] = (SHA256_ROR(w[i - 2], 17) ^ SHA256_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10)) +
+               w[i - 7] +
+               (SHA256_ROR(w[i - 15], 7) ^ SHA256_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+               w[i - 16];
+
+    a = ctx->state[0];
+    b = ctx->state[1];
+    c = ctx->state[2];
+    d = ctx->state[3];
+    e = ctx->state[4];
+    f = ctx->state[5];
+    g = ctx->state[6];
+    h = ctx->state[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (SHA256_ROR(e, 6) ^ SHA256_ROR(e, 11) ^ SHA256_ROR(e, 25)) +
+             ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (SHA256_ROR(a, 2) ^ SHA256_ROR(a, 13) ^ SHA256_ROR(a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+#ifdef SHA256_X86
+/*
+ * 'sha256_transform_x86()' - Process 64-byte blocks with the x86 SHA
+ *                            instructions.
+ *
+ * The state is kept as the ABEF and CDGH word pairs used by the
+ * SHA256RNDS2 instruction, which does two rounds at a time.
+ */
+
+__attribute__((target("sha,sse4.1,ssse3"))) static void /* O - Nothing */
+sha256_transform_x86(sha256_t *ctx,            /* I - Digest context */
+                     const unsigned char *data, /* I - Blocks of data */
+                     size_t blocks)            /* I - Number of blocks */
+{
+    int i;                           /* Looping var */
+    __m128i state0, state1,          /* ABEF and CDGH state */
+        save0, save1,                /* State at the start of the block */
+        msg[4],                      /* Message schedule */
+        round,                       /* Message + constants for 4 rounds */
+        temp;                        /* Temporary */
+    const __m128i mask =             /* Byte order for message words */
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    temp = _mm_loadu_si128((const __m128i *)(ctx->state + 0));
+    state1 = _mm_loadu_si128((const __m128i *)(ctx->state + 4));
+
+    temp = _mm_shuffle_epi32(temp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    state0 = _mm_alignr_epi8(temp, state1, 8);
+    state1 = _mm_blend_epi16(state1, temp, 0xf0);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK) {
+        save0 = state0;
+        save1 = state1;
+
+        for (i = 0; i < 16; i++) {
+            /*
+             * Do rounds 4i to 4i+3, updating the message schedule for the
+             * following rounds...
+             */
+
+            if (i < 4)
+                msg[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i *)(data + 16 * i)), mask);
+
+            round = _mm_add_epi32(msg[i & 3],
+                                  _mm_loadu_si128((const __m128i *)(sha256_k + 4 * i)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, round);
+
+            if (i >= 3 && i < 15) {
+                temp = _mm_alignr_epi8(msg[i & 3], msg[(i - 1) & 3], 4);
+                msg[(i + 1) & 3] = _mm_add_epi32(msg[(i + 1) & 3], temp);
+                msg[(i + 1) & 3] = _mm_sha256msg2_epu32(msg[(i + 1) & 3], msg[i & 3]);
+            }
+
+            round = _mm_shuffle_epi32(round, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, round);
+
+            if (i >= 1 && i < 13)
+                msg[(i - 1) & 3] = _mm_sha256msg1_epu32(msg[(i - 1) & 3], msg[i & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    }
+
+    temp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(temp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, temp, 8);
+
+    _mm_storeu_si128((__m128i *)(ctx->state + 0), state0);
+    _mm_storeu_si128((__m128i *)(ctx->state + 4), state1);
+}
+#endif /* SHA256_X86 */
@@ -24,6 +24,36 @@
 
 #include "epm.h"
 
+/*
+ * 'get_owner()' - Get the numeric user and group IDs for a file.
+ *
+ * Unknown user and group names map to 0 (root).  The reentrant lookup
+ * functions are used so that packages can be built concurrently.
+ */
+
+void                     /* O - Nothing */
+get_owner(const char *user,  /* I - User name */
+          const char *group, /* I - Group name */
+          uid_t *uid,        /* O - User ID */
+          gid_t *gid)        /* O - Group ID */
+{
+    char buffer[16384];  /* String buffer for lookups */
+    struct passwd pwd,   /* User record */
+        *pwdptr;         /* Pointer to user record */
+    struct group grp,    /* Group record */
+        *grpptr;         /* Pointer to group record */
+
+    if (user && !getpwnam_r(user, &pwd, buffer, sizeof(buffer), &pwdptr) && pwdptr)
+        *uid = pwdptr->pw_uid;
+    else
+        *uid = 0;
+
+    if (group && !getgrnam_r(group, &grp, buffer, sizeof(buffer), &grpptr) && grpptr)
+        *gid = grpptr->gr_gid;
+    else
+        *gid = 0;
+}
+
 /*
  * 'get_vernumber()' - Convert a version string to a number...
  */
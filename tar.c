@@ -24,12 +24,6 @@
 
 #include "epm.h"
 
-/*
- * Local globals...
- */
-
-static char last_pathname[1024] = "";
-
 /*
  * 'tar_close()' - Close a tar file, padding as needed.
  */
@@ -162,7 +156,7 @@ tar_directory(tarf_t *tar,         /* I - Tar file to write to */
          */
 
         if (Verbosity)
-            puts(dst);
+            tasks_printf("%s\n", dst);
 
         if (S_ISDIR(srcinfo.st_mode)) {
             /*
@@ -258,7 +252,7 @@ tar_file(tarf_t *fp,           /* I - Tar file to write to */
 
         if (fwrite(buffer, 1, nbytes, fp->file) < nbytes) {
             fprintf(stderr, "epm: Unable to write file data for \"%s\": %s\n",
-                    last_pathname, strerror(errno));
+                    fp->pathname, strerror(errno));
             fclose(file);
             return (-1);
         }
@@ -296,18 +290,14 @@ tar_header(tarf_t *fp,           /* I - Tar file to write to */
     int i,                 /* Looping var... */
         sum;               /* Checksum */
     unsigned char *sumptr; /* Pointer into header record */
-    struct passwd *pwd;    /* Pointer to user record */
-    struct group *grp;     /* Pointer to group record */
+    uid_t uid;             /* User ID */
+    gid_t gid;             /* Group ID */
 
     /*
      * Find the username and groupname IDs...
      */
 
-    pwd = getpwnam(user);
-    grp = getgrnam(group);
-
-    endpwent();
-    endgrent();
+    get_owner(user, group, &uid, &gid);
 
     /*
      * Format the header...
@@ -371,9 +361,9 @@ tar_header(tarf_t *fp,           /* I - Tar file to write to */
 
     snprintf(record.header.mode, sizeof(record.header.mode), "%-6o ", (unsigned)mode);
     snprintf(record.header.uid, sizeof(record.header.uid), "%o ",
-             pwd == NULL ? 0 : (unsigned)pwd->pw_uid);
+             (unsigned)uid);
     snprintf(record.header.gid, sizeof(record.header.gid), "%o ",
-             grp == NULL ? 0 : (unsigned)grp->gr_gid);
+             (unsigned)gid);
     snprintf(record.header.size, sizeof(record.header.size), "%011o", (unsigned)size);
     snprintf(record.header.mtime, sizeof(record.header.mtime), "%011o", (unsigned)mtime);
     memset(&(record.header.chksum), ' ', sizeof(record.header.chksum));
@@ -408,7 +398,7 @@ tar_header(tarf_t *fp,           /* I - Tar file to write to */
         return (-1);
     }
 
-    strlcpy(last_pathname, pathname, sizeof(last_pathname));
+    strlcpy(fp->pathname, pathname, sizeof(fp->pathname));
 
     fp->blocks++;
     return (0);
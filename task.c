@@ -0,0 +1,654 @@
+/*
+ * Build task scheduling functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "epm.h"
+#include <stdarg.h>
+#ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local types...
+ */
+
+struct task_s /**** Build task ****/
+{
+    const char *name;        /* Name of task */
+    task_cb_t cb;            /* Function to call */
+    void *data;              /* Data for function */
+    int status,              /* Exit status */
+        skip,                /* 1 if a dependency failed */
+        done,                /* 1 if finished or skipped */
+        num_waiting,         /* Number of unfinished dependencies */
+        num_check;           /* Unchecked dependencies for tasks_check() */
+    int num_dependents,      /* Number of tasks that depend on this one */
+        alloc_dependents;    /* Allocated dependents */
+    task_t **dependents;     /* Tasks that depend on this one */
+    char *output;            /* Buffered standard output */
+    size_t outused,          /* Bytes of output */
+        outalloc;            /* Allocated bytes of output */
+};
+
+typedef struct /**** Task queue for one worker ****/
+{
+    int head,                /* First (oldest) task */
+        tail;                /* Last (newest) task + 1 */
+    task_t **tasks;          /* Tasks */
+} task_queue_t;
+
+struct tasks_s /**** Build task graph ****/
+{
+    int num_tasks,           /* Number of tasks */
+        alloc_tasks;         /* Allocated tasks */
+    task_t **tasks;          /* Tasks in the order they were added */
+    int num_done,            /* Number of finished tasks */
+        num_flushed,         /* Number of tasks whose output was written */
+        status;              /* Status of first failed task */
+    int num_queues;          /* Number of workers */
+    task_queue_t *queues;    /* Per-worker queues */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mutex;   /* Lock for queues and counters */
+    pthread_cond_t cond;     /* Signalled when tasks are queued or finish */
+#endif /* HAVE_PTHREAD_H */
+};
+
+#ifdef HAVE_PTHREAD_H
+typedef struct /**** Worker thread ****/
+{
+    tasks_t *tasks;          /* Task graph */
+    int queue;               /* Queue number */
+} task_worker_t;
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local globals...
+ */
+
+#ifdef HAVE_PTHREAD_H
+static pthread_key_t TaskKey;             /* Task run by the current thread */
+static pthread_once_t TaskKeyOnce = PTHREAD_ONCE_INIT;
+                                          /* One-time key initialization */
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Local functions...
+ */
+
+static int tasks_check(tasks_t *tasks);
+static void tasks_finish(tasks_t *tasks, task_t *task, int queue);
+#ifdef HAVE_PTHREAD_H
+static void tasks_flush(tasks_t *tasks);
+static void tasks_key(void);
+static task_t *tasks_next(tasks_t *tasks, int queue);
+static void *tasks_worker(task_worker_t *worker);
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * 'tasks_add()' - Add a task to a task graph.
+ *
+ * The callback function returns 0 on success or non-zero on failure.
+ */
+
+task_t *                 /* O - New task or NULL on error */
+tasks_add(tasks_t *tasks,    /* I - Task graph */
+          const char *name,  /* I - Name of task */
+          task_cb_t cb,      /* I - Function to call */
+          void *data)        /* I - Data for function */
+{
+    task_t *task,            /* New task */
+        **temp;              /* New task array */
+
+    if (tasks->num_tasks >= tasks->alloc_tasks) {
+        if ((temp = realloc(tasks->tasks, (size_t)(tasks->alloc_tasks + 16) *
+                                              sizeof(task_t *))) == NULL)
+            return (NULL);
+
+        tasks->tasks = temp;
+        tasks->alloc_tasks += 16;
+    }
+
+    if ((task = calloc(1, sizeof(task_t))) == NULL)
+        return (NULL);
+
+    task->name = name;
+    task->cb = cb;
+    task->data = data;
+
+    tasks->tasks[tasks->num_tasks++] = task;
+
+    return (task);
+}
+
+/*
+ * 'tasks_buffered()' - Determine whether output of the current thread is
+ *                      buffered by a concurrently running task.
+ */
+
+int                     /* O - 1 if buffered, 0 otherwise */
+tasks_buffered(void)    /* I - Nothing */
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_once(&TaskKeyOnce, tasks_key);
+
+    return (pthread_getspecific(TaskKey) != NULL);
+#else
+    return (0);
+#endif /* HAVE_PTHREAD_H */
+}
+
+/*
+ * 'tasks_delete()' - Free a task graph.
+ */
+
+void                     /* O - Nothing */
+tasks_delete(tasks_t *tasks) /* I - Task graph */
+{
+    int i; /* Looping var */
+
+    if (!tasks)
+        return;
+
+    for (i = 0; i < tasks->num_tasks; i++) {
+        free(tasks->tasks[i]->dependents);
+        free(tasks->tasks[i]->output);
+        free(tasks->tasks[i]);
+    }
+
+    free(tasks->tasks);
+    free(tasks);
+}
+
+/*
+ * 'tasks_depend()' - Make one task depend on another.
+ */
+
+int                       /* O - 0 on success, -1 on error */
+tasks_depend(task_t *task, /* I - Task */
+             task_t *dep)  /* I - Task that must finish first */
+{
+    task_t **temp; /* New dependents array */
+
+    if (!task || !dep)
+        return (-1);
+
+    if (dep->num_dependents >= dep->alloc_dependents) {
+        if ((temp = realloc(dep->dependents, (size_t)(dep->alloc_dependents + 4) *
+                                                 sizeof(task_t *))) == NULL)
+            return (-1);
+
+        dep->dependents = temp;
+        dep->alloc_dependents += 4;
+    }
+
+    dep->dependents[dep->num_dependents++] = task;
+    task->num_waiting++;
+
+    return (0);
+}
+
+/*
+ * 'tasks_new()' - Create an empty task graph.
+ */
+
+tasks_t *       /* O - Task graph or NULL on error */
+tasks_new(void) /* I - Nothing */
+{
+    return ((tasks_t *)calloc(1, sizeof(tasks_t)));
+}
+
+/*
+ * 'tasks_printf()' - Write formatted output for the current task.
+ *
+ * Output from tasks that run concurrently is buffered and written in the
+ * order the tasks were added once each of them is finished, so that verbose
+ * output is the same for any number of jobs.
+ */
+
+void                       /* O - Nothing */
+tasks_printf(const char *format, /* I - printf-style format string */
+             ...)                /* I - Additional arguments as needed */
+{
+    va_list ap;            /* Argument pointer */
+    char buffer[8192];     /* Formatted output */
+    int bytes;             /* Length of output */
+
+    va_start(ap, format);
+    bytes = vsnprintf(buffer, sizeof(buffer), format, ap);
+    va_end(ap);
+
+    if (bytes < 0)
+        return;
+
+    if ((size_t)bytes >= sizeof(buffer))
+        bytes = (int)sizeof(buffer) - 1;
+
+    tasks_write(buffer, (size_t)bytes);
+}
+
+/*
+ * 'tasks_run()' - Run all of the tasks in a task graph.
+ *
+ * Up to "max_jobs" tasks are run at the same time (0 means the number of
+ * processors).  Each worker runs the tasks made ready by its own tasks
+ * first and takes the oldest ready task from another worker when it runs
+ * out.  After a task fails no new tasks are started, and tasks that depend
+ * on a failed task are skipped.  Nothing is run if the dependencies are
+ * circular.
+ *
+ * With a single job the tasks are run in the order they were added, as
+ * far as their dependencies allow.
+ */
+
+int                      /* O - 0 on success, status of first failure otherwise */
+tasks_run(tasks_t *tasks, /* I - Task graph */
+          int max_jobs)   /* I - Maximum concurrent tasks or 0 */
+{
+    int i;        /* Looping var */
+    task_t *task; /* Current task */
+
+    if (max_jobs <= 0 && (max_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        max_jobs = 1;
+
+    if (max_jobs > tasks->num_tasks)
+        max_jobs = tasks->num_tasks;
+
+    /*
+     * Worker threads would wait forever for tasks with circular
+     * dependencies, so check for them first...
+     */
+
+    if (tasks_check(tasks)) {
+        fputs("epm: Build tasks have circular dependencies!\n", stderr);
+        return (1);
+    }
+
+#ifdef HAVE_PTHREAD_H
+    if (max_jobs > 1) {
+        pthread_t *threads;      /* Worker threads */
+        task_worker_t *workers;  /* Worker data */
+        int num_threads;         /* Number of running threads */
+
+        /*
+         * Create one queue per worker with room for every task, and spread
+         * the initially-ready tasks over them...
+         */
+
+        tasks->num_queues = max_jobs;
+
+        if ((tasks->queues = calloc((size_t)max_jobs, sizeof(task_queue_t))) == NULL ||
+            (threads = calloc((size_t)max_jobs, sizeof(pthread_t))) == NULL ||
+            (workers = calloc((size_t)max_jobs, sizeof(task_worker_t))) == NULL) {
+            fputs("epm: Unable to allocate memory for build tasks!\n", stderr);
+            exit(1);
+        }
+
+        for (i = 0; i < max_jobs; i++)
+            if ((tasks->queues[i].tasks = calloc((size_t)tasks->num_tasks,
+                                                 sizeof(task_t *))) == NULL) {
+                fputs("epm: Unable to allocate memory for build tasks!\n", stderr);
+                exit(1);
+            }
+
+        for (i = 0; i < tasks->num_tasks; i++)
+            if (tasks->tasks[i]->num_waiting == 0) {
+                task_queue_t *queue = tasks->queues + i % max_jobs;
+                /* Queue for task */
+
+                queue->tasks[queue->tail++] = tasks->tasks[i];
+            }
+
+        pthread_mutex_init(&tasks->mutex, NULL);
+        pthread_cond_init(&tasks->cond, NULL);
+        pthread_once(&TaskKeyOnce, tasks_key);
+        fflush(stdout);
+
+        /*
+         * Start the workers; the first one runs on this thread...
+         */
+
+        for (i = 1, num_threads = 1; i < max_jobs; i++) {
+            workers[i].tasks = tasks;
+            workers[i].queue = i;
+
+            if (pthread_create(threads + i, NULL, (void *(*)(void *))tasks_worker,
+                               workers + i))
+                break;
+
+            num_threads++;
+        }
+
+        if (num_threads < max_jobs) {
+            /*
+             * Couldn't start all of the threads; move any queued work to the
+             * queues of the workers we have...
+             */
+
+            pthread_mutex_lock(&tasks->mutex);
+
+            for (i = num_threads; i < max_jobs; i++) {
+                task_queue_t *from = tasks->queues + i, /* Unused queue */
+                    *to = tasks->queues;                /* First queue */
+
+                while (from->head < from->tail)
+                    to->tasks[to->tail++] = from->tasks[from->head++];
+            }
+
+            tasks->num_queues = num_threads;
+
+            pthread_mutex_unlock(&tasks->mutex);
+        }
+
+        workers[0].tasks = tasks;
+        workers[0].queue = 0;
+        tasks_worker(workers);
+
+        for (i = 1; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
+
+        tasks_flush(tasks);
+
+        pthread_mutex_destroy(&tasks->mutex);
+        pthread_cond_destroy(&tasks->cond);
+
+        for (i = 0; i < max_jobs; i++)
+            free(tasks->queues[i].tasks);
+
+        free(tasks->queues);
+        free(threads);
+        free(workers);
+
+        tasks->queues = NULL;
+        tasks->num_queues = 0;
+
+        return (tasks->status);
+    }
+#endif /* HAVE_PTHREAD_H */
+
+    /*
+     * Run the tasks one at a time, in order...
+     */
+
+    while (tasks->num_done < tasks->num_tasks) {
+        for (i = 0; i < tasks->num_tasks; i++) {
+            task = tasks->tasks[i];
+
+            if (!task->done && task->num_waiting == 0)
+                break;
+        }
+
+        if (i >= tasks->num_tasks) {
+            fputs("epm: Build tasks have circular dependencies!\n", stderr);
+            return (1);
+        }
+
+        if (tasks->status)
+            task->skip = 1;
+        else
+            task->status = (task->cb)(task->data);
+
+        tasks_finish(tasks, task, 0);
+    }
+
+    return (tasks->status);
+}
+
+/*
+ * 'tasks_write()' - Write output for the current task.
+ */
+
+void                          /* O - Nothing */
+tasks_write(const void *data, /* I - Output */
+            size_t bytes)     /* I - Number of bytes */
+{
+#ifdef HAVE_PTHREAD_H
+    task_t *task; /* Current task */
+
+    pthread_once(&TaskKeyOnce, tasks_key);
+
+    if ((task = (task_t *)pthread_getspecific(TaskKey)) != NULL) {
+        if (task->outused + bytes > task->outalloc) {
+            size_t outalloc; /* New size of buffer */
+            char *temp;      /* New buffer */
+
+            for (outalloc = task->outalloc ? task->outalloc : 1024;
+                 outalloc < task->outused + bytes; outalloc *= 2)
+                ;
+
+            if ((temp = realloc(task->output, outalloc)) == NULL) {
+                fputs("epm: Unable to allocate memory for build output!\n", stderr);
+                exit(1);
+            }
+
+            task->output = temp;
+            task->outalloc = outalloc;
+        }
+
+        memcpy(task->output + task->outused, data, bytes);
+        task->outused += bytes;
+        return;
+    }
+#endif /* HAVE_PTHREAD_H */
+
+    fwrite(data, 1, bytes, stdout);
+}
+
+/*
+ * 'tasks_check()' - Check a task graph for circular dependencies.
+ */
+
+static int                 /* O - 0 if OK, -1 if circular */
+tasks_check(tasks_t *tasks) /* I - Task graph */
+{
+    int i,                 /* Looping var */
+        num_ready,         /* Number of tasks that can run */
+        num_checked;       /* Number of tasks checked */
+    task_t *task,          /* Current task */
+        *dep,              /* Dependent task */
+        **ready;           /* Tasks that can run */
+
+    if (tasks->num_tasks == 0)
+        return (0);
+
+    if ((ready = calloc((size_t)tasks->num_tasks, sizeof(task_t *))) == NULL) {
+        fputs("epm: Unable to allocate memory for build tasks!\n", stderr);
+        exit(1);
+    }
+
+    /*
+     * "Run" the tasks without dependencies, then any dependents that have
+     * no dependencies left; tasks that are never reached are in a cycle...
+     */
+
+    for (i = 0, num_ready = 0; i < tasks->num_tasks; i++) {
+        task = tasks->tasks[i];
+
+        if ((task->num_check = task->num_waiting) == 0)
+            ready[num_ready++] = task;
+    }
+
+    for (num_checked = 0; num_checked < num_ready; num_checked++) {
+        task = ready[num_checked];
+
+        for (i = 0; i < task->num_dependents; i++) {
+            dep = task->dependents[i];
+
+            if (--dep->num_check == 0)
+                ready[num_ready++] = dep;
+        }
+    }
+
+    free(ready);
+
+    return (num_ready < tasks->num_tasks ? -1 : 0);
+}
+
+/*
+ * 'tasks_finish()' - Mark a task as finished and queue ready dependents.
+ *
+ * For threaded runs the caller must hold the task graph mutex.
+ */
+
+static void                /* O - Nothing */
+tasks_finish(tasks_t *tasks, /* I - Task graph */
+             task_t *task,   /* I - Finished task */
+             int queue)      /* I - Queue for ready dependents */
+{
+    int i;        /* Looping var */
+    task_t *dep;  /* Dependent task */
+
+    task->done = 1;
+    tasks->num_done++;
+
+    if (task->status && !tasks->status) {
+        if (Verbosity > 1)
+            fprintf(stderr, "epm: Build task \"%s\" failed.\n", task->name);
+
+        tasks->status = task->status;
+    }
+
+    for (i = 0; i < task->num_dependents; i++) {
+        dep = task->dependents[i];
+
+        if (task->status || task->skip)
+            dep->skip = 1;
+
+        if (--dep->num_waiting == 0 && tasks->queues) {
+            task_queue_t *q = tasks->queues + queue; /* Worker queue */
+
+            q->tasks[q->tail++] = dep;
+        }
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * 'tasks_flush()' - Write the buffered output of finished tasks.
+ *
+ * Output is written in the order the tasks were added, stopping at the
+ * first task that is still running.  The caller must hold the task graph
+ * mutex.
+ */
+
+static void              /* O - Nothing */
+tasks_flush(tasks_t *tasks) /* I - Task graph */
+{
+    task_t *task; /* Current task */
+
+    while (tasks->num_flushed < tasks->num_tasks) {
+        task = tasks->tasks[tasks->num_flushed];
+
+        if (!task->done)
+            break;
+
+        if (task->outused > 0) {
+            fwrite(task->output, 1, task->outused, stdout);
+            fflush(stdout);
+        }
+
+        free(task->output);
+        task->output = NULL;
+        task->outused = task->outalloc = 0;
+
+        tasks->num_flushed++;
+    }
+}
+
+/*
+ * 'tasks_key()' - Create the current task key.
+ */
+
+static void     /* O - Nothing */
+tasks_key(void) /* I - Nothing */
+{
+    pthread_key_create(&TaskKey, NULL);
+}
+
+/*
+ * 'tasks_next()' - Get the next task for a worker.
+ *
+ * Workers take the newest task from their own queue, or steal the oldest
+ * task from another worker.  The caller must hold the task graph mutex.
+ */
+
+static task_t *            /* O - Task or NULL if none are ready */
+tasks_next(tasks_t *tasks, /* I - Task graph */
+           int queue)      /* I - Worker queue */
+{
+    int i;              /* Looping var */
+    task_queue_t *q;    /* Queue */
+
+    q = tasks->queues + queue;
+
+    if (q->head < q->tail)
+        return (q->tasks[--q->tail]);
+
+    for (i = 1; i < tasks->num_queues; i++) {
+        q = tasks->queues + (queue + i) % tasks->num_queues;
+
+        if (q->head < q->tail)
+            return (q->tasks[q->head++]);
+    }
+
+    return (NULL);
+}
+
+/*
+ * 'tasks_worker()' - Run tasks until all of them are finished.
+ */
+
+static void *                    /* O - Thread exit value */
+tasks_worker(task_worker_t *worker) /* I - Worker data */
+{
+    tasks_t *tasks = worker->tasks; /* Task graph */
+    task_t *task;                   /* Current task */
+
+    pthread_mutex_lock(&tasks->mutex);
+
+    while (tasks->num_done < tasks->num_tasks) {
+        if ((task = tasks_next(tasks, worker->queue)) == NULL) {
+            pthread_cond_wait(&tasks->cond, &tasks->mutex);
+            continue;
+        }
+
+        if (tasks->status)
+            task->skip = 1;
+
+        if (!task->skip) {
+            pthread_mutex_unlock(&tasks->mutex);
+            pthread_setspecific(TaskKey, task);
+            task->status = (task->cb)(task->data);
+            pthread_setspecific(TaskKey, NULL);
+            pthread_mutex_lock(&tasks->mutex);
+        }
+
+        tasks_finish(tasks, task, worker->queue);
+        tasks_flush(tasks);
+
+        pthread_cond_broadcast(&tasks->cond);
+    }
+
+    pthread_mutex_unlock(&tasks->mutex);
+
+    return (NULL);
+}
+#endif /* HAVE_PTHREAD_H */
@@ -75,6 +75,18 @@ AuthorizationRef SetupAuthorizationRef;
 #define PANE_CONFIRM 2
 #define PANE_REMOVE 3
 
+//
+// Removal log...
+//
+
+static gui_log_t Log;               // Removal log
+static gui_ring_t Ring;             // Output from remove script
+static gui_progress_t Progress;     // Progress records from remove script
+static const char *ProgressMessage; // Progress message
+static double ProgressDone,         // Products removed
+    ProgressTotal;                  // Products to remove
+static time_t ProgressStart;        // Time removal started
+
 //
 // Local functions...
 //
@@ -123,6 +135,8 @@ main(int argc,     // I - Number of command-line arguments
 
     w = make_window();
 
+    gui_log_open(&Log, RemoveLog, "uninst");
+
     Pane[PANE_WELCOME]->show();
     PrevButton->deactivate();
     NextButton->deactivate();
@@ -330,40 +344,22 @@ void load_readme(void) {
 void log_cb(int fd,     // I - Pipe to read from
             int *fdptr) // O - Pipe to read from
 {
-    int bytes;                // Bytes read/to read
-    char *bufptr;             // Pointer into buffer
-    static int bufused = 0;   // Number of bytes used
-    static char buffer[8193]; // Buffer
+    int bytes;         // Bytes read
+    const char *line;  // Line from child
+    char buffer[8193]; // Line buffer
 
-    bytes = 8192 - bufused;
-    if ((bytes = read(fd, buffer + bufused, bytes)) <= 0) {
+    if ((bytes = gui_ring_read(&Ring, fd)) <= 0) {
         // End of file; zero the FD to tell the remove_dist() function to
         // stop...
 
         Fl::remove_fd(fd);
         close(fd);
         *fdptr = 0;
-
-        if (bufused > 0) {
-            // Add remaining text...
-            buffer[bufused] = '\0';
-            RemoveLog->add(buffer);
-            bufused = 0;
-        }
-    } else {
-        // Add bytes to the buffer, then add lines as needed...
-        bufused += bytes;
-        buffer[bufused] = '\0';
-
-        while ((bufptr = strchr(buffer, '\n')) != NULL) {
-            *bufptr++ = '\0';
-            RemoveLog->add(buffer);
-            strcpy(buffer, bufptr);
-            bufused -= bufptr - buffer;
-        }
     }
 
-    RemoveLog->bottomline(RemoveLog->size());
+    // Add complete lines to the log, and anything left at end of file...
+    while ((line = gui_ring_line(&Ring, buffer, sizeof(buffer), bytes <= 0)) != NULL)
+        gui_log_add(&Log, line);
 }
 
 //
@@ -372,7 +368,6 @@ void log_cb(int fd,     // I - Pipe to read from
 
 void next_cb(Fl_Button *, void *) {
     int i;                     // Looping var
-    int progress;              // Progress so far...
     int error;                 // Errors?
     static char message[1024]; // Progress message...
     static int removing = 0;   // Removing software?
@@ -397,21 +392,27 @@ void next_cb(Fl_Button *, void *) {
         CancelButton->deactivate();
         CancelButton->label("Close");
 
-        for (i = 0, progress = 0, error = 0; i < NumInstalled; i++)
+        ProgressMessage = message;
+        ProgressTotal = SoftwareList->nchecked();
+        ProgressStart = time(NULL);
+
+        for (i = 0, ProgressDone = 0.0, error = 0; i < NumInstalled; i++)
             if (SoftwareList->checked(i + 1)) {
                 sprintf(message, "Removing %s v%s...", Installed[i].name,
                         Installed[i].version);
 
-                RemovePercent->value(100.0 * progress / SoftwareList->nchecked());
-                RemovePercent->label(message);
+                gui_progress_show(RemovePercent, message, ProgressDone / ProgressTotal,
+                                  ProgressStart);
                 Pane[PANE_REMOVE]->redraw();
 
                 if ((error = remove_dist(Installed + i)) != 0)
                     break;
 
-                progress++;
+                ProgressDone++;
             }
 
+        gui_log_flush(&Log);
+
         RemovePercent->value(100.0);
 
         if (error)
@@ -441,11 +442,16 @@ remove_dist(const gui_dist_t *dist) // I - Distribution to remove
     int fds[2];         // Pipe FDs
     int status = 0;     // Exit status
 #ifndef __APPLE__
-    int pid; // Process ID
-#endif       // !__APPLE__
+    int pid;            // Process ID
+    int pfds[2];        // Progress pipe FDs
+    char progenv[64];   // Progress environment variable
+#endif // !__APPLE__
+
+    memset(&Progress, 0, sizeof(Progress));
+    Progress.fd = -1;
 
     snprintf(command, sizeof(command), "**** %s ****", dist->name);
-    RemoveLog->add(command);
+    gui_log_add(&Log, command);
 
     if (dist->type == PACKAGE_PORTABLE)
         snprintf(command, sizeof(command), EPM_SOFTWARE "/%s.remove", dist->product);
@@ -460,12 +466,19 @@ remove_dist(const gui_dist_t *dist) // I - Distribution to remove
                                                  kAuthorizationFlagDefaults, args, &fp);
 
     if (astatus != errAuthorizationSuccess) {
-        RemoveLog->add("Failed to execute remove script!");
+        gui_log_add(&Log, "Failed to execute remove script!");
         return (1);
     }
 
     fds[0] = fileno(fp);
 #else
+    // Portable remove scripts also write progress records to a second
+    // pipe...
+    if (dist->type == PACKAGE_PORTABLE && !pipe(pfds))
+        snprintf(progenv, sizeof(progenv), "EPM_PROGRESS_FD=%d", pfds[1]);
+    else
+        pfds[0] = pfds[1] = -1;
+
     // Fork the command and redirect errors and info to stdout...
     pipe(fds);
 
@@ -480,6 +493,11 @@ remove_dist(const gui_dist_t *dist) // I - Distribution to remove
         close(fds[0]);
         close(fds[1]);
 
+        if (pfds[0] >= 0) {
+            close(pfds[0]);
+            putenv(progenv);
+        }
+
         // Execute the command; if an error occurs, return it...
         if (dist->type == PACKAGE_PORTABLE)
             execl(command, command, "now", (char *)0);
@@ -490,22 +508,33 @@ remove_dist(const gui_dist_t *dist) // I - Distribution to remove
     } else if (pid < 0) {
         // Unable to fork!
         sprintf(command, "Unable to remove %s:", dist->name);
-        RemoveLog->add(command);
+        gui_log_add(&Log, command);
 
         sprintf(command, "\t%s", strerror(errno));
-        RemoveLog->add(command);
+        gui_log_add(&Log, command);
 
         close(fds[0]);
         close(fds[1]);
 
+        if (pfds[0] >= 0) {
+            close(pfds[0]);
+            close(pfds[1]);
+        }
+
         return (1);
     }
 
     // Close the output pipe (used by the child)...
     close(fds[1]);
+
+    if (pfds[0] >= 0) {
+        close(pfds[1]);
+        gui_progress_open(&Progress, pfds[0]);
+    }
 #endif // __APPLE__
 
     // Listen for data on the input pipe...
+    memset(&Ring, 0, sizeof(Ring));
     Fl::add_fd(fds[0], (void (*)(int, void *))log_cb, fds);
 
     // Show the user that we're busy...
@@ -514,8 +543,13 @@ remove_dist(const gui_dist_t *dist) // I - Distribution to remove
     // Loop until the child is done...
     while (fds[0]) // log_cb() will close and zero fds[0]...
     {
-        // Wait for events...
-        Fl::wait();
+        // Show the progress of this product...
+        gui_progress_show(RemovePercent, ProgressMessage,
+                          (ProgressDone + gui_progress_fraction(&Progress)) / ProgressTotal,
+                          ProgressStart);
+
+        // Wait for events, at least once a second for the time left...
+        Fl::wait(1.0);
 
 #ifndef __APPLE__
         // Check to see if the child went away...
@@ -532,11 +566,20 @@ remove_dist(const gui_dist_t *dist) // I - Distribution to remove
         // Close the pipe - have all the data from the child...
         Fl::remove_fd(fds[0]);
         close(fds[0]);
+
+        // Add any partial line...
+        char buffer[8193]; // Line buffer
+        const char *line;  // Line from child
+
+        while ((line = gui_ring_line(&Ring, buffer, sizeof(buffer), 1)) != NULL)
+            gui_log_add(&Log, line);
     } else {
         // Get the child's exit status...
         wait(&status);
     }
 
+    gui_progress_close(&Progress);
+
     // Show the user that we're ready...
     UninstallWindow->cursor(FL_CURSOR_DEFAULT);
 
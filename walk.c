@@ -0,0 +1,688 @@
+/*
+ * Directory tree scanning functions for the ESP Package Manager (EPM).
+ *
+ * Copyright © 2020 by Jim Jagielski
+ * Copyright © 1999-2020 by Michael R Sweet
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A directory tree is read by several threads at once.  Each thread has its
+ * own queue of directories to read; it takes the newest directory from its
+ * own queue and, when that is empty, steals the oldest directory from
+ * another queue.  Entries are read relative to the directory file
+ * descriptor and sorted by name, so the resulting tree is the same no matter
+ * how many threads are used or which thread read which directory.  Errors
+ * are recorded in the tree instead of being reported right away for the same
+ * reason.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#ifdef __linux__
+#    define _GNU_SOURCE /* For statx() */
+#endif /* __linux__ */
+#include "epm.h"
+#include <fcntl.h>
+#ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#endif /* HAVE_PTHREAD_H */
+#ifdef __linux__
+#    include <sys/syscall.h>
+#endif /* __linux__ */
+#if defined(__linux__) && defined(SYS_getdents64)
+#    define WALK_GETDENTS 1
+#endif /* __linux__ && SYS_getdents64 */
+
+/*
+ * Local types...
+ */
+
+typedef struct /**** Directory queue for one worker ****/
+{
+    int head,               /* First (oldest) directory */
+        tail,               /* Last (newest) directory + 1 */
+        alloc;              /* Allocated directories */
+    walk_dir_t **dirs;      /* Directories */
+} walk_queue_t;
+
+typedef struct /**** Tree scan ****/
+{
+    int num_queues,         /* Number of workers */
+        pending;            /* Directories queued or being read */
+    walk_queue_t *queues;   /* Per-worker queues */
+    walk_cb_t cb;           /* Directory callback */
+    walk_filter_t filter;   /* Directory entry filter */
+    void *data;             /* Callback data */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mutex;  /* Lock for queues and counters */
+    pthread_cond_t cond;    /* Signalled when directories are queued or read */
+#endif /* HAVE_PTHREAD_H */
+} walk_t;
+
+typedef struct /**** Worker thread ****/
+{
+    walk_t *walk;           /* Tree scan */
+    int queue;              /* Queue number */
+} walk_worker_t;
+
+#ifdef WALK_GETDENTS
+struct walk_dirent64 /**** Linux directory entry ****/
+{
+    unsigned long long d_ino; /* Inode number */
+    long long d_off;          /* Offset to next entry */
+    unsigned short d_reclen;  /* Length of this entry */
+    unsigned char d_type;     /* Type of file */
+    char d_name[1];           /* Filename */
+};
+#endif /* WALK_GETDENTS */
+
+/*
+ * Local functions...
+ */
+
+static int walk_compare(walk_entry_t *a, walk_entry_t *b);
+static walk_dir_t *walk_next(walk_t *walk, int queue);
+static int walk_push(walk_t *walk, int queue, walk_dir_t *dir);
+static void walk_read(walk_t *walk, int queue, walk_dir_t *dir, char *buffer,
+                      size_t bufsize);
+static int walk_stat(walk_dir_t *dir, walk_entry_t *entry, int fd);
+static void *walk_worker(walk_worker_t *worker);
+
+/*
+ * 'walk_add()' - Add an entry to a directory.
+ *
+ * The new entry is zeroed except for the name.
+ */
+
+walk_entry_t *            /* O - New entry or NULL on error */
+walk_add(walk_dir_t *dir, /* I - Directory */
+         const char *name) /* I - Name of entry */
+{
+    walk_entry_t *entry; /* New entry */
+
+    if (dir->num_entries >= dir->alloc_entries) {
+        int alloc;            /* New allocation */
+
+        alloc = dir->alloc_entries ? 2 * dir->alloc_entries : 16;
+
+        if ((entry = realloc(dir->entries, (size_t)alloc * sizeof(walk_entry_t))) == NULL)
+            return (NULL);
+
+        dir->entries = entry;
+        dir->alloc_entries = alloc;
+    }
+
+    entry = dir->entries + dir->num_entries;
+    memset(entry, 0, sizeof(walk_entry_t));
+
+    if ((entry->name = strdup(name)) == NULL)
+        return (NULL);
+
+    dir->num_entries++;
+
+    return (entry);
+}
+
+/*
+ * 'walk_delete()' - Free a directory tree.
+ */
+
+void                        /* O - Nothing */
+walk_delete(walk_dir_t *dir) /* I - Directory tree */
+{
+    int i;                  /* Looping var */
+    walk_entry_t *entry;    /* Current entry */
+
+    if (!dir)
+        return;
+
+    for (i = dir->num_entries, entry = dir->entries; i > 0; i--, entry++) {
+        free(entry->name);
+        free(entry->link);
+        free(entry->text);
+        walk_delete(entry->dir);
+    }
+
+    free(dir->entries);
+    free(dir->path);
+    free(dir);
+}
+
+/*
+ * 'walk_tree()' - Read a directory tree.
+ *
+ * The tree is read using up to "max_jobs" threads.  Directory entries are
+ * sorted by name; the "error" members of the directory and its entries
+ * contain the errno value for anything that could not be read.
+ *
+ * The callback, if any, is called from the worker threads for each directory
+ * after its modification time, change time, and inode number are known.  It
+ * can add the entries itself with walk_add() and return 1 to skip reading
+ * the directory; the information of subdirectory entries is then refreshed
+ * so that they are read as usual.
+ *
+ * The filter, if any, is called for each name before the entry is added and
+ * returns WALK_KEEP, WALK_PRUNE to keep the entry without reading it as a
+ * subdirectory, or WALK_SKIP to leave the entry out.
+ */
+
+walk_dir_t *              /* O - Directory tree or NULL on error */
+walk_tree(const char *path, /* I - Directory to read */
+          int max_jobs,     /* I - Maximum number of threads */
+          walk_cb_t cb,     /* I - Directory callback or NULL */
+          walk_filter_t filter, /* I - Directory entry filter or NULL */
+          void *data)       /* I - Callback and filter data */
+{
+    int i;                /* Looping var */
+    walk_t walk;          /* Tree scan */
+    walk_dir_t *root;     /* Top directory */
+    walk_worker_t *workers; /* Worker data */
+#ifdef HAVE_PTHREAD_H
+    pthread_t *threads;   /* Worker threads */
+    int num_threads;      /* Number of threads started */
+#endif /* HAVE_PTHREAD_H */
+
+    if ((root = calloc(1, sizeof(walk_dir_t))) == NULL ||
+        (root->path = strdup(path)) == NULL) {
+        free(root);
+        return (NULL);
+    }
+
+    if (max_jobs < 1)
+        max_jobs = 1;
+
+    memset(&walk, 0, sizeof(walk));
+
+    walk.num_queues = max_jobs;
+    walk.cb = cb;
+    walk.filter = filter;
+    walk.data = data;
+
+    if ((walk.queues = calloc((size_t)max_jobs, sizeof(walk_queue_t))) == NULL ||
+        (workers = calloc((size_t)max_jobs, sizeof(walk_worker_t))) == NULL) {
+        free(walk.queues);
+        walk_delete(root);
+        return (NULL);
+    }
+
+    for (i = 0; i < max_jobs; i++) {
+        workers[i].walk = &walk;
+        workers[i].queue = i;
+    }
+
+    if (walk_push(&walk, 0, root)) {
+        free(workers);
+        free(walk.queues);
+        walk_delete(root);
+        return (NULL);
+    }
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&walk.mutex, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+
+    if (max_jobs > 1 && (threads = calloc((size_t)max_jobs, sizeof(pthread_t))) != NULL) {
+        /*
+         * Start the workers; the first one runs on this thread...
+         */
+
+        for (i = 1, num_threads = 0; i < max_jobs; i++, num_threads++)
+            if (pthread_create(threads + i, NULL, (void *(*)(void *))walk_worker,
+                               workers + i))
+                break;
+
+        walk_worker(workers);
+
+        for (i = 1; i <= num_threads; i++)
+            pthread_join(threads[i], NULL);
+
+        free(threads);
+    } else
+#endif /* HAVE_PTHREAD_H */
+        walk_worker(workers);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_destroy(&walk.cond);
+    pthread_mutex_destroy(&walk.mutex);
+#endif /* HAVE_PTHREAD_H */
+
+    for (i = 0; i < max_jobs; i++)
+        free(walk.queues[i].dirs);
+
+    free(walk.queues);
+    free(workers);
+
+    return (root);
+}
+
+/*
+ * 'walk_compare()' - Compare two directory entries by name.
+ */
+
+static int                /* O - Result of comparison */
+walk_compare(walk_entry_t *a, /* I - First entry */
+             walk_entry_t *b) /* I - Second entry */
+{
+    return (strcmp(a->name, b->name));
+}
+
+/*
+ * 'walk_next()' - Get the next directory to read.
+ *
+ * The newest directory in the worker's own queue is used first so that the
+ * tree is read depth-first; otherwise the oldest directory in another queue
+ * is stolen since it is likely to have the most work below it.  The walk
+ * must be locked.
+ */
+
+static walk_dir_t * /* O - Directory or NULL if none */
+walk_next(walk_t *walk, /* I - Tree scan */
+          int queue)    /* I - Worker queue */
+{
+    int i;          /* Looping var */
+    walk_queue_t *q; /* Queue */
+
+    q = walk->queues + queue;
+
+    if (q->head < q->tail)
+        return (q->dirs[--q->tail]);
+
+    for (i = 1; i < walk->num_queues; i++) {
+        q = walk->queues + (queue + i) % walk->num_queues;
+
+        if (q->head < q->tail)
+            return (q->dirs[q->head++]);
+    }
+
+    return (NULL);
+}
+
+/*
+ * 'walk_push()' - Queue a directory for reading.
+ *
+ * The walk must be locked.
+ */
+
+static int              /* O - 0 on success, -1 on error */
+walk_push(walk_t *walk, /* I - Tree scan */
+          int queue,    /* I - Worker queue */
+          walk_dir_t *dir) /* I - Directory */
+{
+    walk_queue_t *q; /* Queue */
+
+    q = walk->queues + queue;
+
+    if (q->head == q->tail)
+        q->head = q->tail = 0;
+
+    if (q->tail >= q->alloc) {
+        walk_dir_t **temp; /* New directories */
+        int alloc;         /* New allocation */
+
+        if (q->head > 0) {
+            /*
+             * Reclaim the space used by stolen directories first...
+             */
+
+            memmove(q->dirs, q->dirs + q->head, (size_t)(q->tail - q->head) * sizeof(walk_dir_t *));
+            q->tail -= q->head;
+            q->head = 0;
+        }
+
+        if (q->tail >= q->alloc) {
+            alloc = q->alloc ? 2 * q->alloc : 64;
+
+            if ((temp = realloc(q->dirs, (size_t)alloc * sizeof(walk_dir_t *))) == NULL)
+                return (-1);
+
+            q->dirs = temp;
+            q->alloc = alloc;
+        }
+    }
+
+    q->dirs[q->tail++] = dir;
+    walk->pending++;
+
+    return (0);
+}
+
+/*
+ * 'walk_read()' - Read a directory and queue its subdirectories.
+ */
+
+static void               /* O - Nothing */
+walk_read(walk_t *walk,   /* I - Tree scan */
+          int queue,      /* I - Worker queue */
+          walk_dir_t *dir, /* I - Directory */
+          char *buffer,   /* I - Buffer for directory entries */
+          size_t bufsize) /* I - Size of buffer */
+{
+    int i, j;             /* Looping vars */
+    int fd;               /* Directory file descriptor */
+    int action;           /* Filter result */
+    walk_entry_t *entry;  /* Current entry */
+    walk_dir_t *subdir;   /* Subdirectory */
+    size_t pathlen;       /* Length of directory path */
+    struct stat info;     /* Directory information */
+#ifdef WALK_GETDENTS
+    long bytes;           /* Bytes of entries */
+    long pos;             /* Position in buffer */
+    struct walk_dirent64 *dent; /* Current entry */
+#else
+    DIR *dp;              /* Directory */
+    struct dirent *dent;  /* Current entry */
+#endif /* WALK_GETDENTS */
+
+#ifdef O_DIRECTORY
+    if ((fd = open(dir->path, O_RDONLY | O_DIRECTORY)) < 0)
+#else
+    if ((fd = open(dir->path, O_RDONLY)) < 0)
+#endif /* O_DIRECTORY */
+    {
+        dir->error = errno;
+        return;
+    }
+
+    if (!fstat(fd, &info)) {
+        dir->mtime = (long long)info.st_mtime;
+        dir->ctime = (long long)info.st_ctime;
+        dir->inode = (unsigned long long)info.st_ino;
+    }
+
+    if (walk->cb && (walk->cb)(dir, walk->data) > 0) {
+        /*
+         * The callback supplied the entries; filter them and refresh the
+         * subdirectories...
+         */
+
+        for (i = 0, j = 0, entry = dir->entries; i < dir->num_entries; i++, entry++) {
+            action = walk->filter ? (walk->filter)(dir, entry->name, walk->data) : WALK_KEEP;
+
+            if (action == WALK_SKIP) {
+                free(entry->name);
+                free(entry->link);
+                free(entry->text);
+                continue;
+            }
+
+            entry->prune = action == WALK_PRUNE;
+
+            if (S_ISDIR(entry->mode) && walk_stat(dir, entry, fd))
+                entry->error = ENOMEM;
+
+            if (i > j)
+                dir->entries[j] = *entry;
+
+            j++;
+        }
+
+        dir->num_entries = j;
+
+        close(fd);
+    } else {
+#ifdef WALK_GETDENTS
+        /*
+         * Read the entries in large batches...
+         */
+
+        while ((bytes = syscall(SYS_getdents64, fd, buffer, bufsize)) != 0) {
+            if (bytes < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                dir->error = errno;
+                break;
+            }
+
+            for (pos = 0; pos < bytes; pos += dent->d_reclen) {
+                dent = (struct walk_dirent64 *)(buffer + pos);
+
+                if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+                    continue;
+
+                action = walk->filter ? (walk->filter)(dir, dent->d_name, walk->data)
+                                      : WALK_KEEP;
+
+                if (action == WALK_SKIP)
+                    continue;
+
+                if ((entry = walk_add(dir, dent->d_name)) == NULL ||
+                    walk_stat(dir, entry, fd)) {
+                    dir->error = ENOMEM;
+                    break;
+                }
+
+                entry->prune = action == WALK_PRUNE;
+            }
+
+            if (dir->error)
+                break;
+        }
+
+        close(fd);
+#else
+        if ((dp = fdopendir(fd)) == NULL) {
+            dir->error = errno;
+            close(fd);
+            return;
+        }
+
+        while ((dent = readdir(dp)) != NULL) {
+            if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+                continue;
+
+            action = walk->filter ? (walk->filter)(dir, dent->d_name, walk->data)
+                                  : WALK_KEEP;
+
+            if (action == WALK_SKIP)
+                continue;
+
+            if ((entry = walk_add(dir, dent->d_name)) == NULL ||
+                walk_stat(dir, entry, dirfd(dp))) {
+                dir->error = ENOMEM;
+                break;
+            }
+
+            entry->prune = action == WALK_PRUNE;
+        }
+
+        closedir(dp);
+#endif /* WALK_GETDENTS */
+    }
+
+    if (dir->num_entries > 1)
+        qsort(dir->entries, (size_t)dir->num_entries, sizeof(walk_entry_t),
+              (int (*)(const void *, const void *))walk_compare);
+
+    /*
+     * Queue the subdirectories in reverse order so that the first one is
+     * read next...
+     */
+
+    pathlen = strlen(dir->path);
+
+    for (i = dir->num_entries, entry = dir->entries + i - 1; i > 0; i--, entry--) {
+        if (entry->error || entry->prune || !S_ISDIR(entry->mode))
+            continue;
+
+        if ((subdir = calloc(1, sizeof(walk_dir_t))) == NULL ||
+            (subdir->path = malloc(pathlen + strlen(entry->name) + 2)) == NULL) {
+            free(subdir);
+            entry->error = ENOMEM;
+            continue;
+        }
+
+        if (pathlen > 0 && dir->path[pathlen - 1] == '/')
+            snprintf(subdir->path, pathlen + strlen(entry->name) + 2, "%s%s", dir->path,
+                     entry->name);
+        else
+            snprintf(subdir->path, pathlen + strlen(entry->name) + 2, "%s/%s", dir->path,
+                     entry->name);
+
+        entry->dir = subdir;
+
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        if (walk_push(walk, queue, subdir))
+            entry->error = ENOMEM;
+
+#ifdef HAVE_PTHREAD_H
+        pthread_cond_signal(&walk->cond);
+        pthread_mutex_unlock(&walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+    }
+}
+
+/*
+ * 'walk_stat()' - Get the information for a directory entry.
+ *
+ * Errors are recorded in the entry.
+ */
+
+static int                /* O - 0 on success, -1 on error */
+walk_stat(walk_dir_t *dir, /* I - Directory */
+          walk_entry_t *entry, /* I - Entry */
+          int fd)         /* I - Directory file descriptor */
+{
+    char link[1024];      /* Link text */
+    ssize_t linklen;      /* Length of link text */
+#ifdef HAVE_STATX
+    struct statx info;    /* File information */
+#else
+    struct stat info;     /* File information */
+#endif /* HAVE_STATX */
+#if !defined(HAVE_FSTATAT) && !defined(HAVE_STATX)
+    char path[1024];      /* Full path of entry */
+#endif /* !HAVE_FSTATAT && !HAVE_STATX */
+
+    entry->error = 0;
+
+#ifdef HAVE_STATX
+    if (statx(fd, entry->name, AT_SYMLINK_NOFOLLOW,
+              STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME |
+                  STATX_CTIME | STATX_INO,
+              &info)) {
+        entry->error = errno;
+        return (0);
+    }
+
+    entry->mode = (mode_t)info.stx_mode;
+    entry->uid = (uid_t)info.stx_uid;
+    entry->gid = (gid_t)info.stx_gid;
+    entry->size = (long long)info.stx_size;
+    entry->mtime = (long long)info.stx_mtime.tv_sec;
+    entry->ctime = (long long)info.stx_ctime.tv_sec;
+    entry->inode = (unsigned long long)info.stx_ino;
+#else
+#    ifdef HAVE_FSTATAT
+    if (fstatat(fd, entry->name, &info, AT_SYMLINK_NOFOLLOW))
+#    else
+    snprintf(path, sizeof(path), "%s/%s", dir->path, entry->name);
+
+    if (lstat(path, &info))
+#    endif /* HAVE_FSTATAT */
+    {
+        entry->error = errno;
+        return (0);
+    }
+
+    entry->mode = info.st_mode;
+    entry->uid = info.st_uid;
+    entry->gid = info.st_gid;
+    entry->size = (long long)info.st_size;
+    entry->mtime = (long long)info.st_mtime;
+    entry->ctime = (long long)info.st_ctime;
+    entry->inode = (unsigned long long)info.st_ino;
+#endif /* HAVE_STATX */
+
+    if (S_ISLNK(entry->mode)) {
+#if defined(HAVE_FSTATAT) || defined(HAVE_STATX)
+        linklen = readlinkat(fd, entry->name, link, sizeof(link) - 1);
+#else
+        linklen = readlink(path, link, sizeof(link) - 1);
+#endif /* HAVE_FSTATAT || HAVE_STATX */
+
+        if (linklen < 0) {
+            entry->error = errno;
+            return (0);
+        }
+
+        link[linklen] = '\0';
+
+        free(entry->link);
+
+        if ((entry->link = strdup(link)) == NULL)
+            return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * 'walk_worker()' - Read directories until the whole tree has been read.
+ */
+
+static void *                  /* O - Thread exit value (unused) */
+walk_worker(walk_worker_t *worker) /* I - Worker data */
+{
+    walk_t *walk = worker->walk; /* Tree scan */
+    walk_dir_t *dir;             /* Current directory */
+    char *buffer;                /* Buffer for directory entries */
+    size_t bufsize = 65536;      /* Size of buffer */
+
+    if ((buffer = malloc(bufsize)) == NULL)
+        return (NULL);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+    while (walk->pending > 0) {
+        if ((dir = walk_next(walk, worker->queue)) == NULL) {
+#ifdef HAVE_PTHREAD_H
+            pthread_cond_wait(&walk->cond, &walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+            continue;
+        }
+
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_unlock(&walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        walk_read(walk, worker->queue, dir, buffer, bufsize);
+
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+        if (--walk->pending == 0) {
+#ifdef HAVE_PTHREAD_H
+            pthread_cond_broadcast(&walk->cond);
+#endif /* HAVE_PTHREAD_H */
+        }
+    }
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&walk->mutex);
+#endif /* HAVE_PTHREAD_H */
+
+    free(buffer);
+
+    return (NULL);
+}